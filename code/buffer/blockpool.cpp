@@ -0,0 +1,210 @@
+#include "blockpool.h"
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+/**
+ * per-thread free lists of one pool. only the owner thread pushes and pops, cached_bytes is
+ * atomic because stats() reads it from other threads
+*/
+struct BlockPool::ThreadCache {
+    explicit ThreadCache(BlockPool *pool) : pool(pool), cached_bytes(0) {
+        for (int i = 0; i < CLASS_NUM_; i++) {
+            free_list[i] = nullptr;
+            count[i] = 0;
+        }
+        std::lock_guard<std::mutex> locker(pool->mutex_);
+        pool->thread_caches_.push_back(this);
+    }
+
+    /**
+     * hand everything to the shared rings when the thread exits
+    */
+    ~ThreadCache() {
+        {
+            std::lock_guard<std::mutex> locker(pool->mutex_);
+            auto iter = std::find(pool->thread_caches_.begin(), pool->thread_caches_.end(), this);
+            pool->thread_caches_.erase(iter);
+        }
+        for (int i = 0; i < CLASS_NUM_; i++) {
+            spill(i, count[i]);
+        }
+    }
+
+    Block *pop(int index) {
+        Block *block = free_list[index];
+        if (block == nullptr) {
+            return nullptr;
+        }
+        free_list[index] = block->next;
+        count[index]--;
+        cached_bytes.store(cached_bytes.load(std::memory_order_relaxed) - block->cap,
+                           std::memory_order_relaxed);
+        return block;
+    }
+
+    void push(Block *block, int index) {
+        if (count[index] * block->cap >= THREAD_CACHE_BYTES_) {
+            spill(index, count[index] / 2);
+        }
+        block->next = free_list[index];
+        free_list[index] = block;
+        count[index]++;
+        cached_bytes.store(cached_bytes.load(std::memory_order_relaxed) + block->cap,
+                           std::memory_order_relaxed);
+    }
+
+    /**
+     * move blocks of a size class to the shared ring
+    */
+    void spill(int index, size_t num) {
+        for (size_t i = 0; i < num; i++) {
+            pool->put_shared(pop(index), index);
+        }
+    }
+
+    BlockPool *pool;
+    Block *free_list[CLASS_NUM_];
+    size_t count[CLASS_NUM_];
+    std::atomic<size_t> cached_bytes;
+};
+
+const int BlockPool::CLASS_NUM_;
+const size_t BlockPool::MIN_BLOCK_SIZE_;
+const size_t BlockPool::BLOCK_SIZE_;
+const size_t BlockPool::THREAD_CACHE_BYTES_;
+
+BlockPool *BlockPool::instance() {
+    static BlockPool *pool = new BlockPool(1024, true);
+    return pool;
+}
+
+BlockPool::BlockPool(size_t max_cached) : BlockPool(max_cached, false) {}
+
+BlockPool::BlockPool(size_t max_cached, bool thread_cache) :
+    has_thread_cache_(thread_cache), allocated_bytes_(0), peak_bytes_(0),
+    shared_cached_bytes_(0) {
+    for (int i = 0; i < CLASS_NUM_; i++) {
+        cached_[i].reset(new MpmcRing<Block *>(max_cached));
+    }
+}
+
+BlockPool::~BlockPool() {
+    Block *block = nullptr;
+    for (int i = 0; i < CLASS_NUM_; i++) {
+        while (cached_[i]->pop(block)) {
+            free(block);
+        }
+    }
+}
+
+BlockPool::Block *BlockPool::get(size_t min_cap) {
+    int index = size_class(min_cap);
+    Block *block = nullptr;
+    if (index < 0) {
+        block = allocate(min_cap);
+    } else {
+        ThreadCache *cache = thread_cache();
+        if (cache != nullptr) {
+            block = cache->pop(index);
+        }
+        if (block == nullptr) {
+            block = get_shared(index);
+        }
+    }
+    block->next = nullptr;
+    block->read = block->write = 0;
+    return block;
+}
+
+void BlockPool::put(Block *block) {
+    assert(block != nullptr);
+    int index = size_class(block->cap);
+    if (index < 0) {
+        release(block);
+        return;
+    }
+    assert((MIN_BLOCK_SIZE_ << index) == block->cap);
+    ThreadCache *cache = thread_cache();
+    if (cache != nullptr) {
+        cache->push(block, index);
+    } else {
+        put_shared(block, index);
+    }
+}
+
+BlockPool::Stats BlockPool::stats() const {
+    Stats stats;
+    stats.allocated_bytes = allocated_bytes_.load(std::memory_order_relaxed);
+    stats.peak_bytes = peak_bytes_.load(std::memory_order_relaxed);
+    stats.cached_bytes = shared_cached_bytes_.load(std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        for (const ThreadCache *cache : thread_caches_) {
+            stats.cached_bytes += cache->cached_bytes.load(std::memory_order_relaxed);
+        }
+    }
+    stats.in_use_bytes = stats.allocated_bytes > stats.cached_bytes ?
+        stats.allocated_bytes - stats.cached_bytes : 0;
+    return stats;
+}
+
+int BlockPool::size_class(size_t cap) {
+    int index = 0;
+    size_t size = MIN_BLOCK_SIZE_;
+    while (size < cap) {
+        if (++index == CLASS_NUM_) {
+            return -1;
+        }
+        size <<= 1;
+    }
+    return index;
+}
+
+BlockPool::ThreadCache *BlockPool::thread_cache() {
+    if (!has_thread_cache_) {
+        return nullptr;
+    }
+    // only instance() has thread caches, so every thread needs just one of them
+    static thread_local ThreadCache cache(this);
+    return &cache;
+}
+
+BlockPool::Block *BlockPool::get_shared(int index) {
+    Block *block = nullptr;
+    if (cached_[index]->pop(block)) {
+        shared_cached_bytes_.fetch_sub(block->cap, std::memory_order_relaxed);
+        return block;
+    }
+    return allocate(MIN_BLOCK_SIZE_ << index);
+}
+
+void BlockPool::put_shared(Block *block, int index) {
+    size_t cap = block->cap;
+    // count it before it becomes visible to other threads
+    shared_cached_bytes_.fetch_add(cap, std::memory_order_relaxed);
+    if (!cached_[index]->push(block)) {
+        shared_cached_bytes_.fetch_sub(cap, std::memory_order_relaxed);
+        release(block);
+    }
+}
+
+BlockPool::Block *BlockPool::allocate(size_t cap) {
+    Block *block = static_cast<Block *>(malloc(sizeof(Block) + cap));
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    block->cap = cap;
+    size_t allocated = allocated_bytes_.fetch_add(cap, std::memory_order_relaxed) + cap;
+    size_t peak = peak_bytes_.load(std::memory_order_relaxed);
+    while (peak < allocated &&
+           !peak_bytes_.compare_exchange_weak(peak, allocated, std::memory_order_relaxed)) {
+    }
+    return block;
+}
+
+void BlockPool::release(Block *block) {
+    allocated_bytes_.fetch_sub(block->cap, std::memory_order_relaxed);
+    free(block);
+}
@@ -0,0 +1,163 @@
+/**
+ * BlockPool is a process-wide cache of the memory blocks ChainBuffer is built from.
+ *
+ * a block is a small header followed by its payload in the same allocation:
+ *
+ *      +------+-----+------+-------+-------------------------------------------+
+ *      | next | cap | read | write |  payload (cap bytes)                      |
+ *      +------+-----+------+-------+-------------------------------------------+
+ *                                  data()     data() + read      data() + write
+ *
+ * blocks come in CLASS_NUM_ size classes, MIN_BLOCK_SIZE_ doubling up to BLOCK_SIZE_. a
+ * request is rounded up to the smallest class that fits, so a buffer holding a 300 byte
+ * request line takes 2K instead of a full 16K block. a block larger than BLOCK_SIZE_ (e.g. to
+ * make a big request contiguous) is an oversize block that bypasses the cache.
+ *
+ * released blocks are cached in two tiers:
+ *     1. a per-thread free list for every class, only touched by its own thread. get() and
+ *        put() on a warm thread are a pointer pop/push, without any atomic operation.
+ *        only the shared instance() has these, other pools skip this tier.
+ *     2. a lock-free ring for every class shared by all threads. a thread cache that runs
+ *        empty refills from it, one that grows past THREAD_CACHE_BYTES_ spills half of its
+ *        blocks into it, and blocks that do not fit into the ring are freed.
+ * blocks are never cleared, neither when they are released nor when they are reused.
+ *
+ * stats() reports how many bytes are allocated from malloc and how many of them are lent
+ * to buffers or idle in a cache.
+*/
+
+#ifndef BLOCKPOOL_H
+#define BLOCKPOOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "../pool/mpmcring.h"
+
+class BlockPool {
+public:
+    struct Block {
+        Block *next;
+        size_t cap;
+        size_t read;
+        size_t write;
+
+        char *data() {
+            return reinterpret_cast<char *>(this + 1);
+        }
+
+        const char *data() const {
+            return reinterpret_cast<const char *>(this + 1);
+        }
+    };
+
+    struct Stats {
+        // bytes of payload currently allocated from malloc
+        size_t allocated_bytes;
+        // highest allocated_bytes seen so far
+        size_t peak_bytes;
+        // bytes of the blocks held by buffers
+        size_t in_use_bytes;
+        // bytes of the blocks waiting in the thread caches and the shared rings
+        size_t cached_bytes;
+    };
+
+    static const int CLASS_NUM_ = 4;
+    static const size_t MIN_BLOCK_SIZE_ = 2048;
+    static const size_t BLOCK_SIZE_ = MIN_BLOCK_SIZE_ << (CLASS_NUM_ - 1);
+
+    /**
+     * max number of bytes a thread keeps for every size class
+    */
+    static const size_t THREAD_CACHE_BYTES_ = 256 * 1024;
+
+    /**
+     * get the pool shared by all buffers. it is never destroyed, so threads that are still
+     * running at exit can release their blocks safely
+     * @return the pool instance
+    */
+    static BlockPool *instance();
+
+    /**
+     * create a pool without thread caches
+     * @param max_cached max number of released blocks kept in the shared ring of every class
+    */
+    explicit BlockPool(size_t max_cached = 1024);
+
+    /**
+     * free all cached blocks
+    */
+    ~BlockPool();
+
+    BlockPool(const BlockPool &) = delete;
+    BlockPool &operator=(const BlockPool &) = delete;
+
+    /**
+     * get an empty block. may be called from any thread
+     * @param min_cap min capacity of the block, rounded up to the smallest size class
+     * @return block with read == write == 0 and next == nullptr
+    */
+    Block *get(size_t min_cap = BLOCK_SIZE_);
+
+    /**
+     * release a block. may be called from any thread, not only the one that got it
+     * @param block block obtained from get()
+    */
+    void put(Block *block);
+
+    /**
+     * get the memory counters. they are read without stopping the other threads, so the
+     * numbers of a busy pool are only approximately consistent with each other
+     * @return memory counters of the pool
+    */
+    Stats stats() const;
+
+private:
+    struct ThreadCache;
+
+    BlockPool(size_t max_cached, bool thread_cache);
+
+    /**
+     * get the size class of a capacity
+     * @param cap capacity in bytes
+     * @return index of the smallest class that fits, -1 if cap is larger than BLOCK_SIZE_
+    */
+    static int size_class(size_t cap);
+
+    /**
+     * get the cache of the calling thread
+     * @return cache of the calling thread, nullptr if the pool has no thread caches
+    */
+    ThreadCache *thread_cache();
+
+    /**
+     * take a block of a size class from the shared ring, or malloc one
+    */
+    Block *get_shared(int index);
+
+    /**
+     * give a block of a size class to the shared ring, or free it
+    */
+    void put_shared(Block *block, int index);
+
+    Block *allocate(size_t cap);
+    void release(Block *block);
+
+    const bool has_thread_cache_;
+    std::unique_ptr<MpmcRing<Block *>> cached_[CLASS_NUM_];
+
+    std::atomic<size_t> allocated_bytes_;
+    std::atomic<size_t> peak_bytes_;
+    std::atomic<size_t> shared_cached_bytes_;
+
+    /**
+     * the live thread caches, so stats() can sum up what they hold
+    */
+    mutable std::mutex mutex_;
+    std::vector<ThreadCache *> thread_caches_;
+};
+
+#endif
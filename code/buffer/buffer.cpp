@@ -1,4 +1,5 @@
 #include "buffer.h"
+#include "crlfscan.h"
 #include <algorithm>
 #include <bits/types/struct_iovec.h>
 #include <cassert>
@@ -38,8 +39,7 @@ void Buffer::RetrieveUntil(const char *end) {
 }
 
 void Buffer::RetrieveAll() {
-    memset(&buffer_[0], 0, buffer_.size());
-    // bzero(&buffer_[0], buffer_.size());
+    // the bytes behind write_pos_ are never read, so there is nothing to clear
     read_pos_ = 0;
     write_pos_ = 0;
 }
@@ -50,6 +50,16 @@ std::string Buffer::RetrieveAllToString() {
     return str;
 }
 
+const char * Buffer::FindCRLF() const {
+    const char *begin = Peek();
+    return ::FindCRLF(begin, begin + ReadableBytes());
+}
+
+const char * Buffer::FindHeaderEnd() const {
+    const char *begin = Peek();
+    return ::FindHeaderEnd(begin, begin + ReadableBytes());
+}
+
 const char * Buffer::BeginWriteConst() const {
     return BeginPtr() + write_pos_;
 }
@@ -90,7 +100,8 @@ void Buffer::EnsureWritable(size_t len) {
 }
 
 ssize_t Buffer::ReadFd(int fd, int *save_errno) {
-    char buff[65535];
+    // spill area for what does not fit, one per thread instead of 64K on every call's stack
+    static thread_local char buff[65535];
     struct iovec iov[2];
     const size_t writable = WritableBytes();
 
@@ -99,7 +110,7 @@ ssize_t Buffer::ReadFd(int fd, int *save_errno) {
     iov[1].iov_base = buff;
     iov[1].iov_len = sizeof(buff);
 
-    const size_t len = readv(fd, iov, 2);
+    const ssize_t len = readv(fd, iov, 2);
 
     if (len < 0) {
         *save_errno = errno;
@@ -109,6 +120,7 @@ ssize_t Buffer::ReadFd(int fd, int *save_errno) {
         write_pos_ = buffer_.size();
         Append(buff, len - writable);
     }
+    return len;
 }
 
 ssize_t Buffer::WriteFd(int fd, int *save_errno) {
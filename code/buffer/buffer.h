@@ -103,17 +103,28 @@ public:
     void RetrieveUntil(const char *end);
 
     /**
-     * set everything in buffer to 0 and set read pos, write pos to 0
+     * set read pos, write pos to 0. the content is left as it is
     */
     void RetrieveAll();
 
     /**
-     * get everything readable in the buffer and set everything in buffer to 0
-     * and set read pos, write pos to 0
+     * get everything readable in the buffer and set read pos, write pos to 0
      * @return the entire readable string in the buffer
     */
     std::string RetrieveAllToString();
 
+    /**
+     * find the first "\r\n" in the readable bytes
+     * @return address of its '\r', BeginWriteConst() if there is none
+    */
+    const char *FindCRLF() const;
+
+    /**
+     * find the "\r\n\r\n" that ends the header section in the readable bytes
+     * @return address of its first '\r', BeginWriteConst() if there is none
+    */
+    const char *FindHeaderEnd() const;
+
     /**
      * obtain a pointer to the position in the buffer where bew data can be written
      * @return position in the buffer where new data can be written
@@ -153,7 +164,7 @@ public:
     void Append(const Buffer &buffer);
 
     /**
-     * define a temporary buffer
+     * read into the writable bytes, spilling the rest into a per-thread buffer first
      * @param fd the file descriptor from which data is to be read
      * @param errno a pointer to an integer where the error code will be saved 
      *              if any error occurs
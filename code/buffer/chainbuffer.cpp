@@ -0,0 +1,371 @@
+#include "chainbuffer.h"
+#include "crlfscan.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+/**
+ * what Peek() and BeginWriteConst() point at while the buffer has no block
+*/
+const char EMPTY[1] = {'\0'};
+}
+
+ChainBuffer::ChainBuffer(BlockPool *pool) :
+    pool_(pool), head_(nullptr), tail_(nullptr), write_(nullptr), readable_(0) {
+    assert(pool_ != nullptr);
+}
+
+ChainBuffer::~ChainBuffer() {
+    while (head_ != nullptr) {
+        Block *next = head_->next;
+        pool_->put(head_);
+        head_ = next;
+    }
+}
+
+size_t ChainBuffer::WritableBytes() const {
+    return write_ == nullptr ? 0 : write_->cap - write_->write;
+}
+
+size_t ChainBuffer::ReadableBytes() const {
+    return readable_;
+}
+
+const char *ChainBuffer::Peek() const {
+    if (readable_ == 0) {
+        return BeginWriteConst();
+    }
+    // drained blocks in front of write_ are released by Retrieve(), so the readable bytes are
+    // contiguous iff there is only one block up to write_
+    if (head_ != write_) {
+        PullUp();
+    }
+    return head_->data() + head_->read;
+}
+
+char *ChainBuffer::BeginRead() {
+    if (readable_ == 0) {
+        return BeginWrite();
+    }
+    Peek();
+    return head_->data() + head_->read;
+}
+
+void ChainBuffer::EnsureWritable(size_t len) {
+    if (write_ != nullptr && WritableBytes() >= len) {
+        return;
+    }
+    if (readable_ == 0 && write_ != nullptr) {
+        RetrieveAll();
+        if (WritableBytes() >= len) {
+            return;
+        }
+    }
+    TrimTail();
+    Block *block = pool_->get(len);
+    if (readable_ == 0) {
+        // nothing to keep, start over with the new block
+        while (head_ != nullptr) {
+            Block *next = head_->next;
+            pool_->put(head_);
+            head_ = next;
+        }
+        head_ = tail_ = write_ = block;
+        return;
+    }
+    write_->next = block;
+    tail_ = write_ = block;
+}
+
+void ChainBuffer::HasWritten(size_t len) {
+    readable_ += len;
+    while (len > 0) {
+        assert(write_ != nullptr);
+        size_t n = std::min(len, write_->cap - write_->write);
+        write_->write += n;
+        len -= n;
+        if (len > 0) {
+            write_ = write_->next;
+        }
+    }
+}
+
+void ChainBuffer::Retrieve(size_t len) {
+    assert(len <= ReadableBytes());
+    readable_ -= len;
+    while (len > 0) {
+        Block *block = head_;
+        size_t n = std::min(len, block->write - block->read);
+        block->read += n;
+        len -= n;
+        if (block->read == block->write && block != write_) {
+            head_ = block->next;
+            pool_->put(block);
+        }
+    }
+    if (readable_ == 0 && write_ != nullptr) {
+        // blocks in front of write_ have all been released, reuse write_ from its start
+        while (head_ != write_) {
+            Block *next = head_->next;
+            pool_->put(head_);
+            head_ = next;
+        }
+        write_->read = write_->write = 0;
+    }
+}
+
+void ChainBuffer::RetrieveUntil(const char *end) {
+    assert(Peek() <= end);
+    Retrieve(end - Peek());
+}
+
+void ChainBuffer::Erase(size_t offset, size_t len) {
+    assert(offset + len <= readable_);
+    if (len == 0) {
+        return;
+    }
+    if (offset + len == readable_ && offset == 0) {
+        RetrieveAll();
+        return;
+    }
+    // once pulled up, the readable bytes all live in head_, which is write_
+    char *begin = BeginRead();
+    memmove(begin + offset, begin + offset + len, readable_ - offset - len);
+    head_->write -= len;
+    readable_ -= len;
+}
+
+void ChainBuffer::RetrieveAll() {
+    if (head_ == nullptr) {
+        return;
+    }
+    Block *next = head_->next;
+    while (next != nullptr) {
+        Block *block = next;
+        next = block->next;
+        pool_->put(block);
+    }
+    if (head_->cap > BlockPool::BLOCK_SIZE_) {
+        // do not hold on to an oversize block
+        pool_->put(head_);
+        head_ = tail_ = write_ = nullptr;
+        readable_ = 0;
+        return;
+    }
+    head_->next = nullptr;
+    head_->read = head_->write = 0;
+    tail_ = write_ = head_;
+    readable_ = 0;
+}
+
+void ChainBuffer::Shrink() {
+    if (readable_ != 0) {
+        return;
+    }
+    while (head_ != nullptr) {
+        Block *next = head_->next;
+        pool_->put(head_);
+        head_ = next;
+    }
+    tail_ = write_ = nullptr;
+}
+
+std::string ChainBuffer::RetrieveAllToString() {
+    std::string str;
+    str.reserve(readable_);
+    for (Block *block = head_; block != nullptr; block = block->next) {
+        str.append(block->data() + block->read, block->write - block->read);
+        if (block == write_) {
+            break;
+        }
+    }
+    RetrieveAll();
+    return str;
+}
+
+const char *ChainBuffer::FindCRLF() const {
+    const char *begin = Peek();
+    return ::FindCRLF(begin, begin + ReadableBytes());
+}
+
+const char *ChainBuffer::FindHeaderEnd() const {
+    const char *begin = Peek();
+    return ::FindHeaderEnd(begin, begin + ReadableBytes());
+}
+
+const char *ChainBuffer::BeginWriteConst() const {
+    return write_ == nullptr ? EMPTY : write_->data() + write_->write;
+}
+
+char *ChainBuffer::BeginWrite() {
+    if (write_ == nullptr) {
+        EnsureWritable(1);
+    }
+    return write_->data() + write_->write;
+}
+
+void ChainBuffer::Append(const std::string &str) {
+    Append(str.data(), str.length());
+}
+
+void ChainBuffer::Append(const void *data, size_t len) {
+    assert(data != nullptr);
+    Append(static_cast<const char *>(data), len);
+}
+
+void ChainBuffer::Append(const char *str, size_t len) {
+    assert(str != nullptr || len == 0);
+    while (len > 0) {
+        if (write_ == nullptr) {
+            head_ = tail_ = write_ = pool_->get(NextBlockSize(len));
+        } else if (write_->write == write_->cap) {
+            if (write_->next == nullptr) {
+                write_->next = pool_->get(NextBlockSize(len));
+                tail_ = write_->next;
+            }
+            write_ = write_->next;
+        }
+        size_t n = std::min(len, write_->cap - write_->write);
+        memcpy(write_->data() + write_->write, str, n);
+        write_->write += n;
+        readable_ += n;
+        str += n;
+        len -= n;
+    }
+}
+
+void ChainBuffer::Append(const ChainBuffer &buffer) {
+    for (Block *block = buffer.head_; block != nullptr; block = block->next) {
+        Append(block->data() + block->read, block->write - block->read);
+        if (block == buffer.write_) {
+            break;
+        }
+    }
+}
+
+int ChainBuffer::ReadableIovec(struct iovec *iov, int max_iov) const {
+    assert(iov != nullptr && max_iov > 0);
+    int cnt = 0;
+    if (readable_ == 0) {
+        return 0;
+    }
+    for (Block *block = head_; block != nullptr && cnt < max_iov; block = block->next) {
+        if (block->write > block->read) {
+            iov[cnt].iov_base = block->data() + block->read;
+            iov[cnt].iov_len = block->write - block->read;
+            cnt++;
+        }
+        if (block == write_) {
+            break;
+        }
+    }
+    return cnt;
+}
+
+int ChainBuffer::WritableIovec(struct iovec *iov, int max_iov, size_t len) {
+    assert(iov != nullptr && max_iov > 0);
+    if (write_ == nullptr) {
+        head_ = tail_ = write_ = pool_->get();
+    }
+    int cnt = 0;
+    size_t room = 0;
+    for (Block *block = write_; room < len && cnt < max_iov; block = block->next) {
+        if (block == nullptr) {
+            block = pool_->get();
+            tail_->next = block;
+            tail_ = block;
+        }
+        if (block->cap > block->write) {
+            iov[cnt].iov_base = block->data() + block->write;
+            iov[cnt].iov_len = block->cap - block->write;
+            room += iov[cnt].iov_len;
+            cnt++;
+        }
+    }
+    return cnt;
+}
+
+ssize_t ChainBuffer::ReadFd(int fd, int *save_errno) {
+    // spill area for what does not fit into the tail, so blocks are only taken for bytes
+    // that actually arrived
+    static thread_local char spill[READ_SIZE_];
+    struct iovec iov[2];
+    const size_t writable = WritableBytes();
+    int iov_cnt = 0;
+    if (writable > 0) {
+        iov[iov_cnt].iov_base = write_->data() + write_->write;
+        iov[iov_cnt].iov_len = writable;
+        iov_cnt++;
+    }
+    iov[iov_cnt].iov_base = spill;
+    iov[iov_cnt].iov_len = sizeof(spill);
+    iov_cnt++;
+
+    ssize_t len = readv(fd, iov, iov_cnt);
+    if (len < 0) {
+        *save_errno = errno;
+    } else if (static_cast<size_t>(len) <= writable) {
+        HasWritten(len);
+    } else {
+        HasWritten(writable);
+        Append(spill, len - writable);
+    }
+    return len;
+}
+
+ssize_t ChainBuffer::WriteFd(int fd, int *save_errno) {
+    struct iovec iov[MAX_IOV_];
+    int cnt = ReadableIovec(iov, MAX_IOV_);
+    if (cnt == 0) {
+        return 0;
+    }
+    ssize_t len = writev(fd, iov, cnt);
+    if (len < 0) {
+        *save_errno = errno;
+        return len;
+    }
+    Retrieve(len);
+    return len;
+}
+
+void ChainBuffer::TrimTail() {
+    if (write_ == nullptr) {
+        return;
+    }
+    Block *next = write_->next;
+    while (next != nullptr) {
+        Block *block = next;
+        next = block->next;
+        pool_->put(block);
+    }
+    write_->next = nullptr;
+    tail_ = write_;
+}
+
+size_t ChainBuffer::NextBlockSize(size_t len) const {
+    size_t size = write_ == nullptr ? BlockPool::MIN_BLOCK_SIZE_ : write_->cap * 2;
+    size = std::max(size, len);
+    return std::min(size, BlockPool::BLOCK_SIZE_);
+}
+
+void ChainBuffer::PullUp() const {
+    Block *block = pool_->get(readable_);
+    for (Block *item = head_; item != nullptr; item = item->next) {
+        memcpy(block->data() + block->write, item->data() + item->read, item->write - item->read);
+        block->write += item->write - item->read;
+        if (item == write_) {
+            break;
+        }
+    }
+    assert(block->write == readable_);
+    while (head_ != nullptr) {
+        Block *next = head_->next;
+        pool_->put(head_);
+        head_ = next;
+    }
+    head_ = tail_ = write_ = block;
+}
@@ -0,0 +1,253 @@
+/**
+ * ChainBuffer is a Buffer backed by a singly linked chain of blocks taken from the shared
+ * BlockPool instead of one growing vector.
+ *
+ *      head_                                                   tail_
+ *      +------------------+     +------------------+     +------------------+
+ *      | ////// readable  | --> | readable         | --> | readable |writable|
+ *      +------------------+     +------------------+     +------------------+
+ *        ^ retrieved bytes                                          ^ BeginWrite()
+ *
+ *     1. growing never moves the readable bytes, a full tail just gets a new block linked
+ *        after it. the first block is as small as the data allows, every following one twice
+ *        the size of the last up to BlockPool::BLOCK_SIZE_.
+ *     2. retrieving releases the blocks that were fully read, RetrieveAll() releases all but
+ *        one block and resets it, without clearing any memory. Shrink() gives the last block
+ *        back too, so an idle buffer holds no memory at all.
+ *     3. ReadFd() reads into the tail and a per-thread spill area, and only takes blocks for
+ *        the bytes that arrived. WriteFd() and the users of ReadableIovec() send every block
+ *        with a single writev().
+ *
+ * it keeps the interface of Buffer for the code that parses requests in place: Peek() always
+ * returns all readable bytes as one contiguous range ending at BeginWriteConst(). if they are
+ * spread over several blocks, Peek() first copies them into a single block ("pull-up"), which
+ * only happens for data that does not fit in one block or crosses a block boundary.
+*/
+
+#ifndef CHAINBUFFER_H
+#define CHAINBUFFER_H
+
+#include <cstddef>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "blockpool.h"
+
+class ChainBuffer {
+public:
+    typedef BlockPool::Block Block;
+
+    /**
+     * create an empty buffer, blocks are only taken from the pool once something is written
+     * @param pool pool to take the blocks from
+    */
+    explicit ChainBuffer(BlockPool *pool = BlockPool::instance());
+
+    /**
+     * release all blocks to the pool
+    */
+    ~ChainBuffer();
+
+    ChainBuffer(const ChainBuffer &) = delete;
+    ChainBuffer &operator=(const ChainBuffer &) = delete;
+
+    /**
+     * get the number of bytes that can be written at BeginWrite() without a new block
+     * @return number of contiguous writable bytes
+    */
+    size_t WritableBytes() const;
+
+    /**
+     * get the number of bytes in the buffer that are readable
+     * @return number of bytes in the buffer that are readable
+    */
+    size_t ReadableBytes() const;
+
+    /**
+     * get the address of the readable bytes, pulling them up into one block if needed
+     * @return address of the first readable byte, all ReadableBytes() bytes are contiguous
+    */
+    const char *Peek() const;
+
+    /**
+     * get the readable bytes for changing them in place, pulled up like Peek()
+     * @return address of the first readable byte
+    */
+    char *BeginRead();
+
+    /**
+     * ensure at least len contiguous bytes are writable at BeginWrite()
+     * @param len number of bytes
+    */
+    void EnsureWritable(size_t len);
+
+    /**
+     * this will be called after written something into the buffer, at BeginWrite() or into
+     * the ranges returned by WritableIovec()
+     * @param len number of new bytes that are written
+    */
+    void HasWritten(size_t len);
+
+    /**
+     * drop len readable bytes
+     * @param len number of bytes to drop
+    */
+    void Retrieve(size_t len);
+
+    /**
+     * retrieve until meets character end
+     * @param end address inside the range returned by Peek()
+    */
+    void RetrieveUntil(const char *end);
+
+    /**
+     * drop len readable bytes from the middle of the buffer, the bytes behind them move up.
+     * this pulls the chain up like Peek() does
+     * @param offset position of the first byte to drop, counted from Peek()
+     * @param len number of bytes to drop
+    */
+    void Erase(size_t offset, size_t len);
+
+    /**
+     * drop everything, keeping one block for the next writes. nothing is cleared
+    */
+    void RetrieveAll();
+
+    /**
+     * give all blocks back to the pool if nothing is readable, e.g. when the connection
+     * goes idle. the next write takes a new block
+    */
+    void Shrink();
+
+    /**
+     * get everything readable in the buffer and drop it
+     * @return the entire readable string in the buffer
+    */
+    std::string RetrieveAllToString();
+
+    /**
+     * find the first "\r\n" in the readable bytes, see Peek()
+     * @return address of its '\r', BeginWriteConst() if there is none
+    */
+    const char *FindCRLF() const;
+
+    /**
+     * find the "\r\n\r\n" that ends the header section in the readable bytes
+     * @return address of its first '\r', BeginWriteConst() if there is none
+    */
+    const char *FindHeaderEnd() const;
+
+    /**
+     * obtain a pointer to the position in the buffer where new data can be written
+     * @return position in the buffer where new data can be written
+    */
+    const char *BeginWriteConst() const;
+
+    /**
+     * obtain a pointer to the position in the buffer where new data can be written
+     * @return position in the buffer where new data can be written
+    */
+    char *BeginWrite();
+
+    /**
+     * append the entire string to the buffer
+     * @param str bytes from which to be copied
+    */
+    void Append(const std::string &str);
+
+    /**
+     * append a specified number of bytes to the buffer, filling the blocks one after the other
+     * @param str bytes from which to be copied
+     * @param len number of bytes to be copied
+    */
+    void Append(const char *str, size_t len);
+
+    /**
+     * append a specified number of bytes from a given array of any type to the buffer
+     * @param data bytes from which to be copied
+     * @param len number of bytes to be copied
+    */
+    void Append(const void *data, size_t len);
+
+    /**
+     * append all readable bytes from a given buffer to the buffer
+     * @param buffer bytes from which to be copied
+    */
+    void Append(const ChainBuffer &buffer);
+
+    /**
+     * describe the readable bytes block by block, e.g. for writev()
+     * @param iov where the ranges are stored
+     * @param max_iov max number of ranges
+     * @return number of ranges stored, they cover all readable bytes unless max_iov is reached
+    */
+    int ReadableIovec(struct iovec *iov, int max_iov) const;
+
+    /**
+     * make room for at least len bytes, linking new blocks after the tail, and describe the
+     * writable ranges, e.g. for readv(). call HasWritten() with the number of bytes filled
+     * @param iov where the ranges are stored
+     * @param max_iov max number of ranges
+     * @param len number of bytes to make room for
+     * @return number of ranges stored
+    */
+    int WritableIovec(struct iovec *iov, int max_iov, size_t len);
+
+    /**
+     * read from fd into the tail block and a per-thread spill area with a single readv(),
+     * the spilled bytes are appended to new blocks
+     * @param fd the file descriptor from which data is to be read
+     * @param save_errno where the error code is saved if any error occurs
+     * @return the number of bytes actually read. return -1 if any error occurs
+    */
+    ssize_t ReadFd(int fd, int *save_errno);
+
+    /**
+     * write the readable bytes of all blocks to fd with a single writev()
+     * @param fd the file descriptor to which data is to be written
+     * @param save_errno where the error code is saved if any error occurs
+     * @return the number of bytes actually written. return -1 if any error occurs
+    */
+    ssize_t WriteFd(int fd, int *save_errno);
+
+private:
+    /**
+     * release the empty blocks linked after the one that holds BeginWrite()
+    */
+    void TrimTail();
+
+    /**
+     * get the capacity for the next block of the chain
+     * @param len number of bytes still to be written
+     * @return twice the capacity of the current block, at least len, at most BLOCK_SIZE_
+    */
+    size_t NextBlockSize(size_t len) const;
+
+    /**
+     * copy all readable bytes into a single block that replaces the chain
+    */
+    void PullUp() const;
+
+    /**
+     * max number of blocks WriteFd() hands to the kernel at once
+    */
+    static const int MAX_IOV_ = 8;
+
+    /**
+     * size of the spill area of ReadFd()
+    */
+    static const size_t READ_SIZE_ = 65536;
+
+    BlockPool *pool_;
+
+    /**
+     * Peek() is const for the callers but may pull the chain up
+    */
+    mutable Block *head_;
+    mutable Block *tail_;
+    mutable Block *write_;
+    size_t readable_;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#include "crlfscan.h"
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CRLFSCAN_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+bool always_supported() {
+    return true;
+}
+
+const char *scalar_find_crlf(const char *begin, const char *end) {
+    const char *p = begin;
+    while (end - p >= 2) {
+        p = static_cast<const char *>(memchr(p, '\r', end - p - 1));
+        if (p == nullptr) {
+            return end;
+        }
+        if (p[1] == '\n') {
+            return p;
+        }
+        p++;
+    }
+    return end;
+}
+
+const char *scalar_find_header_end(const char *begin, const char *end) {
+    const char *p = begin;
+    while (end - p >= 4) {
+        p = scalar_find_crlf(p, end - 2);
+        if (p == end - 2) {
+            return end;
+        }
+        if (p[2] == '\r' && p[3] == '\n') {
+            return p;
+        }
+        p += 2;
+    }
+    return end;
+}
+
+#ifdef CRLFSCAN_X86
+
+bool sse2_supported() {
+    return __builtin_cpu_supports("sse2");
+}
+
+/**
+ * mask of the positions i in [p, p + 16) where p[i] == '\r' and p[i + 1] == '\n'
+*/
+__attribute__((target("sse2")))
+inline unsigned sse2_crlf_mask(const char *p) {
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    __m128i first = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    __m128i second = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 1));
+    return _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(first, cr),
+                                           _mm_cmpeq_epi8(second, lf)));
+}
+
+__attribute__((target("sse2")))
+const char *sse2_find_crlf(const char *begin, const char *end) {
+    const char *p = begin;
+    while (end - p >= 16 + 1) {
+        unsigned mask = sse2_crlf_mask(p);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scalar_find_crlf(p, end);
+}
+
+__attribute__((target("sse2")))
+const char *sse2_find_header_end(const char *begin, const char *end) {
+    const char *p = begin;
+    while (end - p >= 16 + 3) {
+        unsigned mask = sse2_crlf_mask(p) & sse2_crlf_mask(p + 2);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return scalar_find_header_end(p, end);
+}
+
+bool avx2_supported() {
+    return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("avx2")))
+inline unsigned avx2_crlf_mask(const char *p) {
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    __m256i first = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+    __m256i second = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + 1));
+    return _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(first, cr),
+                                                 _mm256_cmpeq_epi8(second, lf)));
+}
+
+__attribute__((target("avx2")))
+const char *avx2_find_header_end(const char *begin, const char *end) {
+    const char *p = begin;
+    while (end - p >= 32 + 3) {
+        unsigned mask = avx2_crlf_mask(p) & avx2_crlf_mask(p + 2);
+        if (mask != 0) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return sse2_find_header_end(p, end);
+}
+
+#endif
+
+const ScanKernel KERNELS[] = {
+    {"scalar", always_supported, scalar_find_crlf, scalar_find_header_end},
+#ifdef CRLFSCAN_X86
+    {"sse2", sse2_supported, sse2_find_crlf, sse2_find_header_end},
+    // header lines are mostly shorter than 32 bytes, where the AVX2 loop has nothing to gain
+    // over SSE2 (see test/buffer/crlfscan_bench.cpp), so only the header end uses it
+    {"avx2", avx2_supported, sse2_find_crlf, avx2_find_header_end},
+#endif
+};
+
+const size_t KERNEL_NUM = sizeof(KERNELS) / sizeof(KERNELS[0]);
+
+const ScanKernel &pick_kernel() {
+    for (size_t i = KERNEL_NUM; i > 0; i--) {
+        if (KERNELS[i - 1].supported()) {
+            return KERNELS[i - 1];
+        }
+    }
+    return KERNELS[0];
+}
+
+}
+
+const ScanKernel *ScanKernels(size_t *num) {
+    *num = KERNEL_NUM;
+    return KERNELS;
+}
+
+const ScanKernel &ActiveScanKernel() {
+    static const ScanKernel &kernel = pick_kernel();
+    return kernel;
+}
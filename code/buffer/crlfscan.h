@@ -0,0 +1,73 @@
+/**
+ * vectorized search for the line and header delimiters of HTTP/1.x, used by the buffers'
+ * FindCRLF() and FindHeaderEnd().
+ *
+ * every kernel compares a whole vector of bytes at once against '\r' and, with a load shifted
+ * by one byte, against '\n', so a "\r\n" is found with one compare per 16 (SSE2) or 32 (AVX2)
+ * bytes instead of one per byte. "\r\n\r\n" combines the "\r\n" masks at p and p + 2. the
+ * bytes left over at the end, fewer than a vector plus the pattern, go through the scalar
+ * kernel.
+ *
+ * the best kernel the CPU supports is picked once at run time with CPUID, so the binary does
+ * not need to be built with -mavx2 and still runs on CPUs without it. non-x86 builds only
+ * have the scalar kernel.
+*/
+
+#ifndef CRLFSCAN_H
+#define CRLFSCAN_H
+
+#include <cstddef>
+
+struct ScanKernel {
+    typedef const char *(*FindFunc)(const char *begin, const char *end);
+
+    const char *name;
+
+    /**
+     * @return whether the CPU running the program can execute the kernel
+    */
+    bool (*supported)();
+
+    /**
+     * find the first "\r\n" in [begin, end)
+     * @return address of its '\r', end if there is none
+    */
+    FindFunc find_crlf;
+
+    /**
+     * find the first "\r\n\r\n" in [begin, end)
+     * @return address of its first '\r', end if there is none
+    */
+    FindFunc find_header_end;
+};
+
+/**
+ * get all kernels compiled into the binary, e.g. to compare them in a benchmark
+ * @param num where the number of kernels is stored
+ * @return the kernels, the scalar one first
+*/
+const ScanKernel *ScanKernels(size_t *num);
+
+/**
+ * get the fastest kernel supported by the CPU, picked on the first call
+ * @return the kernel used by FindCRLF() and FindHeaderEnd()
+*/
+const ScanKernel &ActiveScanKernel();
+
+/**
+ * find the first "\r\n" in [begin, end) with the active kernel
+ * @return address of its '\r', end if there is none
+*/
+inline const char *FindCRLF(const char *begin, const char *end) {
+    return ActiveScanKernel().find_crlf(begin, end);
+}
+
+/**
+ * find the first "\r\n\r\n" in [begin, end) with the active kernel
+ * @return address of its first '\r', end if there is none
+*/
+inline const char *FindHeaderEnd(const char *begin, const char *end) {
+    return ActiveScanKernel().find_header_end(begin, end);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#include "bodysink.h"
+#include "../log/log.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <unistd.h>
+
+const char *BodySink::spill_dir = "/tmp";
+
+BodySink::BodySink() : fd_(-1), size_(0) {}
+
+BodySink::~BodySink() {
+    init();
+}
+
+void BodySink::init() {
+    if (fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+    size_ = 0;
+}
+
+bool BodySink::write(const char *data, size_t len) {
+    if (fd_ < 0 && !open_file()) {
+        return false;
+    }
+    while (len > 0) {
+        ssize_t n = ::write(fd_, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERROR("Body spill write error: %s", strerror(errno));
+            return false;
+        }
+        data += n;
+        len -= n;
+        size_ += n;
+    }
+    return true;
+}
+
+int BodySink::fd() const {
+    return fd_;
+}
+
+size_t BodySink::size() const {
+    return size_;
+}
+
+bool BodySink::open_file() {
+    fd_ = open(spill_dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd_ >= 0) {
+        return true;
+    }
+    std::string path = std::string(spill_dir) + "/bodyXXXXXX";
+    fd_ = mkostemp(&path[0], O_CLOEXEC);
+    if (fd_ < 0) {
+        LOG_ERROR("Body spill file error: %s", strerror(errno));
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
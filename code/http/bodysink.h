@@ -0,0 +1,66 @@
+/**
+ * the destination of a request body that is too large to stay in the read buffer.
+ *
+ * HttpRequest hands the decoded body bytes over as they arrive and drops them from the read
+ * buffer right after, so a connection holds at most one read worth of body in memory however
+ * large the upload is. the bytes go to an anonymous temporary file (O_TMPFILE), which
+ * disappears when it is closed, so nothing is left behind if the connection dies mid-upload.
+*/
+
+#ifndef BODY_SINK_H_
+#define BODY_SINK_H_
+
+#include <cstddef>
+
+class BodySink {
+public:
+    BodySink();
+
+    ~BodySink();
+
+    BodySink(const BodySink &) = delete;
+    BodySink &operator=(const BodySink &) = delete;
+
+    /**
+     * drop the body of the previous request and close its file
+    */
+    void init();
+
+    /**
+     * append body bytes to the file, which is created on the first call
+     * @param data bytes to append
+     * @param len number of bytes
+     * @return false if the file could not be created or written
+    */
+    bool write(const char *data, size_t len);
+
+    /**
+     * get the file holding the body. its offset is left at the end, read it with pread()
+     * @return file descriptor, -1 if nothing has been written
+    */
+    int fd() const;
+
+    /**
+     * get the number of bytes written
+     * @return size of the body in the file
+    */
+    size_t size() const;
+
+    /**
+     * the directory of the temporary files
+    */
+    static const char *spill_dir;
+
+private:
+    /**
+     * create the anonymous file in spill_dir, falling back to a named one that is unlinked
+     * right away on file systems without O_TMPFILE
+     * @return false if no file could be created
+    */
+    bool open_file();
+
+    int fd_;
+    size_t size_;
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "compressor.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <utility>
+#include <zlib.h>
+
+#include "../log/log.h"
+
+Compressor::Compressor() : level_(0), min_size_(0) {}
+
+Compressor *Compressor::instance() {
+    static Compressor compressor;
+    return &compressor;
+}
+
+void Compressor::init(int level, size_t min_size, size_t capacity, Submit submit) {
+    level_ = level;
+    min_size_ = min_size;
+    submit_ = std::move(submit);
+    // the index does not know about the results, they are checked against the file instead
+    results_.init(level > 0 ? capacity : 0, capacity, 16, -1);
+}
+
+bool Compressor::accepts(size_t size) const {
+    // a file too large for the results would be compressed on every request
+    return level_ > 0 && size >= min_size_ && results_.accepts(size);
+}
+
+std::shared_ptr<const FileCache::Entry> Compressor::get(const std::string &path,
+                                                        const struct stat &st) {
+    std::shared_ptr<const FileCache::Entry> entry = results_.get(path);
+    if (entry == nullptr || entry->size != st.st_size ||
+        entry->mtime.tv_sec != st.st_mtim.tv_sec || entry->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        return nullptr;
+    }
+    return entry;
+}
+
+bool Compressor::compress(const std::string &path, const struct stat &st, std::string close_head,
+                          std::string keep_alive_head) {
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        if (!pending_.insert(path).second) {
+            return false;
+        }
+    }
+    auto job = [this, path, st, close_head = std::move(close_head),
+                keep_alive_head = std::move(keep_alive_head)]() mutable {
+        run(path, st, std::move(close_head), std::move(keep_alive_head));
+    };
+    if (!submit_ || !submit_(std::move(job))) {
+        // the lane is busy, a later request queues it again
+        std::lock_guard<std::mutex> locker(mutex_);
+        pending_.erase(path);
+        return false;
+    }
+    return true;
+}
+
+void Compressor::run(const std::string &path, const struct stat &st, std::string close_head,
+                     std::string keep_alive_head) {
+    std::string data;
+    int fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        struct stat now;
+        // a file changed since the request saw it would be kept under the wrong mtime
+        if (fstat(fd, &now) == 0 && now.st_size == st.st_size &&
+            now.st_mtim.tv_sec == st.st_mtim.tv_sec && now.st_mtim.tv_nsec == st.st_mtim.tv_nsec) {
+            data.resize(st.st_size);
+            size_t done = 0;
+            ssize_t len = 0;
+            while (done < data.size() &&
+                   (len = pread(fd, &data[done], data.size() - done, done)) > 0) {
+                done += len;
+            }
+            data.resize(done);
+        }
+        close(fd);
+    }
+
+    std::string out;
+    if (data.size() == static_cast<size_t>(st.st_size) &&
+        gzip(data.data(), data.size(), level_, &out)) {
+        std::string length = "Content-length: " + std::to_string(out.size()) + "\r\n\r\n";
+        LOG_DEBUG("gzip %s: %zu -> %zu bytes", path.data(), data.size(), out.size());
+        results_.put(path, st, std::move(out), close_head + length, keep_alive_head + length);
+    }
+
+    std::lock_guard<std::mutex> locker(mutex_);
+    pending_.erase(path);
+}
+
+bool Compressor::gzip(const char *data, size_t len, int level, std::string *out) {
+    z_stream stream = {};
+    // 16 added to the window bits asks for a gzip header and trailer instead of zlib's
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out->resize(deflateBound(&stream, len));
+    stream.next_in = (Bytef *) data;
+    stream.avail_in = len;
+    stream.next_out = (Bytef *) &(*out)[0];
+    stream.avail_out = out->size();
+    int ret = deflate(&stream, Z_FINISH);
+    out->resize(stream.total_out);
+    deflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
@@ -0,0 +1,113 @@
+/**
+ * gzip compression of static text files that have no precompressed sibling.
+ *
+ * compressing is too slow for the thread that builds the response, so a file is compressed
+ * behind the request that asked for it: the first request is answered with the file as it
+ * is, and a job on the compress lane of the Executor reads the file, deflates it and keeps
+ * the result, with its response headers, in a cache of its own. later requests are answered
+ * from there like a FileCache hit. a result is only used while the size and modification time
+ * of the file still match those it was compressed from, a changed file is compressed again.
+*/
+
+#ifndef COMPRESSOR_H_
+#define COMPRESSOR_H_
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <unordered_set>
+
+#include "filecache.h"
+
+class Compressor {
+public:
+    /**
+     * queues a job on the compress lane, returns false if the lane is full
+    */
+    typedef std::function<bool(std::function<void()>)> Submit;
+
+    Compressor();
+
+    ~Compressor() = default;
+
+    Compressor(const Compressor &) = delete;
+    Compressor &operator=(const Compressor &) = delete;
+
+    /**
+     * get the compressor of the server, set up by init()
+     * @return the compressor
+    */
+    static Compressor *instance();
+
+    /**
+     * set the compressor up. not thread-safe, call it before responses are built
+     * @param level zlib compression level 1 (fastest) to 9 (smallest), 0 disables compression
+     * @param min_size smaller files are not worth compressing
+     * @param capacity max number of compressed bytes kept
+     * @param submit queues the compression jobs
+    */
+    void init(int level, size_t min_size, size_t capacity, Submit submit);
+
+    /**
+     * check whether a file is compressed on the fly
+     * @param size size of the file
+     * @return false if compression is disabled, the file is smaller than min_size or larger
+     *         than the results may hold
+    */
+    bool accepts(size_t size) const;
+
+    /**
+     * get the compressed response of a file
+     * @param path full path of the file
+     * @param st current stat of the file
+     * @return the entry, its body gzipped, nullptr if the file has not been compressed yet
+    */
+    std::shared_ptr<const FileCache::Entry> get(const std::string &path, const struct stat &st);
+
+    /**
+     * queue the compression of a file, unless it is queued already
+     * @param path full path of the file
+     * @param st current stat of the file
+     * @param close_head headers of the compressed response on a closing connection after the
+     *                   status line and Date, without Content-length and the empty line,
+     *                   which the job adds
+     * @param keep_alive_head same for a keep-alive connection
+     * @return false if the job was not queued
+    */
+    bool compress(const std::string &path, const struct stat &st, std::string close_head,
+                  std::string keep_alive_head);
+
+    /**
+     * gzip a buffer
+     * @param data bytes to compress
+     * @param len number of bytes
+     * @param level zlib compression level
+     * @param out set to the gzip stream
+     * @return false if zlib failed
+    */
+    static bool gzip(const char *data, size_t len, int level, std::string *out);
+
+private:
+    /**
+     * the job: read the file, compress it and keep the result
+    */
+    void run(const std::string &path, const struct stat &st, std::string close_head,
+             std::string keep_alive_head);
+
+    int level_;
+    size_t min_size_;
+    Submit submit_;
+
+    FileCache results_;
+
+    /**
+     * the files whose job is queued or running
+    */
+    std::unordered_set<std::string> pending_;
+    std::mutex mutex_;
+};
+
+#endif
@@ -0,0 +1,110 @@
+#include "filecache.h"
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <utility>
+
+FileCache::FileCache(size_t capacity, size_t max_file_size, size_t shard_num,
+                     int revalidate_ms) {
+    init(capacity, max_file_size, shard_num, revalidate_ms);
+}
+
+FileCache *FileCache::instance() {
+    static FileCache cache;
+    return &cache;
+}
+
+void FileCache::init(size_t capacity, size_t max_file_size, size_t shard_num,
+                     int revalidate_ms) {
+    assert(shard_num > 0);
+    capacity_ = capacity;
+    revalidate_ms_ = revalidate_ms;
+    // a file has to fit into its shard
+    max_file_size_ = std::min(max_file_size, capacity / shard_num);
+    entries_.init(shard_num);
+}
+
+std::string FileCache::key(const std::string &path, const char *encoding) {
+    if (encoding == nullptr) {
+        return path;
+    }
+    std::string key = path;
+    key += '\0';
+    key += encoding;
+    return key;
+}
+
+std::shared_ptr<const FileCache::Entry> FileCache::get(const std::string &path,
+                                                      bool is_watched) {
+    if (capacity_ == 0) {
+        return nullptr;
+    }
+    std::shared_ptr<const Entry> entry = entries_.get(path);
+    if (entry == nullptr) {
+        return nullptr;
+    }
+
+    if (revalidate_ms_ < 0 || is_watched) {
+        return entry;
+    }
+    int64_t now = now_ms();
+    if (now - entry->checked_ms.load(std::memory_order_relaxed) < revalidate_ms_) {
+        return entry;
+    }
+    /**
+     * the lock is not held across the stat(), the other workers of the shard go on. the
+     * coding of a key() ends the path at its NUL
+    */
+    struct stat st;
+    if (stat(path.data(), &st) < 0 || st.st_size != entry->size ||
+        st.st_mtim.tv_sec != entry->mtime.tv_sec || st.st_mtim.tv_nsec != entry->mtime.tv_nsec) {
+        erase(path);
+        return nullptr;
+    }
+    entry->checked_ms.store(now, std::memory_order_relaxed);
+    return entry;
+}
+
+uint64_t FileCache::generation(const std::string &path) {
+    return entries_.generation(path);
+}
+
+bool FileCache::put(const std::string &path, const struct stat &st, std::string body,
+                    std::string close_head, std::string keep_alive_head, uint64_t generation) {
+    if (!accepts(body.size())) {
+        return false;
+    }
+    std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+    entry->head[0] = std::move(close_head);
+    entry->head[1] = std::move(keep_alive_head);
+    entry->body = std::move(body);
+    entry->size = st.st_size;
+    entry->mtime = st.st_mtim;
+    entry->checked_ms.store(now_ms(), std::memory_order_relaxed);
+
+    size_t size = entry->body.size();
+    // fails if the file may have changed while it was read, the next request reads it again
+    return entries_.put(path, std::move(entry), size, capacity_ / entries_.shard_num(),
+                        SIZE_MAX, generation);
+}
+
+void FileCache::erase(const std::string &path) {
+    entries_.erase(path);
+}
+
+bool FileCache::accepts(size_t size) const {
+    return capacity_ > 0 && size <= max_file_size_;
+}
+
+size_t FileCache::size() const {
+    return entries_.size();
+}
+
+size_t FileCache::bytes() const {
+    return entries_.bytes();
+}
+
+int64_t FileCache::now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,177 @@
+/**
+ * a cache of small static files, ready to be written: the bytes of the file together with the
+ * headers of a 200 response, serialized once for a keep-alive and once for a closing
+ * connection. a hit is answered with the status line and Date, then one writev() of the two,
+ * without stat(), open() or mmap().
+ *
+ * the entries are kept in a ShardedLru, every shard with its own lock and share of the
+ * capacity. an entry is handed out as a shared_ptr and stays valid while a connection is still
+ * writing it, even after it has been evicted.
+ *
+ * a hit older than revalidate_ms stats the file once more and drops the entry if the size or
+ * modification time changed, so an edited file is served again within that interval. a caller
+ * that knows the entries of a file are erased when it changes (a FileIndex watching it) skips
+ * that stat(). an erase() also fails the put() of a response that read the file before it,
+ * so a file changed while it was read is not cached as it was.
+*/
+
+#ifndef FILE_CACHE_H_
+#define FILE_CACHE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+#include "shardedlru.h"
+
+class FileCache {
+public:
+    struct Entry {
+        /**
+         * the headers of the response after the status line and Date, ending with the empty
+         * line, and the file
+        */
+        std::string head[2];
+        std::string body;
+
+        /**
+         * size and modification time of the file when it was read. the body may differ from
+         * the file, e.g. compressed
+        */
+        off_t size;
+        struct timespec mtime;
+
+        /**
+         * when the file was last known to be unchanged, in ms of the steady clock
+        */
+        mutable std::atomic<int64_t> checked_ms;
+
+        /**
+         * get the headers for a connection that is kept alive or closed after the response
+         * @param is_keep_alive whether the connection is kept alive
+         * @return headers, ending with the empty line
+        */
+        const std::string &header(bool is_keep_alive) const {
+            return head[is_keep_alive ? 1 : 0];
+        }
+    };
+
+    /**
+     * @param capacity max number of body bytes held, 0 disables the cache
+     * @param max_file_size larger bodies are never cached
+     * @param shard_num number of independently locked shards
+     * @param revalidate_ms age of an entry at which a hit checks the file again, -1 never
+    */
+    FileCache(size_t capacity = 0, size_t max_file_size = 0, size_t shard_num = 16,
+              int revalidate_ms = 1000);
+
+    ~FileCache() = default;
+
+    FileCache(const FileCache &) = delete;
+    FileCache &operator=(const FileCache &) = delete;
+
+    /**
+     * get the cache of the server, set up by init()
+     * @return the static file cache
+    */
+    static FileCache *instance();
+
+    /**
+     * get the key of a file served with a content coding, e.g. the .gz sibling negotiated for
+     * a request of the plain file. it differs from the key of the same file requested as it
+     * is, whose entry has other headers. the coding follows a NUL, which no path contains, so
+     * the key still reads as the path where the file is stat()ed
+     * @param path full path of the file
+     * @param encoding the content coding, nullptr if the file is sent as it is
+     * @return the key for get() and put()
+    */
+    static std::string key(const std::string &path, const char *encoding);
+
+    /**
+     * drop all entries and resize the cache. not thread-safe, call it before the cache is used
+     * @param capacity max number of body bytes held, 0 disables the cache
+     * @param max_file_size larger bodies are never cached
+     * @param shard_num number of independently locked shards
+     * @param revalidate_ms age of an entry at which a hit checks the file again, -1 never,
+     *                      when something else erases the entries of changed files
+    */
+    void init(size_t capacity, size_t max_file_size, size_t shard_num = 16,
+              int revalidate_ms = 1000);
+
+    /**
+     * look a file up and mark it as recently used
+     * @param path full path of the file, or its key()
+     * @param is_watched the entry is erased when the file changes, it needs no revalidation
+     * @return the entry, nullptr on a miss or if the file changed since it was read
+    */
+    std::shared_ptr<const Entry> get(const std::string &path, bool is_watched = false);
+
+    /**
+     * get the number of erase() calls so far in the shard of a path, to be taken before the
+     * file is stat()ed and read for put()
+     * @param path full path of the file, or its key()
+     * @return the erase generation of the path
+    */
+    uint64_t generation(const std::string &path);
+
+    /**
+     * add a file, replacing the entry of the same path, and evict the least recently used
+     * entries of its shard until it fits
+     * @param path full path of the file, or its key()
+     * @param st stat of the file when it was read
+     * @param body the body of the response
+     * @param close_head headers of the response on a closing connection
+     * @param keep_alive_head headers of the response on a keep-alive connection
+     * @param generation generation() of the path before the file was read, ANY_GENERATION
+     *                   if the caller checks the file itself
+     * @return false if the cache is disabled, the body is too large or the path was erased
+     *         since generation
+    */
+    bool put(const std::string &path, const struct stat &st, std::string body,
+             std::string close_head, std::string keep_alive_head,
+             uint64_t generation = ANY_GENERATION);
+
+    static const uint64_t ANY_GENERATION = UINT64_MAX;
+
+    /**
+     * drop the entry of a file
+     * @param path full path of the file, or its key()
+    */
+    void erase(const std::string &path);
+
+    /**
+     * check whether a body of this size is cached by put()
+     * @param size size of the body in bytes
+     * @return false if the cache is disabled or the file is too large
+    */
+    bool accepts(size_t size) const;
+
+    /**
+     * get the number of entries
+     * @return number of files cached
+    */
+    size_t size() const;
+
+    /**
+     * get the number of body bytes held
+     * @return sum of the sizes of the cached bodies
+    */
+    size_t bytes() const;
+
+private:
+    /**
+     * get the steady clock in ms
+    */
+    static int64_t now_ms();
+
+    size_t capacity_;
+    size_t max_file_size_;
+    int revalidate_ms_;
+
+    ShardedLru<Entry> entries_;
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "fileindex.h"
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <mutex>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+#include "filecache.h"
+#include "mmaptable.h"
+#include "httpresponse.h"
+#include "../log/log.h"
+
+namespace {
+
+const uint32_t WATCH_MASK = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE |
+                            IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+                            IN_ONLYDIR;
+
+bool has_prefix(const std::string &path, const std::string &dir) {
+    return path.size() > dir.size() && path.compare(0, dir.size(), dir) == 0 &&
+           path[dir.size()] == '/';
+}
+
+}  // namespace
+
+FileIndex::FileIndex() : is_enabled_(false), inotify_fd_(-1), wakeup_fd_(-1) {}
+
+FileIndex::~FileIndex() {
+    stop();
+}
+
+FileIndex *FileIndex::instance() {
+    static FileIndex index;
+    return &index;
+}
+
+bool FileIndex::init(const std::string &root) {
+    stop();
+    root_ = root;
+    base_ = root;
+    while (base_.size() > 1 && base_.back() == '/') {
+        base_.pop_back();
+    }
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wakeup_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd_ < 0 || wakeup_fd_ < 0) {
+        LOG_WARN("FileIndex: inotify unavailable (%d), every file is stat()ed", errno);
+        stop();
+        return false;
+    }
+    walk("");
+    is_enabled_ = true;
+    thread_ = std::thread(&FileIndex::loop, this);
+    LOG_INFO("FileIndex: %zu entries under %s", size(), root_.c_str());
+    return true;
+}
+
+void FileIndex::stop() {
+    is_enabled_ = false;
+    if (thread_.joinable()) {
+        uint64_t one = 1;
+        ssize_t ret = write(wakeup_fd_, &one, sizeof(one));
+        (void) ret;
+        thread_.join();
+    }
+    if (inotify_fd_ >= 0) {
+        close(inotify_fd_);
+        inotify_fd_ = -1;
+    }
+    if (wakeup_fd_ >= 0) {
+        close(wakeup_fd_);
+        wakeup_fd_ = -1;
+    }
+    std::unique_lock<std::shared_mutex> locker(mutex_);
+    entries_.clear();
+    links_.clear();
+    watches_.clear();
+}
+
+FileIndex::LOOKUP_ FileIndex::lookup(const std::string &src_dir, const std::string &path,
+                                     Meta *meta) const {
+    if (!is_enabled_.load(std::memory_order_acquire) || src_dir != root_) {
+        return UNKNOWN;
+    }
+    if (path.size() < 2 || path[0] != '/' || path.back() == '/' ||
+        path.find("//") != std::string::npos || path.find("/.") != std::string::npos) {
+        // not a path the walk produces, stat() knows better
+        return UNKNOWN;
+    }
+    std::shared_lock<std::shared_mutex> locker(mutex_);
+    auto it = entries_.find(path);
+    if (it != entries_.end()) {
+        *meta = it->second;
+        return FOUND;
+    }
+    for (const std::string &link : links_) {
+        if (has_prefix(path, link)) {
+            return UNKNOWN;
+        }
+    }
+    return MISSING;
+}
+
+size_t FileIndex::size() const {
+    std::shared_lock<std::shared_mutex> locker(mutex_);
+    return entries_.size();
+}
+
+void FileIndex::walk(const std::string &rel) {
+    std::string dir = base_ + rel;
+    int wd = inotify_add_watch(inotify_fd_, dir.c_str(), WATCH_MASK);
+    if (wd < 0) {
+        // e.g. out of watches, the directory would go stale
+        LOG_WARN("FileIndex: cannot watch %s (%d)", dir.c_str(), errno);
+    } else {
+        watches_[wd] = rel;
+    }
+
+    DIR *dp = opendir(dir.c_str());
+    if (dp == nullptr) {
+        return;
+    }
+    std::vector<std::string> dirs;
+    while (struct dirent *de = readdir(dp)) {
+        std::string name = de->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        if (refresh(rel + "/" + name)) {
+            dirs.push_back(rel + "/" + name);
+        }
+    }
+    closedir(dp);
+    for (const std::string &sub : dirs) {
+        walk(sub);
+    }
+}
+
+bool FileIndex::refresh(const std::string &rel) {
+    std::string path = base_ + rel;
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0) {
+        remove(rel);
+        return false;
+    }
+    Meta meta = {st.st_size, st.st_mtim, st.st_mode, st.st_ino, HttpResponse::file_type(rel)};
+
+    bool is_new_dir = false;
+    bool is_link = false;
+    if (S_ISDIR(st.st_mode)) {
+        // a linked directory is not followed, a loop would never end
+        struct stat lst;
+        is_link = lstat(path.c_str(), &lst) == 0 && S_ISLNK(lst.st_mode);
+    }
+    {
+        std::unique_lock<std::shared_mutex> locker(mutex_);
+        auto it = entries_.find(rel);
+        is_new_dir = S_ISDIR(st.st_mode) && !is_link &&
+                     (it == entries_.end() || !S_ISDIR(it->second.mode));
+        entries_[rel] = meta;
+        if (is_link) {
+            links_.insert(rel);
+        }
+    }
+    drop_cached(rel);
+    return is_new_dir;
+}
+
+void FileIndex::remove(const std::string &rel) {
+    std::vector<std::string> gone;
+    {
+        std::unique_lock<std::shared_mutex> locker(mutex_);
+        auto it = entries_.find(rel);
+        if (it == entries_.end()) {
+            return;
+        }
+        bool is_dir = S_ISDIR(it->second.mode);
+        entries_.erase(it);
+        links_.erase(rel);
+        gone.push_back(rel);
+        if (is_dir) {
+            for (auto entry = entries_.begin(); entry != entries_.end();) {
+                if (has_prefix(entry->first, rel)) {
+                    gone.push_back(entry->first);
+                    links_.erase(entry->first);
+                    entry = entries_.erase(entry);
+                } else {
+                    ++entry;
+                }
+            }
+        }
+    }
+    for (auto it = watches_.begin(); it != watches_.end();) {
+        if (it->second == rel || has_prefix(it->second, rel)) {
+            inotify_rm_watch(inotify_fd_, it->first);
+            it = watches_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    for (const std::string &path : gone) {
+        drop_cached(path);
+    }
+}
+
+void FileIndex::drop_cached(const std::string &rel) {
+    FileCache::instance()->erase(root_ + rel);
+    MmapTable::instance()->erase(root_ + rel);
+    /**
+     * a precompressed sibling came or went, the Vary header of the plain file changes with it,
+     * and the sibling may be cached as negotiated for the plain file too
+    */
+    static const std::pair<const char *, const char *> SIBLINGS[] = {
+        { ".gz", "gzip" },
+        { ".br", "br" },
+    };
+    for (const auto &sibling : SIBLINGS) {
+        size_t len = strlen(sibling.first);
+        if (rel.size() > len && rel.compare(rel.size() - len, len, sibling.first) == 0) {
+            FileCache::instance()->erase(root_ + rel.substr(0, rel.size() - len));
+            FileCache::instance()->erase(FileCache::key(root_ + rel, sibling.second));
+        }
+    }
+}
+
+void FileIndex::loop() {
+    // aligned for the struct inotify_event at its start
+    alignas(struct inotify_event) char buf[64 * 1024];
+    struct pollfd fds[2] = {{inotify_fd_, POLLIN, 0}, {wakeup_fd_, POLLIN, 0}};
+    while (true) {
+        if (poll(fds, 2, -1) < 0 && errno != EINTR) {
+            LOG_ERROR("FileIndex: poll error %d", errno);
+            break;
+        }
+        if (fds[1].revents != 0) {
+            break;
+        }
+        ssize_t len;
+        while ((len = read(inotify_fd_, buf, sizeof(buf))) > 0) {
+            handle_events(buf, len);
+        }
+    }
+}
+
+void FileIndex::handle_events(const char *buf, ssize_t len) {
+    for (const char *p = buf; p < buf + len;) {
+        const struct inotify_event *event = (const struct inotify_event *) p;
+        p += sizeof(struct inotify_event) + event->len;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            // events were lost, nothing short of walking the tree again is safe
+            LOG_WARN("FileIndex: inotify queue overflow, walking %s again", root_.c_str());
+            is_enabled_ = false;
+            for (const auto &watch : watches_) {
+                inotify_rm_watch(inotify_fd_, watch.first);
+            }
+            watches_.clear();
+            {
+                std::unique_lock<std::shared_mutex> locker(mutex_);
+                for (const auto &entry : entries_) {
+                    FileCache::instance()->erase(root_ + entry.first);
+                }
+                entries_.clear();
+                links_.clear();
+            }
+            walk("");
+            is_enabled_ = true;
+            continue;
+        }
+        auto watch = watches_.find(event->wd);
+        if (watch == watches_.end()) {
+            continue;
+        }
+        if (event->mask & IN_IGNORED) {
+            watches_.erase(watch);
+            continue;
+        }
+        if (watch->second.empty() && (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF))) {
+            // the tree itself is gone, answer from stat() from now on
+            LOG_WARN("FileIndex: %s was removed, index disabled", root_.c_str());
+            is_enabled_ = false;
+            continue;
+        }
+        if (event->len == 0) {
+            // an event of the watched directory itself, its parent reports it too
+            continue;
+        }
+
+        std::string rel = watch->second + "/" + event->name;
+        if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            remove(rel);
+        } else if (refresh(rel)) {
+            walk(rel);
+        }
+    }
+}
@@ -0,0 +1,163 @@
+/**
+ * the metadata of every file and directory under the resources directory, so a response needs
+ * no stat() to find out whether its file exists, how large it is and what type it has.
+ *
+ * 1. keeping it current:
+ *     the tree is walked once by init(), which puts an inotify watch on every directory. a
+ *     thread of its own then reads the events and updates the index: created, changed, moved
+ *     and deleted files, and new directories, which are walked and watched in turn. the
+ *     entries of changed files are dropped from FileCache::instance() as well, which then
+ *     skips the revalidation of the files the index has FOUND. if the kernel drops events
+ *     (IN_Q_OVERFLOW) the whole tree is walked again.
+ *
+ * 2. misses:
+ *     the index holds the complete tree, so a path it does not know does not exist, and a
+ *     scanner probing for files is answered with 404 from the index alone: the index is its
+ *     own negative cache. a lookup is only authoritative for the paths the walk produces, one
+ *     slash between names and no "." or ".." segment; any other path is UNKNOWN and the
+ *     caller falls back to stat().
+*/
+
+#ifndef FILE_INDEX_H_
+#define FILE_INDEX_H_
+
+#include <atomic>
+#include <ctime>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+class FileIndex {
+public:
+    enum LOOKUP_ {
+        UNKNOWN = -1,
+        MISSING,
+        FOUND,
+    };
+
+    struct Meta {
+        off_t size;
+        struct timespec mtime;
+        mode_t mode;
+        ino_t ino;
+
+        /**
+         * MIME type of the file, one of the values of HttpResponse's type table
+        */
+        std::string_view type;
+    };
+
+    FileIndex();
+
+    ~FileIndex();
+
+    FileIndex(const FileIndex &) = delete;
+    FileIndex &operator=(const FileIndex &) = delete;
+
+    /**
+     * get the index of the server, set up by init()
+     * @return the index of the resources directory
+    */
+    static FileIndex *instance();
+
+    /**
+     * walk a directory tree, watch it and start the thread that applies the changes
+     * @param root directory of the tree, the src_dir of the responses
+     * @return false if inotify is not available, the index then stays empty and every
+     *         lookup is UNKNOWN
+    */
+    bool init(const std::string &root);
+
+    /**
+     * stop watching the tree and forget it
+    */
+    void stop();
+
+    /**
+     * look the metadata of a file up
+     * @param src_dir directory the path is relative to
+     * @param path path of a request, e.g. "/index.html"
+     * @param meta filled with the metadata if the file is FOUND
+     * @return FOUND, MISSING if the file does not exist, UNKNOWN if the index cannot tell
+    */
+    LOOKUP_ lookup(const std::string &src_dir, const std::string &path, Meta *meta) const;
+
+    /**
+     * get the number of files and directories known
+     * @return number of entries
+    */
+    size_t size() const;
+
+private:
+    /**
+     * add a directory and everything under it, watching every directory
+     * @param rel path of the directory relative to root_, "" for the root itself
+    */
+    void walk(const std::string &rel);
+
+    /**
+     * stat one path and add, update or (if it is gone) remove its entry
+     * @param rel path relative to root_, starting with '/'
+     * @return the entry was a directory that is new to the index
+    */
+    bool refresh(const std::string &rel);
+
+    /**
+     * remove a path and, if it is a directory, everything under it
+     * @param rel path relative to root_, starting with '/'
+    */
+    void remove(const std::string &rel);
+
+    /**
+     * erase a changed path from FileCache::instance() and MmapTable::instance(), and if it is a
+     * .gz or .br sibling also the file it was compressed from and the sibling as negotiated
+     * @param rel path relative to root_, starting with '/'
+    */
+    void drop_cached(const std::string &rel);
+
+    /**
+     * read inotify events until stop() is called
+    */
+    void loop();
+
+    /**
+     * apply a batch of inotify events
+    */
+    void handle_events(const char *buf, ssize_t len);
+
+    /**
+     * the directory as passed to init(), and without its trailing slash
+    */
+    std::string root_;
+    std::string base_;
+
+    /**
+     * metadata by path relative to root_, e.g. "/index.html"
+    */
+    std::unordered_map<std::string, Meta> entries_;
+
+    /**
+     * symlinks to directories. they are not walked, a link loop would never end, so the
+     * paths below them are UNKNOWN
+    */
+    std::unordered_set<std::string> links_;
+    mutable std::shared_mutex mutex_;
+
+    /**
+     * the directory of each inotify watch, relative to root_. only used by init() and the
+     * thread
+    */
+    std::unordered_map<int, std::string> watches_;
+
+    std::atomic<bool> is_enabled_;
+    int inotify_fd_;
+    int wakeup_fd_;
+    std::thread thread_;
+};
+
+#endif
@@ -1,16 +1,88 @@
 #include "httpconn.h"
+#include <algorithm>
 #include <cassert>
 #include <cerrno>
 #include <cstddef>
 #include <cstdint>
+#include <fcntl.h>
+#include <functional>
 #include <netinet/in.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <utility>
+#include <vector>
+
+size_t HttpConn::prefetch_window = 0;
+
+namespace {
+
+const size_t PAGE_BYTES = sysconf(_SC_PAGESIZE);
+
+/**
+ * check whether all pages of a range of a mapped file are in memory
+*/
+bool is_mapped(const char *data, size_t off, size_t len) {
+    size_t start = off / PAGE_BYTES * PAGE_BYTES;
+    thread_local std::vector<unsigned char> pages;
+    pages.resize((off + len - start + PAGE_BYTES - 1) / PAGE_BYTES);
+    if (mincore(const_cast<char *>(data) + start, off + len - start, pages.data()) < 0) {
+        return true;
+    }
+    for (unsigned char page : pages) {
+        if (!(page & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * check whether the first and the last byte of a range of an open file are in the page
+ * cache. sendfile() reads the pages in between in order, so a window is rarely cached at
+ * both ends with a hole in the middle
+*/
+bool is_cached(int fd, off_t off, size_t len) {
+#ifdef RWF_NOWAIT
+    char byte;
+    struct iovec iov = {&byte, 1};
+    for (off_t at : {off, off + static_cast<off_t>(len) - 1}) {
+        if (preadv2(fd, &iov, 1, at, RWF_NOWAIT) < 0 && errno == EAGAIN) {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+/**
+ * a duplicate of an open file for a prefetch job, closed with the last copy of the job
+ * whether it ran or not
+*/
+struct SharedFd {
+    explicit SharedFd(int fd) : fd(fd) {}
+    ~SharedFd() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+    int fd;
+};
+
+}  // namespace
 
 HttpConn::HttpConn() {
     fd_ = -1;
+    generation_ = 0;
     addr_ = {0};
     is_close_ = true;
+    file_bytes_ = 0;
+    is_keep_alive_ = false;
+    is_cold_ = false;
+    is_sending_ = false;
 };
 
 HttpConn::~HttpConn() {
@@ -21,6 +93,10 @@ int HttpConn::get_fd() const {
     return fd_;
 }
 
+uint32_t HttpConn::get_generation() const {
+    return generation_;
+}
+
 sockaddr_in HttpConn::get_addr() const {
     return addr_;
 }
@@ -34,20 +110,24 @@ const char * HttpConn::get_ip() const {
 }
 
 bool HttpConn::is_keep_alive() const {
-    return request_.is_keep_alive();
+    return is_keep_alive_;
 }
 
 int HttpConn::to_write_bytes() const {
-    return iov_[0].iov_len + iov_[1].iov_len;
+    return write_buffer_.ReadableBytes() + file_bytes_;
 }
 
 void HttpConn::init(int sock_fd, const sockaddr_in &addr) {
     assert(sock_fd > 0);
     user_cnt++;
+    generation_++;
     addr_ = addr;
     fd_ = sock_fd;
+    clear_pending();
     write_buffer_.RetrieveAll();
     read_buffer_.RetrieveAll();
+    request_.init();
+    is_keep_alive_ = false;
     is_close_ = false;
     LOG_INFO("Client[%d](%s:%s) in, userCount:%d", fd_, get_ip(), get_port(), (int) user_cnt);
 }
@@ -59,88 +139,470 @@ ssize_t HttpConn::read(int *save_error) {
         if (len <= 0) {
             break;
         }
-    } while (is_ET);
+    } while (is_ET && read_buffer_.ReadableBytes() < MAX_READ_BYTES_);
     return len;
 }
 
 ssize_t HttpConn::write(int *save_error) {
     ssize_t len = -1;
+    // a file was cut at the end of its checked window, the next call goes on with the rest
+    bool is_cut = false;
     do {
-        len = writev(fd_, iov_, iov_cnt_);
+        is_cut = false;
+        if (!pending_.empty() && pending_.front().buffered == 0 &&
+            !is_resident(pending_.front())) {
+            // the file is read in by prefetch_job(), this thread goes on with other connections
+            is_cold_ = true;
+            *save_error = EAGAIN;
+            len = -1;
+            break;
+        }
+        if (!pending_.empty() && pending_.front().buffered == 0 &&
+            pending_.front().file_fd >= 0) {
+            // the headers are out, the file goes from the page cache to the socket
+            Pending &item = pending_.front();
+            size_t count = resident_len(item);
+            is_cut = count < item.file.iov_len;
+            len = sendfile(fd_, item.file_fd, &item.file_off, count);
+            if (len == 0) {
+                // the file shrank since its length was sent, the response cannot be finished
+                LOG_ERROR("Client[%d] file ended before its Content-length", fd_);
+                *save_error = EIO;
+                len = -1;
+                break;
+            }
+            if (len < 0) {
+                *save_error = errno;
+                break;
+            }
+            item.file.iov_len -= len;
+            file_bytes_ -= len;
+            if (item.file.iov_len == 0) {
+                if (!item.keeps_file) {
+                    ::close(item.file_fd);
+                }
+                pending_.pop_front();
+            }
+            if (to_write_bytes() == 0) {
+                write_buffer_.Shrink();
+                break;
+            }
+            continue;
+        }
+
+        // interleave the queued responses and their files
+        bool more = false;
+        struct iovec iov[MAX_IOV_];
+        int iov_cnt = gather(iov, &is_cut, &more);
+        if (more) {
+            struct msghdr msg = {};
+            msg.msg_iov = iov;
+            msg.msg_iovlen = iov_cnt;
+            len = sendmsg(fd_, &msg, MSG_MORE);
+        } else {
+            len = writev(fd_, iov, iov_cnt);
+        }
         if (len <= 0) {
             *save_error = errno;
             break;
         }
-        if (iov_[0].iov_len + iov_[1].iov_len == 0) {
+        advance(len);
+        if (to_write_bytes() == 0) {
+            // the responses are out, the connection does not need its blocks until the next one
+            write_buffer_.Shrink();
             break;
-        } else if (static_cast<size_t>(len) > iov_[0].iov_len) {
-            iov_[1].iov_base = (uint8_t *) iov_[1].iov_base + (len - iov_[0].iov_len);
-            iov_[1].iov_len -= (len - iov_[0].iov_len);
-            if (iov_[0].iov_len != 0) {
-                write_buffer_.RetrieveAll();
-                iov_[0].iov_len = 0;
-            }
-        } else {
-            iov_[0].iov_base = (uint8_t *) iov_[0].iov_base + len;
-            iov_[0].iov_len -= len;
-            write_buffer_.RetrieveAll();
         }
-    } while (is_ET || to_write_bytes() > 10240);
+    } while (is_ET || is_cut || to_write_bytes() > 10240);
     return len;
 }
 
+void HttpConn::receive(std::string_view data) {
+    read_buffer_.Append(data.data(), data.size());
+}
+
+const struct msghdr *HttpConn::send_msg(int *flags) {
+    assert(!is_sending_);
+    if (pending_.empty() || (pending_.front().buffered == 0 &&
+                             (pending_.front().file_fd >= 0 || !is_resident(pending_.front())))) {
+        // sendfile() or the prefetch of write() takes it from here
+        return nullptr;
+    }
+    bool is_cut = false;
+    bool more = false;
+    int iov_cnt = gather(send_iov_, &is_cut, &more);
+    if (iov_cnt == 0) {
+        return nullptr;
+    }
+    send_msg_ = {};
+    send_msg_.msg_iov = send_iov_;
+    send_msg_.msg_iovlen = iov_cnt;
+    *flags = more ? MSG_MORE : 0;
+    is_sending_ = true;
+    return &send_msg_;
+}
+
+void HttpConn::finish_send(ssize_t len) {
+    is_sending_ = false;
+    if (len > 0) {
+        advance(len);
+    }
+    if (to_write_bytes() == 0) {
+        write_buffer_.Shrink();
+    }
+}
+
+bool HttpConn::is_sending() const {
+    return is_sending_;
+}
+
+int HttpConn::gather(struct iovec *iov, bool *is_cut, bool *more) {
+    struct iovec blocks[MAX_IOV_];
+    int block_cnt = write_buffer_.ReadableIovec(blocks, MAX_IOV_);
+    int iov_cnt = 0;
+    int block = 0;
+    size_t block_off = 0;
+    for (Pending &item : pending_) {
+        size_t need = item.buffered;
+        while (need > 0 && block < block_cnt && iov_cnt < MAX_IOV_) {
+            size_t n = std::min(need, blocks[block].iov_len - block_off);
+            iov[iov_cnt].iov_base = (uint8_t *) blocks[block].iov_base + block_off;
+            iov[iov_cnt].iov_len = n;
+            iov_cnt++;
+            need -= n;
+            block_off += n;
+            if (block_off == blocks[block].iov_len) {
+                block++;
+                block_off = 0;
+            }
+        }
+        if (need > 0) {
+            break;
+        }
+        if (item.file_fd >= 0) {
+            *more = true;
+            break;
+        }
+        if (item.file.iov_len > 0) {
+            if (iov_cnt == MAX_IOV_) {
+                break;
+            }
+            if (!is_resident(item)) {
+                // written up to the file, the next call stops in front of it
+                *is_cut = true;
+                break;
+            }
+            iov[iov_cnt].iov_base = item.file.iov_base;
+            iov[iov_cnt].iov_len = resident_len(item);
+            if (iov[iov_cnt++].iov_len < item.file.iov_len) {
+                *is_cut = true;
+                break;
+            }
+        }
+    }
+    return iov_cnt;
+}
+
+void HttpConn::advance(size_t len) {
+    while (!pending_.empty()) {
+        Pending &item = pending_.front();
+        size_t n = std::min(len, item.buffered);
+        write_buffer_.Retrieve(n);
+        item.buffered -= n;
+        len -= n;
+        if (item.buffered > 0) {
+            break;
+        }
+        if (item.file_fd >= 0) {
+            // the file is not part of the iovecs, sendfile() takes it from here
+            break;
+        }
+        n = std::min(len, item.file.iov_len);
+        item.file.iov_base = (uint8_t *) item.file.iov_base + n;
+        item.file.iov_len -= n;
+        file_bytes_ -= n;
+        len -= n;
+        if (item.file.iov_len > 0) {
+            break;
+        }
+        pending_.pop_front();
+    }
+}
+
+bool HttpConn::needs_prefetch() const {
+    return is_cold_;
+}
+
+std::function<void()> HttpConn::prefetch_job() const {
+    assert(is_cold_ && !pending_.empty());
+    const Pending &item = pending_.front();
+    size_t off = file_offset(item);
+    size_t len = std::min(prefetch_window, item.file.iov_len);
+    if (item.file_fd >= 0) {
+        // the connection may close its file while the job is still queued
+        std::shared_ptr<SharedFd> file = std::make_shared<SharedFd>(dup(item.file_fd));
+        return [file, off, len]() {
+            if (file->fd < 0) {
+                return;
+            }
+            readahead(file->fd, off, len);
+            // readahead() only starts the reads, waiting for the last page waits for the window
+            char byte;
+            ssize_t ret = pread(file->fd, &byte, 1, off + len - 1);
+            (void) ret;
+        };
+    }
+    std::shared_ptr<const MmapTable::Mapping> mapping = item.mapping;
+    return [mapping, off, len]() {
+        size_t start = off / PAGE_BYTES * PAGE_BYTES;
+#ifdef MADV_POPULATE_READ
+        if (madvise(const_cast<char *>(mapping->data) + start, off + len - start,
+                    MADV_POPULATE_READ) == 0) {
+            return;
+        }
+#endif
+        // fault the pages in one by one where the kernel cannot populate the range
+        volatile char touched;
+        for (size_t at = start; at < off + len; at += PAGE_BYTES) {
+            touched = mapping->data[at];
+        }
+        (void) touched;
+    };
+}
+
+void HttpConn::finish_prefetch() {
+    is_cold_ = false;
+    if (!pending_.empty()) {
+        Pending &item = pending_.front();
+        item.resident_end = file_offset(item) + std::min(prefetch_window, item.file.iov_len);
+    }
+}
+
+bool HttpConn::is_resident(Pending &item) {
+    if (prefetch_window == 0 || item.file.iov_len == 0 ||
+        (item.file_fd < 0 && item.mapping == nullptr)) {
+        // nothing to check, or the body of a cache entry
+        return true;
+    }
+    size_t off = file_offset(item);
+    if (off < item.resident_end) {
+        return true;
+    }
+    size_t len = std::min(prefetch_window, item.file.iov_len);
+    if (item.file_fd >= 0 ? !is_cached(item.file_fd, off, len) :
+        !is_mapped(item.mapping->data, off, len)) {
+        return false;
+    }
+    item.resident_end = off + len;
+    return true;
+}
+
+size_t HttpConn::resident_len(const Pending &item) {
+    if (prefetch_window == 0 || (item.file_fd < 0 && item.mapping == nullptr)) {
+        return item.file.iov_len;
+    }
+    return std::min(item.file.iov_len, item.resident_end - file_offset(item));
+}
+
+size_t HttpConn::file_offset(const Pending &item) {
+    if (item.file_fd >= 0) {
+        return item.file_off;
+    }
+    return static_cast<const char *>(item.file.iov_base) - item.mapping->data;
+}
+
 void HttpConn::close() {
     response_.unmap_file();
+    clear_pending();
     if (is_close_ == false) {
         is_close_ = true;
+        generation_++;
         user_cnt--;
+        write_buffer_.RetrieveAll();
+        write_buffer_.Shrink();
+        read_buffer_.RetrieveAll();
+        read_buffer_.Shrink();
         ::close(fd_);
         LOG_INFO("Client[%d](%s:%s) quit, UserCount:%d", fd_, get_ip(), get_port(), (int) user_cnt);
     }
 }
 
 bool HttpConn::process() {
-    // initialize the request object to reset its state for a new request
-    request_.init();
-
-    // check if there are any readable bytes in the read buffer
-    if (read_buffer_.ReadableBytes() <= 0) {
-        // if no readable bytes, return false indicating no request to process
+    if (request_.needs_verify()) {
+        // the request waits for its blocking job, nothing behind it may be answered first
         return false;
-    } else if (request_.parse(read_buffer_)) {
-        // if the request is successfully parsed, log the request path
-        LOG_DEBUG("%s", request_.path().c_str());
-
-        /**
-         * initialize the response object with the source directory, retuest path,
-         * keep-alive flag and a 200 OK status code
-        */
-        response_.init(src_dir, request_.path(), request_.is_keep_alive(), 200);
-    } else {
-        /** if the request parsing failed, initialize the response object with a 400
-         *  bad request status code
-        */
-        response_.init(src_dir, request_.path(), false, 400);
-    }
-
-    // generate the HTTP response and store it in the write buffer
-    response_.make_response(write_buffer_);
+    }
 
-    // set up the iovec structure for the response headers
-    iov_[0].iov_base = const_cast<char *>(write_buffer_.Peek());
-    iov_[0].iov_len = write_buffer_.ReadableBytes();
-    iov_cnt_ = 1;
+    size_t queued = 0;
+    while (pending_.size() < MAX_PIPELINE_) {
+        if (request_.is_finished()) {
+            // the previous request has been answered, nothing points into its bytes any more
+            read_buffer_.Retrieve(request_.size());
+            request_.init();
+        }
+
+        // check if there are any readable bytes in the read buffer
+        if (read_buffer_.ReadableBytes() <= 0) {
+            // if no readable bytes, give the blocks back while waiting for the next request
+            read_buffer_.Shrink();
+            break;
+        }
+
+        HttpRequest::HTTP_CODE_ ret = request_.parse(read_buffer_);
+        if (ret == HttpRequest::NO_REQUEST) {
+            // the request is incomplete, parse() goes on where it stopped after the next read
+            break;
+        } else if (ret == HttpRequest::GET_REQUEST) {
+            // if the request is successfully parsed, log the request path
+            LOG_DEBUG("%s", request_.path().c_str());
+
+            if (request_.needs_verify()) {
+                // the response is built by finish_blocking() once the blocking job has run
+                break;
+            }
+
+            // answer with a 200 OK status code, keeping the connection if the request asks to
+            prepare_response(200, request_.is_keep_alive());
+        } else {
+            /** if the request parsing failed, answer with a 400 bad request status code
+             *  and close the connection, the rest of the buffer cannot be trusted
+            */
+            prepare_response(400, false);
+        }
+        queued++;
+
+        if (!is_keep_alive_) {
+            // the requests after it are never answered
+            break;
+        }
+    }
+    return queued > 0;
+}
+
+bool HttpConn::is_blocking() const {
+    return request_.needs_verify();
+}
+
+std::function<bool()> HttpConn::blocking_job() const {
+    return request_.verify_job();
+}
+
+bool HttpConn::blocking_job_async(AsyncUserStore &store,
+                                  std::function<void(bool)> callback) const {
+    return request_.verify_async(store, std::move(callback));
+}
+
+void HttpConn::finish_blocking(bool result) {
+    request_.set_verified(result);
+    prepare_response(200, request_.is_keep_alive());
+}
+
+void HttpConn::reject_blocking() {
+    request_.set_verified(false);
+    prepare_response(503, false);
+}
+
+void HttpConn::prepare_response(int code, bool is_keep_alive) {
+    int encodings = HttpResponse::IDENTITY;
+    HttpResponse::Validator is_not_modified;
+    std::string_view range;
+    HttpResponse::Validator is_range_current;
+    if (code == 200) {
+        encodings = HttpResponse::accepted_encodings(
+            request_.header(HttpRequest::ACCEPT_ENCODING));
+        if (request_.is_conditional()) {
+            is_not_modified = [this](std::string_view etag, time_t last_modified) {
+                return request_.is_not_modified(etag, last_modified);
+            };
+        }
+        range = request_.range();
+        if (!range.empty() && !request_.header(HttpRequest::IF_RANGE).empty()) {
+            is_range_current = [this](std::string_view etag, time_t last_modified) {
+                return request_.is_range_current(etag, last_modified);
+            };
+        }
+    }
+    response_.init(src_dir, request_.path(), is_keep_alive, code, encodings,
+                   std::move(is_not_modified), range, std::move(is_range_current));
+    is_keep_alive_ = is_keep_alive;
+
+    // generate the HTTP response behind the responses already queued in the write buffer
+    size_t before = write_buffer_.ReadableBytes();
+    response_.make_response(write_buffer_);
+    if (!response_.parts().empty()) {
+        queue_parts(before);
+        return;
+    }
+    Pending item = {write_buffer_.ReadableBytes() - before, {nullptr, 0}, nullptr, 0, -1, 0,
+                    response_.cached(), false, 0};
 
     // check if there is a file to be sent as part of the response
-    if (response_.file_len() > 0 && response_.file()) {
-        // if there is a file, set up the iovec structure for the file
-        iov_[1].iov_base = response_.file();
-        iov_[1].iov_len = response_.file_len();
-        iov_cnt_ = 2;
+    if (item.cached) {
+        // a cache hit, the body is written straight from the entry
+        item.mm_len = item.cached->body.size();
+        item.file.iov_base = (void *) item.cached->body.data();
+        item.file.iov_len = item.mm_len;
+        file_bytes_ += item.mm_len;
+    } else if (response_.file_len() > 0 && response_.file_fd() >= 0) {
+        // the file stays open until write() has sent it with sendfile()
+        item.file_fd = response_.file_fd();
+        item.mm_len = response_.file_len();
+        item.file.iov_len = item.mm_len;
+        file_bytes_ += item.mm_len;
+        response_.release_file();
+    } else if (response_.file_len() > 0 && response_.file()) {
+        // the queue borrows the mapping until write() has sent the file
+        item.mapping = response_.mapping();
+        item.mm_len = response_.file_len();
+        item.file.iov_base = (void *) item.mapping->data;
+        item.file.iov_len = item.mm_len;
+        file_bytes_ += item.mm_len;
+        response_.release_file();
     }
+    pending_.push_back(item);
 
-    // log the file size, the number of iovec structures, and the total bytes to be written
-    LOG_DEBUG("filesize:%d, %d  to %d", response_.file_len(), iov_cnt_, to_write_bytes());
+    // log the file size and the total bytes to be written
+    LOG_DEBUG("filesize:%d, to %d", item.mm_len, to_write_bytes());
+}
 
-    return true;
-}
\ No newline at end of file
+void HttpConn::queue_parts(size_t before) {
+    std::shared_ptr<const MmapTable::Mapping> mapping = response_.mapping();
+    int file_fd = response_.file_fd();
+    size_t owner = SIZE_MAX;
+    for (const HttpResponse::Part &part : response_.parts()) {
+        // the headers of a part go between the bytes of the previous one and its own
+        write_buffer_.Append(part.head);
+        Pending item = {write_buffer_.ReadableBytes() - before, {nullptr, 0}, nullptr, 0, -1, 0,
+                        nullptr, true, 0};
+        before = write_buffer_.ReadableBytes();
+        if (part.len > 0 && (file_fd >= 0 || mapping != nullptr)) {
+            item.file_fd = file_fd;
+            item.file_off = part.offset;
+            item.mapping = mapping;
+            item.mm_len = response_.file_len();
+            item.file.iov_base =
+                mapping != nullptr ? (void *) (mapping->data + part.offset) : nullptr;
+            item.file.iov_len = part.len;
+            file_bytes_ += part.len;
+            owner = pending_.size();
+        }
+        pending_.push_back(item);
+    }
+    if (owner != SIZE_MAX) {
+        // the file goes with the last part that is sent from it
+        pending_[owner].keeps_file = false;
+        response_.release_file();
+    }
+    LOG_DEBUG("%zu parts, to %d", response_.parts().size(), to_write_bytes());
+}
+
+void HttpConn::clear_pending() {
+    for (const Pending &item : pending_) {
+        if (!item.keeps_file && item.file_fd >= 0) {
+            ::close(item.file_fd);
+        }
+    }
+    pending_.clear();
+    file_bytes_ = 0;
+    is_cold_ = false;
+    is_sending_ = false;
+}
@@ -19,13 +19,19 @@
 
 #include <atomic>
 #include <bits/types/struct_iovec.h>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
 
 #include "httprequest.h"
 #include "netinet/in.h"
 #include "httpresponse.h"
-#include "../buffer/buffer.h"
+#include "../buffer/chainbuffer.h"
 
 class HttpConn {
 public:
@@ -40,19 +46,59 @@ public:
     void init(int sock_fd, const sockaddr_in &addr);
 
     /**
-     * read data from socket into the read_buffer_ buffer
+     * read data from socket into the read_buffer_ buffer. in ET mode it reads until EAGAIN,
+     * but stops early once MAX_READ_BYTES_ are buffered so an upload does not pile up in
+     * memory before it is parsed; it then returns a positive length and the caller has to
+     * re-arm the fd to get the rest
      * @param save_error pointer to an integer where the function stores the error number
      *                   if an error occurs
     */
     ssize_t read(int *save_error);
 
     /**
-     * write data from the write_buffer_ buffer to the socket
+     * write the queued responses to the socket, as many of them as fit into one writev()
+     * call, then go on with the next call while the socket takes more. a file that is not
+     * mapped is sent with sendfile() once the bytes in front of it are out; those go with
+     * MSG_MORE so the kernel holds them back for the first segment of the file. a partial
+     * sendfile() resumes at the saved offset on the next call. with prefetch_window set, file
+     * bytes are only sent once they are found in the page cache; write() stops with EAGAIN
+     * and needs_prefetch() in front of bytes that are not
      * @param save_error pointer to an integer where the function stores the error number
      *                   if an error occurs
     */
     ssize_t write(int *save_error);
 
+    /**
+     * append bytes an event backend received from the socket to the request, instead of
+     * read()
+     * @param data bytes received
+    */
+    void receive(std::string_view data);
+
+    /**
+     * describe the next bytes of the queued responses as a message for an event backend to
+     * send, instead of write(). the message points into the queued responses, which stay
+     * untouched until finish_send() is called
+     * @param flags set to the flags to send it with, MSG_MORE if a file sent with sendfile()
+     *              follows
+     * @return the message, nullptr if write() has to send the next bytes: a file sent with
+     *         sendfile(), or one that is not in the page cache
+    */
+    const struct msghdr *send_msg(int *flags);
+
+    /**
+     * hand the result of the message from send_msg() back
+     * @param len number of bytes sent, negative if the send failed
+    */
+    void finish_send(ssize_t len);
+
+    /**
+     * check whether a message from send_msg() is still being sent. the connection must not
+     * be closed before it is done
+     * @return whether finish_send() is outstanding
+    */
+    bool is_sending() const;
+
     /**
      * close connection and free resources
     */
@@ -64,6 +110,14 @@ public:
     */
     int get_fd() const;
 
+    /**
+     * get the generation of the connection. it is bumped by every init() and close(), so an
+     * event or a task tagged with an older generation belongs to a connection that has since
+     * been closed, and possibly its fd reused
+     * @return generation of the connection
+    */
+    uint32_t get_generation() const;
+
     /**
      * get the port of the connection
      * @return port #
@@ -83,14 +137,73 @@ public:
     sockaddr_in get_addr() const;
 
     /**
-     * managing the parsing of an HTTP request and thepreparation of the corresponding HTTP
-     * response. It handles reading from the input buffer, parsing the retuest, generating the
-     * response, and setting up the IO vectors for effecient writing. The function ensures that
-     * the resposne is properly formatted and ready to be sent back to the client.
-     * @return true if the resposne is ready to be sent
+     * managing the parsing of the HTTP requests in the read buffer and the preparation of the
+     * corresponding HTTP responses. every complete request already buffered is answered, so
+     * the responses to pipelined requests are queued together and leave in the same writev()
+     * calls. it stops early at a request with a blocking part, after a response that closes
+     * the connection, or once MAX_PIPELINE_ responses are waiting to be written.
+     * @return true if at least one response is ready to be sent
     */
     bool process();
 
+    /**
+     * check whether process() stopped at a request with a blocking part (see
+     * HttpRequest::needs_verify). no response is prepared until finish_blocking() or
+     * reject_blocking() is called
+     * @return whether the request waits for its blocking job
+    */
+    bool is_blocking() const;
+
+    /**
+     * get the blocking job of the pending request. the job does not touch the connection, it
+     * is meant to run on the blocking lane of the Executor
+     * @return the blocking job, returning its result
+    */
+    std::function<bool()> blocking_job() const;
+
+    /**
+     * run the blocking part of the pending request on an AsyncUserStore instead, without
+     * holding any thread while the query is in flight
+     * @param store store whose event loop runs the queries
+     * @param callback invoked on the store's loop thread with the result for finish_blocking()
+     * @return false if the store did not accept the job
+    */
+    bool blocking_job_async(AsyncUserStore &store, std::function<void(bool)> callback) const;
+
+    /**
+     * build the response of the pending request from the result of its blocking job
+     * @param result result returned by blocking_job()
+    */
+    void finish_blocking(bool result);
+
+    /**
+     * answer the pending request with 503 Service Unavailable, used when the blocking job
+     * could not be queued
+    */
+    void reject_blocking();
+
+    /**
+     * check whether write() stopped in front of file bytes that are not in the page cache.
+     * sending them would wait for the disk on the calling thread, the caller runs
+     * prefetch_job() elsewhere and then calls finish_prefetch() before writing again
+     * @return whether the connection waits for its file to be read in
+    */
+    bool needs_prefetch() const;
+
+    /**
+     * get the job that reads the next prefetch_window bytes of the file write() stopped at.
+     * the job does not touch the connection, it is meant to run on the IO lane of the
+     * Executor
+     * @return the prefetch job
+    */
+    std::function<void()> prefetch_job() const;
+
+    /**
+     * let write() send the prefetched bytes without looking at the page cache again, also
+     * used to send them right away when the prefetch job could not be queued
+    */
+    void finish_prefetch();
+
     /**
      * return the total number of bytes that are pending to be written to the sockert
      * @return the total number of bytes that are pending to be written to the sockert
@@ -98,8 +211,8 @@ public:
     int to_write_bytes() const;
     
     /**
-     * check whether the request should be kept alive
-     * @return whether the request should be kept alive
+     * check whether the connection should be kept alive once the queued responses are written
+     * @return whether the last queued response keeps the connection alive
     */
     bool is_keep_alive() const;
 
@@ -107,17 +220,145 @@ public:
     static const char *src_dir;
     static std::atomic<int> user_cnt;
 
+    /**
+     * bytes of a file checked against the page cache, and read in when they are not, at a
+     * time. 0 sends files without checking them
+    */
+    static size_t prefetch_window;
+
 private:
+    /**
+     * generate a response into write_buffer_ and queue it, with its file, for write()
+     * @param code status code of the response
+     * @param is_keep_alive whether the connection is kept after the response
+    */
+    void prepare_response(int code, bool is_keep_alive);
+
+    /**
+     * queue the parts of a 206 response behind its headers
+     * @param before bytes of write_buffer_ that belong to earlier responses
+    */
+    void queue_parts(size_t before);
+
+    /**
+     * unmap or close the files of the queued responses and forget them
+    */
+    void clear_pending();
+
+    /**
+     * describe the queued responses for one writev(): the bytes of each one in
+     * write_buffer_, split at block boundaries, then its file. a file is only added after
+     * all of its headers, and nothing after a file that is sent with sendfile()
+     * @param iov where the ranges are stored, MAX_IOV_ of them at most
+     * @param is_cut set if a file is cut at the end of its checked window
+     * @param more set if a file sent with sendfile() follows the ranges
+     * @return number of ranges stored
+    */
+    int gather(struct iovec *iov, bool *is_cut, bool *more);
+
+    /**
+     * hand the written bytes back to the responses in order, a finished one is dropped
+     * @param len number of bytes written from the ranges of gather()
+    */
+    void advance(size_t len);
+
     int fd_;
+    std::atomic<uint32_t> generation_;
     struct sockaddr_in addr_;
 
     bool is_close_;
 
-    int iov_cnt_;
-    struct iovec iov_[2];
+    /**
+     * max number of iovecs handed to one writev()
+    */
+    static const int MAX_IOV_ = 64;
+
+    /**
+     * bytes buffered in read_buffer_ at which read() stops reading
+    */
+    static const size_t MAX_READ_BYTES_ = 128 * 1024;
+
+    /**
+     * max number of responses queued on a connection. process() stops parsing pipelined
+     * requests there until write() has caught up
+    */
+    static const size_t MAX_PIPELINE_ = 16;
+
+    /**
+     * a queued response: its bytes in write_buffer_, then the part of its file that is not
+     * written yet. the file is either mapped (mapping), open (file_fd, with file.iov_base
+     * unused and file_off the offset sendfile() goes on from) or the body of a cache entry;
+     * the response holds on to the mapping or the entry until it is written. the parts of a
+     * 206 are queued as an item each, all but the last of them with keeps_file set: they
+     * share the open file, which the last one closes
+    */
+    struct Pending {
+        size_t buffered;
+        struct iovec file;
+        std::shared_ptr<const MmapTable::Mapping> mapping;
+        size_t mm_len;
+        int file_fd;
+        off_t file_off;
+        std::shared_ptr<const FileCache::Entry> cached;
+        bool keeps_file;
+
+        /**
+         * offset into the file up to which its bytes were found in the page cache or read in
+        */
+        size_t resident_end;
+    };
+
+    /**
+     * check whether the next bytes of a queued file are in the page cache, with mincore() if
+     * it is mapped or a non-blocking read of the first and the last page of the window if it
+     * is sent with sendfile(), and note how far they are
+     * @param item the queued response
+     * @return true if the next bytes may be sent without waiting for the disk
+    */
+    static bool is_resident(Pending &item);
+
+    /**
+     * get how many of the file bytes of a queued response may be sent before the page cache
+     * has to be checked again
+     * @param item the queued response
+     * @return the bytes up to the end of the checked window
+    */
+    static size_t resident_len(const Pending &item);
+
+    /**
+     * get how far the file of a queued response is sent
+     * @param item the queued response, with a mapped or open file
+     * @return offset of the next byte to send into the file
+    */
+    static size_t file_offset(const Pending &item);
+
+    /**
+     * the responses waiting to be written, in the order of their requests. the bytes of all
+     * of them follow each other in write_buffer_
+    */
+    std::deque<Pending> pending_;
+
+    /**
+     * sum of the file parts of pending_
+    */
+    size_t file_bytes_;
+
+    bool is_keep_alive_;
+
+    /**
+     * write() stopped at a file that has to be read in first, see needs_prefetch()
+    */
+    bool is_cold_;
+
+    /**
+     * the message of send_msg() and its ranges, while is_sending_
+    */
+    struct iovec send_iov_[MAX_IOV_];
+    struct msghdr send_msg_;
+    bool is_sending_;
 
-    Buffer read_buffer_;
-    Buffer write_buffer_;
+    ChainBuffer read_buffer_;
+    ChainBuffer write_buffer_;
 
     HttpRequest request_;
     HttpResponse response_;
@@ -0,0 +1,91 @@
+#include "httpdate.h"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+const char DAYS[] = "SunMonTueWedThuFriSat";
+const char MONTHS[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+void two_digits(char *out, int value) {
+    out[0] = static_cast<char>('0' + value / 10);
+    out[1] = static_cast<char>('0' + value % 10);
+}
+
+/**
+ * a reader copies a slot right after loading its index, a minute before the ring comes back
+ * to it
+*/
+const int SLOT_NUM = 64;
+
+struct Slot {
+    std::atomic<time_t> sec{-1};
+    char text[HttpDate::LEN];
+};
+
+Slot slots[SLOT_NUM];
+std::atomic<int> current{0};
+std::mutex mutex;
+
+}  // namespace
+
+void HttpDate::format(time_t t, char *out) {
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    memcpy(out, DAYS + tm.tm_wday * 3, 3);
+    memcpy(out + 3, ", ", 2);
+    two_digits(out + 5, tm.tm_mday);
+    out[7] = ' ';
+    memcpy(out + 8, MONTHS + tm.tm_mon * 3, 3);
+    out[11] = ' ';
+    two_digits(out + 12, (tm.tm_year + 1900) / 100);
+    two_digits(out + 14, (tm.tm_year + 1900) % 100);
+    out[16] = ' ';
+    two_digits(out + 17, tm.tm_hour);
+    out[19] = ':';
+    two_digits(out + 20, tm.tm_min);
+    out[22] = ':';
+    two_digits(out + 23, tm.tm_sec);
+    memcpy(out + 25, " GMT", 4);
+}
+
+bool HttpDate::parse(std::string_view date, time_t *t) {
+    char buf[64];
+    if (date.size() >= sizeof(buf)) {
+        return false;
+    }
+    memcpy(buf, date.data(), date.size());
+    buf[date.size()] = '\0';
+    struct tm tm = {};
+    const char *end = strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == nullptr || *end != '\0') {
+        return false;
+    }
+    *t = timegm(&tm);
+    return true;
+}
+
+std::string_view HttpDate::now() {
+    time_t t = time(nullptr);
+    int slot = current.load(std::memory_order_acquire);
+    if (slots[slot].sec.load(std::memory_order_relaxed) == t) {
+        return std::string_view(slots[slot].text, LEN);
+    }
+
+    std::unique_lock<std::mutex> locker(mutex, std::try_to_lock);
+    if (!locker.owns_lock()) {
+        // another thread is filling the next slot, this one formats the date on its own
+        thread_local char text[LEN];
+        format(t, text);
+        return std::string_view(text, LEN);
+    }
+    slot = current.load(std::memory_order_relaxed);
+    if (slots[slot].sec.load(std::memory_order_relaxed) != t) {
+        slot = (slot + 1) % SLOT_NUM;
+        format(t, slots[slot].text);
+        slots[slot].sec.store(t, std::memory_order_relaxed);
+        current.store(slot, std::memory_order_release);
+    }
+    return std::string_view(slots[slot].text, LEN);
+}
@@ -0,0 +1,47 @@
+/**
+ * the dates of HTTP header fields, in the IMF-fixdate format: "Sun, 06 Nov 1994 08:49:37 GMT".
+ *
+ * every response carries the current time in a Date header. formatting it is done once a
+ * second by whichever thread first notices that the second changed, the others copy the text
+ * that is already there. the text is kept in a ring of slots, so a slot is only overwritten
+ * long after the threads that read it are done with it.
+*/
+
+#ifndef HTTP_DATE_H_
+#define HTTP_DATE_H_
+
+#include <cstddef>
+#include <ctime>
+#include <string_view>
+
+class HttpDate {
+public:
+    /**
+     * length of a formatted date
+    */
+    static const size_t LEN = 29;
+
+    /**
+     * format a time
+     * @param t seconds since the epoch
+     * @param out receives LEN bytes, not terminated
+    */
+    static void format(time_t t, char *out);
+
+    /**
+     * parse a date. the obsolete formats of RFC 850 and asctime() are not accepted, a client
+     * echoes the dates we send it anyway
+     * @param date the text of the date
+     * @param t set to the seconds since the epoch
+     * @return false if the text is not a date
+    */
+    static bool parse(std::string_view date, time_t *t);
+
+    /**
+     * get the current time, formatted at most once a second for all threads
+     * @return the date, valid for a minute
+    */
+    static std::string_view now();
+};
+
+#endif
@@ -1,71 +1,335 @@
 #include "httprequest.h"
+#include "httpdate.h"
+#include "../buffer/crlfscan.h"
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <cstddef>
 #include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
 #include <mysql/mysql.h>
-#include <regex>
 #include <strings.h>
+#include <utility>
 
-bool HttpRequest::parse_request_line(const std::string &line) {
-    std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
-    std::smatch sub_smatch;
+namespace {
 
-    if (std::regex_match(line, sub_smatch, patten)) {
-        method_ = sub_smatch[1];
-        path_ = sub_smatch[2];
-        version_ = sub_smatch[3];
-        state_ = HEADERS;
-        return true;
+/**
+ * names of the known header fields, in the order of HttpRequest::HEADER_
+*/
+constexpr std::string_view HEADER_NAMES[] = {
+    "Host", "Connection", "Content-Length", "Content-Type", "Transfer-Encoding", "Accept",
+    "Accept-Encoding", "Accept-Language", "User-Agent", "Cookie", "Referer", "Origin",
+    "Cache-Control", "If-None-Match", "If-Modified-Since", "If-Range", "Range", "Expect",
+    "Upgrade", "Authorization",
+};
+static_assert(sizeof(HEADER_NAMES) / sizeof(HEADER_NAMES[0]) == HttpRequest::HEADER_NUM,
+              "a known header has no name");
+
+/**
+ * the perfect hash only reads the length and the first and last character of a name, which
+ * tell all known names apart. a candidate is then confirmed with one strncasecmp()
+*/
+constexpr uint32_t header_hash(std::string_view name, uint32_t seed) {
+    uint32_t h = seed;
+    h = (h ^ static_cast<uint32_t>(name.size())) * 16777619u;
+    h = (h ^ static_cast<uint32_t>(name.front() | 0x20)) * 16777619u;
+    h = (h ^ static_cast<uint32_t>(name.back() | 0x20)) * 16777619u;
+    return h >> 26;
+}
+
+struct HeaderTable {
+    static const uint32_t SIZE_ = 64;
+    static const uint8_t EMPTY_ = 0xff;
+
+    uint32_t seed;
+    uint8_t slot[SIZE_];
+};
+
+/**
+ * try seeds until every known name lands in a bucket of its own
+*/
+constexpr HeaderTable make_header_table() {
+    HeaderTable table{};
+    for (uint32_t seed = 2166136261u; ; seed++) {
+        table.seed = seed;
+        for (uint8_t &slot : table.slot) {
+            slot = HeaderTable::EMPTY_;
+        }
+        bool perfect = true;
+        for (uint8_t id = 0; id < HttpRequest::HEADER_NUM && perfect; id++) {
+            uint8_t &slot = table.slot[header_hash(HEADER_NAMES[id], seed)];
+            perfect = slot == HeaderTable::EMPTY_;
+            slot = id;
+        }
+        if (perfect) {
+            return table;
+        }
+    }
+}
+
+constexpr HeaderTable HEADER_TABLE = make_header_table();
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    return a.size() == b.size() && strncasecmp(a.data(), b.data(), a.size()) == 0;
+}
+
+std::string_view trim(std::string_view str) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+/**
+ * the weak comparison of entity tags ignores the W/ prefix
+*/
+std::string_view opaque_tag(std::string_view tag) {
+    if (tag.size() > 2 && tag[0] == 'W' && tag[1] == '/') {
+        tag.remove_prefix(2);
+    }
+    return tag;
+}
+
+}
+
+HttpRequest::HEADER_ HttpRequest::header_id(std::string_view name) {
+    if (name.empty()) {
+        return UNKNOWN_HEADER;
+    }
+    uint8_t id = HEADER_TABLE.slot[header_hash(name, HEADER_TABLE.seed)];
+    if (id == HeaderTable::EMPTY_ || !equals_ignore_case(name, HEADER_NAMES[id])) {
+        return UNKNOWN_HEADER;
     }
-    LOG_ERROR("RequestLine Error!");
-    return false;
+    return static_cast<HEADER_>(id);
 }
 
-void HttpRequest::parse_header(const std::string &line) {
-    std::regex patten("^([^:]*): ?(.*)$");
-    std::smatch sub_match;
+bool HttpRequest::parse_request_line(std::string_view line) {
+    const std::string_view HTTP = "HTTP/";
+    size_t method_end = line.find(' ');
+    size_t path_end = method_end == std::string_view::npos ?
+        std::string_view::npos : line.find(' ', method_end + 1);
+    if (path_end == std::string_view::npos) {
+        LOG_ERROR("RequestLine Error!");
+        return false;
+    }
+    std::string_view version = line.substr(path_end + 1);
+    if (version.compare(0, HTTP.size(), HTTP) != 0 ||
+        version.find(' ', HTTP.size()) != std::string_view::npos) {
+        LOG_ERROR("RequestLine Error!");
+        return false;
+    }
+    method_.assign(line.data(), method_end);
+    // the query string is kept apart, routes and files only see the bare path
+    std::string_view target = line.substr(method_end + 1, path_end - method_end - 1);
+    size_t query = target.find('?');
+    path_.assign(target.substr(0, query));
+    if (query != std::string_view::npos) {
+        query_.assign(target.substr(query + 1));
+    }
+    version_.assign(version.data() + HTTP.size(), version.size() - HTTP.size());
+    state_ = HEADERS;
+    return true;
+}
 
-    if (std::regex_match(line, sub_match, patten)) {
-        header_[sub_match[1]] = sub_match[2];
+bool HttpRequest::parse_header(std::string_view line, size_t offset) {
+    size_t colon = line.find(':');
+    if (colon == std::string_view::npos) {
+        LOG_ERROR("Header Error!");
+        return false;
+    }
+    size_t value = colon + 1;
+    if (value < line.size() && line[value] == ' ') {
+        value++;
+    }
+    Value field_value{static_cast<uint32_t>(offset + value),
+                      static_cast<uint32_t>(line.size() - value)};
+    HEADER_ id = header_id(line.substr(0, colon));
+    if ((id == CONTENT_LENGTH || id == TRANSFER_ENCODING) && known_[id].offset != 0) {
+        // a proxy keeping the first of two framings would split the stream elsewhere
+        LOG_ERROR("Repeated framing header!");
+        return false;
+    }
+    if (id != UNKNOWN_HEADER) {
+        known_[id] = field_value;
     } else {
-        state_ = BODY;
+        fields_.push_back(Field{static_cast<uint32_t>(offset), static_cast<uint32_t>(colon),
+                                field_value});
     }
+    return true;
 }
 
-void HttpRequest::parse_body(const std::string &line) {
-    body_ = line;
-    parse_post();
-    state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+bool HttpRequest::parse_headers_end() {
+    std::string_view length = header(CONTENT_LENGTH);
+    content_length_ = 0;
+    for (char ch : length) {
+        if (ch < '0' || ch > '9' || content_length_ > MAX_BODY_SIZE_) {
+            LOG_ERROR("Content-Length Error!");
+            return false;
+        }
+        content_length_ = content_length_ * 10 + (ch - '0');
+    }
+    if (content_length_ > MAX_BODY_SIZE_) {
+        LOG_ERROR("Content-Length Error!");
+        return false;
+    }
+    std::string_view encoding = header(TRANSFER_ENCODING);
+    if (!encoding.empty()) {
+        // a request with both framings could be read differently by a proxy in front of us
+        if (!equals_ignore_case(encoding, "chunked") || !length.empty()) {
+            LOG_ERROR("Transfer-Encoding Error!");
+            return false;
+        }
+        is_chunked_ = true;
+    }
+    is_keep_alive_ = version_ == "1.1" && equals_ignore_case(header(CONNECTION), "keep-alive");
+    body_offset_ = body_end_ = parsed_;
+    body_left_ = content_length_;
+    if (is_chunked_) {
+        state_ = CHUNK_SIZE;
+    } else {
+        state_ = content_length_ > 0 ? BODY : FINISH;
+    }
+    return true;
 }
 
-void HttpRequest::parse_path() {
-    if (path_ == "/") {
-        path_ = "/index.html";
+bool HttpRequest::parse_body(ChainBuffer &buffer) {
+    char *begin = buffer.BeginRead();
+    size_t n = std::min(buffer.ReadableBytes() - parsed_, body_left_);
+    if (body_size_ + n > MAX_BODY_SIZE_) {
+        LOG_ERROR("Request Body Too Large!");
+        return false;
+    }
+    if (sink_.fd() < 0 && content_length_ <= MAX_INPLACE_BODY_ &&
+        body_size_ + n <= MAX_INPLACE_BODY_) {
+        // keep it in place, right behind the body bytes of the previous chunks
+        if (body_end_ != parsed_) {
+            memmove(begin + body_end_, begin + parsed_, n);
+        }
+        body_end_ += n;
     } else {
-        for (auto &item : DEFAULT_HTML_) {
-            if (item == path_) {
+        if (sink_.fd() < 0) {
+            // the body outgrew the buffer, what was kept in place goes first
+            if (!sink_.write(begin + body_offset_, body_end_ - body_offset_)) {
+                return false;
+            }
+            body_end_ = body_offset_;
+        }
+        if (!sink_.write(begin + parsed_, n)) {
+            return false;
+        }
+    }
+    parsed_ += n;
+    body_size_ += n;
+    body_left_ -= n;
+    if (body_left_ == 0) {
+        state_ = is_chunked_ ? CHUNK_END : FINISH;
+    }
+    return true;
+}
+
+bool HttpRequest::parse_chunk_size(std::string_view line) {
+    line = line.substr(0, line.find(';'));
+    while (!line.empty() && (line.back() == ' ' || line.back() == '\t')) {
+        line.remove_suffix(1);
+    }
+    if (line.empty()) {
+        LOG_ERROR("Chunk Size Error!");
+        return false;
+    }
+    body_left_ = 0;
+    for (char ch : line) {
+        if (!isxdigit(static_cast<unsigned char>(ch)) || body_left_ > MAX_BODY_SIZE_) {
+            LOG_ERROR("Chunk Size Error!");
+            return false;
+        }
+        body_left_ = body_left_ * 16 + (ch <= '9' ? ch - '0' : conver_hex(ch));
+    }
+    if (body_size_ + body_left_ > MAX_BODY_SIZE_) {
+        LOG_ERROR("Request Body Too Large!");
+        return false;
+    }
+    state_ = body_left_ > 0 ? BODY : TRAILERS;
+    return true;
+}
+
+void HttpRequest::compact(ChainBuffer &buffer) {
+    if (state_ > HEADERS && parsed_ > body_end_) {
+        buffer.Erase(body_end_, parsed_ - body_end_);
+        parsed_ = body_end_;
+    }
+}
+
+void HttpRequest::parse_path() {
+    route_ = routes().match(path_);
+    switch (route_) {
+        case INDEX_ROUTE:
+            path_ = "/index.html";
+            break;
+        case PAGE_ROUTE:
+        case LOGIN_ROUTE:
+        case REGISTER_ROUTE:
+            if (path_.size() < 5 || path_.compare(path_.size() - 5, 5, ".html") != 0) {
                 path_ += ".html";
-                break;
             }
+            break;
+        default:
+            break;
+    }
+}
+
+Router &HttpRequest::routes() {
+    static Router table = [] {
+        Router router;
+        router.add(Router::EXACT, "/", INDEX_ROUTE);
+        for (const char *page : {"/index", "/welcome", "/video", "/picture"}) {
+            router.add(Router::EXACT, page, PAGE_ROUTE);
         }
+        router.add(Router::EXACT, "/login", LOGIN_ROUTE);
+        router.add(Router::EXACT, "/login.html", LOGIN_ROUTE);
+        router.add(Router::EXACT, "/register", REGISTER_ROUTE);
+        router.add(Router::EXACT, "/register.html", REGISTER_ROUTE);
+        return router;
+    }();
+    return table;
+}
+
+std::vector<HttpRequest::Handler> &HttpRequest::handlers() {
+    static std::vector<Handler> handlers;
+    return handlers;
+}
+
+int HttpRequest::add_route(Router::MATCH_ type, const std::string &pattern, Handler handler) {
+    assert(handler);
+    int id = USER_ROUTE + static_cast<int>(handlers().size());
+    if (!routes().add(type, pattern, id)) {
+        return Router::NO_ROUTE;
     }
+    handlers().push_back(std::move(handler));
+    return id;
+}
+
+int HttpRequest::route() const {
+    return route_;
 }
 
 void HttpRequest::parse_post() {
-    if (method_ == "POST" && header_["Content-Type"] == "application/x-www-form-urlencoded") {
+    if (method_ == "POST" && header(CONTENT_TYPE) == "application/x-www-form-urlencoded") {
+        if (body_fd() >= 0) {
+            LOG_WARN("Form body of %zu bytes not parsed", body_size_);
+            return;
+        }
+        body_.assign(body().data(), body().size());
         parse_from_urlencoded();
-        if (DEFAULT_HEML_TAG_.count(path_) != 0) {
-            int tag = DEFAULT_HEML_TAG_.find(path_)->second;
-            LOG_DEBUG("Tag:%d", tag);
-            if (tag == 0 || tag == 1) {
-                bool is_login = (tag == 1);
-                if (user_verify(post_["username"], post_["password"], is_login)) {
-                    path_ = "/welcome.html";
-                } else {
-                    path_ = "/error.html";
-                }
-            }
+        if (route_ == LOGIN_ROUTE || route_ == REGISTER_ROUTE) {
+            LOG_DEBUG("Route:%d", route_);
+            // answered once verify_job() has run, see needs_verify()
+            needs_verify_ = true;
+            is_login_ = (route_ == LOGIN_ROUTE);
         }
     }
 }
@@ -185,6 +449,28 @@ bool HttpRequest::user_verify(const std::string &name, const std::string &pwd, b
     return flag;
 }
 
+bool HttpRequest::needs_verify() const {
+    return needs_verify_;
+}
+
+std::function<bool()> HttpRequest::verify_job() const {
+    assert(needs_verify_);
+    return std::bind(&HttpRequest::user_verify, get_post("username"), get_post("password"),
+                     is_login_);
+}
+
+bool HttpRequest::verify_async(AsyncUserStore &store, AsyncUserStore::Callback callback) const {
+    assert(needs_verify_);
+    return store.verify(get_post("username"), get_post("password"), is_login_,
+                        std::move(callback));
+}
+
+void HttpRequest::set_verified(bool is_verified) {
+    assert(needs_verify_);
+    needs_verify_ = false;
+    path_ = is_verified ? "/welcome.html" : "/error.html";
+}
+
 int HttpRequest::conver_hex(char ch) {
     if (ch >= 'A' && ch <= 'F') {
         return ch - 'A' + 10;
@@ -196,61 +482,200 @@ int HttpRequest::conver_hex(char ch) {
 }
 
 bool HttpRequest::is_keep_alive() const {
-    if (header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    return is_keep_alive_;
+}
+
+bool HttpRequest::is_conditional() const {
+    return (method_ == "GET" || method_ == "HEAD") &&
+           (!header(IF_NONE_MATCH).empty() || !header(IF_MODIFIED_SINCE).empty());
+}
+
+bool HttpRequest::is_not_modified(std::string_view etag, time_t last_modified) const {
+    std::string_view tags = header(IF_NONE_MATCH);
+    if (!tags.empty()) {
+        etag = opaque_tag(etag);
+        while (!tags.empty()) {
+            size_t comma = tags.find(',');
+            std::string_view tag = trim(tags.substr(0, comma));
+            tags = comma == std::string_view::npos ? "" : tags.substr(comma + 1);
+            if (tag == "*" || opaque_tag(tag) == etag) {
+                return true;
+            }
+        }
+        return false;
     }
-    return false;
+    time_t since = 0;
+    std::string_view date = header(IF_MODIFIED_SINCE);
+    return !date.empty() && HttpDate::parse(date, &since) && last_modified <= since;
+}
+
+std::string_view HttpRequest::range() const {
+    return method_ == "GET" ? header(RANGE) : std::string_view();
+}
+
+bool HttpRequest::is_range_current(std::string_view etag, time_t last_modified) const {
+    std::string_view validator = trim(header(IF_RANGE));
+    if (validator.empty()) {
+        return true;
+    }
+    if (validator.front() == '"' || validator.compare(0, 2, "W/") == 0) {
+        // a weak tag on either side never matches strongly
+        return validator.front() == '"' && validator == etag;
+    }
+    time_t date = 0;
+    return HttpDate::parse(validator, &date) && date == last_modified;
 }
 
 void HttpRequest::init() {
-    method_ = path_ = version_ = body_ = "";
+    method_ = path_ = query_ = version_ = body_ = "";
     state_ = REQUEST_LINE;
-    header_.clear();
+    needs_verify_ = is_login_ = is_keep_alive_ = false;
+    memset(known_, 0, sizeof(known_));
+    fields_.clear();
     post_.clear();
+    buffer_ = nullptr;
+    parsed_ = content_length_ = body_left_ = body_offset_ = body_end_ = body_size_ = 0;
+    is_chunked_ = false;
+    route_ = Router::NO_ROUTE;
+    sink_.init();
 }
 
-bool HttpRequest::parse(Buffer &buffer) {
-    // this is used to indicate the end of a line in HTTP
-    const char CRLF[] = "\r\n";
-    if (buffer.ReadableBytes() <= 0) {
-        return false;
-    }
-    
-    /**
-     * find th end of the current line using the search function to locate the CRLF sequencce
-     * and extract the current line from the buffer into a string
-    */
-    while (buffer.ReadableBytes() != 0 && state_ != FINISH) {
-        const char *line_end = std::search(buffer.Peek(), buffer.BeginWriteConst(),
-            CRLF, CRLF + 2);
-        std::string line(buffer.Peek(), line_end);
+HttpRequest::HTTP_CODE_ HttpRequest::parse(ChainBuffer &buffer) {
+    assert(buffer_ == nullptr || buffer_ == &buffer);
+    buffer_ = &buffer;
+
+    while (state_ != FINISH) {
+        // Peek() may pull the readable bytes up into one block, the offsets stay the same
+        const char *begin = buffer.Peek();
+        const char *end = begin + buffer.ReadableBytes();
+        const char *p = begin + parsed_;
+        if (state_ == BODY) {
+            if (p == end) {
+                compact(buffer);
+                return NO_REQUEST;
+            }
+            if (!parse_body(buffer)) {
+                return bad_request(buffer);
+            }
+            continue;
+        }
+
+        // only the bytes after the last complete line are scanned again
+        const char *line_end = FindCRLF(p, end);
+        if (line_end == end) {
+            size_t pending = state_ > HEADERS ? end - p : end - begin;
+            if (pending > MAX_HEAD_SIZE_) {
+                LOG_ERROR("Request Header Too Large!");
+                return bad_request(buffer);
+            }
+            compact(buffer);
+            return NO_REQUEST;
+        }
+        std::string_view line(p, line_end - p);
+        size_t offset = parsed_;
+        parsed_ += line.size() + 2;
 
+        bool is_valid = true;
         switch (state_) {
             case REQUEST_LINE:
-                if (!parse_request_line(line)) {
-                    return false;
+                is_valid = parse_request_line(line);
+                if (is_valid) {
+                    parse_path();
                 }
-                parse_path();
                 break;
             case HEADERS:
-                parse_header(line);
-                if (buffer.ReadableBytes() <= 2) {
+                is_valid = line.empty() ? parse_headers_end() : parse_header(line, offset);
+                break;
+            case CHUNK_SIZE:
+                is_valid = parse_chunk_size(line);
+                break;
+            case CHUNK_END:
+                // the CRLF closing the data of a chunk
+                is_valid = line.empty();
+                state_ = CHUNK_SIZE;
+                break;
+            case TRAILERS:
+                // trailer fields are not used, the empty line ends the body
+                if (line.empty()) {
                     state_ = FINISH;
                 }
                 break;
-            case BODY:
-                parse_body(line);
-                break;
             default:
                 break;
         }
-        if (line_end == buffer.BeginWrite()) {
-            break;
+        if (!is_valid) {
+            return bad_request(buffer);
         }
-        buffer.RetrieveUntil(line_end + 2);
+    }
+    compact(buffer);
+    if (body_size_ > 0) {
+        parse_post();
+        LOG_DEBUG("Body len:%zu", body_size_);
+    }
+    if (route_ >= USER_ROUTE) {
+        handlers()[route_ - USER_ROUTE](*this);
     }
     LOG_DEBUG("[%s], [%s], [%s]", method_.c_str(), path_.c_str(), version_.c_str());
-    return true;
+    return GET_REQUEST;
+}
+
+HttpRequest::HTTP_CODE_ HttpRequest::bad_request(const ChainBuffer &buffer) {
+    state_ = FINISH;
+    parsed_ = buffer.ReadableBytes();
+    is_keep_alive_ = false;
+    memset(known_, 0, sizeof(known_));
+    fields_.clear();
+    body_offset_ = body_end_ = body_size_ = 0;
+    sink_.init();
+    return BAD_REQUEST;
+}
+
+bool HttpRequest::is_finished() const {
+    return state_ == FINISH;
+}
+
+size_t HttpRequest::size() const {
+    return parsed_;
+}
+
+std::string_view HttpRequest::header(std::string_view key) const {
+    HEADER_ id = header_id(key);
+    if (id != UNKNOWN_HEADER) {
+        return header(id);
+    }
+    if (buffer_ == nullptr) {
+        return std::string_view();
+    }
+    const char *begin = buffer_->Peek();
+    for (const Field &field : fields_) {
+        if (equals_ignore_case(key, std::string_view(begin + field.key, field.key_len))) {
+            return std::string_view(begin + field.value.offset, field.value.len);
+        }
+    }
+    return std::string_view();
+}
+
+std::string_view HttpRequest::header(HEADER_ id) const {
+    assert(id < HEADER_NUM);
+    if (known_[id].offset == 0) {
+        return std::string_view();
+    }
+    return std::string_view(buffer_->Peek() + known_[id].offset, known_[id].len);
+}
+
+std::string_view HttpRequest::body() const {
+    if (buffer_ == nullptr || sink_.fd() >= 0) {
+        return std::string_view();
+    }
+    return std::string_view(buffer_->Peek() + body_offset_, body_end_ - body_offset_);
+}
+
+int HttpRequest::body_fd() const {
+    return sink_.fd();
+}
+
+size_t HttpRequest::body_size() const {
+    return body_size_;
 }
 
 std::string HttpRequest::path() const{
@@ -261,6 +686,10 @@ std::string & HttpRequest::path() {
     return path_;
 }
 
+std::string HttpRequest::query() const {
+    return query_;
+}
+
 std::string HttpRequest::method() const {
     return method_;
 }
@@ -46,14 +46,20 @@
 #ifndef HTTP_REQUEST_H_
 #define HTTP_REQUEST_H_
 
+#include <cstdint>
+#include <ctime>
+#include <functional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
-#include <regex>
+#include <vector>
 
 #include "mysql/mysql.h"
-#include "../buffer/buffer.h"
+#include "../buffer/chainbuffer.h"
+#include "bodysink.h"
+#include "router.h"
 #include "../log/log.h"
+#include "../pool/asyncuserstore.h"
 #include "../pool/sqlconnRAII.h"
 
 class HttpRequest {
@@ -62,6 +68,9 @@ public:
         REQUEST_LINE,
         HEADERS,
         BODY,
+        CHUNK_SIZE,
+        CHUNK_END,
+        TRAILERS,
         FINISH,
     };
 
@@ -76,6 +85,53 @@ public:
         CLOSED_CONNECTION,
     };
 
+    /**
+     * the header fields the server looks at, each parsed into a fixed slot. any other field
+     * is kept in a flat overflow list
+    */
+    enum HEADER_ {
+        HOST = 0,
+        CONNECTION,
+        CONTENT_LENGTH,
+        CONTENT_TYPE,
+        TRANSFER_ENCODING,
+        ACCEPT,
+        ACCEPT_ENCODING,
+        ACCEPT_LANGUAGE,
+        USER_AGENT,
+        COOKIE,
+        REFERER,
+        ORIGIN,
+        CACHE_CONTROL,
+        IF_NONE_MATCH,
+        IF_MODIFIED_SINCE,
+        IF_RANGE,
+        RANGE,
+        EXPECT,
+        UPGRADE,
+        AUTHORIZATION,
+        HEADER_NUM,
+        UNKNOWN_HEADER = HEADER_NUM,
+    };
+
+    /**
+     * the handler ids of the routes the server comes with. handlers added with add_route()
+     * get the ids from USER_ROUTE on
+    */
+    enum ROUTE_ {
+        PAGE_ROUTE = 0,
+        INDEX_ROUTE,
+        LOGIN_ROUTE,
+        REGISTER_ROUTE,
+        USER_ROUTE,
+    };
+
+    /**
+     * a handler of an added route, run on a complete request. it may e.g. rewrite path() to
+     * pick the file the request is answered with
+    */
+    typedef std::function<void(HttpRequest &request)> Handler;
+
     HttpRequest() {
         init();
     }
@@ -88,12 +144,75 @@ public:
     void init();
 
     /**
-     * parse an HTTP request from a given buffer. it reads from the buffer and parse differnent parts
-     * of the HTTP request: the request line, headers, and body
+     * parse an HTTP request from a given buffer. it is a state machine over the request line,
+     * the headers and the body that resumes where the previous call stopped, so a request
+     * that arrives in several reads is parsed once, line by line, as its bytes come in.
+     *
+     * nothing is retrieved from the buffer: the header fields are kept as offsets into its
+     * readable bytes, and the caller drops the size() bytes of the request once it is
+     * answered. until then the buffer must only be appended to.
+     *
+     * the body is framed by Content-Length or by chunked Transfer-Encoding. up to
+     * MAX_INPLACE_BODY_ bytes are kept in the buffer after the headers, the chunk framing
+     * taken out. a larger body goes to a BodySink while it arrives and is erased from the
+     * buffer, so the buffer never holds more than the headers and the last read
      * @param buffer contains the raw HTTP request data to be parsed
-     * @return whether the parse successed
+     * @return GET_REQUEST if the request is complete, NO_REQUEST if more bytes are needed,
+     *         BAD_REQUEST if it is malformed
+    */
+    HTTP_CODE_ parse(ChainBuffer &buffer);
+
+    /**
+     * check whether parse() has seen the whole request
+     * @return whether the request is complete
+    */
+    bool is_finished() const;
+
+    /**
+     * get the number of buffer bytes taken by the request, valid once it is finished
+     * @return size of the request line, the headers and the body
+    */
+    size_t size() const;
+
+    /**
+     * look up a header field of a request parsed from the buffer. the value points into the
+     * buffer, it is valid until the request is dropped from it
+     * @param key name of the header field, case-insensitive
+     * @return value of the header field, empty if the request does not have it
+    */
+    std::string_view header(std::string_view key) const;
+
+    /**
+     * look up a known header field by its slot, without hashing or comparing its name
+     * @param id slot of the header field
+     * @return value of the header field, empty if the request does not have it
+    */
+    std::string_view header(HEADER_ id) const;
+
+    /**
+     * map a header name to its slot with the perfect hash computed at compile time
+     * @param name name of the header field, case-insensitive
+     * @return slot of the field, UNKNOWN_HEADER if the server does not know it
+    */
+    static HEADER_ header_id(std::string_view name);
+
+    /**
+     * get the body kept in the buffer, valid until the request is dropped from it
+     * @return decoded body, empty if there is none or it went to body_fd()
+    */
+    std::string_view body() const;
+
+    /**
+     * get the file of a body too large to be kept in the buffer
+     * @return file descriptor, -1 if the body is in body()
     */
-    bool parse(Buffer &buffer);
+    int body_fd() const;
+
+    /**
+     * get the size of the decoded body, wherever it is kept
+     * @return number of body bytes received so far
+    */
+    size_t body_size() const;
 
     /**
      * get the path
@@ -107,6 +226,12 @@ public:
     */
     std::string &path();
 
+    /**
+     * get the query string, the part of the request target after '?'
+     * @return the query without the '?', empty if the target has none
+    */
+    std::string query() const;
+
     /**
      * get the method
      * @return method
@@ -139,48 +264,172 @@ public:
     */
     bool is_keep_alive() const;
 
-private:
     /**
-     * parse a request line of an HTTP request
-     * @param line a line to be parsed
+     * check whether the request is a GET or HEAD carrying If-None-Match or If-Modified-Since,
+     * so that its answer may be a 304 Not Modified
+     * @return whether is_not_modified() has anything to evaluate
     */
-    bool parse_request_line(const std::string &line);
+    bool is_conditional() const;
 
     /**
-     * parse a request header of a HTTP request
-     * @param line a line to be parsed
+     * evaluate the conditional header fields against the current validators of the file.
+     * If-None-Match is compared weakly, W/"x" matching "x", and when it is present
+     * If-Modified-Since is ignored
+     * @param etag entity tag of the file, quoted, with or without W/
+     * @param last_modified modification time of the file
+     * @return true if the copy the client holds is still current
     */
-    void parse_header(const std::string &line);
+    bool is_not_modified(std::string_view etag, time_t last_modified) const;
 
     /**
-     * parse a request body of a HTTP request
-     * @param line a line to be parsed
+     * get the byte ranges a GET asks for
+     * @return value of the Range header field, empty if there is none or the method is not GET
     */
-    void parse_body(const std::string &line);
+    std::string_view range() const;
 
     /**
-     * parse a request path of a HTTP request
+     * evaluate If-Range against the current validators of the file. an entity tag has to
+     * match strongly, a date exactly
+     * @param etag entity tag of the file, quoted
+     * @param last_modified modification time of the file
+     * @return true if the Range may be served, which it may if there is no If-Range
     */
-    void parse_path();
+    bool is_range_current(std::string_view etag, time_t last_modified) const;
+
     /**
-     * parse a POST HTTP request data when the Content-type is a specific string
+     * check whether the request is a login or register form whose credentials still have to
+     * be verified against MySQL. parse() never queries the database itself, so the blocking
+     * part of the request can be run on another thread
+     * @return whether verify_job() has to be run before the response is built
     */
-    void parse_post();
+    bool needs_verify() const;
 
     /**
-     * parse the body of a POST request that is encoded as a specific type
+     * get the blocking part of the request. the job only holds copies of the form fields, so
+     * it can run on any thread while the connection keeps being owned by its event loop
+     * @return a callable running user_verify() and returning its result
     */
-    void parse_from_urlencoded();
+    std::function<bool()> verify_job() const;
+
+    /**
+     * apply the result of verify_job(), which selects the page the request is answered with
+     * @param is_verified result of verify_job()
+    */
+    void set_verified(bool is_verified);
+
+    /**
+     * queue the verification on an AsyncUserStore instead of running verify_job()
+     * @param store store whose event loop runs the queries
+     * @param callback invoked on the store's loop thread with the result for set_verified()
+     * @return false if the store did not accept the job
+    */
+    bool verify_async(AsyncUserStore &store, AsyncUserStore::Callback callback) const;
+
+    /**
+     * get the route the path of the request matched
+     * @return handler id of the route, Router::NO_ROUTE if none matched
+    */
+    int route() const;
+
+    /**
+     * add a route to the table shared by all requests. routes are not locked, they must be
+     * added before the server starts
+     * @param type how the pattern is compared to request paths
+     * @param pattern path, path prefix or path suffix
+     * @param handler run on every complete request whose path matches
+     * @return handler id of the route, Router::NO_ROUTE if the pattern is empty
+    */
+    static int add_route(Router::MATCH_ type, const std::string &pattern, Handler handler);
+
     /**
      * verify a user's credentials against a MYSQL database. The method can handle both login
      * and registration scenarios
      * @param name name of the user
      * @param pwd password of the user
      * @param is_login whether the user is login or registration
-     * @return 
+     * @return whether the user logged in or registered successfully
     */
     static bool user_verify(const std::string &name, const std::string &pwd, bool is_login);
 
+private:
+    /**
+     * parse a request line of an HTTP request
+     * @param line a line to be parsed, without its CRLF
+     * @return false if it is not "<method> <path> HTTP/<version>"
+    */
+    bool parse_request_line(std::string_view line);
+
+    /**
+     * parse a request header of a HTTP request
+     * @param line a line to be parsed, without its CRLF
+     * @param offset position of the line in the buffer's readable bytes
+     * @return false if the line has no ':'
+    */
+    bool parse_header(std::string_view line, size_t offset);
+
+    /**
+     * finish the headers at the empty line: pick the framing of the body from Content-Length
+     * and Transfer-Encoding
+     * @return false if they are malformed, both given, or the body is too large
+    */
+    bool parse_headers_end();
+
+    /**
+     * take the body bytes at parsed_ that belong to the current chunk, or to the
+     * Content-Length body. they are moved down over the chunk framing in front of them or,
+     * once the body outgrows MAX_INPLACE_BODY_, written to the sink
+     * @param buffer the buffer being parsed
+     * @return false if the sink failed or the body is too large
+    */
+    bool parse_body(ChainBuffer &buffer);
+
+    /**
+     * parse the line announcing the size of the next chunk, "<hex size>[;extensions]"
+     * @param line a line to be parsed, without its CRLF
+     * @return false if the size is malformed or too large
+    */
+    bool parse_chunk_size(std::string_view line);
+
+    /**
+     * erase the consumed chunk framing and spilled body bytes from the buffer, once per call
+     * of parse() instead of once per chunk
+     * @param buffer the buffer being parsed
+    */
+    void compact(ChainBuffer &buffer);
+
+    /**
+     * mark the request as unusable, so the caller answers it and drops everything buffered
+     * @param buffer the buffer being parsed
+     * @return BAD_REQUEST
+    */
+    HTTP_CODE_ bad_request(const ChainBuffer &buffer);
+
+    /**
+     * match the request path against the routes, and rewrite it for the built-in ones
+    */
+    void parse_path();
+
+    /**
+     * get the route table, holding the built-in routes until more are added
+     * @return the table shared by all requests
+    */
+    static Router &routes();
+
+    /**
+     * get the handlers of the added routes
+     * @return the handlers, the one of id USER_ROUTE first
+    */
+    static std::vector<Handler> &handlers();
+    /**
+     * parse a POST HTTP request data when the Content-type is a specific string
+    */
+    void parse_post();
+
+    /**
+     * parse the body of a POST request that is encoded as a specific type
+    */
+    void parse_from_urlencoded();
+
     /**
      * convert hex-number to dec-number
      * @param ch character to be converted
@@ -195,14 +444,86 @@ private:
     PARSE_STATE_ state_;
 
     /**
-     * store the request path, HTTP method (e.g. GET, POST),  request body
+     * store the request path without its query string, the query string, HTTP method (e.g.
+     * GET, POST), and a copy of a urlencoded form body, which parse_from_urlencoded() decodes
+     * in place
     */
-    std::string method_, path_, version_, body_;
+    std::string method_, path_, query_, version_, body_;
 
     /**
-     * a map that stores the HTTP headers and their values
+     * a header value, as an offset into the readable bytes of the buffer being parsed. the
+     * request line comes first, so offset 0 marks a field the request does not have
     */
-    std::unordered_map<std::string, std::string> header_;
+    struct Value {
+        uint32_t offset;
+        uint32_t len;
+    };
+
+    /**
+     * a header field without a slot, with the offset of its name
+    */
+    struct Field {
+        uint32_t key;
+        uint32_t key_len;
+        Value value;
+    };
+
+    /**
+     * the known header fields of the request, indexed by HEADER_. a repeated field keeps the
+     * last value, except a repeated Content-Length or Transfer-Encoding, which fails the
+     * request with 400
+    */
+    Value known_[HEADER_NUM];
+
+    /**
+     * the other header fields of the request in the order they were received
+    */
+    std::vector<Field> fields_;
+
+    /**
+     * the buffer the fields point into
+    */
+    const ChainBuffer *buffer_;
+
+    /**
+     * number of bytes of the buffer the state machine is done with
+    */
+    size_t parsed_;
+
+    /**
+     * length of the body announced by Content-Length
+    */
+    size_t content_length_;
+
+    /**
+     * whether the body is framed by chunked Transfer-Encoding
+    */
+    bool is_chunked_;
+
+    /**
+     * bytes left in the current chunk, or in the Content-Length body
+    */
+    size_t body_left_;
+
+    /**
+     * the decoded body kept in the buffer is [body_offset_, body_end_), body_end_ is where
+     * the next body byte is moved to. the chunk framing consumed since lies between
+     * body_end_ and parsed_
+    */
+    size_t body_offset_;
+    size_t body_end_;
+
+    /**
+     * number of decoded body bytes, in the buffer or in sink_
+    */
+    size_t body_size_;
+
+    /**
+     * the file of a body that outgrew MAX_INPLACE_BODY_
+    */
+    BodySink sink_;
+
+    bool is_keep_alive_;
 
     /**
      * a map that stores the parsed POST data from the request body
@@ -210,17 +531,23 @@ private:
     std::unordered_map<std::string, std::string> post_;
 
     /**
-     * store a map that associates specific HTML file paths with integer tags which are common
-     * endpoints that the server expects to handle, such as "/idnex", "/register", "/login",
-     * "/welcome", "/video" and "/picture". this set is used to check and append the ".html"
-     * extension if the requested path matches one of these default paths
+     * whether the request is a login/register form waiting for verify_job(), and which of both
+    */
+    bool needs_verify_;
+    bool is_login_;
+
+    /**
+     * the route the path matched when the request line was parsed, Router::NO_ROUTE if none
     */
-    static const std::unordered_set<std::string> DEFAULT_HTML_;
+    int route_;
 
     /**
-     * store a map that associates specific HTML file paths with integer tags
+     * max size of the request line and the headers (and of a chunk size line or trailer),
+     * of a body kept in the read buffer, and of a body at all
     */
-    static const std::unordered_map<std::string, int> DEFAULT_HEML_TAG_;
+    static const size_t MAX_HEAD_SIZE_ = 64 * 1024;
+    static const size_t MAX_INPLACE_BODY_ = 64 * 1024;
+    static const size_t MAX_BODY_SIZE_ = 64 * 1024 * 1024;
 };
 
 #endif
\ No newline at end of file
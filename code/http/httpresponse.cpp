@@ -1,12 +1,162 @@
 #include "httpresponse.h"
+#include "compressor.h"
+#include "fileindex.h"
+#include "httpdate.h"
+#include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
 #include <fcntl.h>
+#include <random>
 #include <string>
-#include <sys/mman.h>
+#include <utility>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <unordered_map>
 
-const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE_ = {
+size_t HttpResponse::sendfile_threshold = SIZE_MAX;
+
+namespace {
+
+/**
+ * the precompressed siblings of a file, in the order of preference
+*/
+const struct {
+    HttpResponse::ENCODING_ encoding;
+    const char *suffix;
+    const char *name;
+} SIBLINGS[] = {
+    { HttpResponse::BROTLI, ".br", "br" },
+    { HttpResponse::GZIP,   ".gz", "gzip" },
+};
+
+bool equals_ignore_case(std::string_view a, std::string_view b) {
+    return a.size() == b.size() &&
+           std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+               return tolower((unsigned char) x) == tolower((unsigned char) y);
+           });
+}
+
+/**
+ * images and archives are compressed already, only text is worth compressing
+*/
+bool is_text(std::string_view type) {
+    return type.compare(0, 5, "text/") == 0 || type.find("xml") != std::string::npos;
+}
+
+std::string_view trim(std::string_view str) {
+    while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+        str.remove_prefix(1);
+    }
+    while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+        str.remove_suffix(1);
+    }
+    return str;
+}
+
+/**
+ * parse a decimal number of a byte range. a number too large for the type saturates, it
+ * lies past the end of any file anyway
+ * @return false if str is empty or not a number
+*/
+bool parse_offset(std::string_view str, uint64_t *value) {
+    if (str.empty()) {
+        return false;
+    }
+    *value = 0;
+    for (char ch : str) {
+        if (ch < '0' || ch > '9') {
+            return false;
+        }
+        *value = *value > (UINT64_MAX - 9) / 10 ? UINT64_MAX : *value * 10 + (ch - '0');
+    }
+    return true;
+}
+
+/**
+ * parse a Range header field, "bytes=0-499, 1000-, -500", against a file of size bytes
+ * @param ranges set to the satisfiable ranges as offset and length, in the order asked for
+ * @return false if the field is malformed or asks for more than max ranges, the whole file
+ *         is sent then as if there were no Range
+*/
+bool parse_ranges(std::string_view header, size_t size, size_t max,
+                  std::vector<std::pair<size_t, size_t>> *ranges) {
+    const std::string_view UNIT = "bytes=";
+    if (header.size() < UNIT.size() || !equals_ignore_case(header.substr(0, UNIT.size()), UNIT)) {
+        return false;
+    }
+    header.remove_prefix(UNIT.size());
+    size_t count = 0;
+    while (!header.empty()) {
+        size_t comma = header.find(',');
+        std::string_view spec = trim(header.substr(0, comma));
+        header = comma == std::string_view::npos ? "" : header.substr(comma + 1);
+        if (spec.empty()) {
+            continue;
+        }
+        size_t dash = spec.find('-');
+        if (++count > max || dash == std::string_view::npos) {
+            return false;
+        }
+        uint64_t first = 0;
+        uint64_t last = 0;
+        bool has_first = parse_offset(spec.substr(0, dash), &first);
+        bool has_last = parse_offset(spec.substr(dash + 1), &last);
+        if (dash == 0) {
+            // the last bytes of the file
+            if (!has_last) {
+                return false;
+            }
+            if (last > 0 && size > 0) {
+                last = std::min<uint64_t>(last, size);
+                ranges->emplace_back(size - last, last);
+            }
+            continue;
+        }
+        if (!has_first || (dash + 1 < spec.size() && !has_last) || (has_last && last < first)) {
+            return false;
+        }
+        if (first < size) {
+            last = has_last ? std::min<uint64_t>(last, size - 1) : size - 1;
+            ranges->emplace_back(first, last - first + 1);
+        }
+    }
+    return count > 0;
+}
+
+/**
+ * sort ranges by offset and merge the ones that overlap or touch, so "bytes=0-,0-,0-" does
+ * not send the file three times
+ * @param ranges offsets and lengths, replaced by the merged ranges
+*/
+void merge_ranges(std::vector<std::pair<size_t, size_t>> *ranges) {
+    if (ranges->size() < 2) {
+        return;
+    }
+    std::sort(ranges->begin(), ranges->end());
+    size_t last = 0;
+    for (size_t i = 1; i < ranges->size(); i++) {
+        std::pair<size_t, size_t> &merged = (*ranges)[last];
+        const std::pair<size_t, size_t> &range = (*ranges)[i];
+        if (range.first <= merged.first + merged.second) {
+            merged.second = std::max(merged.second, range.first + range.second - merged.first);
+        } else {
+            (*ranges)[++last] = range;
+        }
+    }
+    ranges->resize(last + 1);
+}
+
+/**
+ * maps file extensions to their corresponding MIME types(e.g. html -> text/html)
+*/
+constexpr struct {
+    std::string_view suffix;
+    std::string_view type;
+} SUFFIX_TYPE[] = {
     { ".html",  "text/html" },
     { ".xml",   "text/xml" },
     { ".xhtml", "application/xhtml+xml" },
@@ -24,29 +174,100 @@ const std::unordered_map<std::string, std::string> HttpResponse::SUFFIX_TYPE_ =
     { ".avi",   "video/x-msvideo" },
     { ".gz",    "application/x-gzip" },
     { ".tar",   "application/x-tar" },
-    { ".css",   "text/css "},
-    { ".js",    "text/javascript "},
+    { ".css",   "text/css" },
+    { ".js",    "text/javascript" },
 };
 
-const std::unordered_map<int, std::string> HttpResponse::CODE_STATUS_ = {
-    { 200, "OK" },
-    { 400, "Bad Request" },
-    { 403, "Forbidden" },
-    { 404, "Not Found" },
+#define FILE_NOT_FOUND "File NotFound!"
+
+/**
+ * the error page of a status, for when the page of its own is missing
+*/
+#define ERROR_BODY(code, reason) \
+    "<html><title>Error</title><body bgcolor=\"ffffff\">" code " : " reason "\n" \
+    "<p>" FILE_NOT_FOUND "</p><hr><em>TinyWebServer</em></body></html>"
+
+#define STATUS(code, reason) \
+    { code, reason, "HTTP/1.1 " #code " " reason "\r\n", ERROR_BODY(#code, reason) }
+
+/**
+ * maps HTTP status codes to their status messages (e.g. 200 -> OK), the whole status line
+ * and the error page
+*/
+constexpr struct Status {
+    int code;
+    std::string_view reason;
+    std::string_view line;
+    std::string_view error_body;
+} CODE_STATUS[] = {
+    STATUS(200, "OK"),
+    STATUS(206, "Partial Content"),
+    STATUS(304, "Not Modified"),
+    STATUS(400, "Bad Request"),
+    STATUS(403, "Forbidden"),
+    STATUS(404, "Not Found"),
+    STATUS(416, "Range Not Satisfiable"),
+    STATUS(503, "Service Unavailable"),
 };
 
+#undef STATUS
+#undef ERROR_BODY
+
+const Status *find_status(int code) {
+    for (const Status &status : CODE_STATUS) {
+        if (status.code == code) {
+            return &status;
+        }
+    }
+    return nullptr;
+}
+
+void append(ChainBuffer &buffer, std::string_view str) {
+    buffer.Append(str.data(), str.size());
+}
+
+void append_number(ChainBuffer &buffer, uint64_t value) {
+    char digits[20];
+    std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), value);
+    buffer.Append(digits, result.ptr - digits);
+}
+
+}  // namespace
+
 const std::unordered_map<int, std::string> HttpResponse::CODE_PATH_ = {
     { 400, "/400.html" },
     { 403, "/403.html" },
     { 404, "/404.html" },
 };
 
+/**
+ * pages are revalidated on every use, which costs a 304 once they are cached. the other files
+ * are used for a while without asking, images longer as they change less often
+*/
+std::vector<std::pair<std::string, int>> HttpResponse::suffix_max_age_ = {
+    { ".html", 0 },
+    { ".xml",  0 },
+    { ".css",  3600 },
+    { ".js",   3600 },
+    { ".png",  86400 },
+    { ".gif",  86400 },
+    { ".jpg",  86400 },
+    { ".jpeg", 86400 },
+};
+
 HttpResponse::HttpResponse() {
     code_ = -1;
     is_keep_alive_ = false;
     path_ = "";
     src_dir_ = "";
-    mm_file_ = nullptr;
+    file_fd_ = -1;
+    type_ = {};
+    encodings_ = IDENTITY;
+    encoding_ = nullptr;
+    encoded_type_ = {};
+    is_vary_ = false;
+    is_gzipped_ = false;
+    max_age_ = -1;
     mm_file_stat_ = {0};
 }
 
@@ -54,126 +275,537 @@ HttpResponse::~HttpResponse() {
     unmap_file();
 }
 
-void HttpResponse::init(const std::string &src_dir, std::string &path, bool is_keep_alive, int code) {
+void HttpResponse::init(const std::string &src_dir, std::string &path, bool is_keep_alive,
+                        int code, int encodings, Validator is_not_modified,
+                        std::string_view range, Validator is_range_current) {
     assert(src_dir != "");
-    if (mm_file_ != nullptr) {
-        unmap_file();
-    }
+    unmap_file();
+    cached_.reset();
+    type_ = {};
+    encodings_ = encodings;
+    encoding_ = nullptr;
+    encoded_type_ = {};
+    is_vary_ = false;
+    is_gzipped_ = false;
+    max_age_ = -1;
+    is_not_modified_ = std::move(is_not_modified);
+    range_.assign(range.data(), range.size());
+    is_range_current_ = std::move(is_range_current);
+    parts_.clear();
+    boundary_.clear();
     code_= code;
     path_ = path;
     is_keep_alive_ = is_keep_alive;
     src_dir_ = src_dir;
-    mm_file_ = nullptr;
     mm_file_stat_ = {0};
 }
 
-void HttpResponse::add_state_line(Buffer &buffer) {
-    std::string status;
-    if (CODE_STATUS_.count(code_) == 1) {
-        status = CODE_STATUS_.find(code_)->second;
-    } else {
+void HttpResponse::add_state_line(ChainBuffer &buffer) {
+    const Status *status = find_status(code_);
+    if (status == nullptr) {
         code_ = 400;
-        status = CODE_STATUS_.find(400)->second;
+        status = find_status(400);
     }
-    buffer.Append("HTTP/1.1 " + std::to_string(code_) + " " + status + "\r\n");
+    append(buffer, status->line);
+    append(buffer, "Date: ");
+    append(buffer, HttpDate::now());
+    append(buffer, "\r\n");
 }
 
-void HttpResponse::add_header(Buffer &buffer) {
-    buffer.Append("Connection: ");
-    if (is_keep_alive_) {
-        buffer.Append("keep-alive\r\n");
-        buffer.Append("keep-alive: max=6, timeout=120\r\n");
+void HttpResponse::add_header(ChainBuffer &buffer, bool is_keep_alive) {
+    if (is_keep_alive) {
+        append(buffer, "Connection: keep-alive\r\nkeep-alive: max=6, timeout=120\r\n");
     } else {
-        buffer.Append("close\r\n");
+        append(buffer, "Connection: close\r\n");
+    }
+    if (code_ == 206 && parts_.size() == 1) {
+        append(buffer, "Content-Range: bytes ");
+        append_number(buffer, parts_[0].offset);
+        append(buffer, "-");
+        append_number(buffer, parts_[0].offset + parts_[0].len - 1);
+        append(buffer, "/");
+        append_number(buffer, mm_file_stat_.st_size);
+        append(buffer, "\r\n");
+    } else if (code_ == 416) {
+        append(buffer, "Content-Range: bytes */");
+        append_number(buffer, mm_file_stat_.st_size);
+        append(buffer, "\r\n");
+    }
+    if (!boundary_.empty()) {
+        append(buffer, "Content-type: multipart/byteranges; boundary=");
+        append(buffer, boundary_);
+        append(buffer, "\r\n");
+    } else if (code_ != 304 && code_ != 416) {
+        // a 304 and a 416 have no body to describe
+        append(buffer, "Content-type: ");
+        append(buffer, get_file_type());
+        append(buffer, "\r\n");
+    }
+    if (encoding_ != nullptr && code_ != 304 && code_ != 416) {
+        append(buffer, "Content-Encoding: ");
+        append(buffer, encoding_);
+        append(buffer, "\r\n");
+    }
+    if (code_ == 200 || code_ == 206 || code_ == 304) {
+        add_validators(buffer);
+    }
+    if (is_vary_) {
+        append(buffer, "Vary: Accept-Encoding\r\n");
+    }
+}
+
+void HttpResponse::add_validators(ChainBuffer &buffer) {
+    char tag[ETAG_LEN_];
+    char date[HttpDate::LEN];
+    HttpDate::format(mm_file_stat_.st_mtim.tv_sec, date);
+    append(buffer, "ETag: ");
+    append(buffer, etag(tag));
+    append(buffer, "\r\nLast-Modified: ");
+    buffer.Append(date, sizeof(date));
+    append(buffer, "\r\n");
+    if (max_age_ == 0) {
+        append(buffer, "Cache-Control: no-cache\r\n");
+    } else if (max_age_ > 0) {
+        append(buffer, "Cache-Control: max-age=");
+        append_number(buffer, max_age_);
+        append(buffer, "\r\n");
+    }
+}
+
+bool HttpResponse::add_not_modified(ChainBuffer &buffer) {
+    char tag[ETAG_LEN_];
+    if (!is_not_modified_ || !is_not_modified_(etag(tag), mm_file_stat_.st_mtim.tv_sec)) {
+        return false;
+    }
+    code_ = 304;
+    cached_.reset();
+    add_state_line(buffer);
+    add_header(buffer, is_keep_alive_);
+    append(buffer, "\r\n");
+    return true;
+}
+
+std::string_view HttpResponse::etag(char *tag) const {
+    uint64_t mtime = static_cast<uint64_t>(mm_file_stat_.st_mtim.tv_sec) * 1000000000 +
+                     mm_file_stat_.st_mtim.tv_nsec;
+    int len = snprintf(tag, ETAG_LEN_, "%s\"%llx-%llx-%llx%s\"", is_gzipped_ ? "W/" : "",
+                       (unsigned long long) mm_file_stat_.st_ino,
+                       (unsigned long long) mm_file_stat_.st_size, (unsigned long long) mtime,
+                       is_gzipped_ ? "-gzip" : "");
+    return std::string_view(tag, len);
+}
+
+bool HttpResponse::add_content(ChainBuffer &buffer) {
+    if (code_ == 416) {
+        append(buffer, "Content-length: 0\r\n\r\n");
+        return false;
+    }
+    std::string path = src_dir_ + path_;
+    if (mm_file_stat_.st_size > 0 &&
+        static_cast<size_t>(mm_file_stat_.st_size) < sendfile_threshold) {
+        // the mapping made for an earlier response of the same version of the file
+        mapping_ = MmapTable::instance()->get(path, mm_file_stat_);
+    }
+    if (mapping_ == nullptr) {
+        int src_fd = open(path.data(), O_RDONLY | O_CLOEXEC);
+        if (src_fd < 0) {
+            error_content(buffer, FILE_NOT_FOUND);
+            return false;
+        }
+        LOG_DEBUG("file path %s", path.data());
+        if (!type_.empty() && parts_.empty()) {
+            /**
+             * the size came from the index, which may lag behind a write by a moment. mapping
+             * past the end of a file that just shrank would fault on access
+            */
+            fstat(src_fd, &mm_file_stat_);
+        }
+
+        if (mm_file_stat_.st_size == 0) {
+            // nothing to map, mmap() refuses a length of 0
+            close(src_fd);
+        } else if (static_cast<size_t>(mm_file_stat_.st_size) >= sendfile_threshold) {
+            /**
+             * the kernel copies the file straight from the page cache to the socket, without
+             * mapping it into the process and tearing the mapping down again
+            */
+            file_fd_ = src_fd;
+        } else {
+            /**
+             * mapping file to memory to speed up file access
+            */
+            mapping_ = MmapTable::instance()->map(path, src_fd, mm_file_stat_);
+            close(src_fd);
+            if (mapping_ == nullptr) {
+                error_content(buffer, FILE_NOT_FOUND);
+                return false;
+            }
+        }
+    }
+    size_t len = mm_file_stat_.st_size;
+    if (!parts_.empty()) {
+        len = 0;
+        for (const Part &part : parts_) {
+            len += part.head.size() + part.len;
+        }
+    }
+    append(buffer, "Content-length: ");
+    append_number(buffer, len);
+    append(buffer, "\r\n\r\n");
+    return true;
+}
+
+void HttpResponse::cache_file(const std::string &key, uint64_t generation) {
+    std::string head[2];
+    ChainBuffer buffer;
+    for (int is_keep_alive = 0; is_keep_alive < 2; is_keep_alive++) {
+        add_header(buffer, is_keep_alive);
+        append(buffer, "Content-length: ");
+        append_number(buffer, mm_file_stat_.st_size);
+        append(buffer, "\r\n\r\n");
+        head[is_keep_alive] = buffer.RetrieveAllToString();
+    }
+    std::string body;
+    if (mapping_ != nullptr) {
+        body.assign(mapping_->data, mapping_->len);
+    }
+    FileCache::instance()->put(key, mm_file_stat_, std::move(body), std::move(head[0]),
+                               std::move(head[1]), generation);
+}
+
+void HttpResponse::error_html() {
+    if (CODE_PATH_.count(code_) == 1) {
+        path_ = CODE_PATH_.find(code_)->second;
+        encoding_ = nullptr;
+        encoded_type_ = {};
+        is_vary_ = false;
+        stat_file();
     }
-    buffer.Append("Content-type: " + get_file_type() + "\r\n");
 }
 
-void HttpResponse::add_content(Buffer &buffer) {
-    int src_fd = open((src_dir_ + path_).data(), O_RDONLY);
-    if (src_fd < 0) {
-        error_content(buffer, "File NotFound!");
+bool HttpResponse::stat_file() {
+    FileIndex::Meta meta;
+    type_ = {};
+    switch (FileIndex::instance()->lookup(src_dir_, path_, &meta)) {
+        case FileIndex::FOUND:
+            mm_file_stat_ = {0};
+            mm_file_stat_.st_size = meta.size;
+            mm_file_stat_.st_mtim = meta.mtime;
+            mm_file_stat_.st_mode = meta.mode;
+            mm_file_stat_.st_ino = meta.ino;
+            type_ = meta.type;
+            return true;
+        case FileIndex::MISSING:
+            return false;
+        default:
+            return stat((src_dir_ + path_).data(), &mm_file_stat_) == 0;
+    }
+}
+
+bool HttpResponse::is_servable(const std::string &path) const {
+    FileIndex::Meta meta;
+    struct stat st;
+    switch (FileIndex::instance()->lookup(src_dir_, path, &meta)) {
+        case FileIndex::FOUND:
+            st.st_mode = meta.mode;
+            break;
+        case FileIndex::MISSING:
+            return false;
+        default:
+            if (stat((src_dir_ + path).data(), &st) < 0) {
+                return false;
+            }
+    }
+    return S_ISREG(st.st_mode) && (st.st_mode & S_IROTH);
+}
+
+void HttpResponse::negotiate() {
+    std::string_view type = file_type(path_);
+    if (!is_text(type) || !is_servable(path_)) {
         return;
     }
+    for (const auto &sibling : SIBLINGS) {
+        std::string path = path_ + sibling.suffix;
+        if (!is_servable(path)) {
+            continue;
+        }
+        is_vary_ = true;
+        if (encodings_ & sibling.encoding) {
+            encoding_ = sibling.name;
+            encoded_type_ = type;
+            path_ = std::move(path);
+            return;
+        }
+    }
+}
 
+bool HttpResponse::gzip_cached() {
+    std::string_view type = file_type(path_);
+    if (encoding_ != nullptr || !is_text(type) || !stat_file() ||
+        !S_ISREG(mm_file_stat_.st_mode) || !(mm_file_stat_.st_mode & S_IROTH) ||
+        !Compressor::instance()->accepts(mm_file_stat_.st_size)) {
+        return false;
+    }
+    // the file is sent compressed to some clients, plain to the others
+    is_vary_ = true;
+    if (!(encodings_ & GZIP) || !range_.empty()) {
+        // ranges are cut from the file as it is, not from a body compressed on the fly
+        return false;
+    }
+    std::string path = src_dir_ + path_;
+    cached_ = Compressor::instance()->get(path, mm_file_stat_);
+    if (cached_) {
+        is_gzipped_ = true;
+        return true;
+    }
+
+    // compress the file for the next request, this one gets it as it is
+    code_ = 200;
+    encoding_ = "gzip";
+    encoded_type_ = type;
+    is_gzipped_ = true;
+    std::string head[2];
+    ChainBuffer buffer;
+    for (int is_keep_alive = 0; is_keep_alive < 2; is_keep_alive++) {
+        add_header(buffer, is_keep_alive);
+        head[is_keep_alive] = buffer.RetrieveAllToString();
+    }
+    encoding_ = nullptr;
+    encoded_type_ = {};
+    is_gzipped_ = false;
+    Compressor::instance()->compress(path, mm_file_stat_, std::move(head[0]),
+                                     std::move(head[1]));
+    return false;
+}
+
+void HttpResponse::select_ranges() {
+    char tag[ETAG_LEN_];
+    if (range_.empty() ||
+        (is_range_current_ && !is_range_current_(etag(tag), mm_file_stat_.st_mtim.tv_sec))) {
+        return;
+    }
     /**
-     * mapping file to memory to speed up file access
+     * the ranges must lie within the file that is mapped or sent, so its size is taken from
+     * the file rather than from the index, which may lag behind a write
     */
-    LOG_DEBUG("file path %s", (src_dir_ + path_).data());
-    int *mm_ret = (int *) mmap(0, mm_file_stat_.st_size, PROT_READ, MAP_PRIVATE, src_fd, 0);
-    if (*mm_ret == -1) {
-        error_content(buffer, "File NotFound!");
+    if (!type_.empty() && stat((src_dir_ + path_).data(), &mm_file_stat_) < 0) {
+        return;
+    }
+    std::vector<std::pair<size_t, size_t>> ranges;
+    size_t size = mm_file_stat_.st_size;
+    if (!parse_ranges(range_, size, MAX_RANGES_, &ranges)) {
+        return;
+    }
+    if (ranges.empty()) {
+        code_ = 416;
+        return;
+    }
+    merge_ranges(&ranges);
+    code_ = 206;
+    if (ranges.size() == 1) {
+        parts_.push_back({ranges[0].first, ranges[0].second, ""});
         return;
     }
-    mm_file_ = (char *) mm_ret;
-    close(src_fd);
-    buffer.Append("Content-length: " + std::to_string(mm_file_stat_.st_size) + "\r\n\r\n");
+
+    static thread_local std::mt19937_64 engine(std::random_device{}());
+    char boundary[17];
+    snprintf(boundary, sizeof(boundary), "%016llx", (unsigned long long) engine());
+    boundary_ = boundary;
+    std::string_view type = get_file_type();
+    for (const auto &range : ranges) {
+        std::string head = parts_.empty() ? "--" : "\r\n--";
+        head += boundary_ + "\r\nContent-type: ";
+        head += type;
+        head += "\r\n";
+        head += "Content-Range: bytes " + std::to_string(range.first) + "-" +
+                std::to_string(range.first + range.second - 1) + "/" + std::to_string(size) +
+                "\r\n\r\n";
+        parts_.push_back({range.first, range.second, std::move(head)});
+    }
+    parts_.push_back({0, 0, "\r\n--" + boundary_ + "--\r\n"});
 }
 
-void HttpResponse::error_html() {
-    if (CODE_PATH_.count(code_) == 1) {
-        path_ = CODE_PATH_.find(code_)->second;
-        stat((src_dir_ + path_).data(), &mm_file_stat_);
+int HttpResponse::accepted_encodings(std::string_view header) {
+    int encodings = IDENTITY;
+    while (!header.empty()) {
+        size_t comma = header.find(',');
+        std::string_view item = header.substr(0, comma);
+        header = comma == std::string_view::npos ? "" : header.substr(comma + 1);
+
+        size_t semicolon = item.find(';');
+        std::string_view name = trim(item.substr(0, semicolon));
+        if (semicolon != std::string_view::npos) {
+            // "q=0", "q=0.0" and so on refuse the coding
+            std::string_view param = trim(item.substr(semicolon + 1));
+            if (param.size() > 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=' &&
+                param.find_first_not_of("0.", 2) == std::string_view::npos) {
+                continue;
+            }
+        }
+        if (equals_ignore_case(name, "br")) {
+            encodings |= BROTLI;
+        } else if (equals_ignore_case(name, "gzip") || equals_ignore_case(name, "x-gzip")) {
+            encodings |= GZIP;
+        } else if (name == "*") {
+            encodings |= BROTLI | GZIP;
+        }
+    }
+    return encodings;
+}
+
+void HttpResponse::set_max_age(const std::string &suffix, int max_age) {
+    for (auto &policy : suffix_max_age_) {
+        if (policy.first == suffix) {
+            policy.second = max_age;
+            return;
+        }
     }
+    suffix_max_age_.emplace_back(suffix, max_age);
 }
 
-std::string HttpResponse::get_file_type() {
-    std::string::size_type index = path_.find_last_of('.');
-    if (index == std::string::npos) {
-        return "text/plain";
+std::string_view HttpResponse::get_file_type() const {
+    if (!encoded_type_.empty()) {
+        return encoded_type_;
     }
-    std::string suffix = path_.substr(index);
-    if (SUFFIX_TYPE_.count(suffix) == 1) {
-        return SUFFIX_TYPE_.find(suffix)->second;
+    return !type_.empty() ? type_ : file_type(path_);
+}
+
+std::string_view HttpResponse::file_type(std::string_view path) {
+    std::string_view::size_type index = path.find_last_of('.');
+    if (index != std::string_view::npos) {
+        std::string_view suffix = path.substr(index);
+        for (const auto &entry : SUFFIX_TYPE) {
+            if (entry.suffix == suffix) {
+                return entry.type;
+            }
+        }
     }
     return "text/plain";
 }
 
-void HttpResponse::make_response(Buffer &buffer) {
-    if (stat((src_dir_ + path_).data(), &mm_file_stat_) < 0 ||
-        S_ISDIR(mm_file_stat_.st_mode)) {
+void HttpResponse::make_response(ChainBuffer &buffer) {
+    if (code_ == -1 || code_ == 200) {
+        std::string::size_type index = path_.find_last_of('.');
+        std::string_view suffix = index == std::string::npos ?
+            std::string_view() : std::string_view(path_).substr(index);
+        for (const auto &policy : suffix_max_age_) {
+            if (policy.first == suffix) {
+                max_age_ = policy.second;
+                break;
+            }
+        }
+        negotiate();
+        if (gzip_cached()) {
+            code_ = 200;
+            if (!add_not_modified(buffer)) {
+                add_state_line(buffer);
+                buffer.Append(cached_->header(is_keep_alive_));
+            }
+            return;
+        }
+    }
+    std::string path = src_dir_ + path_;
+    // a negotiated sibling has other headers than the same file requested as it is
+    std::string key = FileCache::key(path, encoding_);
+    if ((code_ == -1 || code_ == 200) && range_.empty()) {
+        // the index drops the entries of the files it watches, the others are stat()ed
+        FileIndex::Meta meta;
+        bool is_watched = FileIndex::instance()->lookup(src_dir_, path_, &meta) == FileIndex::FOUND;
+        cached_ = FileCache::instance()->get(key, is_watched);
+        if (cached_) {
+            code_ = 200;
+            // the tag is in the cached headers, the file is only looked up to compare it
+            if (!is_not_modified_ || !stat_file() || !add_not_modified(buffer)) {
+                add_state_line(buffer);
+                buffer.Append(cached_->header(is_keep_alive_));
+            }
+            return;
+        }
+    }
+
+    // taken before the file is looked at, a change while it is read keeps it out of the cache
+    uint64_t generation = FileCache::instance()->generation(key);
+    if (!stat_file() || S_ISDIR(mm_file_stat_.st_mode)) {
         code_ = 404;
     } else if (!(mm_file_stat_.st_mode & S_IROTH)) {
         code_ = 403;
     } else if (code_ == -1) {
         code_ = 200;
     }
+    if (code_ == 200 && add_not_modified(buffer)) {
+        return;
+    }
+    if (code_ == 200) {
+        select_ranges();
+    }
     error_html();
     add_state_line(buffer);
-    add_header(buffer);
-    add_content(buffer);
+    add_header(buffer, is_keep_alive_);
+    if (add_content(buffer) && code_ == 200 && file_fd_ < 0 &&
+        FileCache::instance()->accepts(mm_file_stat_.st_size)) {
+        cache_file(key, generation);
+    }
 }
 
 void HttpResponse::unmap_file() {
-    if (mm_file_ != nullptr) {
-        munmap(mm_file_, mm_file_stat_.st_size);
-        mm_file_ = nullptr;
+    mapping_.reset();
+    if (file_fd_ >= 0) {
+        close(file_fd_);
+        file_fd_ = -1;
     }
 }
 
-char * HttpResponse::file() {
-    return mm_file_;
+const char *HttpResponse::file() const {
+    return mapping_ != nullptr ? mapping_->data : nullptr;
+}
+
+std::shared_ptr<const MmapTable::Mapping> HttpResponse::mapping() const {
+    return mapping_;
+}
+
+int HttpResponse::file_fd() const {
+    return file_fd_;
+}
+
+std::shared_ptr<const FileCache::Entry> HttpResponse::cached() const {
+    return cached_;
+}
+
+const std::vector<HttpResponse::Part> &HttpResponse::parts() const {
+    return parts_;
 }
 
 size_t HttpResponse::file_len() const {
     return mm_file_stat_.st_size;
 }
 
-void HttpResponse::error_content(Buffer &buffer, std::string message) {
+void HttpResponse::release_file() {
+    mapping_.reset();
+    file_fd_ = -1;
+}
+
+void HttpResponse::error_content(ChainBuffer &buffer, std::string_view message) {
+    const Status *status = find_status(code_);
+    if (status != nullptr && message == FILE_NOT_FOUND) {
+        append(buffer, "Content-length: ");
+        append_number(buffer, status->error_body.size());
+        append(buffer, "\r\n\r\n");
+        append(buffer, status->error_body);
+        return;
+    }
+
     std::string body;
-    std::string status;
     body += "<html><title>Error</title>";
     body += "<body bgcolor=\"ffffff\">";
-    if (CODE_STATUS_.count(code_) == 1) {
-        status = CODE_STATUS_.find(code_)->second;
-    } else {
-        status = "Bad Request";
-    }
-    body += std::to_string(code_) + " : " + status + "\n";
-    body += "<p>" + message + "</p>";
-    body += "<hr><em>TinyWebServer</em></body></html>";
+    body += std::to_string(code_) + " : ";
+    body += status != nullptr ? status->reason : "Bad Request";
+    body += "\n<p>";
+    body += message;
+    body += "</p><hr><em>TinyWebServer</em></body></html>";
 
-    buffer.Append("Content-length: " + std::to_string(body.size()) + "\r\n\r\n");
+    append(buffer, "Content-length: ");
+    append_number(buffer, body.size());
+    append(buffer, "\r\n\r\n");
     buffer.Append(body);
 }
 
@@ -41,27 +41,61 @@
  *       | Connection: keep-alive        |                   |
  *       +-------------------------------+-------------------+
  *
- *    5. What does mm_file_ and mm_file_stat_ used for?
+ *    5. What does mapping_ and mm_file_stat_ used for?
  *        in this project, data are stored in two spaces: Database and server-memory. The requested
- *        data will be mapped into memory (marked as mm_file_), and its metadata is stored in
- *        mm_file_stat_. This allows efficient file cintent access without loading the entire file
- *        into memory.
+ *        data will be mapped into memory (borrowed from the MmapTable as mapping_), and its
+ *        metadata is stored in mm_file_stat_. This allows efficient file cintent access without
+ *        loading the entire file into memory.
 */
 
 
 #ifndef HTTP_RESPONSE_H_
 #define HTTP_RESPONSE_H_
 
+#include <ctime>
+#include <functional>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <fcntl.h>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 #include <sys/mman.h>
 
-#include "../buffer/buffer.h"
+#include "filecache.h"
+#include "mmaptable.h"
+#include "../buffer/chainbuffer.h"
 #include "../log/log.h"
 
 class HttpResponse {
 public:
+    /**
+     * content codings of the precompressed siblings of a file, foo.js.br and foo.js.gz
+    */
+    enum ENCODING_ {
+        IDENTITY = 0,
+        GZIP = 1,
+        BROTLI = 2,
+    };
+
+    /**
+     * evaluates the conditional header fields of the request against the entity tag and
+     * modification time of the file, returning true if a 304 Not Modified is the answer
+    */
+    typedef std::function<bool(std::string_view etag, time_t last_modified)> Validator;
+
+    /**
+     * a part of a 206 response: its headers, then len bytes of the file from offset on. a
+     * single range has no headers of its own, the parts of a multipart/byteranges body are
+     * followed by one without bytes that holds the closing boundary
+    */
+    struct Part {
+        size_t offset;
+        size_t len;
+        std::string head;
+    };
+
     HttpResponse();
     ~HttpResponse();
     /**
@@ -70,25 +104,65 @@ public:
      * @param path path to store resource
      * @param is_keep_alive shall we keep the connction alive for further requests
      * @param code HTTP reaponse code
+     * @param encodings the ENCODING_s the client accepts, see accepted_encodings()
+     * @param is_not_modified set for a conditional request, nullptr otherwise
+     * @param range value of the Range header field of a GET, empty if there is none
+     * @param is_range_current evaluates If-Range, nullptr if the request has none
     */
-    void init(const std::string &src_dir, std::string &path, bool is_keep_alive = false, int code = -1);
+    void init(const std::string &src_dir, std::string &path, bool is_keep_alive = false,
+              int code = -1, int encodings = IDENTITY, Validator is_not_modified = nullptr,
+              std::string_view range = {}, Validator is_range_current = nullptr);
 
     /**
-     * create a HTTP response based on the requested resource and its status
+     * create a HTTP response based on the requested resource and its status. a text file with
+     * a precompressed sibling the client accepts is answered with the sibling, brotli before
+     * gzip, and one without is gzipped by the Compressor if that is enabled. a file in
+     * FileCache::instance() is answered from there, a small file that is not is added to it.
+     * a file the client holds a current copy of is answered with a 304 and no body, decided
+     * from the index or the cache without opening the file. a Range is answered with a 206
+     * whose parts() are cut from the mapped or open file, the caches are not used for it
      * @param buffer store the HTTP response
     */
-    void make_response(Buffer &buffer);
+    void make_response(ChainBuffer &buffer);
 
     /**
-     * unmap file
+     * give the mapping of the file back, or close the file if it is sent with sendfile()
     */
     void unmap_file();
 
     /**
      * get the mm file
-     * @return mm file
+     * @return mm file, nullptr if the file is not mapped
+    */
+    const char *file() const;
+
+    /**
+     * get the mapping of the file, shared through MmapTable::instance() with the other
+     * responses of the same file
+     * @return the mapping, nullptr if the file is not mapped
+    */
+    std::shared_ptr<const MmapTable::Mapping> mapping() const;
+
+    /**
+     * get the open file of a response whose body is sent with sendfile() instead of being
+     * mapped, see sendfile_threshold
+     * @return file descriptor, -1 if the file is mapped or there is none
     */
-    char *file();
+    int file_fd() const;
+
+    /**
+     * get the cache entry a response was answered from. its body takes the place of the file,
+     * the caller keeps the entry until the body is sent
+     * @return the entry, nullptr if the response was not answered from the cache
+    */
+    std::shared_ptr<const FileCache::Entry> cached() const;
+
+    /**
+     * get the parts of a 206 response. the caller sends the headers of each part and then its
+     * bytes from file() or file_fd(), instead of the whole file
+     * @return the parts, empty if the response is not a 206
+    */
+    const std::vector<Part> &parts() const;
 
     /**
      * get the length of the file
@@ -97,11 +171,19 @@ public:
     size_t file_len() const;
 
     /**
-     * generate an HTML error page and append it to the response buffer
+     * hand the mapped or open file over to the caller, which holds on to mapping() or closes
+     * file_fd() until it is sent. the response forgets the file, so the next init() does not
+     * close a file that is still queued for writing
+    */
+    void release_file();
+
+    /**
+     * generate an HTML error page and append it to the response buffer. the page of each
+     * status with the usual message is rendered at compile time
      * @param buffer a buffer to store error content
      * @param message message to be stored
     */
-    void error_content(Buffer &buffer, std::string message);
+    void error_content(ChainBuffer &buffer, std::string_view message);
 
     /**
      * get the status code
@@ -109,37 +191,135 @@ public:
     */
     int code() const;
 
+    /**
+     * files of at least this many bytes are kept open and sent with sendfile(), smaller ones
+     * are mapped and written from memory. 0 sends every file with sendfile(), SIZE_MAX none
+    */
+    static size_t sendfile_threshold;
+
+    /**
+     * get the MIME type of a file by its suffix
+     * @param path path or name of the file
+     * @return the type, text/plain for an unknown suffix. it points into a constant table
+    */
+    static std::string_view file_type(std::string_view path);
+
+    /**
+     * parse an Accept-Encoding header, e.g. "gzip, deflate, br;q=0.9"
+     * @param header value of the header
+     * @return the ENCODING_s the client accepts, those with q=0 excluded
+    */
+    static int accepted_encodings(std::string_view header);
+
+    /**
+     * set the Cache-Control policy of the files with a suffix. not thread-safe, call it
+     * before responses are built
+     * @param suffix suffix of the files, e.g. ".css"
+     * @param max_age seconds a client may use its copy without revalidating, 0 makes it
+     *                revalidate every time (no-cache), a negative value sends no Cache-Control
+    */
+    static void set_max_age(const std::string &suffix, int max_age);
+
 private:  // methods
     /**
-     * add the HTTP state line to the buffer, including the HTTP version, status
-     * code and status message
+     * add the HTTP state line to the buffer, including the HTTP version, status code and
+     * status message, followed by the Date header every response carries. both are copied
+     * from text that is formatted already
      * @param buffer store the formation in the buffer
     */
-    void add_state_line(Buffer &buffer);
+    void add_state_line(ChainBuffer &buffer);
 
     /**
-     * add the header information to the buffer, including the connection type
-     * and content type
+     * add the header information to the buffer, including the connection type and content
+     * type. everything but the state line and Date, which makes them fit for a cache entry
      * @param buffer store the information in the buffer
+     * @param is_keep_alive whether the connection is kept alive after the response
     */
-    void add_header(Buffer &buffer);
+    void add_header(ChainBuffer &buffer, bool is_keep_alive);
 
     /**
-     * add the content of the requested file to the buffer by memory-mapping in the file
+     * add ETag, Last-Modified and Cache-Control of the file in mm_file_stat_ to the buffer
      * @param buffer store the information in the buffer
     */
-    void add_content(Buffer &buffer);
+    void add_validators(ChainBuffer &buffer);
+
+    /**
+     * answer with a header-only 304 if the client's copy of the file in mm_file_stat_ is
+     * current
+     * @param buffer store the response in the buffer
+     * @return false if the request is not conditional or the copy is stale
+    */
+    bool add_not_modified(ChainBuffer &buffer);
+
+    /**
+     * get the entity tag of the file in mm_file_stat_, made of its inode, size and
+     * modification time. the gzipped body the Compressor makes gets a weak tag of its own:
+     * it is the same content, but a different zlib level would give other bytes
+     * @param tag receives the tag, ETAG_LEN_ bytes at most
+     * @return the quoted tag
+    */
+    std::string_view etag(char *tag) const;
+
+    /**
+     * add the length of the requested file, or of the parts of a 206, to the buffer and
+     * borrow the mapping of the file, or keep it open for sendfile() if it is large
+     * @param buffer store the information in the buffer
+     * @return false if the file could not be read, an error page is added instead, or
+     *         nothing of it is sent for a 416
+    */
+    bool add_content(ChainBuffer &buffer);
+
+    /**
+     * add the mapped file to FileCache::instance(), with the headers of both connection types
+     * @param key FileCache::key() of the file and its coding
+     * @param generation FileCache::generation() of the key before the file was looked up
+    */
+    void cache_file(const std::string &key, uint64_t generation);
 
     /**
      * relocate to error html
     */
     void error_html();
 
+    /**
+     * fill mm_file_stat_ for the requested file from FileIndex::instance(), or with stat() if
+     * the index does not know the path
+     * @return false if the file does not exist
+    */
+    bool stat_file();
+
+    /**
+     * check whether a file exists and may be served, from the index if it knows the path
+     * @param path path of the file, relative to src_dir_
+    */
+    bool is_servable(const std::string &path) const;
+
+    /**
+     * pick the precompressed sibling of the requested file the client prefers and point path_
+     * to it, noting that the response varies with Accept-Encoding if there is any sibling
+    */
+    void negotiate();
+
+    /**
+     * look the gzipped file up in Compressor::instance() if the client accepts gzip and no
+     * sibling was picked, and queue its compression if it is not there yet
+     * @return true if cached_ is set to the compressed response
+    */
+    bool gzip_cached();
+
+    /**
+     * evaluate If-Range and the Range of the request against the file in mm_file_stat_,
+     * turning the response into a 206 with parts_, a 416 if no range is satisfiable, or
+     * leaving it a 200 for the whole file if the Range is malformed or outdated. the parts
+     * are in the order of the file, ranges that overlap or touch are sent as one
+    */
+    void select_ranges();
+
     /**
      * get the type of a specific file
      * @return the type of a specific file
     */
-    std::string get_file_type();
+    std::string_view get_file_type() const;
 
 private:  // variables
     /**
@@ -164,29 +344,90 @@ private:  // variables
     std::string src_dir_;
 
     /**
-     * pointer to the memory-mapped file. used to access file content efficiently
+     * the memory-mapped file, used to access file content efficiently
     */
-    char *mm_file_;
+    std::shared_ptr<const MmapTable::Mapping> mapping_;
 
     /**
-     * stores the metadatta(e.g. size, permissions) of the memory-mapped file
+     * the requested file if it is sent with sendfile(), -1 otherwise
     */
-    struct stat mm_file_stat_;
+    int file_fd_;
+
+    /**
+     * MIME type of the requested file as found by the index, empty if it was stat()ed
+    */
+    std::string_view type_;
+
+    /**
+     * the ENCODING_s the client accepts. if a sibling is served, encoding_ is its coding
+     * and encoded_type_ the MIME type of the file it was compressed from
+    */
+    int encodings_;
+    const char *encoding_;
+    std::string_view encoded_type_;
+
+    /**
+     * whether the file has a precompressed sibling, so caches must key on Accept-Encoding
+    */
+    bool is_vary_;
+
+    /**
+     * whether the body is the Compressor's gzip of the file in mm_file_stat_
+    */
+    bool is_gzipped_;
 
     /**
-     * maps file exxtensions to their corresponding MIME types(e.g. html -> test/heml)
+     * Cache-Control max-age of the requested file, -1 if it has no policy
     */
-    static const std::unordered_map<std::string, std::string> SUFFIX_TYPE_;
+    int max_age_;
 
     /**
-     * maps HTTP status codes to their corresponding status maeesges(e.g. 200 -> OK)
+     * evaluates the conditional request, nullptr if the request is not one
     */
-    static const std::unordered_map<int, std::string> CODE_STATUS_;
+    Validator is_not_modified_;
+
+    /**
+     * the Range of the request, and the If-Range evaluator if it has one
+    */
+    std::string range_;
+    Validator is_range_current_;
+
+    /**
+     * the parts of a 206 response, and the boundary between them if there are several
+    */
+    std::vector<Part> parts_;
+    std::string boundary_;
+
+    /**
+     * more ranges in one request are not served, the whole file is sent instead
+    */
+    static const size_t MAX_RANGES_ = 16;
+
+    /**
+     * room for the longest entity tag
+    */
+    static const size_t ETAG_LEN_ = 64;
+
+    /**
+     * the cache entry the response was answered from, nullptr on a miss
+    */
+    std::shared_ptr<const FileCache::Entry> cached_;
+
+    /**
+     * stores the metadatta(e.g. size, permissions) of the memory-mapped file
+    */
+    struct stat mm_file_stat_;
 
     /**
      * maps error status codes to their corresponding error HTML paths(e.g. 404 -> /40.html)
     */
     static const std::unordered_map<int, std::string> CODE_PATH_;
+
+    /**
+     * maps file extensions to their Cache-Control max-age, see set_max_age(). a handful of
+     * entries, scanned without building a key string for every request
+    */
+    static std::vector<std::pair<std::string, int>> suffix_max_age_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#include "mmaptable.h"
+#include <algorithm>
+#include <cassert>
+#include <sys/mman.h>
+
+MmapTable::Mapping::Mapping(const char *data, size_t len, const struct timespec &mtime)
+    : data(data), len(len), mtime(mtime) {}
+
+MmapTable::Mapping::~Mapping() {
+    munmap(const_cast<char *>(data), len);
+}
+
+MmapTable::MmapTable(size_t capacity, size_t shard_num) {
+    init(capacity, shard_num);
+}
+
+MmapTable *MmapTable::instance() {
+    static MmapTable table;
+    return &table;
+}
+
+void MmapTable::init(size_t capacity, size_t shard_num) {
+    assert(shard_num > 0);
+    capacity_ = capacity;
+    mappings_.init(shard_num);
+}
+
+std::shared_ptr<const MmapTable::Mapping> MmapTable::get(const std::string &path,
+                                                          const struct stat &st) {
+    if (capacity_ == 0) {
+        return nullptr;
+    }
+    std::shared_ptr<const Mapping> mapping = mappings_.get(path);
+    if (mapping == nullptr) {
+        return nullptr;
+    }
+    if (mapping->len != static_cast<size_t>(st.st_size) ||
+        mapping->mtime.tv_sec != st.st_mtim.tv_sec ||
+        mapping->mtime.tv_nsec != st.st_mtim.tv_nsec) {
+        // left for map() to replace, the file is mapped again right after the miss
+        return nullptr;
+    }
+    return mapping;
+}
+
+std::shared_ptr<const MmapTable::Mapping> MmapTable::map(const std::string &path, int fd,
+                                                          const struct stat &st) {
+    assert(st.st_size > 0);
+    size_t len = st.st_size;
+    void *data = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        return nullptr;
+    }
+    // the advice is given once, every later response of the file borrows the mapping
+    madvise(data, len, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    if (len >= HUGE_PAGE_) {
+        // only anonymous and shmem mappings take it on most kernels, EINVAL is expected
+        madvise(data, len, MADV_HUGEPAGE);
+    }
+#endif
+    std::shared_ptr<const Mapping> mapping =
+        std::make_shared<const Mapping>(static_cast<const char *>(data), len, st.st_mtim);
+
+    size_t limit = capacity_ / mappings_.shard_num();
+    size_t max_num = std::max<size_t>(MAX_MAPPINGS_ / mappings_.shard_num(), 1);
+    if (len <= limit) {
+        // the evicted mappings are unmapped after the lock of the shard is released
+        mappings_.put(path, mapping, len, limit, max_num);
+    }
+    return mapping;
+}
+
+void MmapTable::erase(const std::string &path) {
+    mappings_.erase(path);
+}
+
+size_t MmapTable::size() const {
+    return mappings_.size();
+}
+
+size_t MmapTable::bytes() const {
+    return mappings_.bytes();
+}
@@ -0,0 +1,130 @@
+/**
+ * the memory mappings of the files that are sent from memory, shared by all connections.
+ *
+ * mapping a file for every response and unmapping it once it is written costs two system
+ * calls, and every munmap() makes the kernel flush the TLBs of all the cores the process runs
+ * on. a file that is requested again is lent out from the mapping made for its first request
+ * instead: a response holds the mapping as a shared_ptr until its body is written, and the
+ * table keeps the mappings of files still in use. a mapping is only unmapped when the table
+ * needs room for others, or its file changed, and then only after its last borrower is done.
+ *
+ * a mapping belongs to one version of its file, a lookup with another size or modification
+ * time misses and the next mapping replaces it. like the entries of the FileCache, the mappings
+ * are kept in a ShardedLru.
+*/
+
+#ifndef MMAP_TABLE_H_
+#define MMAP_TABLE_H_
+
+#include <cstddef>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+
+#include "shardedlru.h"
+
+class MmapTable {
+public:
+    struct Mapping {
+        const char *data;
+        size_t len;
+
+        /**
+         * modification time of the file when it was mapped
+        */
+        struct timespec mtime;
+
+        Mapping(const char *data, size_t len, const struct timespec &mtime);
+
+        /**
+         * unmap the file, once no response and no table holds the mapping any more
+        */
+        ~Mapping();
+
+        Mapping(const Mapping &) = delete;
+        Mapping &operator=(const Mapping &) = delete;
+    };
+
+    /**
+     * @param capacity max number of bytes kept mapped, 0 keeps none: every mapping is then
+     *                 unmapped with its last response
+     * @param shard_num number of independently locked shards
+    */
+    explicit MmapTable(size_t capacity = 0, size_t shard_num = 16);
+
+    ~MmapTable() = default;
+
+    MmapTable(const MmapTable &) = delete;
+    MmapTable &operator=(const MmapTable &) = delete;
+
+    /**
+     * get the table of the server, set up by init()
+     * @return the mmap table
+    */
+    static MmapTable *instance();
+
+    /**
+     * drop all mappings and resize the table. not thread-safe, call it before the table is
+     * used
+     * @param capacity max number of bytes kept mapped, 0 keeps none
+     * @param shard_num number of independently locked shards
+    */
+    void init(size_t capacity, size_t shard_num = 16);
+
+    /**
+     * borrow the mapping of a file and mark it as recently used
+     * @param path full path of the file
+     * @param st current stat of the file, its size and modification time have to match
+     * @return the mapping, nullptr if the file is not mapped or changed since
+    */
+    std::shared_ptr<const Mapping> get(const std::string &path, const struct stat &st);
+
+    /**
+     * map a file, replacing the mapping of the same path, and evict the least recently used
+     * mappings of its shard until it fits. a file larger than the share of a shard is mapped
+     * without being kept. the file is advised to be read ahead, and to be
+     * backed by huge pages if it is large enough for them
+     * @param path full path of the file
+     * @param fd the open file
+     * @param st stat of the open file, its size must not be 0
+     * @return the mapping, nullptr if mmap() failed
+    */
+    std::shared_ptr<const Mapping> map(const std::string &path, int fd, const struct stat &st);
+
+    /**
+     * forget the mapping of a file, it is unmapped once its borrowers are done
+     * @param path full path of the file
+    */
+    void erase(const std::string &path);
+
+    /**
+     * get the number of mappings kept
+     * @return number of files mapped
+    */
+    size_t size() const;
+
+    /**
+     * get the number of bytes kept mapped
+     * @return sum of the sizes of the mappings
+    */
+    size_t bytes() const;
+
+private:
+    size_t capacity_;
+
+    ShardedLru<Mapping> mappings_;
+
+    /**
+     * mappings at least this large are advised to use transparent huge pages
+    */
+    static const size_t HUGE_PAGE_ = 2 * 1024 * 1024;
+
+    /**
+     * max number of mappings kept by all shards, well below the vm.max_map_count of 65530
+     * a process gets by default
+    */
+    static const size_t MAX_MAPPINGS_ = 16384;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "router.h"
+#include <cassert>
+
+Router::Router() : forward_(1), backward_(1), size_(0) {
+    forward_[0].exact = forward_[0].partial = NO_ROUTE;
+    backward_[0].exact = backward_[0].partial = NO_ROUTE;
+}
+
+bool Router::add(MATCH_ type, const std::string &pattern, int handler) {
+    if (pattern.empty() || handler < 0) {
+        return false;
+    }
+    std::vector<Node> &trie = type == SUFFIX ? backward_ : forward_;
+    Node &node = trie[insert(trie, pattern, type == SUFFIX)];
+    int &slot = type == EXACT ? node.exact : node.partial;
+    if (slot == NO_ROUTE) {
+        size_++;
+    }
+    slot = handler;
+    return true;
+}
+
+int Router::match(std::string_view path) const {
+    // the longest prefix seen on the way down, or the exact route at the end of the path
+    int best = forward_[0].partial;
+    uint32_t node = 0;
+    size_t i = 0;
+    for (; i < path.size(); i++) {
+        node = child(forward_, node, path[i]);
+        if (node == 0) {
+            break;
+        }
+        if (forward_[node].partial != NO_ROUTE) {
+            best = forward_[node].partial;
+        }
+    }
+    if (i == path.size() && forward_[node].exact != NO_ROUTE) {
+        return forward_[node].exact;
+    }
+    if (best != NO_ROUTE) {
+        return best;
+    }
+
+    // no prefix, the longest suffix then
+    node = 0;
+    for (size_t j = path.size(); j > 0; j--) {
+        node = child(backward_, node, path[j - 1]);
+        if (node == 0) {
+            break;
+        }
+        if (backward_[node].partial != NO_ROUTE) {
+            best = backward_[node].partial;
+        }
+    }
+    return best;
+}
+
+size_t Router::size() const {
+    return size_;
+}
+
+uint32_t Router::insert(std::vector<Node> &trie, const std::string &pattern, bool reversed) {
+    uint32_t node = 0;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char ch = reversed ? pattern[pattern.size() - 1 - i] : pattern[i];
+        uint32_t next = child(trie, node, ch);
+        if (next == 0) {
+            next = static_cast<uint32_t>(trie.size());
+            trie.push_back(Node{NO_ROUTE, NO_ROUTE, {}});
+            // trie may have moved, index it again
+            trie[node].next.emplace_back(ch, next);
+        }
+        node = next;
+    }
+    return node;
+}
+
+uint32_t Router::child(const std::vector<Node> &trie, uint32_t node, char ch) {
+    assert(node < trie.size());
+    for (const auto &edge : trie[node].next) {
+        if (edge.first == ch) {
+            return edge.second;
+        }
+    }
+    return 0;
+}
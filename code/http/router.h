@@ -0,0 +1,99 @@
+/**
+ * a table of URL routes mapping request paths to handler ids.
+ *
+ * routes are added once at startup and then only matched, in O(path length): exact and prefix
+ * routes share a trie walked along the path, suffix routes (e.g. ".php") have a trie of their
+ * own over the reversed patterns, walked back from the end of the path only if no exact or
+ * prefix route matched. an exact route wins over any prefix route, and the longest prefix
+ * wins over any suffix route, e.g. with
+ *
+ *     EXACT "/login" -> 1, PREFIX "/static/" -> 2, PREFIX "/" -> 3, SUFFIX ".png" -> 4
+ *
+ * "/login" gives 1, "/static/a.png" gives 2 and "/a.png" gives 3.
+*/
+
+#ifndef ROUTER_H_
+#define ROUTER_H_
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class Router {
+public:
+    enum MATCH_ {
+        EXACT = 0,
+        PREFIX,
+        SUFFIX,
+    };
+
+    /**
+     * what match() returns for a path no route matches
+    */
+    static constexpr int NO_ROUTE = -1;
+
+    Router();
+
+    ~Router() = default;
+
+    /**
+     * add a route, replacing the handler of the same pattern and match type. not thread-safe,
+     * routes must be added before the table is shared
+     * @param type how the pattern is compared to a path
+     * @param pattern path, path prefix or path suffix, not empty
+     * @param handler id returned by match(), not negative
+     * @return false if the pattern is empty or the handler is negative
+    */
+    bool add(MATCH_ type, const std::string &pattern, int handler);
+
+    /**
+     * find the route of a path
+     * @param path path of a request, without query string
+     * @return handler id of the best matching route, NO_ROUTE if none matches
+    */
+    int match(std::string_view path) const;
+
+    /**
+     * get the number of routes
+     * @return number of routes added, a replaced one counts once
+    */
+    size_t size() const;
+
+private:
+    struct Node {
+        /**
+         * handlers of an exact, and of a prefix or suffix route ending at the node
+        */
+        int exact;
+        int partial;
+
+        /**
+         * the children, by byte. routes fan out little, so a short list beats a table of 256
+        */
+        std::vector<std::pair<char, uint32_t>> next;
+    };
+
+    /**
+     * walk one of the tries, adding the nodes of a pattern that are missing
+     * @return index of the node the pattern ends at
+    */
+    static uint32_t insert(std::vector<Node> &trie, const std::string &pattern, bool reversed);
+
+    /**
+     * get the child of a node by byte
+     * @return index of the child, 0 if there is none (the root is never a child)
+    */
+    static uint32_t child(const std::vector<Node> &trie, uint32_t node, char ch);
+
+    /**
+     * trie over the exact and prefix patterns, and over the reversed suffix patterns
+    */
+    std::vector<Node> forward_;
+    std::vector<Node> backward_;
+
+    size_t size_;
+};
+
+#endif
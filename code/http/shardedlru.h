@@ -0,0 +1,214 @@
+/**
+ * ShardedLru is the table behind the FileCache and the MmapTable: values shared by all
+ * connections, found by path and evicted least recently used first once their shard runs out
+ * of bytes.
+ *
+ * the table is split into shards by the hash of the key, each with its own lock, LRU list and
+ * byte count, so workers looking up different files rarely wait for each other. a value is
+ * handed out as a shared_ptr and stays valid while a connection still uses it, even after it
+ * has been evicted. evicted values are released after the lock of their shard is dropped, so a
+ * value whose destructor is expensive (e.g. munmap()) never stalls the shard.
+ *
+ * every shard counts its erase() calls. a caller that takes generation() before it reads a
+ * file passes it to put(), which then fails if the key was erased in between.
+*/
+
+#ifndef SHARDED_LRU_H_
+#define SHARDED_LRU_H_
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+template<class V>
+class ShardedLru {
+public:
+    static const uint64_t ANY_GENERATION = UINT64_MAX;
+
+    /**
+     * @param shard_num number of independently locked shards
+    */
+    explicit ShardedLru(size_t shard_num = 16) {
+        init(shard_num);
+    }
+
+    ShardedLru(const ShardedLru &) = delete;
+    ShardedLru &operator=(const ShardedLru &) = delete;
+
+    /**
+     * drop all values and change the number of shards. not thread-safe, call it before the
+     * table is used
+     * @param shard_num number of independently locked shards
+    */
+    void init(size_t shard_num) {
+        assert(shard_num > 0);
+        shards_.clear();
+        for (size_t i = 0; i < shard_num; i++) {
+            shards_.emplace_back(new Shard());
+        }
+    }
+
+    /**
+     * get the number of shards
+     * @return number of shards, each holding a share of the capacity
+    */
+    size_t shard_num() const {
+        return shards_.size();
+    }
+
+    /**
+     * look a value up and mark it as recently used
+     * @param key key of the value
+     * @return the value, nullptr if the key is not in the table
+    */
+    std::shared_ptr<const V> get(const std::string &key) {
+        Shard &s = shard(key);
+        std::lock_guard<std::mutex> locker(s.mutex);
+        auto it = s.index.find(key);
+        if (it == s.index.end()) {
+            return nullptr;
+        }
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return it->second->value;
+    }
+
+    /**
+     * add a value, replacing the value of the same key, and evict the least recently used
+     * values of its shard until it fits
+     * @param key key of the value
+     * @param value the value
+     * @param bytes size the value is accounted with
+     * @param limit max number of bytes of the shard
+     * @param max_num max number of values of the shard
+     * @param generation generation() of the key before the value was made, ANY_GENERATION
+     *                   to add it anyway
+     * @return false if the key was erased since generation
+    */
+    bool put(const std::string &key, std::shared_ptr<const V> value, size_t bytes,
+             size_t limit, size_t max_num = SIZE_MAX, uint64_t generation = ANY_GENERATION) {
+        // declared before the lock, the evicted values are released after it
+        LruList evicted;
+        Shard &s = shard(key);
+        std::lock_guard<std::mutex> locker(s.mutex);
+        if (generation != ANY_GENERATION &&
+            s.erased.load(std::memory_order_relaxed) != generation) {
+            return false;
+        }
+        remove(s, key, evicted);
+        while (!s.lru.empty() && (s.bytes + bytes > limit || s.lru.size() >= max_num)) {
+            s.bytes -= s.lru.back().bytes;
+            s.index.erase(s.lru.back().key);
+            evicted.splice(evicted.end(), s.lru, std::prev(s.lru.end()));
+        }
+        s.lru.push_front(Node{key, std::move(value), bytes});
+        s.index[key] = s.lru.begin();
+        s.bytes += bytes;
+        return true;
+    }
+
+    /**
+     * drop the value of a key and count the erase in its shard
+     * @param key key of the value
+    */
+    void erase(const std::string &key) {
+        LruList evicted;
+        Shard &s = shard(key);
+        std::lock_guard<std::mutex> locker(s.mutex);
+        s.erased.fetch_add(1, std::memory_order_release);
+        remove(s, key, evicted);
+    }
+
+    /**
+     * get the number of erase() calls so far in the shard of a key
+     * @param key key of the value
+     * @return the erase generation of the key
+    */
+    uint64_t generation(const std::string &key) {
+        return shard(key).erased.load(std::memory_order_acquire);
+    }
+
+    /**
+     * get the number of values
+     * @return number of values held by all shards
+    */
+    size_t size() const {
+        size_t num = 0;
+        for (const auto &s : shards_) {
+            std::lock_guard<std::mutex> locker(s->mutex);
+            num += s->lru.size();
+        }
+        return num;
+    }
+
+    /**
+     * get the number of bytes held
+     * @return sum of the sizes the values were put with
+    */
+    size_t bytes() const {
+        size_t num = 0;
+        for (const auto &s : shards_) {
+            std::lock_guard<std::mutex> locker(s->mutex);
+            num += s->bytes;
+        }
+        return num;
+    }
+
+private:
+    struct Node {
+        std::string key;
+        std::shared_ptr<const V> value;
+        size_t bytes;
+    };
+
+    typedef std::list<Node> LruList;
+
+    struct Shard {
+        mutable std::mutex mutex;
+
+        /**
+         * the values, most recently used first, and their positions by key
+        */
+        LruList lru;
+        std::unordered_map<std::string, typename LruList::iterator> index;
+
+        size_t bytes = 0;
+
+        /**
+         * number of erase() calls, read without the lock by generation()
+        */
+        std::atomic<uint64_t> erased{0};
+    };
+
+    Shard &shard(const std::string &key) {
+        return *shards_[std::hash<std::string>()(key) % shards_.size()];
+    }
+
+    /**
+     * move the value of a key out of its shard, the lock of the shard is held
+    */
+    static void remove(Shard &s, const std::string &key, LruList &evicted) {
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            s.bytes -= it->second->bytes;
+            evicted.splice(evicted.end(), s.lru, it->second);
+            s.index.erase(it);
+        }
+    }
+
+    /**
+     * held in unique_ptr, a shard with its mutex cannot move
+    */
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+#endif
@@ -0,0 +1,229 @@
+#include "asyncuserstore.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <utility>
+
+AsyncUserStore::AsyncUserStore(size_t max_jobs) :
+    max_jobs_(max_jobs), wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)), is_close_(true),
+    epoller_(new Epoller(64)) {
+    assert(max_jobs_ > 0);
+    assert(wakeup_fd_ >= 0);
+    epoller_->add_fd(wakeup_fd_, EPOLLIN);
+}
+
+AsyncUserStore::~AsyncUserStore() {
+    stop();
+    for (Conn &conn : conns_) {
+        mysql_close(conn.sql);
+    }
+    close(wakeup_fd_);
+}
+
+bool AsyncUserStore::init(const char *host, int port, const char *user, const char *pwd,
+                          const char *db_name, int conn_size) {
+    assert(conn_size > 0);
+    assert(!thread_.joinable());
+    for (int i = 0; i < conn_size; i++) {
+        MYSQL *sql = mysql_init(nullptr);
+        if (sql == nullptr) {
+            LOG_ERROR("MySQL Init Error!");
+            continue;
+        }
+        if (mysql_real_connect(sql, host, user, pwd, db_name, port, nullptr, 0) == nullptr) {
+            LOG_ERROR("MySQL Connect Error: %s", mysql_error(sql));
+            mysql_close(sql);
+            continue;
+        }
+        Conn conn;
+        conn.sql = sql;
+        conn.fd = sql->net.fd;
+        conn.state = IDLE;
+        // registered disarmed, step() arms it while a call is not ready
+        epoller_->add_fd(conn.fd, EPOLLONESHOT);
+        conns_.push_back(std::move(conn));
+    }
+    if (conns_.empty()) {
+        return false;
+    }
+    is_close_ = false;
+    thread_ = std::thread(&AsyncUserStore::loop, this);
+    LOG_INFO("AsyncUserStore start, connections: %d", (int) conns_.size());
+    return true;
+}
+
+bool AsyncUserStore::verify(const std::string &name, const std::string &pwd, bool is_login,
+                            Callback callback) {
+    assert(callback);
+    {
+        // checked under the lock, stop() drains jobs_ after it set is_close_ under it
+        std::lock_guard<std::mutex> locker(mutex_);
+        if (is_close_ || jobs_.size() >= max_jobs_) {
+            return false;
+        }
+        jobs_.push_back(Job{name, pwd, is_login, std::move(callback)});
+    }
+    uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_WARN("AsyncUserStore wakeup error!");
+    }
+    return true;
+}
+
+void AsyncUserStore::stop() {
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        is_close_ = true;
+    }
+    uint64_t one = 1;
+    ssize_t ret = write(wakeup_fd_, &one, sizeof(one));
+    (void) ret;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    std::deque<Job> jobs;
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        jobs.swap(jobs_);
+    }
+    for (Job &job : jobs) {
+        job.callback(false);
+    }
+    for (Conn &conn : conns_) {
+        if (conn.state != IDLE) {
+            // the connection is left in the middle of a query, it is only closed from now on
+            conn.state = IDLE;
+            conn.job.callback(false);
+        }
+    }
+}
+
+size_t AsyncUserStore::conn_count() const {
+    return conns_.size();
+}
+
+void AsyncUserStore::loop() {
+    while (!is_close_) {
+        int event_cnt = epoller_->wait(-1);
+        for (int i = 0; i < event_cnt; i++) {
+            int fd = epoller_->get_event_fd(i);
+            if (fd == wakeup_fd_) {
+                uint64_t cnt = 0;
+                ssize_t ret = read(wakeup_fd_, &cnt, sizeof(cnt));
+                (void) ret;
+                continue;
+            }
+            for (Conn &conn : conns_) {
+                if (conn.fd == fd && conn.state != IDLE) {
+                    step(conn);
+                    break;
+                }
+            }
+        }
+        dispatch();
+    }
+}
+
+void AsyncUserStore::dispatch() {
+    for (Conn &conn : conns_) {
+        if (conn.state != IDLE) {
+            continue;
+        }
+        Job job;
+        {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (jobs_.empty()) {
+                return;
+            }
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+        start(conn, std::move(job));
+    }
+}
+
+void AsyncUserStore::start(Conn &conn, Job &&job) {
+    conn.job = std::move(job);
+    if (conn.job.name.empty() || conn.job.pwd.empty()) {
+        finish(conn, false);
+        return;
+    }
+    conn.order = "SELECT username, password FROM user WHERE username='" +
+                 escape(conn.sql, conn.job.name) + "' LIMIT 1";
+    LOG_DEBUG("%s", conn.order.c_str());
+    conn.state = SELECT;
+    step(conn);
+}
+
+void AsyncUserStore::step(Conn &conn) {
+    while (conn.state != IDLE) {
+        net_async_status status = NET_ASYNC_ERROR;
+        switch (conn.state) {
+            case SELECT:
+            case INSERT:
+                status = mysql_real_query_nonblocking(conn.sql, conn.order.data(),
+                                                      conn.order.size());
+                break;
+            case STORE: {
+                MYSQL_RES *res = nullptr;
+                status = mysql_store_result_nonblocking(conn.sql, &res);
+                if (status != NET_ASYNC_COMPLETE || res == nullptr) {
+                    break;
+                }
+                // the result is stored, fetching its rows does not touch the socket
+                bool flag = !conn.job.is_login;
+                while (MYSQL_ROW row = mysql_fetch_row(res)) {
+                    flag = conn.job.is_login && conn.job.pwd == row[1];
+                }
+                mysql_free_result(res);
+                if (!conn.job.is_login && flag) {
+                    conn.order = "INSERT INTO user(username, password) VALUES('" +
+                                 escape(conn.sql, conn.job.name) + "', '" +
+                                 escape(conn.sql, conn.job.pwd) + "')";
+                    LOG_DEBUG("%s", conn.order.c_str());
+                    conn.state = INSERT;
+                    continue;
+                }
+                finish(conn, flag);
+                return;
+            }
+            default:
+                break;
+        }
+
+        if (status == NET_ASYNC_NOT_READY) {
+            // the call may wait for the reply or for room to send a long query in
+            epoller_->mod_fd(conn.fd, EPOLLIN | EPOLLOUT | EPOLLONESHOT);
+            return;
+        } else if (status == NET_ASYNC_ERROR) {
+            LOG_WARN("AsyncUserStore query error: %s", mysql_error(conn.sql));
+            finish(conn, false);
+            return;
+        }
+        if (conn.state == SELECT) {
+            conn.state = STORE;
+        } else if (conn.state == INSERT) {
+            finish(conn, true);
+        } else {
+            // STORE completed without a result set
+            finish(conn, false);
+        }
+    }
+}
+
+void AsyncUserStore::finish(Conn &conn, bool result) {
+    conn.state = IDLE;
+    Callback callback = std::move(conn.job.callback);
+    conn.job = Job();
+    callback(result);
+}
+
+std::string AsyncUserStore::escape(MYSQL *sql, const std::string &str) {
+    std::string escaped(str.size() * 2 + 1, '\0');
+    unsigned long len = mysql_real_escape_string(sql, &escaped[0], str.data(), str.size());
+    escaped.resize(len);
+    return escaped;
+}
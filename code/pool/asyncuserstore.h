@@ -0,0 +1,178 @@
+/**
+ * AsyncUserStore verifies login/register forms with the non-blocking API of the MySQL client
+ * library (mysql_real_query_nonblocking and friends, MySQL 8.0.16+), so a login does not hold
+ * a thread while the database answers.
+ *
+ * 1. threading:
+ *     the store runs one event loop thread that owns a few MySQL connections and an Epoller.
+ *     verify() may be called from any thread, it queues a job and wakes the loop through an
+ *     eventfd. the loop hands queued jobs to idle connections.
+ *
+ * 2. a job is a small state machine driven by the socket of its connection:
+ *
+ *     SELECT --(row found or login)--> done
+ *        |
+ *        +---(register, name is free)--> INSERT --> done
+ *
+ *     every step calls the non-blocking function of the state again. while it returns
+ *     NET_ASYNC_NOT_READY the socket of the connection (MYSQL::net.fd) is armed for EPOLLIN
+ *     and EPOLLOUT with EPOLLONESHOT, as the call may wait for either, and the step is
+ *     retried when the socket becomes ready.
+ *
+ * 3. completion:
+ *     the callback of a job is invoked on the loop thread with the result, it must only hand
+ *     the result over (e.g. queue a task or wake another event loop) and return.
+*/
+
+#ifndef ASYNCUSERSTORE_H
+#define ASYNCUSERSTORE_H
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <mysql/mysql.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../log/log.h"
+#include "../server/epoller.h"
+
+class AsyncUserStore {
+public:
+    /**
+     * callback of a job, invoked on the loop thread with whether the user logged in or
+     * registered successfully
+    */
+    typedef std::function<void(bool)> Callback;
+
+    /**
+     * @param max_jobs max number of jobs waiting for an idle connection
+    */
+    explicit AsyncUserStore(size_t max_jobs = 4096);
+
+    /**
+     * stop the event loop and close all connections
+    */
+    ~AsyncUserStore();
+
+    AsyncUserStore(const AsyncUserStore &) = delete;
+    AsyncUserStore &operator=(const AsyncUserStore &) = delete;
+
+    /**
+     * open the connections and start the event loop thread. connecting is blocking, this is
+     * meant to be called once at startup
+     * @param host host of the DB
+     * @param port port of the DB
+     * @param user user of the DB
+     * @param pwd pwd of the DB
+     * @param db_name name of the DB
+     * @param conn_size number of connections
+     * @return false if no connection could be opened
+    */
+    bool init(const char *host, int port, const char *user, const char *pwd, const char *db_name,
+              int conn_size = 4);
+
+    /**
+     * queue the verification of a user. may be called from any thread
+     * @param name name of the user
+     * @param pwd password of the user
+     * @param is_login whether the user is login or registration
+     * @param callback invoked on the loop thread with the result
+     * @return false if the store is not running or too many jobs are queued, the callback is
+     *         not invoked then
+    */
+    bool verify(const std::string &name, const std::string &pwd, bool is_login,
+                Callback callback);
+
+    /**
+     * stop the event loop, jobs still queued are completed with false
+    */
+    void stop();
+
+    /**
+     * get the number of open connections
+     * @return number of connections
+    */
+    size_t conn_count() const;
+
+private:
+    enum STATE_ {
+        IDLE = 0,
+        SELECT,
+        STORE,
+        INSERT,
+    };
+
+    struct Job {
+        std::string name;
+        std::string pwd;
+        bool is_login;
+        Callback callback;
+    };
+
+    struct Conn {
+        MYSQL *sql;
+        int fd;
+        STATE_ state;
+        Job job;
+        std::string order;
+    };
+
+    /**
+     * wait for socket events and the wakeup eventfd until stop() is called
+    */
+    void loop();
+
+    /**
+     * hand queued jobs to idle connections
+    */
+    void dispatch();
+
+    /**
+     * start a job on an idle connection
+     * @param conn idle connection
+     * @param job job to be run
+    */
+    void start(Conn &conn, Job &&job);
+
+    /**
+     * advance the state machine of a connection as far as the socket allows
+     * @param conn busy connection
+    */
+    void step(Conn &conn);
+
+    /**
+     * invoke the callback of the connection's job and make the connection idle again
+     * @param conn busy connection
+     * @param result result of the job
+    */
+    void finish(Conn &conn, bool result);
+
+    /**
+     * escape a string for a quoted SQL literal
+     * @param sql connection whose character set is used
+     * @param str string to be escaped
+     * @return escaped string
+    */
+    static std::string escape(MYSQL *sql, const std::string &str);
+
+    size_t max_jobs_;
+    int wakeup_fd_;
+    std::atomic<bool> is_close_;
+    std::thread thread_;
+    std::unique_ptr<Epoller> epoller_;
+
+    /**
+     * only touched by the loop thread once it runs
+    */
+    std::vector<Conn> conns_;
+
+    std::mutex mutex_;
+    std::deque<Job> jobs_;
+};
+
+#endif
@@ -0,0 +1,114 @@
+/**
+ * Executor groups the worker threads of the server into named lanes, every lane is a ThreadPool
+ * with its own number of threads and its own bound on queued tasks.
+ *
+ *   1. CPU lane:
+ *       reading, parsing and building responses. tasks are short, and when the lane is full
+ *       the submitter runs the task itself.
+ *   2. BLOCKING lane:
+ *       calls that park a thread, i.e. the MySQL queries of the login and register forms. it
+ *       is sized like the SQL connection pool, so a burst of logins can only occupy these
+ *       threads while static files keep being served by the CPU lane. a full lane rejects new
+ *       tasks instead of blocking the submitter.
+ *   3. COMPRESS lane:
+ *       gzip of static files for the Compressor, which takes milliseconds per file. nobody
+ *       waits for the result, so a full lane rejects the task and a later request retries.
+ *   4. IO lane:
+ *       reading files that are not in the page cache into it before a response is sent from
+ *       them, so the disk is waited for here rather than on a CPU thread faulting on the
+ *       mapping or blocking in sendfile(). a full lane rejects the task and the response is
+ *       sent right away.
+*/
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <cassert>
+#include <cstddef>
+#include <memory>
+#include <utility>
+
+#include "threadpool.h"
+
+class Executor {
+public:
+    enum Lane {
+        CPU = 0,
+        BLOCKING,
+        COMPRESS,
+        IO,
+        LANE_NUM,
+    };
+
+    /**
+     * create the thread pools of all lanes
+     * @param cpu_thread_num number of threads of the CPU lane
+     * @param cpu_max_tasks max number of queued or running tasks of the CPU lane
+     * @param blocking_thread_num number of threads of the BLOCKING lane
+     * @param blocking_max_tasks max number of queued or running tasks of the BLOCKING lane
+     * @param compress_thread_num number of threads of the COMPRESS lane
+     * @param compress_max_tasks max number of queued or running tasks of the COMPRESS lane
+     * @param io_thread_num number of threads of the IO lane
+     * @param io_max_tasks max number of queued or running tasks of the IO lane
+    */
+    Executor(size_t cpu_thread_num, size_t cpu_max_tasks, size_t blocking_thread_num,
+             size_t blocking_max_tasks, size_t compress_thread_num = 1,
+             size_t compress_max_tasks = 64, size_t io_thread_num = 1,
+             size_t io_max_tasks = 256) {
+        lanes_[CPU].reset(new ThreadPool(cpu_thread_num, cpu_max_tasks));
+        lanes_[BLOCKING].reset(new ThreadPool(blocking_thread_num, blocking_max_tasks));
+        lanes_[COMPRESS].reset(new ThreadPool(compress_thread_num, compress_max_tasks));
+        lanes_[IO].reset(new ThreadPool(io_thread_num, io_max_tasks));
+    }
+
+    Executor(const Executor &) = delete;
+    Executor &operator=(const Executor &) = delete;
+
+    /**
+     * queue a task on a lane, or run it on the calling thread if the lane is full
+     * @param lane lane to run the task on
+     * @param task callable invoked with no arguments
+    */
+    template<class F>
+    void post(Lane lane, F &&task) {
+        assert(lane >= 0 && lane < LANE_NUM);
+        lanes_[lane]->AddTask(std::forward<F>(task));
+    }
+
+    /**
+     * queue a task on a lane unless the lane is full
+     * @param lane lane to run the task on
+     * @param task callable invoked with no arguments
+     * @return false if the lane is full and the task was not queued
+    */
+    template<class F>
+    bool try_post(Lane lane, F &&task) {
+        assert(lane >= 0 && lane < LANE_NUM);
+        return lanes_[lane]->TryAddTask(std::forward<F>(task));
+    }
+
+    /**
+     * get the name of a lane, for logging
+     * @param lane lane
+     * @return name of the lane
+    */
+    static const char *lane_name(Lane lane) {
+        switch (lane) {
+            case CPU:
+                return "cpu";
+            case BLOCKING:
+                return "blocking";
+            case COMPRESS:
+                return "compress";
+            case IO:
+                return "io";
+            default:
+                return "unknown";
+        }
+    }
+
+private:
+    std::unique_ptr<ThreadPool> lanes_[LANE_NUM];
+};
+
+#endif
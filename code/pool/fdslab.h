@@ -0,0 +1,136 @@
+/**
+ * FdSlab is a container of objects indexed directly by file descriptor, used instead of
+ * std::unordered_map<int, T> for the per-connection state of the event loop.
+ *
+ * 1. layout:
+ *     the slab is split into chunks of CHUNK_SIZE_ slots. the table of chunk pointers is
+ *     allocated once for the whole fd range, a chunk is allocated the first time one of its fds
+ *     is used and then stays for the lifetime of the slab. a slot never moves, so pointers
+ *     handed out to the timer or to worker threads stay valid, and looking up an fd is two
+ *     array indexings without hashing or rehashing.
+ *
+ *     +---------+---------+-----+      +--------+--------+-----+--------+
+ *     | chunk 0 | chunk 1 | ... | ---> | slot 0 | slot 1 | ... | slot N |   (64-byte aligned)
+ *     +---------+---------+-----+      +--------+--------+-----+--------+
+ *
+ * 2. threading:
+ *     operator[] (which may allocate a chunk) must only be called by the owning event loop
+ *     thread, get() may be called from any thread.
+*/
+
+#ifndef FDSLAB_H
+#define FDSLAB_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <new>
+
+template<class T>
+class FdSlab {
+public:
+    /**
+     * allocate the chunk table covering fds [0, max_fd)
+     * @param max_fd exclusive upper bound of the fds stored in the slab
+    */
+    explicit FdSlab(size_t max_fd = 65536) :
+        chunk_cnt_((max_fd + CHUNK_SIZE_ - 1) / CHUNK_SIZE_),
+        chunks_(new std::atomic<Slot *>[chunk_cnt_]) {
+        assert(max_fd > 0);
+        for (size_t i = 0; i < chunk_cnt_; i++) {
+            chunks_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    FdSlab(const FdSlab &) = delete;
+    FdSlab &operator=(const FdSlab &) = delete;
+
+    /**
+     * destruct every object of every allocated chunk
+    */
+    ~FdSlab() {
+        for (size_t i = 0; i < chunk_cnt_; i++) {
+            Slot *chunk = chunks_[i].load(std::memory_order_relaxed);
+            if (chunk == nullptr) {
+                continue;
+            }
+            for (size_t j = 0; j < CHUNK_SIZE_; j++) {
+                chunk[j].~Slot();
+            }
+            free(chunk);
+        }
+    }
+
+    /**
+     * get the object of fd, allocating its chunk if needed. event loop thread only
+     * @param fd file descriptor, must be lower than capacity()
+     * @return the object of fd
+    */
+    T &operator[](int fd) {
+        assert(fd >= 0 && static_cast<size_t>(fd) < capacity());
+        std::atomic<Slot *> &entry = chunks_[fd / CHUNK_SIZE_];
+        Slot *chunk = entry.load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            chunk = alloc_chunk();
+            entry.store(chunk, std::memory_order_release);
+        }
+        return chunk[fd % CHUNK_SIZE_].value;
+    }
+
+    /**
+     * get the object of fd without allocating
+     * @param fd file descriptor
+     * @return the object of fd, or nullptr if fd is out of range or was never used
+    */
+    T *get(int fd) const {
+        if (fd < 0 || static_cast<size_t>(fd) >= capacity()) {
+            return nullptr;
+        }
+        Slot *chunk = chunks_[fd / CHUNK_SIZE_].load(std::memory_order_acquire);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        return &chunk[fd % CHUNK_SIZE_].value;
+    }
+
+    /**
+     * get the exclusive upper bound of the fds that can be stored
+     * @return the number of slots the chunk table covers
+    */
+    size_t capacity() const {
+        return chunk_cnt_ * CHUNK_SIZE_;
+    }
+
+private:
+    /**
+     * a slot owns a whole number of cache lines, so two connections handled by different
+     * threads never share one
+    */
+    struct alignas(64) Slot {
+        T value;
+    };
+
+    /**
+     * allocate a cache-line aligned chunk and default-construct all of its slots
+    */
+    Slot *alloc_chunk() {
+        void *mem = nullptr;
+        if (posix_memalign(&mem, alignof(Slot), sizeof(Slot) * CHUNK_SIZE_) != 0) {
+            throw std::bad_alloc();
+        }
+        Slot *chunk = static_cast<Slot *>(mem);
+        for (size_t j = 0; j < CHUNK_SIZE_; j++) {
+            new (&chunk[j]) Slot();
+        }
+        return chunk;
+    }
+
+    static const size_t CHUNK_SIZE_ = 256;
+
+    size_t chunk_cnt_;
+    std::unique_ptr<std::atomic<Slot *>[]> chunks_;
+};
+
+#endif
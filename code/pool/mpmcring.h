@@ -0,0 +1,142 @@
+/**
+ * MpmcRing is a bounded lock-free multi-producer multi-consumer queue (Vyukov's design). the
+ * storage is allocated once in the constructor, push and pop never allocate nor take a lock.
+ *
+ * every cell carries a sequence number telling whose turn it is:
+ *     seq == pos       the cell is free for the producer that claims position pos
+ *     seq == pos + 1   the cell holds the element for the consumer that claims position pos
+ * a producer (consumer) claims a position with a CAS on enqueue_pos_ (dequeue_pos_), then
+ * publishes the cell by bumping its sequence number.
+*/
+
+#ifndef MPMCRING_H
+#define MPMCRING_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+template<class T>
+class MpmcRing {
+public:
+    /**
+     * @param capacity max number of elements, rounded up to a power of two
+    */
+    explicit MpmcRing(size_t capacity = 1024) : enqueue_pos_(0), dequeue_pos_(0) {
+        assert(capacity > 0);
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (size_t i = 0; i < size; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MpmcRing(const MpmcRing &) = delete;
+    MpmcRing &operator=(const MpmcRing &) = delete;
+
+    /**
+     * append an element. may be called from any thread
+     * @param item element to be appended
+     * @return false if the ring is full
+    */
+    bool push(T item) {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->item = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * take the oldest element. may be called from any thread
+     * @param item where the element is stored
+     * @return false if the ring is empty
+    */
+    bool pop(T &item) {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell *cell;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            size_t seq = cell->seq.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        item = std::move(cell->item);
+        cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * get the number of elements. the answer may be stale as soon as it is returned
+     * @return the number of claimed positions, including elements still being published
+    */
+    size_t size() const {
+        size_t tail = enqueue_pos_.load(std::memory_order_relaxed);
+        size_t head = dequeue_pos_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    /**
+     * check whether the ring is empty. the answer may be stale as soon as it is returned
+     * @return whether the ring is empty
+    */
+    bool empty() const {
+        return size() == 0;
+    }
+
+    /**
+     * get the capacity of the ring
+     * @return max number of elements
+    */
+    size_t capacity() const {
+        return mask_ + 1;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> seq;
+        T item;
+    };
+
+    std::unique_ptr<Cell[]> cells_;
+    size_t mask_;
+    /**
+     * producers and consumers contend on different counters, keep them on separate cache lines
+    */
+    char pad0_[64];
+    std::atomic<size_t> enqueue_pos_;
+    char pad1_[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> dequeue_pos_;
+    char pad2_[64 - sizeof(std::atomic<size_t>)];
+};
+
+#endif
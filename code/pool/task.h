@@ -0,0 +1,127 @@
+/**
+ * Task is a type-erased void() callable with inline storage, used by the ThreadPool instead of
+ * std::function<void()>.
+ *
+ * a callable of at most INLINE_SIZE_ bytes, such as std::bind(&WebServer::on_read, this, client,
+ * generation), is constructed directly inside the task, so emplacing it never allocates. larger
+ * callables still work, they are moved to the heap.
+ *
+ * a Task is neither copyable nor movable: the pool keeps its tasks in a preallocated slab and
+ * passes pointers to the slots around.
+*/
+
+#ifndef TASK_H
+#define TASK_H
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+class Task {
+public:
+    static const size_t INLINE_SIZE_ = 48;
+
+    Task() : ops_(nullptr) {}
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task() {
+        reset();
+    }
+
+    /**
+     * store a callable in the task, the task must be empty
+     * @param func the callable, invoked later with no arguments
+    */
+    template<class F>
+    void emplace(F &&func) {
+        assert(ops_ == nullptr);
+        typedef typename std::decay<F>::type Func;
+        emplace_impl<Func>(std::forward<F>(func), std::integral_constant<bool, fits<Func>()>());
+    }
+
+    /**
+     * invoke the stored callable, the task must not be empty
+    */
+    void operator()() {
+        assert(ops_ != nullptr);
+        ops_->invoke(storage_);
+    }
+
+    /**
+     * destroy the stored callable, making the task empty again
+    */
+    void reset() {
+        if (ops_ != nullptr) {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+    explicit operator bool() const {
+        return ops_ != nullptr;
+    }
+
+private:
+    struct Ops {
+        void (*invoke)(void *storage);
+        void (*destroy)(void *storage);
+    };
+
+    template<class Func>
+    static constexpr bool fits() {
+        return sizeof(Func) <= INLINE_SIZE_ &&
+               alignof(std::max_align_t) % alignof(Func) == 0 &&
+               std::is_nothrow_destructible<Func>::value;
+    }
+
+    template<class Func, class F>
+    void emplace_impl(F &&func, std::true_type) {
+        new (storage_) Func(std::forward<F>(func));
+        ops_ = &InlineOps<Func>::ops_;
+    }
+
+    template<class Func, class F>
+    void emplace_impl(F &&func, std::false_type) {
+        *reinterpret_cast<Func **>(storage_) = new Func(std::forward<F>(func));
+        ops_ = &HeapOps<Func>::ops_;
+    }
+
+    template<class Func>
+    struct InlineOps {
+        static void invoke(void *storage) {
+            (*static_cast<Func *>(storage))();
+        }
+        static void destroy(void *storage) {
+            static_cast<Func *>(storage)->~Func();
+        }
+        static const Ops ops_;
+    };
+
+    template<class Func>
+    struct HeapOps {
+        static void invoke(void *storage) {
+            (**static_cast<Func **>(storage))();
+        }
+        static void destroy(void *storage) {
+            delete *static_cast<Func **>(storage);
+        }
+        static const Ops ops_;
+    };
+
+    alignas(std::max_align_t) unsigned char storage_[INLINE_SIZE_];
+    const Ops *ops_;
+};
+
+template<class Func>
+const Task::Ops Task::InlineOps<Func>::ops_ = {&Task::InlineOps<Func>::invoke,
+                                               &Task::InlineOps<Func>::destroy};
+
+template<class Func>
+const Task::Ops Task::HeapOps<Func>::ops_ = {&Task::HeapOps<Func>::invoke,
+                                             &Task::HeapOps<Func>::destroy};
+
+#endif
@@ -1,14 +1,47 @@
+/**
+ * ThreadPool is a work-stealing scheduler.
+ *
+ * 1. queues:
+ *     every worker owns a lock-free WorkStealingDeque. tasks submitted by a worker (e.g. a task
+ *     that queues a follow-up) go to the bottom of its own deque. tasks submitted from outside
+ *     the pool, like the reactor's deal_read/deal_write, go to a global injection ring.
+ *
+ * 2. where a worker looks for its next task:
+ *     own deque (LIFO) -> injection ring -> steal from the other workers (FIFO) -> park.
+ *     when it takes from the injection ring, a worker moves a batch of tasks into its own
+ *     deque, so idle workers can steal from that batch.
+ *
+ * 3. parking:
+ *     an idle worker registers itself in sleepers_ and re-checks the queues before it blocks
+ *     on cond_. a submitter only touches park_mutex_ when sleepers_ is non-zero, so a busy pool
+ *     is never woken through a futex.
+ *
+ * 4. allocation-free submission:
+ *     tasks live in a slab of max_tasks Task slots allocated up front, free slots are kept in
+ *     a lock-free ring. AddTask takes a free slot, constructs the callable in the slot's inline
+ *     storage and pushes the slot pointer, so a small task such as
+ *     std::bind(&WebServer::on_read, this, client, generation) is queued without any malloc.
+ *     if every slot is in use the pool is overloaded, and the submitting thread runs the task
+ *     itself, which throttles the producer instead of growing the queue without bound.
+*/
+
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
-#include <functional>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <utility>
+#include <vector>
+
+#include "mpmcring.h"
+#include "task.h"
+#include "workstealingdeque.h"
 
 class ThreadPool {
 public:
@@ -18,67 +51,227 @@ public:
      * create a thread pool with thread number as a specified number to execute tasks
      * concurrently
      * @param thread_num the number of threads to execute tasks in the thread pool
+     * @param max_tasks the number of task slots, i.e. how many tasks may be queued or running
     */
-    explicit ThreadPool(size_t thread_num = 8) : pool_(std::make_shared<Pool>()) {
-        assert(thread_num > 0);
-        for (auto i = 0; i < thread_num; i++) {
-           std::thread([pool = pool_] {
-                std::unique_lock<std::mutex> locker(pool->mutex_);
-                while (true) {
-                    /**
-                     * why unlock -> task() -> lock() ?
-                     * to ensure that the task execution doesnot holds the lock, this could:
-                     *   1. avoid blocking other threads:
-                     *       if the mutex remained locked while the task is executing, other
-                     *       threads in the pool would be blocked from accessing other tasks.
-                     *   2. prevent deadlocks:
-                     *       if the task begin executed involves operations that might need
-                     *       to acquire the same mutex, this may cause deadlocks.
-                    */
-                    if (!pool->tasks_.empty()) {
-                        auto task = std::move(pool->tasks_.front());
-                        pool->tasks_.pop();
-                        locker.unlock();
-                        task();
-                        locker.lock();
-                    } else if (pool->is_closed_) {
-                        break;
-                    } else {
-                        pool->cond_.wait(locker);
-                    }
-                }
-           }).detach();
+    explicit ThreadPool(size_t thread_num = 8, size_t max_tasks = 4096) :
+        pool_(std::make_shared<Pool>(thread_num, max_tasks)) {
+        assert(thread_num > 0 && max_tasks > 0);
+        for (size_t i = 0; i < thread_num; i++) {
+            std::thread([pool = pool_, i] {
+                pool->run(i);
+            }).detach();
         }
     }
 
     ~ThreadPool() {
         if (static_cast<bool>(pool_)) {
             {
-                std::lock_guard<std::mutex> locker(pool_->mutex_);
+                std::lock_guard<std::mutex> locker(pool_->park_mutex_);
                 pool_->is_closed_ = true;
             }
             pool_->cond_.notify_all();
         }
     }
 
+    /**
+     * queue a task, or run it on the calling thread if every task slot is in use
+     * @param task callable invoked with no arguments
+    */
     template<class F>
     void AddTask(F &&task) {
-        {
-            std::lock_guard<std::mutex> locker(pool_->mutex_);
-            pool_->tasks_.emplace(std::forward<F>(task));
+        Task *slot = nullptr;
+        if (!pool_->free_.pop(slot)) {
+            // every slot is queued or running, run the task on the caller
+            task();
+            return;
+        }
+        slot->emplace(std::forward<F>(task));
+        pool_->submit(slot);
+    }
+
+    /**
+     * queue a task unless every task slot is in use. for tasks that must never run on the
+     * caller, e.g. blocking calls submitted by an event loop
+     * @param task callable invoked with no arguments
+     * @return false if the pool is full and the task was not queued
+    */
+    template<class F>
+    bool TryAddTask(F &&task) {
+        Task *slot = nullptr;
+        if (!pool_->free_.pop(slot)) {
+            return false;
         }
-        pool_->cond_.notify_one();
+        slot->emplace(std::forward<F>(task));
+        pool_->submit(slot);
+        return true;
     }
 
 private:
+
     struct Pool {
-        std::mutex mutex_;
+        /**
+         * max number of tasks a worker moves from the injection queue to its deque at once
+        */
+        static const size_t BATCH_ = 32;
+
+        Pool(size_t thread_num, size_t max_tasks) :
+            tasks_(new Task[max_tasks]), free_(max_tasks), inject_(max_tasks), sleepers_(0),
+            is_closed_(false) {
+            for (size_t i = 0; i < max_tasks; i++) {
+                free_.push(&tasks_[i]);
+            }
+            for (size_t i = 0; i < thread_num; i++) {
+                workers_.emplace_back(new WorkStealingDeque<Task *>());
+            }
+        }
+
+        /**
+         * the worker this thread belongs to, nullptr if it is not a worker of this pool
+        */
+        WorkStealingDeque<Task *> *self() {
+            const std::pair<Pool *, size_t> &current = current_worker();
+            return current.first == this ? workers_[current.second].get() : nullptr;
+        }
+
+        void submit(Task *task) {
+            WorkStealingDeque<Task *> *deque = self();
+            if (deque == nullptr || !deque->push(task)) {
+                // never fails, the ring can hold every slot of the slab
+                inject_.push(task);
+            }
+            wake_one();
+        }
+
+        void wake_one() {
+            /**
+             * pairs with the sleepers_ increment in park(): either the parking worker sees the
+             * new task when it re-checks, or this thread sees the sleeper and notifies it
+            */
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleepers_.load(std::memory_order_relaxed) > 0) {
+                { std::lock_guard<std::mutex> locker(park_mutex_); }
+                cond_.notify_one();
+            }
+        }
+
+        /**
+         * move up to a fair share of the injection queue into the worker's deque
+         * @return the first task of the batch, or nullptr if the queue is empty
+        */
+        Task *take_injected(WorkStealingDeque<Task *> &deque) {
+            Task *task = nullptr;
+            if (!inject_.pop(task)) {
+                return nullptr;
+            }
+            size_t batch = inject_.size() / workers_.size();
+            if (batch > BATCH_) {
+                batch = BATCH_;
+            }
+            Task *item = nullptr;
+            for (size_t i = 0; i < batch && inject_.pop(item); i++) {
+                if (!deque.push(item)) {
+                    inject_.push(item);
+                    break;
+                }
+            }
+            return task;
+        }
+
+        Task *steal(size_t index, uint32_t &seed) {
+            size_t n = workers_.size();
+            // xorshift, so that thieves do not all start with the same victim
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            Task *task = nullptr;
+            for (size_t i = 0, start = seed % n; i < n; i++) {
+                size_t victim = (start + i) % n;
+                if (victim != index && workers_[victim]->steal(task)) {
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+
+        bool has_work() {
+            if (!inject_.empty()) {
+                return true;
+            }
+            for (auto &deque : workers_) {
+                if (!deque->empty()) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * block until there might be work
+         * @return false if the pool is closed and drained
+        */
+        bool park() {
+            std::unique_lock<std::mutex> locker(park_mutex_);
+            sleepers_.fetch_add(1, std::memory_order_seq_cst);
+            bool keep_running = true;
+            if (!has_work()) {
+                if (is_closed_) {
+                    keep_running = false;
+                } else {
+                    cond_.wait(locker);
+                }
+            }
+            sleepers_.fetch_sub(1, std::memory_order_relaxed);
+            return keep_running;
+        }
+
+        void run(size_t index) {
+            current_worker() = std::make_pair(this, index);
+            WorkStealingDeque<Task *> &deque = *workers_[index];
+            uint32_t seed = static_cast<uint32_t>(index) * 2654435761u + 1;
+            while (true) {
+                Task *task = nullptr;
+                if (!deque.pop(task)) {
+                    task = take_injected(deque);
+                    if (task != nullptr && !deque.empty()) {
+                        // the batch can be stolen by idle workers
+                        wake_one();
+                    }
+                }
+                if (task == nullptr) {
+                    task = steal(index, seed);
+                }
+                if (task != nullptr) {
+                    (*task)();
+                    task->reset();
+                    free_.push(task);
+                } else if (!park()) {
+                    break;
+                }
+            }
+            current_worker() = std::make_pair(nullptr, 0);
+        }
+
+        static std::pair<Pool *, size_t> &current_worker() {
+            static thread_local std::pair<Pool *, size_t> current(nullptr, 0);
+            return current;
+        }
+
+        /**
+         * a slot is either in free_, or queued in inject_ / a worker deque, or running
+        */
+        std::unique_ptr<Task[]> tasks_;
+        MpmcRing<Task *> free_;
+        MpmcRing<Task *> inject_;
+
+        std::vector<std::unique_ptr<WorkStealingDeque<Task *>>> workers_;
+
+        std::mutex park_mutex_;
         std::condition_variable cond_;
+        std::atomic<int> sleepers_;
         bool is_closed_;
-        std::queue<std::function<void()>> tasks_;
     };
     std::shared_ptr<Pool> pool_;
 };
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,120 @@
+/**
+ * WorkStealingDeque is a fixed-capacity Chase-Lev deque. It has exactly one owner thread that
+ * pushes and pops at the bottom, while any number of thief threads steal from the top. push and
+ * pop of the owner never take a lock, and only the last element is fought over with a CAS.
+ *
+ *        steal() --> +-----+-----+-----+-----+-----+ <-- push() / pop()
+ *                    top_                     bottom_
+ *
+ * the owner works LIFO on the bottom, which keeps recently pushed (cache-hot) tasks on the
+ * same thread, while thieves take the oldest tasks from the top.
+ *
+ * elements are stored in std::atomic slots, so T must be trivially copyable (e.g. a pointer).
+*/
+
+#ifndef WORKSTEALINGDEQUE_H
+#define WORKSTEALINGDEQUE_H
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+template<class T>
+class WorkStealingDeque {
+public:
+    /**
+     * @param capacity max number of elements, rounded up to a power of two
+    */
+    explicit WorkStealingDeque(size_t capacity = 256) : top_(0), bottom_(0) {
+        assert(capacity > 0);
+        size_t size = 1;
+        while (size < capacity) {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        buffer_.reset(new std::atomic<T>[size]);
+    }
+
+    /**
+     * push an element at the bottom. owner thread only
+     * @param item element to be pushed
+     * @return false if the deque is full
+    */
+    bool push(T item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t > static_cast<int64_t>(mask_)) {
+            return false;
+        }
+        buffer_[b & mask_].store(item, std::memory_order_relaxed);
+        // publishes the element (and whatever it points to) to the thieves
+        bottom_.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * pop the most recently pushed element. owner thread only
+     * @param item where the popped element is stored
+     * @return false if the deque is empty or a thief took the last element
+    */
+    bool pop(T &item) {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = buffer_[b & mask_].load(std::memory_order_relaxed);
+        if (t == b) {
+            // last element, race against the thieves for it
+            bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                    std::memory_order_relaxed);
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    /**
+     * take the oldest element. may be called from any thread
+     * @param item where the stolen element is stored
+     * @return false if the deque is empty or another thread won the race
+    */
+    bool steal(T &item) {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b) {
+            return false;
+        }
+        item = buffer_[t & mask_].load(std::memory_order_relaxed);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
+    }
+
+    /**
+     * check whether the deque looks empty. the answer may be stale as soon as it is returned
+     * @return whether the deque is empty
+    */
+    bool empty() const {
+        return bottom_.load(std::memory_order_relaxed) <= top_.load(std::memory_order_relaxed);
+    }
+
+private:
+    /**
+     * top_ is written by thieves and bottom_ by the owner, keep them on separate cache lines.
+     * padding is used instead of alignas since the deque is allocated with plain new
+    */
+    std::atomic<int64_t> top_;
+    char top_pad_[64 - sizeof(std::atomic<int64_t>)];
+    std::atomic<int64_t> bottom_;
+    char bottom_pad_[64 - sizeof(std::atomic<int64_t>)];
+    size_t mask_;
+    std::unique_ptr<std::atomic<T>[]> buffer_;
+};
+
+#endif
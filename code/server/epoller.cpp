@@ -1,33 +1,57 @@
 #include "epoller.h"
+#include "../log/log.h"
 #include <cassert>
 #include <cstdint>
 #include <sys/epoll.h>
 #include <unistd.h>
 
-Epoller::Epoller(int max_event) : epoller_fd_(epoll_create(512)), events_(max_event) {
-    assert(epoller_fd_ >= 0 && events_.size() > 0);
+Epoller::Epoller(int max_event, Backend backend) : epoller_fd_(-1), events_(max_event) {
+    assert(events_.size() > 0);
+    if (backend == IO_URING) {
+        uring_.reset(new IoUring(max_event));
+        if (uring_->is_valid()) {
+            results_.resize(max_event);
+            return;
+        }
+        uring_.reset();
+        LOG_WARN("io_uring unavailable, fall back to epoll");
+    }
+    epoller_fd_ = epoll_create(512);
+    assert(epoller_fd_ >= 0);
 }
 
 Epoller::~Epoller() {
-    close(epoller_fd_);
+    if (epoller_fd_ >= 0) {
+        close(epoller_fd_);
+    }
+}
+
+bool Epoller::enable_io() {
+    return uring_ && uring_->init_buffers();
 }
 
-bool Epoller::add_fd(int fd, uint32_t events) {
+bool Epoller::add_fd(int fd, uint32_t events, uint32_t generation, bool is_io) {
     if (fd < 0) {
         return false;
     }
+    if (uring_) {
+        return uring_->add_fd(fd, events, generation, is_io);
+    }
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = pack(fd, generation);
     ev.events = events;
     return 0 == epoll_ctl(epoller_fd_, EPOLL_CTL_ADD, fd, &ev);
 }
 
-bool Epoller::mod_fd(int fd, uint32_t events) {
+bool Epoller::mod_fd(int fd, uint32_t events, uint32_t generation) {
     if (fd < 0) {
         return false;
     }
+    if (uring_) {
+        return uring_->mod_fd(fd, events, generation);
+    }
     epoll_event ev = {0};
-    ev.data.fd = fd;
+    ev.data.u64 = pack(fd, generation);
     ev.events = events;
     return 0 == epoll_ctl(epoller_fd_, EPOLL_CTL_MOD, fd, &ev);
 }
@@ -36,11 +60,22 @@ bool Epoller::del_fd(int fd) {
     if (fd < 0) {
         return false;
     }
+    if (uring_) {
+        return uring_->del_fd(fd);
+    }
     epoll_event ev = {0};
     return 0 == epoll_ctl(epoller_fd_, EPOLL_CTL_DEL, fd, &ev);
 }
 
+bool Epoller::send(int fd, const struct msghdr *msg, int flags) {
+    return uring_ && uring_->send(fd, msg, flags);
+}
+
 int Epoller::wait(int timeout_ms) {
+    if (uring_) {
+        return uring_->wait(timeout_ms, &events_[0], &results_[0],
+                            static_cast<int>(events_.size()));
+    }
     return epoll_wait(epoller_fd_, &events_[0], static_cast<int>(events_.size()), timeout_ms);
 }
 
@@ -52,4 +87,34 @@ int Epoller::get_event_fd(size_t i) const {
 uint32_t Epoller::get_events(size_t i) const {
     assert(i < events_.size() && i >= 0);
     return events_[i].events;
+}
+
+uint32_t Epoller::get_event_generation(size_t i) const {
+    assert(i < events_.size() && i >= 0);
+    return static_cast<uint32_t>(events_[i].data.u64 >> 32);
+}
+
+std::string_view Epoller::get_event_data(size_t i) const {
+    assert(i < events_.size());
+    if (!uring_ || results_[i].data == nullptr) {
+        return {};
+    }
+    return std::string_view(results_[i].data, results_[i].len);
+}
+
+bool Epoller::get_event_sent(size_t i, ssize_t *len) const {
+    assert(i < events_.size());
+    if (!uring_ || !results_[i].is_send) {
+        return false;
+    }
+    *len = results_[i].len;
+    return true;
+}
+
+uint64_t Epoller::pack(int fd, uint32_t generation) {
+    return (static_cast<uint64_t>(generation) << 32) | static_cast<uint32_t>(fd);
+}
+
+Epoller::Backend Epoller::backend() const {
+    return uring_ ? IO_URING : EPOLL;
 }
\ No newline at end of file
@@ -2,38 +2,66 @@
 #define EPOLLER_H_
 
 #include <cstdint>
+#include <memory>
+#include <string_view>
 #include <vector>
 #include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "iouring.h"
 
 
 class Epoller {
 public:
+    /**
+     * the kernel interface used to wait for events
+    */
+    enum Backend {
+        EPOLL = 0,
+        IO_URING,
+    };
+
     /**
      * initialize the epoller_fd_ file descriptor by calling 'epoll_create' and initialize the
      * events_ vector to hold max_event number of epoll_event structures.
+     * @param max_event max number of events returned by one wait()
+     * @param backend EPOLL, or IO_URING to poll through io_uring. falls back to EPOLL if the
+     *                kernel does not support io_uring
     */
-    explicit Epoller(int max_event = 1024);
+    explicit Epoller(int max_event = 1024, Backend backend = EPOLL);
 
     /**
      * close file dexcriptor
     */
     ~Epoller();
 
+    /**
+     * let the backend receive from and send to the fds added with is_io itself, see
+     * get_event_data() and send()
+     * @return false if it only reports readiness: epoll, or io_uring on a kernel before 5.7
+    */
+    bool enable_io();
+
     /**
      * adds a file descriptor to the epoll instance, monitoring it for the events secified in 'events'
      * @param fd file descriptor to be added
      * @param events events to be added
+     * @param generation generation tag reported back with every event of fd, see get_event_generation()
+     * @param is_io the backend receives from the fd, if enable_io() succeeded. the generation
+     *              must not change until del_fd()
      * @return true if the operation is successful, otherwise false
     */
-    bool add_fd(int fd, uint32_t events);
+    bool add_fd(int fd, uint32_t events, uint32_t generation = 0, bool is_io = false);
 
     /**
      * modifies the event mask for a file descriptor fd in the epoll instance
      * @param fd file descriptor to be modifued
      * @param events events to be modified
+     * @param generation generation tag reported back with every event of fd
      * @return true if the operation is successful, otherwise false
     */
-    bool mod_fd(int fd, uint32_t events);
+    bool mod_fd(int fd, uint32_t events, uint32_t generation = 0);
 
     /**
      * deletes a file descriptor from the epoll instance
@@ -42,6 +70,16 @@ public:
     */
     bool del_fd(int fd);
 
+    /**
+     * send a message to an fd added with is_io through the backend. the send is reported by
+     * wait() as an event, see get_event_sent(). the fd must not be closed before
+     * @param fd file descriptor to send to
+     * @param msg message to be sent, it and the bytes it points to must stay valid until then
+     * @param flags flags of sendmsg()
+     * @return false if the backend does not send for the fd, the caller writes itself
+    */
+    bool send(int fd, const struct msghdr *msg, int flags);
+
     /**
      * waits for events on the file descriptors added to the epoll instance
      * @param timeout_ms specifies the maximum time to wait in ms
@@ -62,6 +100,44 @@ public:
      * @return the event associated with the i th event in the 'events_' vector
     */
     uint32_t get_events(size_t i) const;
+
+    /**
+     * get the generation tag the fd of the i th event was registered with. the fd and the tag
+     * are packed together into epoll_event.data.u64
+     * @param i position of the event
+     * @return the generation passed to add_fd/mod_fd
+    */
+    uint32_t get_event_generation(size_t i) const;
+
+    /**
+     * get the bytes the backend received for an EPOLLIN event of an fd added with is_io
+     * @param i position of the event
+     * @return the bytes, valid until the next wait(). empty if the caller has to read the
+     *         socket itself
+    */
+    std::string_view get_event_data(size_t i) const;
+
+    /**
+     * check whether the i th event completes a send()
+     * @param i position of the event
+     * @param len set to the number of bytes sent, -errno if the send failed
+     * @return true for the completion of a send()
+    */
+    bool get_event_sent(size_t i, ssize_t *len) const;
+
+    /**
+     * pack a file descriptor and a generation tag into the epoll_event.data.u64 layout
+     * @param fd file descriptor, stored in the low 32 bits so data.fd still reads it
+     * @param generation generation tag, stored in the high 32 bits
+     * @return packed tag
+    */
+    static uint64_t pack(int fd, uint32_t generation);
+
+    /**
+     * get the backend actually in use
+     * @return EPOLL or IO_URING
+    */
+    Backend backend() const;
 private:
     /**
      * hold the file descriptor for the epoll instance
@@ -72,6 +148,16 @@ private:
      * stores theevents that are returned by the epoll_wait system call
     */
     std::vector<struct epoll_event> events_;
+
+    /**
+     * what the io_uring backend did for each event besides reporting it
+    */
+    std::vector<IoUring::Result> results_;
+
+    /**
+     * the io_uring backend, nullptr when epoll is used
+    */
+    std::unique_ptr<IoUring> uring_;
 };
 
 #endif
\ No newline at end of file
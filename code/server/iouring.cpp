@@ -0,0 +1,471 @@
+#include "iouring.h"
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+IoUring::IoUring(unsigned entries) :
+    ring_fd_(-1), features_(0), sq_ptr_(MAP_FAILED), sq_map_size_(0), cq_ptr_(MAP_FAILED),
+    cq_map_size_(0), sqes_(static_cast<io_uring_sqe *>(MAP_FAILED)), sqes_map_size_(0),
+    loop_tid_(std::thread::id()), timeout_({0, 0}), bufs_(nullptr) {
+    assert(entries > 0);
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = entries * 4;
+
+    ring_fd_ = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd_ < 0) {
+        return;
+    }
+    features_ = params.features;
+
+    /**
+     * the submission ring, the completion ring and the entry array are shared with the kernel
+     * through mmap. since 5.4 both rings live in a single mapping (IORING_FEAT_SINGLE_MMAP)
+    */
+    sq_map_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_map_size_ = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = features_ & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap) {
+        sq_map_size_ = cq_map_size_ = std::max(sq_map_size_, cq_map_size_);
+    }
+    sq_ptr_ = mmap(nullptr, sq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   ring_fd_, IORING_OFF_SQ_RING);
+    if (sq_ptr_ == MAP_FAILED) {
+        return;
+    }
+    if (single_mmap) {
+        cq_ptr_ = sq_ptr_;
+    } else {
+        cq_ptr_ = mmap(nullptr, cq_map_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_CQ_RING);
+        if (cq_ptr_ == MAP_FAILED) {
+            return;
+        }
+    }
+    sqes_map_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+    sqes_ = static_cast<io_uring_sqe *>(mmap(nullptr, sqes_map_size_, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES));
+    if (sqes_ == MAP_FAILED) {
+        return;
+    }
+
+    char *sq = static_cast<char *>(sq_ptr_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_entries_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_entries);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+
+    char *cq = static_cast<char *>(cq_ptr_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    // slot i of the submission ring always points at entry i
+    for (unsigned i = 0; i < *sq_entries_; i++) {
+        sq_array_[i] = i;
+    }
+}
+
+IoUring::~IoUring() {
+    if (bufs_ != nullptr) {
+        // closing the ring below drops the buffers it still holds
+        munmap(bufs_, BUF_NUM_ * BUF_SIZE_);
+    }
+    if (sqes_ != MAP_FAILED) {
+        munmap(sqes_, sqes_map_size_);
+    }
+    if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+        munmap(cq_ptr_, cq_map_size_);
+    }
+    if (sq_ptr_ != MAP_FAILED) {
+        munmap(sq_ptr_, sq_map_size_);
+    }
+    if (ring_fd_ >= 0) {
+        close(ring_fd_);
+    }
+}
+
+bool IoUring::is_valid() const {
+    return ring_fd_ >= 0 && sq_ptr_ != MAP_FAILED && cq_ptr_ != MAP_FAILED && sqes_ != MAP_FAILED;
+}
+
+bool IoUring::init_buffers() {
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (bufs_ != nullptr) {
+        return true;
+    }
+    if (!(features_ & IORING_FEAT_FAST_POLL)) {
+        // the feature bit of 5.7, the release that brought provided buffers
+        return false;
+    }
+    void *mem = mmap(nullptr, BUF_NUM_ * BUF_SIZE_, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (mem == MAP_FAILED) {
+        return false;
+    }
+    bufs_ = static_cast<char *>(mem);
+    for (unsigned bid = 0; bid < BUF_NUM_; bid++) {
+        recycle(static_cast<uint16_t>(bid));
+    }
+    publish();
+    return true;
+}
+
+bool IoUring::add_fd(int fd, uint32_t events, uint32_t generation, bool is_io) {
+    if (fd < 0 || static_cast<uint64_t>(fd) > FD_MASK_) {
+        return false;
+    }
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (static_cast<size_t>(fd) >= fds_.size()) {
+        fds_.resize(fd + 1, FdState{0, 0, 0, false, false, false, false});
+    }
+    disarm(fd);
+    FdState &state = fds_[fd];
+    state.events = events;
+    state.generation = generation;
+    state.is_io = is_io && bufs_ != nullptr;
+    state.is_receiving = false;
+    state.is_sending = false;
+    bool ret = arm(fd);
+    submit_if_foreign();
+    return ret;
+}
+
+bool IoUring::mod_fd(int fd, uint32_t events, uint32_t generation) {
+    if (fd < 0 || static_cast<uint64_t>(fd) > FD_MASK_) {
+        return false;
+    }
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (static_cast<size_t>(fd) >= fds_.size()) {
+        fds_.resize(fd + 1, FdState{0, 0, 0, false, false, false, false});
+    }
+    disarm(fd);
+    fds_[fd].events = events;
+    fds_[fd].generation = generation;
+    bool ret = arm(fd);
+    submit_if_foreign();
+    return ret;
+}
+
+bool IoUring::del_fd(int fd) {
+    if (fd < 0) {
+        return false;
+    }
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (static_cast<size_t>(fd) >= fds_.size()) {
+        return false;
+    }
+    FdState &state = fds_[fd];
+    bool is_io = state.is_io;
+    bool ret = disarm(fd);
+    if (state.is_receiving) {
+        // the fd is about to be closed, bytes still in flight belong to nobody
+        ret = cancel(make_tag(fd, state.generation, RECV)) && ret;
+        state.is_receiving = false;
+    }
+    if (state.is_sending) {
+        // is_sending stays set until the completion, which the caller waits for
+        ret = cancel(make_tag(fd, state.generation, SEND)) && ret;
+    }
+    state.events = 0;
+    state.is_io = false;
+    if (is_io && pending() > 0) {
+        /**
+         * the fd is closed next and its number may be reused at once. a recv still in the
+         * submission ring would be bound to the next socket and take its bytes
+        */
+        enter(pending(), 0, 0, nullptr, 0);
+    } else {
+        submit_if_foreign();
+    }
+    return ret;
+}
+
+bool IoUring::send(int fd, const struct msghdr *msg, int flags) {
+    std::lock_guard<std::mutex> locker(mutex_);
+    if (fd < 0 || static_cast<size_t>(fd) >= fds_.size()) {
+        return false;
+    }
+    FdState &state = fds_[fd];
+    if (!state.is_io || state.is_sending) {
+        return false;
+    }
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_SENDMSG;
+    sqe.fd = fd;
+    sqe.addr = reinterpret_cast<uint64_t>(msg);
+    sqe.len = 1;
+    sqe.msg_flags = static_cast<uint32_t>(flags | MSG_NOSIGNAL);
+    sqe.user_data = make_tag(fd, state.generation, SEND);
+    state.is_sending = push(sqe);
+    submit_if_foreign();
+    return state.is_sending;
+}
+
+int IoUring::wait(int timeout_ms, struct epoll_event *events, Result *results,
+                  int max_events) {
+    assert(events != nullptr && results != nullptr && max_events > 0);
+    loop_tid_ = std::this_thread::get_id();
+    if (!lent_.empty() || !recycled_.empty()) {
+        // the caller is done with the bytes of the last events
+        std::lock_guard<std::mutex> locker(mutex_);
+        recycled_.insert(recycled_.end(), lent_.begin(), lent_.end());
+        lent_.clear();
+        publish();
+    }
+    unsigned min_complete = timeout_ms == 0 ? 0 : 1;
+    unsigned flags = IORING_ENTER_GETEVENTS;
+    int ret;
+
+    /**
+     * the queued entries are submitted by the same call that waits, and the lock is not held
+     * while blocking: the kernel serializes concurrent io_uring_enter calls and never consumes
+     * more entries than have been published
+    */
+    if (features_ & IORING_FEAT_EXT_ARG) {
+        struct __kernel_timespec ts = {timeout_ms / 1000, (timeout_ms % 1000) * 1000000LL};
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        if (timeout_ms > 0) {
+            arg.ts = reinterpret_cast<uint64_t>(&ts);
+        }
+        unsigned to_submit;
+        {
+            std::lock_guard<std::mutex> locker(mutex_);
+            to_submit = pending();
+        }
+        ret = enter(to_submit, min_complete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        unsigned to_submit;
+        {
+            std::lock_guard<std::mutex> locker(mutex_);
+            if (timeout_ms > 0) {
+                // completes after the timeout or as soon as any other entry completes
+                struct io_uring_sqe sqe;
+                memset(&sqe, 0, sizeof(sqe));
+                timeout_.tv_sec = timeout_ms / 1000;
+                timeout_.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+                sqe.opcode = IORING_OP_TIMEOUT;
+                sqe.fd = -1;
+                sqe.addr = reinterpret_cast<uint64_t>(&timeout_);
+                sqe.len = 1;
+                sqe.off = 1;
+                sqe.user_data = IGNORED_TAG_;
+                push(sqe);
+            }
+            to_submit = pending();
+        }
+        ret = enter(to_submit, min_complete, flags, nullptr, 0);
+    }
+    if (ret < 0 && errno != ETIME && errno != EBUSY) {
+        return -1;
+    }
+
+    int cnt = 0;
+    std::lock_guard<std::mutex> locker(mutex_);
+    unsigned head = *cq_head_;
+    unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+    while (head != tail && cnt < max_events) {
+        const struct io_uring_cqe &cqe = cqes_[head & *cq_mask_];
+        head++;
+        if (cqe.user_data == IGNORED_TAG_) {
+            continue;
+        }
+        int fd = static_cast<int>(cqe.user_data & FD_MASK_);
+        KIND_ kind = static_cast<KIND_>((cqe.user_data >> 30) & 3);
+        uint32_t seq = static_cast<uint32_t>(cqe.user_data >> 32);
+        bool has_buffer = kind == RECV && (cqe.flags & IORING_CQE_F_BUFFER);
+        uint16_t bid = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        FdState *state = static_cast<size_t>(fd) < fds_.size() ? &fds_[fd] : nullptr;
+        if (state == nullptr || (kind == POLL && (!state->armed || state->seq != seq)) ||
+            (kind == RECV && (!state->is_io || state->generation != seq)) ||
+            (kind == SEND && state->generation != seq)) {
+            // the poll has been removed or replaced, or the fd closed since it was queued
+            if (has_buffer) {
+                recycle(bid);
+            }
+            continue;
+        }
+
+        events[cnt].data.u64 = (static_cast<uint64_t>(state->generation) << 32) |
+                               static_cast<uint32_t>(fd);
+        results[cnt] = Result{nullptr, 0, false};
+        if (kind == POLL) {
+            state->armed = false;
+            events[cnt].events = cqe.res < 0 ? EPOLLERR : static_cast<uint32_t>(cqe.res);
+        } else if (kind == SEND) {
+            state->is_sending = false;
+            events[cnt].events = EPOLLOUT;
+            results[cnt].len = cqe.res;
+            results[cnt].is_send = true;
+        } else {
+            state->is_receiving = false;
+            if (has_buffer && cqe.res <= 0) {
+                recycle(bid);
+            }
+            if (cqe.res > 0) {
+                // lent to the caller until the next wait()
+                lent_.push_back(bid);
+                events[cnt].events = EPOLLIN;
+                results[cnt].data = bufs_ + bid * BUF_SIZE_;
+                results[cnt].len = cqe.res;
+            } else if (cqe.res == 0) {
+                // the peer shut its side down
+                events[cnt].events = EPOLLIN | EPOLLRDHUP;
+            } else if (cqe.res == -ENOBUFS) {
+                // the pool ran dry, the caller reads the bytes itself
+                events[cnt].events = EPOLLIN;
+            } else {
+                events[cnt].events = EPOLLERR;
+            }
+        }
+        cnt++;
+        if (state->events & EPOLLONESHOT) {
+            continue;
+        }
+        if (kind == POLL) {
+            arm(fd);
+        } else if (kind == RECV && (state->events & EPOLLIN) &&
+                   (cqe.res > 0 || cqe.res == -ENOBUFS)) {
+            // only the recv is queued again, a poll for the other events may still be armed
+            state->is_receiving = receive(fd);
+        }
+    }
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    return cnt;
+}
+
+bool IoUring::arm(int fd) {
+    FdState &state = fds_[fd];
+    uint32_t events = state.events & (EPOLLIN | EPOLLOUT | EPOLLPRI | EPOLLRDHUP);
+    if (state.is_io && (events & EPOLLIN)) {
+        // the recv reports the bytes and the hang-up alike
+        if (!state.is_receiving) {
+            state.is_receiving = receive(fd);
+        }
+        events &= ~(EPOLLIN | EPOLLRDHUP);
+        if (events == 0 || !state.is_receiving) {
+            return state.is_receiving;
+        }
+    }
+    state.seq++;
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_POLL_ADD;
+    sqe.fd = fd;
+    sqe.poll32_events = events;
+    sqe.user_data = make_tag(fd, state.seq);
+    state.armed = push(sqe);
+    return state.armed;
+}
+
+bool IoUring::receive(int fd) {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_RECV;
+    sqe.fd = fd;
+    sqe.flags = IOSQE_BUFFER_SELECT;
+    sqe.buf_group = BUF_GROUP_;
+    sqe.len = BUF_SIZE_;
+    sqe.user_data = make_tag(fd, fds_[fd].generation, RECV);
+    return push(sqe);
+}
+
+bool IoUring::cancel(uint64_t tag) {
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_ASYNC_CANCEL;
+    sqe.fd = -1;
+    sqe.addr = tag;
+    sqe.user_data = IGNORED_TAG_;
+    return push(sqe);
+}
+
+void IoUring::recycle(uint16_t bid) {
+    recycled_.push_back(bid);
+}
+
+void IoUring::publish() {
+    std::sort(recycled_.begin(), recycled_.end());
+    size_t i = 0;
+    while (i < recycled_.size()) {
+        size_t run = 1;
+        while (i + run < recycled_.size() && recycled_[i + run] == recycled_[i] + run) {
+            run++;
+        }
+        struct io_uring_sqe sqe;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_PROVIDE_BUFFERS;
+        // the number of buffers goes in the fd field
+        sqe.fd = static_cast<int>(run);
+        sqe.addr = reinterpret_cast<uint64_t>(bufs_ + recycled_[i] * BUF_SIZE_);
+        sqe.len = BUF_SIZE_;
+        sqe.off = recycled_[i];
+        sqe.buf_group = BUF_GROUP_;
+        sqe.user_data = IGNORED_TAG_;
+        if (!push(sqe)) {
+            // keep the rest for the next wait()
+            break;
+        }
+        i += run;
+    }
+    recycled_.erase(recycled_.begin(), recycled_.begin() + i);
+}
+
+bool IoUring::disarm(int fd) {
+    FdState &state = fds_[fd];
+    if (!state.armed) {
+        return true;
+    }
+    struct io_uring_sqe sqe;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_POLL_REMOVE;
+    sqe.fd = -1;
+    sqe.addr = make_tag(fd, state.seq);
+    sqe.user_data = IGNORED_TAG_;
+    state.armed = false;
+    return push(sqe);
+}
+
+bool IoUring::push(const struct io_uring_sqe &sqe) {
+    unsigned tail = *sq_tail_;
+    if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= *sq_entries_) {
+        // the ring is full, let the kernel consume what is already queued
+        enter(pending(), 0, 0, nullptr, 0);
+        if (tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) >= *sq_entries_) {
+            return false;
+        }
+    }
+    sqes_[tail & *sq_mask_] = sqe;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+unsigned IoUring::pending() const {
+    return *sq_tail_ - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+}
+
+void IoUring::submit_if_foreign() {
+    if (loop_tid_.load() != std::this_thread::get_id() && pending() > 0) {
+        enter(pending(), 0, 0, nullptr, 0);
+    }
+}
+
+int IoUring::enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg,
+                   size_t arg_size) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+                                    flags, arg, arg_size));
+}
+
+uint64_t IoUring::make_tag(int fd, uint32_t seq, KIND_ kind) {
+    return (static_cast<uint64_t>(seq) << 32) | (static_cast<uint64_t>(kind) << 30) |
+           (static_cast<uint64_t>(fd) & FD_MASK_);
+}
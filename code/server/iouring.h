@@ -0,0 +1,292 @@
+/**
+ * IoUring is the io_uring event backend of Epoller. It talks to the kernel through the raw
+ * io_uring_setup/io_uring_enter system calls, so no liburing is needed.
+ *
+ * 1. why io_uring for readiness?
+ *     with epoll every EPOLLONESHOT connection costs one epoll_ctl(MOD) per event to be re-armed
+ *     plus one epoll_wait per loop iteration. here interest changes become IORING_OP_POLL_ADD /
+ *     IORING_OP_POLL_REMOVE submission entries. the entries queued by the event loop thread are
+ *     only handed to the kernel by the io_uring_enter call that also waits for completions, so a
+ *     whole loop iteration costs one system call.
+ *
+ * 2. how epoll semantics are emulated:
+ *     a poll request is one-shot. when it completes, the event is reported and the poll is
+ *     queued again unless the fd was registered with EPOLLONESHOT, in which case it stays
+ *     disarmed until mod_fd() is called, just like epoll. every (re-)registration bumps a
+ *     per-fd sequence number that is packed into user_data, so completions of removed or
+ *     replaced polls are recognized and dropped.
+ *
+ * 3. threading:
+ *     add_fd/mod_fd/del_fd may be called from worker threads while the event loop is blocked in
+ *     wait(). those calls submit their entries immediately, calls from the event loop thread are
+ *     batched until the next wait().
+ *
+ * 4. completion-based I/O:
+ *     after init_buffers(), an fd added with is_io is not polled for EPOLLIN. an IORING_OP_RECV
+ *     is queued instead, and the kernel picks one of the buffers of a pool handed to the ring
+ *     (IORING_OP_PROVIDE_BUFFERS) once data arrives. the EPOLLIN event then carries the bytes,
+ *     and the buffer goes back to the pool at the next wait(). the responses leave through
+ *     send(), an IORING_OP_SENDMSG whose completion is reported as an event as well. neither
+ *     costs the loop thread a system call of its own, both ride on the io_uring_enter of the
+ *     next wait().
+ *
+ *          wait() --> RECV done: EPOLLIN + bytes --> parse, build the response --> send()
+ *            ^                                                                    |
+ *            +------------------- SENDMSG done: bytes sent <----------------------+
+ *
+ *     a recv is never cancelled while the fd stays added, so no bytes the kernel has taken
+ *     off the socket get lost. it is queued again after every completion while the fd is
+ *     registered for EPOLLIN, and the bytes of one that completes after interest in EPOLLIN
+ *     was dropped are still reported.
+*/
+
+#ifndef IOURING_H_
+#define IOURING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <thread>
+#include <vector>
+
+class IoUring {
+public:
+    /**
+     * what the ring did for an event, besides finding the fd ready
+    */
+    struct Result {
+        /**
+         * bytes received for an EPOLLIN event, valid until the next wait(). nullptr if the
+         * caller has to read the socket itself
+        */
+        const char *data;
+
+        /**
+         * number of bytes received or sent, -errno if a send failed
+        */
+        ssize_t len;
+
+        /**
+         * the event completes a send()
+        */
+        bool is_send;
+    };
+
+    /**
+     * set up an io_uring instance and map its submission and completion rings
+     * @param entries number of submission queue entries, the completion queue is 4 times larger
+    */
+    explicit IoUring(unsigned entries = 1024);
+
+    /**
+     * unmap the rings and close the io_uring file descriptor
+    */
+    ~IoUring();
+
+    /**
+     * check whether the io_uring instance was set up successfully
+     * @return false if the kernel refused io_uring_setup or the rings could not be mapped
+    */
+    bool is_valid() const;
+
+    /**
+     * hand the pool of receive buffers to the kernel, so fds added with is_io are
+     * received from by the ring
+     * @return false if the kernel does not support provided buffers (before 5.7)
+    */
+    bool init_buffers();
+
+    /**
+     * start polling a file descriptor for the epoll events in 'events'
+     * @param fd file descriptor to be added
+     * @param events epoll events, EPOLLONESHOT is honored, EPOLLET is ignored
+     * @param generation generation tag reported back in the high half of data.u64
+     * @param is_io receive with the ring instead of polling for EPOLLIN, if init_buffers()
+     *              succeeded. the generation must stay the same until del_fd()
+     * @return true if the request is queued
+    */
+    bool add_fd(int fd, uint32_t events, uint32_t generation = 0, bool is_io = false);
+
+    /**
+     * replace the events polled for a file descriptor and re-arm it
+     * @param fd file descriptor to be modified
+     * @param events epoll events
+     * @param generation generation tag reported back in the high half of data.u64
+     * @return true if the request is queued
+    */
+    bool mod_fd(int fd, uint32_t events, uint32_t generation = 0);
+
+    /**
+     * stop polling a file descriptor, cancelling its recv and send. a cancelled send is still
+     * reported, the fd must not be closed before. the entries of an fd added with is_io are
+     * submitted at once, so none of them meets the next socket that gets the fd number
+     * @param fd file descriptor to be deleted
+     * @return true if the request is queued
+    */
+    bool del_fd(int fd);
+
+    /**
+     * queue a sendmsg() on an fd added with is_io, reported by wait() as an EPOLLOUT event
+     * with is_send set. the message, its iovecs and the bytes they point to must stay valid
+     * until then
+     * @param fd file descriptor to send to
+     * @param msg message to be sent
+     * @param flags flags of sendmsg(), e.g. MSG_MORE
+     * @return false if the fd is not received from by the ring or a send is already queued
+    */
+    bool send(int fd, const struct msghdr *msg, int flags);
+
+    /**
+     * submit the batched requests and wait for completions, after giving the buffers of the
+     * previous events back to the pool
+     * @param timeout_ms maximum time to wait in ms, -1 waits forever
+     * @param events where the ready events are stored, in epoll_event layout
+     * @param results where what the ring did for each event is stored
+     * @param max_events capacity of 'events' and 'results'
+     * @return number of ready events, or -1 if an error occurs
+    */
+    int wait(int timeout_ms, struct epoll_event *events, Result *results, int max_events);
+
+private:
+    /**
+     * the state of a polled file descriptor
+    */
+    struct FdState {
+        uint32_t events;
+        uint32_t generation;
+        uint32_t seq;
+        bool armed;
+        bool is_io;
+        bool is_receiving;
+        bool is_sending;
+    };
+
+    /**
+     * the request a completion belongs to, kept in user_data next to the fd
+    */
+    enum KIND_ {
+        POLL = 0,
+        RECV,
+        SEND,
+    };
+
+    /**
+     * queue a poll request for the current registration of fd, and a recv if it is received
+     * from by the ring and none is queued yet. mutex_ must be held
+    */
+    bool arm(int fd);
+
+    /**
+     * queue a recv into a buffer of the pool, mutex_ must be held
+    */
+    bool receive(int fd);
+
+    /**
+     * queue the cancellation of a recv or send, mutex_ must be held
+    */
+    bool cancel(uint64_t tag);
+
+    /**
+     * give a buffer back to the pool, handed to the kernel by publish(). mutex_ must be held
+    */
+    void recycle(uint16_t bid);
+
+    /**
+     * hand the recycled buffers to the kernel, one IORING_OP_PROVIDE_BUFFERS per run of
+     * consecutive ids. mutex_ must be held
+    */
+    void publish();
+
+    /**
+     * queue the cancellation of the armed poll request of fd, mutex_ must be held
+    */
+    bool disarm(int fd);
+
+    /**
+     * copy an entry into the submission ring and publish it, submitting the queued entries
+     * first if the ring is full. mutex_ must be held
+     * @param sqe entry to be queued
+     * @return false if the ring is still full
+    */
+    bool push(const struct io_uring_sqe &sqe);
+
+    /**
+     * get the number of entries published but not consumed by the kernel yet
+    */
+    unsigned pending() const;
+
+    /**
+     * hand the queued entries to the kernel right away when the caller is not the event loop,
+     * mutex_ must be held
+    */
+    void submit_if_foreign();
+
+    /**
+     * thin wrapper of the io_uring_enter system call
+    */
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t arg_size);
+
+    /**
+     * pack a request into user_data: the fd in the low 30 bits, its KIND_ above them and the
+     * poll sequence number (or the generation for a recv or send) in the high 32 bits
+    */
+    static uint64_t make_tag(int fd, uint32_t seq, KIND_ kind = POLL);
+
+    static const uint64_t IGNORED_TAG_ = ~0ULL;
+    static const uint64_t FD_MASK_ = (1ULL << 30) - 1;
+
+    /**
+     * the pool of receive buffers
+    */
+    static const unsigned BUF_NUM_ = 256;
+    static const size_t BUF_SIZE_ = 8192;
+    static const uint16_t BUF_GROUP_ = 0;
+
+    int ring_fd_;
+    unsigned features_;
+
+    void *sq_ptr_;
+    size_t sq_map_size_;
+    void *cq_ptr_;
+    size_t cq_map_size_;
+    struct io_uring_sqe *sqes_;
+    size_t sqes_map_size_;
+
+    unsigned *sq_head_;
+    unsigned *sq_tail_;
+    unsigned *sq_mask_;
+    unsigned *sq_entries_;
+    unsigned *sq_array_;
+
+    unsigned *cq_head_;
+    unsigned *cq_tail_;
+    unsigned *cq_mask_;
+    struct io_uring_cqe *cqes_;
+
+    /**
+     * thread that runs wait(), entries queued from any other thread are submitted at once
+    */
+    std::atomic<std::thread::id> loop_tid_;
+
+    /**
+     * keeps the timeout alive for the kernel when IORING_FEAT_EXT_ARG is not available
+    */
+    struct __kernel_timespec timeout_;
+
+    std::vector<FdState> fds_;
+    std::mutex mutex_;
+
+    /**
+     * the buffers of the pool, nullptr before init_buffers(). lent_ holds the ones reported by
+     * the last wait(), recycled_ the ones waiting for publish()
+    */
+    char *bufs_;
+    std::vector<uint16_t> lent_;
+    std::vector<uint16_t> recycled_;
+};
+
+#endif
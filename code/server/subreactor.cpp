@@ -0,0 +1,387 @@
+#include "subreactor.h"
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <functional>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+SubReactor::SubReactor(int id, int listen_fd, int timeout_ms, uint32_t listen_event,
+                       uint32_t conn_event, Executor *executor, AsyncUserStore *user_store,
+                       Epoller::Backend backend) :
+    id_(id), listen_fd_(listen_fd), wakeup_fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+    timeout_ms_(timeout_ms), listen_event_(listen_event), conn_event_(conn_event),
+    is_close_(false), timer_(new HeapTimer()), epoller_(new Epoller(1024, backend)),
+    executor_(executor), user_store_(user_store), io_(false) {
+    assert(wakeup_fd_ >= 0);
+    if (backend == Epoller::IO_URING) {
+        io_ = epoller_->enable_io();
+        if (!io_) {
+            LOG_WARN("SubReactor[%d] io_uring only reports readiness", id_);
+        }
+    }
+    epoller_->add_fd(wakeup_fd_, EPOLLIN);
+    if (listen_fd_ >= 0) {
+        epoller_->add_fd(listen_fd_, listen_event_ | EPOLLIN);
+    }
+}
+
+SubReactor::~SubReactor() {
+    stop();
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+    }
+    close(wakeup_fd_);
+}
+
+void SubReactor::start() {
+    assert(!thread_.joinable());
+    thread_ = std::thread(&SubReactor::loop, this);
+}
+
+void SubReactor::stop() {
+    is_close_ = true;
+    uint64_t one = 1;
+    ssize_t ret = write(wakeup_fd_, &one, sizeof(one));
+    (void) ret;
+    join();
+}
+
+void SubReactor::join() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void SubReactor::hand_over(int fd, const sockaddr_in &addr) {
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        pending_.emplace_back(fd, addr);
+    }
+    uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_WARN("SubReactor[%d] wakeup error!", id_);
+    }
+}
+
+void SubReactor::loop() {
+    LOG_INFO("SubReactor[%d] start, listen fd: %d", id_, listen_fd_);
+    int time_ms = -1;
+    while (!is_close_) {
+        if (timeout_ms_ > 0) {
+            time_ms = timer_->GetNextTick();
+        }
+        int event_cnt = epoller_->wait(time_ms);
+        for (int i = 0; i < event_cnt; i++) {
+            int fd = epoller_->get_event_fd(i);
+            uint32_t events = epoller_->get_events(i);
+            if (fd == listen_fd_) {
+                deal_listen();
+                continue;
+            } else if (fd == wakeup_fd_) {
+                deal_wakeup();
+                continue;
+            }
+            HttpConn *client = users_.get(fd);
+            assert(client != nullptr);
+            if (client->get_generation() != epoller_->get_event_generation(i)) {
+                LOG_DEBUG("SubReactor[%d] stale event of Client[%d]", id_, fd);
+                continue;
+            }
+            ssize_t sent = 0;
+            if (epoller_->get_event_sent(i, &sent)) {
+                extent_time(client);
+                on_sent(client, sent);
+            } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                close_conn(client);
+            } else if (events & EPOLLIN) {
+                extent_time(client);
+                on_read(client, epoller_->get_event_data(i));
+            } else if (events & EPOLLOUT) {
+                extent_time(client);
+                on_write(client);
+            } else {
+                LOG_ERROR("Unexpected Event!");
+            }
+        }
+    }
+    LOG_INFO("SubReactor[%d] quit", id_);
+}
+
+void SubReactor::deal_listen() {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    do {
+        int fd = accept4(listen_fd_, (struct sockaddr *) &addr, &len, SOCK_NONBLOCK);
+        if (fd < 0) {
+            return;
+        } else if (HttpConn::user_cnt >= MAX_FD_) {
+            send(fd, "server busy", 11, 0);
+            close(fd);
+            LOG_WARN("Clients are full");
+            return;
+        }
+        add_client(fd, addr);
+    } while (listen_event_ & EPOLLET);
+}
+
+void SubReactor::deal_wakeup() {
+    uint64_t cnt = 0;
+    ssize_t ret = read(wakeup_fd_, &cnt, sizeof(cnt));
+    (void) ret;
+    std::vector<std::pair<int, sockaddr_in>> pending;
+    std::vector<BlockingResult> done;
+    std::vector<std::pair<int, uint32_t>> prefetched;
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        pending.swap(pending_);
+        done.swap(done_);
+        prefetched.swap(prefetched_);
+    }
+    for (auto &item : pending) {
+        add_client(item.first, item.second);
+    }
+    for (auto &item : done) {
+        HttpConn *client = users_.get(item.fd);
+        if (client == nullptr || client->get_generation() != item.generation) {
+            // the connection was closed while the job was running
+            continue;
+        }
+        client->finish_blocking(item.result);
+        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLIN, client->get_generation());
+        if (send_response(client)) {
+            on_process(client);
+        }
+    }
+    for (auto &item : prefetched) {
+        HttpConn *client = users_.get(item.first);
+        if (client == nullptr || client->get_generation() != item.second) {
+            continue;
+        }
+        client->finish_prefetch();
+        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, client->get_generation());
+    }
+}
+
+void SubReactor::add_client(int fd, const sockaddr_in &addr) {
+    assert(fd > 0);
+    if (static_cast<size_t>(fd) >= users_.capacity()) {
+        LOG_WARN("SubReactor[%d] Client[%d] out of slab range", id_, fd);
+        close(fd);
+        return;
+    }
+    HttpConn &client = users_[fd];
+    client.init(fd, addr);
+    if (timeout_ms_ > 0) {
+        timer_->add(fd, timeout_ms_, std::bind(&SubReactor::close_conn, this, &client));
+    }
+    epoller_->add_fd(fd, EPOLLIN | conn_event_, client.get_generation(), io_);
+    LOG_INFO("SubReactor[%d] Client[%d] in!", id_, fd);
+}
+
+void SubReactor::on_read(HttpConn *client, std::string_view data) {
+    assert(client != nullptr);
+    int read_errno = 0;
+    uint32_t generation = client->get_generation();
+    ssize_t ret = static_cast<ssize_t>(data.size());
+    if (data.empty()) {
+        ret = client->read(&read_errno);
+    } else {
+        client->receive(data);
+    }
+    if (ret <= 0 && read_errno != EAGAIN) {
+        close_conn(client);
+        return;
+    }
+    if (client->is_sending()) {
+        // stop receiving until the response is out, on_sent() processes the bytes
+        epoller_->mod_fd(client->get_fd(), conn_event_, generation);
+        return;
+    }
+    if (client->to_write_bytes() > 0 || client->is_blocking()) {
+        // bytes the ring received before the fd stopped reading, they wait for their turn
+        return;
+    }
+    on_process(client);
+    if (HttpConn::is_ET && data.empty() && ret > 0 && client->get_generation() == generation &&
+        client->to_write_bytes() == 0 && !client->is_blocking()) {
+        // read() stopped before EAGAIN, re-arming reports the bytes still in the socket
+        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLIN, generation);
+    }
+}
+
+void SubReactor::on_write(HttpConn *client) {
+    assert(client != nullptr);
+    int write_errno = 0;
+    ssize_t ret = client->write(&write_errno);
+    if (client->needs_prefetch()) {
+        deal_prefetch(client);
+        return;
+    }
+    if (client->to_write_bytes() == 0) {
+        if (client->is_keep_alive()) {
+            epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLIN, client->get_generation());
+            on_process(client);
+            return;
+        }
+    } else if (ret >= 0 || write_errno == EAGAIN) {
+        // still registered for EPOLLOUT, wait for the socket to drain
+        return;
+    }
+    close_conn(client);
+}
+
+void SubReactor::on_sent(HttpConn *client, ssize_t len) {
+    assert(client != nullptr);
+    client->finish_send(len);
+    if (closing_.erase(client->get_fd()) > 0 || len <= 0) {
+        close_conn(client);
+        return;
+    }
+    if (client->to_write_bytes() > 0) {
+        if (send_response(client)) {
+            on_process(client);
+        }
+        return;
+    }
+    if (!client->is_keep_alive()) {
+        close_conn(client);
+        return;
+    }
+    epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLIN, client->get_generation());
+    on_process(client);
+}
+
+void SubReactor::on_process(HttpConn *client) {
+    while (client->process()) {
+        if (!send_response(client)) {
+            return;
+        }
+    }
+    if (client->is_blocking()) {
+        deal_blocking(client);
+    }
+}
+
+bool SubReactor::send_response(HttpConn *client) {
+    if (io_) {
+        int flags = 0;
+        const struct msghdr *msg = client->send_msg(&flags);
+        if (msg != nullptr) {
+            if (epoller_->send(client->get_fd(), msg, flags)) {
+                // the ring sends it, on_sent() goes on from there
+                return false;
+            }
+            client->finish_send(0);
+        }
+    }
+    int write_errno = 0;
+    ssize_t ret = client->write(&write_errno);
+    if (client->needs_prefetch()) {
+        deal_prefetch(client);
+        return false;
+    }
+    if (client->to_write_bytes() > 0) {
+        if (ret >= 0 || write_errno == EAGAIN) {
+            epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, client->get_generation());
+            return false;
+        }
+        close_conn(client);
+        return false;
+    }
+    if (!client->is_keep_alive()) {
+        close_conn(client);
+        return false;
+    }
+    return true;
+}
+
+void SubReactor::deal_blocking(HttpConn *client) {
+    int fd = client->get_fd();
+    uint32_t generation = client->get_generation();
+    if (user_store_ == nullptr && executor_ == nullptr) {
+        client->finish_blocking(client->blocking_job()());
+        if (send_response(client)) {
+            on_process(client);
+        }
+        return;
+    }
+    // stop reading, the request buffer must not change until the result is applied
+    epoller_->mod_fd(fd, conn_event_, generation);
+    bool queued = false;
+    if (user_store_ != nullptr) {
+        queued = client->blocking_job_async(*user_store_, [this, fd, generation](bool result) {
+            blocking_done(fd, generation, result);
+        });
+    } else {
+        std::function<bool()> job = client->blocking_job();
+        queued = executor_->try_post(Executor::BLOCKING, [this, fd, generation, job] {
+            blocking_done(fd, generation, job());
+        });
+    }
+    if (!queued) {
+        LOG_WARN("SubReactor[%d] blocking job not accepted, Client[%d] rejected", id_, fd);
+        client->reject_blocking();
+        send_response(client);
+    }
+}
+
+void SubReactor::blocking_done(int fd, uint32_t generation, bool result) {
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        done_.push_back(BlockingResult{fd, generation, result});
+    }
+    uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_WARN("SubReactor[%d] wakeup error!", id_);
+    }
+}
+
+void SubReactor::deal_prefetch(HttpConn *client) {
+    int fd = client->get_fd();
+    uint32_t generation = client->get_generation();
+    // stop reading and writing, only a hang-up is reported until the file is in
+    epoller_->mod_fd(fd, conn_event_, generation);
+    std::function<void()> job = client->prefetch_job();
+    if (executor_ == nullptr || !executor_->try_post(Executor::IO, [this, fd, generation, job] {
+            job();
+            prefetch_done(fd, generation);
+        })) {
+        client->finish_prefetch();
+        epoller_->mod_fd(fd, conn_event_ | EPOLLOUT, generation);
+    }
+}
+
+void SubReactor::prefetch_done(int fd, uint32_t generation) {
+    {
+        std::lock_guard<std::mutex> locker(mutex_);
+        prefetched_.emplace_back(fd, generation);
+    }
+    uint64_t one = 1;
+    if (write(wakeup_fd_, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        LOG_WARN("SubReactor[%d] wakeup error!", id_);
+    }
+}
+
+void SubReactor::close_conn(HttpConn *client) {
+    assert(client != nullptr);
+    if (client->is_sending()) {
+        // the ring still reads the response, on_sent() closes once the send is cancelled
+        if (closing_.insert(client->get_fd()).second) {
+            epoller_->del_fd(client->get_fd());
+        }
+        return;
+    }
+    LOG_INFO("SubReactor[%d] Client[%d] quit!", id_, client->get_fd());
+    epoller_->del_fd(client->get_fd());
+    client->close();
+}
+
+void SubReactor::extent_time(HttpConn *client) {
+    assert(client != nullptr);
+    if (timeout_ms_ > 0) {
+        timer_->adjust(client->get_fd(), timeout_ms_);
+    }
+}
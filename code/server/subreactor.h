@@ -0,0 +1,253 @@
+/**
+ * A SubReactor is one event loop of the one-loop-per-thread (multi-reactor) mode.
+ *
+ * Every SubReactor owns its own Epoller, HeapTimer and the slice of connections that were
+ * accepted by it. A connection never leaves the SubReactor it was assigned to, so it is read,
+ * parsed and written on the same thread without crossing into the ThreadPool and without
+ * re-arming EPOLLONESHOT after every event.
+ *
+ * Connections reach a SubReactor in one of two ways:
+ *   1. SO_REUSEPORT sharding: the SubReactor owns a listening socket bound to the shared port,
+ *      and the kernel balances incoming connections across all listeners.
+ *   2. hand-over: the main acceptor accepts the connection and calls hand_over(), which queues
+ *      the fd and wakes the SubReactor through an eventfd.
+ *
+ * A request with a blocking part (the SQL query of a login/register form) is the exception to
+ * staying on the loop thread: its job runs on the blocking lane of the Executor, and the result
+ * comes back through the same eventfd, so the connection itself is still only touched by the
+ * loop thread.
+ *
+ * With the io_uring backend the ring does the I/O of the connections as well: it receives into
+ * buffers of its pool and hands the bytes over with the EPOLLIN event, and it sends the
+ * responses held in memory while the loop goes on, reporting the send as an event of its own.
+ * Only one send of a connection is in flight, and a connection is not closed before its send
+ * is done. Files sent with sendfile(), the listening sockets and the eventfd stay on readiness.
+*/
+
+#ifndef SUBREACTOR_H_
+#define SUBREACTOR_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <netinet/in.h>
+#include <string_view>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "../timer/heaptimer.h"
+#include "../pool/asyncuserstore.h"
+#include "../pool/executor.h"
+#include "../pool/fdslab.h"
+#include "epoller.h"
+#include "../http/httpconn.h"
+
+class SubReactor {
+public:
+    /**
+     * create the epoll instance and the wakeup eventfd of the sub-reactor
+     * @param id index of the sub-reactor, only used for logging
+     * @param listen_fd SO_REUSEPORT listening socket owned by this sub-reactor, or -1 if
+     *                  connections are handed over by the main acceptor
+     * @param timeout_ms idle timeout of a connection in ms
+     * @param listen_event event configuration for the listening socket
+     * @param conn_event event configuration for the client connection sockets
+     * @param executor executor whose blocking lane runs the blocking jobs of the requests, shared
+     *                 by all sub-reactors. if nullptr the jobs run on the loop thread
+     * @param user_store store running the jobs with the non-blocking MySQL API, preferred over
+     *                   the executor when not nullptr
+     * @param backend event backend of the sub-reactor's Epoller
+    */
+    SubReactor(int id, int listen_fd, int timeout_ms, uint32_t listen_event, uint32_t conn_event,
+               Executor *executor, AsyncUserStore *user_store,
+               Epoller::Backend backend = Epoller::EPOLL);
+
+    /**
+     * stop the event loop and close the listening socket and the wakeup eventfd
+    */
+    ~SubReactor();
+
+    /**
+     * spawn the thread that runs the event loop
+    */
+    void start();
+
+    /**
+     * ask the event loop to quit and wait for its thread to finish
+    */
+    void stop();
+
+    /**
+     * wait for the event loop thread to finish
+    */
+    void join();
+
+    /**
+     * queue a connection accepted by the main acceptor and wake up the event loop. this is
+     * the only method that may be called from another thread
+     * @param fd file descriptor of the accepted connection, already in non-blocking mode
+     * @param addr client address
+    */
+    void hand_over(int fd, const sockaddr_in &addr);
+
+private:
+    /**
+     * wait for events and dispatch them until stop() is called
+    */
+    void loop();
+
+    /**
+     * accept new connections on the owned listening socket
+    */
+    void deal_listen();
+
+    /**
+     * register all connections queued by hand_over(), finish the requests whose blocking job
+     * is done and go on writing the responses whose file has been read in
+    */
+    void deal_wakeup();
+
+    /**
+     * set up a new client connection with the epoll instance and the timer
+     * @param fd file descriptor to be added
+     * @param addr client address
+    */
+    void add_client(int fd, const sockaddr_in &addr);
+
+    /**
+     * read from the client, then parse and answer the request inline
+     * @param client client connection to read data from
+     * @param data bytes the ring received for the client, empty if they have to be read
+    */
+    void on_read(HttpConn *client, std::string_view data);
+
+    /**
+     * write the pending response to the client
+     * @param client client connection to write data to
+    */
+    void on_write(HttpConn *client);
+
+    /**
+     * go on after the ring sent a part of the responses: send the rest, or read the next
+     * requests once they are out
+     * @param client client connection the send belongs to
+     * @param len number of bytes sent, -errno if the send failed
+    */
+    void on_sent(HttpConn *client, ssize_t len);
+
+    /**
+     * process the buffered request and try to send the response right away. the socket is
+     * only switched to EPOLLOUT when the response could not be flushed
+     * @param client client connection to be processed
+    */
+    void on_process(HttpConn *client);
+
+    /**
+     * write the prepared response
+     * @param client client connection to write data to
+     * @return true if the whole response was sent and the connection is kept alive
+    */
+    bool send_response(HttpConn *client);
+
+    /**
+     * run the blocking job of the client's pending request on the AsyncUserStore or the
+     * blocking lane. the fd only waits for hang-ups until the result is back
+     * @param client client connection whose request waits for its blocking job
+    */
+    void deal_blocking(HttpConn *client);
+
+    /**
+     * queue the result of a blocking job and wake up the event loop, called on the blocking lane
+     * or the loop thread of the AsyncUserStore
+     * @param fd file descriptor of the connection the job belongs to
+     * @param generation generation of the connection when the job was queued
+     * @param result result of the job
+    */
+    void blocking_done(int fd, uint32_t generation, bool result);
+
+    /**
+     * read the file the client's response stopped at into the page cache on the IO lane of
+     * the executor, the fd only waits for hang-ups until it is in. without an executor, or
+     * if the lane is full, the file is sent right away
+     * @param client client connection whose write() stopped at a file that is not cached
+    */
+    void deal_prefetch(HttpConn *client);
+
+    /**
+     * queue the connection whose file has been read in and wake up the event loop, called on
+     * the IO lane
+     * @param fd file descriptor of the connection the job belongs to
+     * @param generation generation of the connection when the job was queued
+    */
+    void prefetch_done(int fd, uint32_t generation);
+
+    /**
+     * close a client connection and remove it from the epoll instance. while the ring sends
+     * for it, the send is cancelled and the close waits for on_sent()
+     * @param client client connection to be closed
+    */
+    void close_conn(HttpConn *client);
+
+    /**
+     * extend the timeout duration for a client's connection
+     * @param client client connection whose timeout duration is to be extended
+    */
+    void extent_time(HttpConn *client);
+
+    static const int MAX_FD_ = 65535;
+
+    int id_;
+    int listen_fd_;
+    int wakeup_fd_;
+    int timeout_ms_;
+    uint32_t listen_event_;
+    uint32_t conn_event_;
+
+    std::atomic<bool> is_close_;
+    std::thread thread_;
+
+    std::unique_ptr<HeapTimer> timer_;
+    std::unique_ptr<Epoller> epoller_;
+    Executor *executor_;
+    AsyncUserStore *user_store_;
+
+    /**
+     * whether the ring receives and sends for the connections, see Epoller::enable_io()
+    */
+    bool io_;
+
+    /**
+     * connections whose close waits for the completion of their cancelled send
+    */
+    std::unordered_set<int> closing_;
+
+    /**
+     * the connections owned by this sub-reactor, only touched by the event loop thread
+    */
+    FdSlab<HttpConn> users_;
+
+    /**
+     * a finished blocking job of a connection
+    */
+    struct BlockingResult {
+        int fd;
+        uint32_t generation;
+        bool result;
+    };
+
+    /**
+     * connections handed over by the main acceptor, waiting to be registered, results of
+     * blocking jobs waiting to be applied, and connections whose file has been read in, with
+     * their generation
+    */
+    std::mutex mutex_;
+    std::vector<std::pair<int, sockaddr_in>> pending_;
+    std::vector<BlockingResult> done_;
+    std::vector<std::pair<int, uint32_t>> prefetched_;
+};
+
+#endif
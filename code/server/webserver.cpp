@@ -8,21 +8,58 @@
 #include <functional>
 #include <iterator>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <utility>
+
+#include "../http/compressor.h"
+#include "../http/fileindex.h"
+#include "../http/mmaptable.h"
 
 WebServer::WebServer(int port, int trig_mode, int timeout_ms, bool opt_linger, int sql_port,
               const char *sql_user, const char *sql_pwd, const char *db_name,
-              int conn_pool_num, int thread_num, bool open_log, int log_level, int log_que_size) :
+              int conn_pool_num, int thread_num, bool open_log, int log_level, int log_que_size,
+              int reactor_num, bool reuse_port, bool use_io_uring, size_t cpu_queue_num,
+              size_t blocking_queue_num, bool async_sql, size_t sendfile_threshold,
+              size_t file_cache_bytes, int gzip_level, size_t gzip_min_size,
+              size_t mmap_table_bytes, size_t prefetch_window) :
     port_(port), open_linger_(opt_linger), timeout_ms_(timeout_ms), is_close_(false),
-    timer_(new HeapTimer()), thread_pool_(new ThreadPool(thread_num)), epoller_(new Epoller()) {
+    timer_(new HeapTimer()),
+    executor_(new Executor(thread_num, cpu_queue_num, conn_pool_num, blocking_queue_num)),
+    epoller_(new Epoller(1024, use_io_uring ? Epoller::IO_URING : Epoller::EPOLL)),
+    reactor_num_(reactor_num), reuse_port_(reuse_port), next_reactor_(0) {
+    assert(reactor_num_ >= 0);
     src_dir_ = getcwd(nullptr, 256);
     assert(src_dir_);
     strncat(src_dir_, "/resources/", 16);
     HttpConn::user_cnt = 0;
     HttpConn::src_dir = src_dir_;
-    SqlConnPool::instance()->init("localhost", sql_port, sql_user, sql_pwd, db_name);
+    HttpResponse::sendfile_threshold = sendfile_threshold;
+    HttpConn::prefetch_window = prefetch_window;
+    /**
+     * the index drops the cache entries of the files it watches. the interval is for the rest:
+     * paths below linked directories, and all of them if inotify is unavailable or the index
+     * gets disabled
+    */
+    size_t max_cached = sendfile_threshold > 0 ? sendfile_threshold - 1 : 0;
+    FileCache::instance()->init(file_cache_bytes, max_cached, 16, 1000);
+    MmapTable::instance()->init(mmap_table_bytes);
+    FileIndex::instance()->init(src_dir_);
+    Compressor::instance()->init(gzip_level, gzip_min_size, file_cache_bytes / 4,
+                                 [this](std::function<void()> job) {
+        return executor_->try_post(Executor::COMPRESS, std::move(job));
+    });
+    SqlConnPool::instance()->init("localhost", sql_port, sql_user, sql_pwd, db_name,
+                                  conn_pool_num);
+    if (async_sql) {
+        user_store_.reset(new AsyncUserStore());
+        if (!user_store_->init("localhost", sql_port, sql_user, sql_pwd, db_name, conn_pool_num)) {
+            LOG_WARN("AsyncUserStore init error, falling back to the blocking lane");
+            user_store_.reset();
+        }
+    }
 
     init_event_mode(trig_mode);
     if (!init_socket()) {
@@ -41,14 +78,39 @@ WebServer::WebServer(int port, int trig_mode, int timeout_ms, bool opt_linger, i
                 (conn_event_ & EPOLLET ? "ET" : "LT"));
             LOG_INFO("LogSys level: %d", log_level);
             LOG_INFO("srcDir: %s", HttpConn::src_dir);
+            LOG_INFO("sendfile threshold: %zu, file cache: %zu bytes", sendfile_threshold,
+                     file_cache_bytes);
+            LOG_INFO("gzip level: %d, min size: %zu", gzip_level, gzip_min_size);
+            LOG_INFO("mmap table: %zu bytes, prefetch window: %zu bytes", mmap_table_bytes,
+                     prefetch_window);
             LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", conn_pool_num, thread_num);
+            LOG_INFO("Executor lane %s: %d threads, %d tasks, lane %s: %d threads, %d tasks",
+                Executor::lane_name(Executor::CPU), thread_num, (int) cpu_queue_num,
+                Executor::lane_name(Executor::BLOCKING), conn_pool_num, (int) blocking_queue_num);
+            LOG_INFO("User Store: %s", user_store_ ? "async" : "blocking lane");
+            LOG_INFO("SubReactor num: %d, ReusePort: %s", reactor_num_,
+                (reactor_num_ > 0 && reuse_port_) ? "true" : "false");
+            LOG_INFO("Event Backend: %s",
+                epoller_->backend() == Epoller::IO_URING ? "io_uring" : "epoll");
         }
     }
 }
 
 WebServer::~WebServer() {
-    close(listen_fd_);
+    if (user_store_) {
+        // its callbacks still reference the sub-reactors
+        user_store_->stop();
+    }
+    reactors_.clear();
+    FileIndex::instance()->stop();
+    if (listen_fd_ >= 0) {
+        close(listen_fd_);
+    }
     is_close_ = true;
+    BlockPool::Stats stats = BlockPool::instance()->stats();
+    LOG_INFO("Buffer memory: %zu KB allocated, %zu KB peak, %zu KB in use, %zu KB cached",
+        stats.allocated_bytes / 1024, stats.peak_bytes / 1024, stats.in_use_bytes / 1024,
+        stats.cached_bytes / 1024);
     free(src_dir_);
     SqlConnPool::instance()->close_pool();
 }
@@ -71,13 +133,14 @@ void WebServer::close_conn(HttpConn *client) {
 
 void WebServer::add_client(int fd, sockaddr_in addr) {
     assert(fd > 0);
-    users_[fd].init(fd, addr);
+    HttpConn &client = users_[fd];
+    client.init(fd, addr);
     if (timeout_ms_ > 0) {
-        timer_->add(fd, timeout_ms_, std::bind(&WebServer::close_conn, this, &users_[fd]));
+        timer_->add(fd, timeout_ms_, std::bind(&WebServer::close_conn, this, &client));
     }
-    epoller_->add_fd(fd, EPOLLIN | conn_event_);
+    epoller_->add_fd(fd, EPOLLIN | conn_event_, client.get_generation());
     set_fd_nonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].get_fd());
+    LOG_INFO("Client[%d] in!", client.get_fd());
 }
 
 void WebServer::deal_listen() {
@@ -87,11 +150,16 @@ void WebServer::deal_listen() {
         int fd = accept(listen_fd_, (struct sockaddr *) &addr, &len);
         if (fd < 0) {
             return;
-        } else if (HttpConn::user_cnt >= MAX_FD_) {
+        } else if (HttpConn::user_cnt >= MAX_FD_ || static_cast<size_t>(fd) >= users_.capacity()) {
             send_error(fd, "server busy");
             LOG_WARN("Clients are full");
             return;
         }
+        if (!reactors_.empty()) {
+            set_fd_nonblock(fd);
+            reactors_[next_reactor_++ % reactors_.size()]->hand_over(fd, addr);
+            continue;
+        }
         add_client(fd, addr);
     } while (listen_event_ & EPOLLET);
 }
@@ -99,17 +167,23 @@ void WebServer::deal_listen() {
 void WebServer::deal_read(HttpConn *client) {
     assert(client != nullptr);
     extent_time(client);
-    thread_pool_->AddTask(std::bind(&WebServer::on_read, this, client));
+    executor_->post(Executor::CPU,
+                    std::bind(&WebServer::on_read, this, client, client->get_generation()));
 }
 
 void WebServer::deal_write(HttpConn *client) {
     assert(client != nullptr);
     extent_time(client);
-    thread_pool_->AddTask(std::bind(&WebServer::on_write, this, client));
+    executor_->post(Executor::CPU,
+                    std::bind(&WebServer::on_write, this, client, client->get_generation()));
 }
 
-void WebServer::on_read(HttpConn *client) {
+void WebServer::on_read(HttpConn *client, uint32_t generation) {
     assert(client);
+    if (client->get_generation() != generation) {
+        // the connection was closed and its fd reused while the task was queued
+        return;
+    }
     int ret = -1;
     int read_errno = 0;
     ret = client->read(&read_errno);
@@ -120,11 +194,18 @@ void WebServer::on_read(HttpConn *client) {
     on_process(client);
 }
 
-void WebServer::on_write(HttpConn *client) {
+void WebServer::on_write(HttpConn *client, uint32_t generation) {
     assert(client != nullptr);
+    if (client->get_generation() != generation) {
+        return;
+    }
     int ret = -1;
     int write_errno = 0;
     ret = client->write(&write_errno);
+    if (client->needs_prefetch()) {
+        deal_prefetch(client);
+        return;
+    }
     if (client->to_write_bytes() == 0) {
         if (client->is_keep_alive()) {
             on_process(client);
@@ -132,7 +213,7 @@ void WebServer::on_write(HttpConn *client) {
         }
     } else if (ret < 0) {
         if (write_errno == EAGAIN) {
-            epoller_->mod_fd(client->get_fd(), conn_event_ != EPOLLOUT);
+            epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, client->get_generation());
             return;
         }
     }
@@ -141,10 +222,87 @@ void WebServer::on_write(HttpConn *client) {
 
 void WebServer::on_process(HttpConn *client) {
     if (client->process()) {
-        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT); 
+        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, client->get_generation());
+    } else if (client->is_blocking()) {
+        // the fd stays disarmed (EPOLLONESHOT) until the blocking job is done
+        deal_blocking(client);
+    } else {
+        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLIN, client->get_generation());
+    }
+}
+
+void WebServer::deal_blocking(HttpConn *client) {
+    assert(client != nullptr);
+    uint32_t generation = client->get_generation();
+    bool queued = false;
+    if (user_store_) {
+        queued = client->blocking_job_async(*user_store_, [this, client, generation](bool result) {
+            executor_->post(Executor::CPU, std::bind(&WebServer::on_blocking_done, this, client,
+                                                     generation, result));
+        });
     } else {
-        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLIN);
+        std::function<bool()> job = client->blocking_job();
+        queued = executor_->try_post(Executor::BLOCKING, [this, client, generation, job] {
+            bool result = job();
+            executor_->post(Executor::CPU, std::bind(&WebServer::on_blocking_done, this, client,
+                                                     generation, result));
+        });
+    }
+    if (!queued) {
+        LOG_WARN("Blocking job not accepted, Client[%d] rejected", client->get_fd());
+        client->reject_blocking();
+        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, client->get_generation());
+    }
+}
+
+void WebServer::on_blocking_done(HttpConn *client, uint32_t generation, bool result) {
+    assert(client != nullptr);
+    if (client->get_generation() != generation) {
+        // the connection timed out or was closed while the job was running
+        return;
     }
+    client->finish_blocking(result);
+    epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, client->get_generation());
+}
+
+void WebServer::deal_prefetch(HttpConn *client) {
+    assert(client != nullptr);
+    uint32_t generation = client->get_generation();
+    std::function<void()> job = client->prefetch_job();
+    bool queued = executor_->try_post(Executor::IO, [this, client, generation, job] {
+        job();
+        executor_->post(Executor::CPU,
+                        std::bind(&WebServer::on_prefetched, this, client, generation));
+    });
+    if (!queued) {
+        LOG_DEBUG("Prefetch not accepted, Client[%d] waits for the disk", client->get_fd());
+        client->finish_prefetch();
+        epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, generation);
+    }
+}
+
+void WebServer::on_prefetched(HttpConn *client, uint32_t generation) {
+    assert(client != nullptr);
+    if (client->get_generation() != generation) {
+        return;
+    }
+    client->finish_prefetch();
+    epoller_->mod_fd(client->get_fd(), conn_event_ | EPOLLOUT, client->get_generation());
+}
+
+bool WebServer::add_route(Router::MATCH_ type, const std::string &pattern,
+                          HttpRequest::Handler handler) {
+    if (HttpRequest::add_route(type, pattern, std::move(handler)) == Router::NO_ROUTE) {
+        LOG_ERROR("Route %s not added", pattern.c_str());
+        return false;
+    }
+    LOG_INFO("Route %s added", pattern.c_str());
+    return true;
+}
+
+void WebServer::set_max_age(const std::string &suffix, int max_age) {
+    HttpResponse::set_max_age(suffix, max_age);
+    LOG_INFO("Cache-Control of %s: max-age %d", suffix.c_str(), max_age);
 }
 
 void WebServer::start() {
@@ -152,6 +310,18 @@ void WebServer::start() {
     if (!is_close_) {
         LOG_INFO("======== Server Start ========");
     }
+    if (!is_close_ && !reactors_.empty()) {
+        for (auto &reactor : reactors_) {
+            reactor->start();
+        }
+        if (reuse_port_) {
+            // every sub-reactor accepts on its own listener, nothing left for this thread
+            for (auto &reactor : reactors_) {
+                reactor->join();
+            }
+            return;
+        }
+    }
     while (!is_close_) {
         if (timeout_ms_ > 0) {
             time_ms = timer_->GetNextTick();
@@ -162,15 +332,20 @@ void WebServer::start() {
             uint32_t events = epoller_->get_events(i);
             if (fd == listen_fd_) {
                 deal_listen();
-            } else if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
-                assert(users_.count(fd) > 0);
-                close_conn(&users_[fd]);
+                continue;
+            }
+            HttpConn *client = users_.get(fd);
+            assert(client != nullptr);
+            if (client->get_generation() != epoller_->get_event_generation(i)) {
+                LOG_DEBUG("Stale event of Client[%d]", fd);
+                continue;
+            }
+            if (events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                close_conn(client);
             } else if (events & EPOLLIN) {
-                assert(users_.count(fd) > 0);
-                deal_read(&users_[fd]);
+                deal_read(client);
             } else if (events & EPOLLOUT) {
-                assert(users_.count(fd) > 0);
-                deal_write(&users_[fd]);
+                deal_write(client);
             } else {
                 LOG_ERROR("Unexpected Event!");
             }
@@ -180,11 +355,56 @@ void WebServer::start() {
 
 bool WebServer::init_socket() {
     int ret;
-    struct sockaddr_in addr;
+    listen_fd_ = -1;
     if (port_ > 65535 || port_ < 1024) {
         LOG_ERROR("Port:%d erorr!", port_);
         return false;
     }
+
+    /**
+     * sub-reactors never share an epoll instance with the main thread, so a connection only
+     * fires on one thread and EPOLLONESHOT re-arming is not needed there
+    */
+    uint32_t sub_conn_event = conn_event_ & ~EPOLLONESHOT;
+    if (reactor_num_ > 0 && reuse_port_) {
+        for (int i = 0; i < reactor_num_; i++) {
+            int fd = create_listen_fd();
+            if (fd < 0) {
+                reactors_.clear();
+                return false;
+            }
+            reactors_.emplace_back(new SubReactor(i, fd, timeout_ms_, listen_event_, sub_conn_event,
+                                                  executor_.get(), user_store_.get(),
+                                                  epoller_->backend()));
+        }
+        LOG_INFO("Server Port:%d", port_);
+        return true;
+    }
+
+    listen_fd_ = create_listen_fd();
+    if (listen_fd_ < 0) {
+        return false;
+    }
+
+    ret = epoller_->add_fd(listen_fd_, listen_event_ | EPOLLIN);
+    if (ret == 0) {
+        close(listen_fd_);
+        listen_fd_ = -1;
+        LOG_ERROR("Add listen error");
+        return false;
+    }
+    for (int i = 0; i < reactor_num_; i++) {
+        reactors_.emplace_back(new SubReactor(i, -1, timeout_ms_, listen_event_, sub_conn_event,
+                                              executor_.get(), user_store_.get(),
+                                              epoller_->backend()));
+    }
+    LOG_INFO("Server Port:%d", port_);
+    return true;
+}
+
+int WebServer::create_listen_fd() {
+    int ret;
+    struct sockaddr_in addr;
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
     addr.sin_port = htons(port_);
@@ -194,52 +414,65 @@ bool WebServer::init_socket() {
         opt_linger.l_linger = 1;
     }
 
-    listen_fd_ = socket(AF_INET, SOCK_STREAM, 0);
+    int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
 
-    if (listen_fd_ < 0) {
+    if (listen_fd < 0) {
         LOG_ERROR("Create socket error!", port_);
-        return false;
+        return -1;
     }
 
-    ret = setsockopt(listen_fd_, SOL_SOCKET, SO_LINGER, &opt_linger, sizeof(opt_linger));
+    ret = setsockopt(listen_fd, SOL_SOCKET, SO_LINGER, &opt_linger, sizeof(opt_linger));
     if (ret == -1) {
-        close(listen_fd_);
+        close(listen_fd);
         LOG_ERROR("Init linger error!", port_);
-        return false;
+        return -1;
     }
 
     int optval = 1;
 
-    ret = setsockopt(listen_fd_, SOL_SOCKET, SO_REUSEADDR, (const void *) &optval, sizeof(int));
+    ret = setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, (const void *) &optval, sizeof(int));
     if (ret == -1) {
-        close(listen_fd_);
+        close(listen_fd);
         LOG_ERROR("set socket setsockopt erorr!", port_);
-        return false;
+        return -1;
+    }
+
+    /**
+     * accepted sockets inherit TCP_NODELAY. responses leave in as few writev() calls as
+     * possible, so a batch that does not fit into one must not wait for the client's delayed
+     * ACK of the previous one
+    */
+    ret = setsockopt(listen_fd, IPPROTO_TCP, TCP_NODELAY, (const void *) &optval, sizeof(int));
+    if (ret == -1) {
+        close(listen_fd);
+        LOG_ERROR("set socket TCP_NODELAY erorr!");
+        return -1;
+    }
+
+    if (reactor_num_ > 0 && reuse_port_) {
+        ret = setsockopt(listen_fd, SOL_SOCKET, SO_REUSEPORT, (const void *) &optval, sizeof(int));
+        if (ret == -1) {
+            close(listen_fd);
+            LOG_ERROR("set socket SO_REUSEPORT erorr!");
+            return -1;
+        }
     }
 
-    ret = bind(listen_fd_, (struct sockaddr *) &addr, sizeof(addr));
+    ret = bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr));
     if (ret < 0) {
-        close(listen_fd_);
+        close(listen_fd);
         LOG_ERROR("Bind Port:%d error!", port_);
-        return false;
+        return -1;
     }
 
-    ret = listen(listen_fd_, 6);
+    ret = listen(listen_fd, 6);
     if (ret < 0) {
-        close(listen_fd_);
+        close(listen_fd);
         LOG_ERROR("Listen Port:%d error!", port_);
-        return false;
+        return -1;
     }
-
-    ret = epoller_->add_fd(listen_fd_, listen_event_ | EPOLLIN);
-    if (ret == 0) {
-        close(listen_fd_);
-        LOG_ERROR("Add listen error");
-        return false;
-    }
-    set_fd_nonblock(listen_fd_);
-    LOG_INFO("Server Port:%d", port_);
-    return true;
+    set_fd_nonblock(listen_fd);
+    return listen_fd;
 }
 
 int WebServer::set_fd_nonblock(int fd) {
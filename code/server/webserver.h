@@ -4,24 +4,79 @@
 #include <cstdint>
 #include <memory>
 #include <netinet/in.h>
-#include <unordered_map>
+#include <string>
+#include <vector>
 
 #include "../timer/heaptimer.h"
-#include "../pool/threadpool.h"
+#include "../pool/asyncuserstore.h"
+#include "../pool/executor.h"
+#include "../pool/fdslab.h"
 #include "epoller.h"
+#include "subreactor.h"
 #include "../http/httpconn.h"
 
 class WebServer {
 public:
+    /**
+     * @param reactor_num number of sub-reactors for the one-loop-per-thread mode. 0 keeps the
+     *                    single reactor + ThreadPool mode
+     * @param reuse_port in multi-reactor mode, whether every sub-reactor accepts on its own
+     *                   SO_REUSEPORT listener (true) or the main thread accepts and hands the
+     *                   connections over round-robin (false)
+     * @param use_io_uring wait for events through io_uring instead of epoll
+     * @param cpu_queue_num max number of queued or running tasks of the CPU lane, whose size
+     *                      is thread_num
+     * @param blocking_queue_num max number of queued or running SQL jobs of the blocking lane,
+     *                           whose size is conn_pool_num. requests beyond it get a 503
+     * @param async_sql verify login/register forms with the non-blocking MySQL API on an
+     *                  AsyncUserStore (conn_pool_num connections) instead of the blocking lane
+     * @param sendfile_threshold files of at least this many bytes are sent with sendfile(),
+     *                           smaller ones are mapped. 0 for all files, SIZE_MAX for none
+     * @param file_cache_bytes size of the cache of small files answered without touching the
+     *                         file system, 0 disables it. files sent with sendfile() are not
+     *                         cached
+     * @param gzip_level zlib level (1-9) text files without a precompressed sibling are
+     *                   gzipped with on the compress lane, 0 disables it
+     * @param gzip_min_size smaller files are not gzipped
+     * @param mmap_table_bytes size of the files kept mapped between their responses, 0 maps
+     *                         and unmaps a file for each response
+     * @param prefetch_window bytes of a file that are checked against the page cache, and
+     *                        read in on the IO lane if they are not, before they are sent.
+     *                        0 sends files without checking them
+    */
     WebServer(int port, int trig_mode, int timeout_ms, bool opt_linger, int sql_port,
               const char *sql_user, const char *sql_pwd, const char *db_name,
-              int conn_pool_num, int thread_num, bool open_log, int log_level, int log_que_size);
+              int conn_pool_num, int thread_num, bool open_log, int log_level, int log_que_size,
+              int reactor_num = 0, bool reuse_port = true, bool use_io_uring = false,
+              size_t cpu_queue_num = 4096, size_t blocking_queue_num = 256,
+              bool async_sql = false, size_t sendfile_threshold = 64 * 1024,
+              size_t file_cache_bytes = 64 * 1024 * 1024, int gzip_level = 0,
+              size_t gzip_min_size = 1024, size_t mmap_table_bytes = 256 * 1024 * 1024,
+              size_t prefetch_window = 2 * 1024 * 1024);
     ~WebServer();
 
     /**
      * start the event-loop and waits for every using epoll_wait and handles them accordingly
     */
     void start();
+
+    /**
+     * add an endpoint of our own. the handler runs on the thread that parsed the request, for
+     * every complete request whose path matches; routes must be added before start()
+     * @param type how the pattern is compared to request paths: exact, prefix or suffix
+     * @param pattern path, path prefix or path suffix
+     * @param handler e.g. rewrites the path of the request to the file to answer with
+     * @return false if the pattern is empty
+    */
+    bool add_route(Router::MATCH_ type, const std::string &pattern, HttpRequest::Handler handler);
+
+    /**
+     * set how long clients may use their copy of the files with a suffix before revalidating
+     * it; policies must be set before start()
+     * @param suffix suffix of the files, e.g. ".css"
+     * @param max_age Cache-Control max-age in seconds, 0 for no-cache, negative for none
+    */
+    void set_max_age(const std::string &suffix, int max_age);
     
 private:
     /**
@@ -32,6 +87,13 @@ private:
     */
     bool init_socket();
 
+    /**
+     * create a non-blocking listening socket bound to port_ with the configured SO_LINGER
+     * option. SO_REUSEPORT is set when the multi-reactor mode shards the port
+     * @return the listening socket, or -1 if any step failed
+    */
+    int create_listen_fd();
+
     /**
      * configures the event handling mode for the server based on the provided trig_mode
      * @param trig_mode determins how events are detected and procesed by the epoll instance
@@ -58,7 +120,7 @@ private:
 
     /**
      * handles read events by extending the connection's timeout and adding a read task
-     * to the thread pool
+     * to the CPU lane
      * @param client client connection to be dealt with
     */
     void deal_read(HttpConn *client);
@@ -85,14 +147,17 @@ private:
     /**
      * reads data from the client and process it
      * @param client client connection to read data from
+     * @param generation generation of the connection when the task was queued, the task is
+     *                   dropped if the connection has been recycled since
     */
-    void on_read(HttpConn *client);
+    void on_read(HttpConn *client, uint32_t generation);
 
     /**
      * write data to the client and handle any errors
      * @param client client connection to write data to
+     * @param generation generation of the connection when the task was queued
     */
-    void on_write(HttpConn *client);
+    void on_write(HttpConn *client, uint32_t generation);
 
     /**
      * process the client's request and updates the epoll instance accordingly
@@ -100,6 +165,36 @@ private:
     */
     void on_process(HttpConn *client);
 
+    /**
+     * queue the blocking job of the client's pending request on the AsyncUserStore or the
+     * blocking lane, or answer the request with 503 if it was not accepted
+     * @param client client connection whose request waits for its blocking job
+    */
+    void deal_blocking(HttpConn *client);
+
+    /**
+     * build the response of a request whose blocking job has finished, runs on the CPU lane
+     * @param client client connection the job belongs to
+     * @param generation generation of the connection when the job was queued
+     * @param result result of the blocking job
+    */
+    void on_blocking_done(HttpConn *client, uint32_t generation, bool result);
+
+    /**
+     * read the file the client's response stopped at into the page cache on the IO lane, the
+     * fd stays disarmed until it is in. if the lane is full the file is sent right away
+     * @param client client connection whose write() stopped at a file that is not cached
+    */
+    void deal_prefetch(HttpConn *client);
+
+    /**
+     * go on writing the response of a connection whose file has been read in, runs on the
+     * CPU lane
+     * @param client client connection the job belongs to
+     * @param generation generation of the connection when the job was queued
+    */
+    void on_prefetched(HttpConn *client, uint32_t generation);
+
     static const int MAX_FD_ = 65535;
 
     /**
@@ -162,10 +257,16 @@ private:
     std::unique_ptr<HeapTimer> timer_;
 
     /**
-     * manage a collection of threads that handle client requests, allowing the server
-     * to process mutiple requests concurrently
+     * the worker threads that handle client requests: the CPU lane parses requests and builds
+     * responses, the blocking lane runs the SQL queries of the login/register forms
+    */
+    std::unique_ptr<Executor> executor_;
+
+    /**
+     * runs the login/register queries without blocking a thread, nullptr if the blocking lane
+     * is used instead
     */
-    std::unique_ptr<ThreadPool> thread_pool_;
+    std::unique_ptr<AsyncUserStore> user_store_;
 
     /**
      * encapsulates the epoll functionally, managing the file descriptors and events
@@ -175,10 +276,30 @@ private:
 
     /**
      * maps client socket file descriptors to HttpConn instances, stores the state and data
-     * for each connected client, enabling the server to manage multiple client connections
-     * efficiently
+     * for each connected client. indexed directly by fd, so dispatching an event needs no
+     * hashing and a connection never moves in memory
+    */
+    FdSlab<HttpConn> users_;
+
+    /**
+     * number of sub-reactors, 0 if the server runs in single reactor mode
+    */
+    int reactor_num_;
+
+    /**
+     * whether every sub-reactor owns its own SO_REUSEPORT listener
+    */
+    bool reuse_port_;
+
+    /**
+     * the sub-reactors of the multi-reactor mode, each runs its own event loop thread
+    */
+    std::vector<std::unique_ptr<SubReactor>> reactors_;
+
+    /**
+     * round-robin cursor used by the main acceptor to hand over connections
     */
-    std::unordered_map<int, HttpConn> users_;
+    size_t next_reactor_;
 };
 
 #endif
\ No newline at end of file
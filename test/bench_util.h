@@ -0,0 +1,66 @@
+/**
+ * helpers shared by the microbenchmarks: the requests they parse, and a timer for a loop of
+ * rounds of the code under test.
+*/
+
+#ifndef BENCH_UTIL_H_
+#define BENCH_UTIL_H_
+
+#include <chrono>
+#include <cstddef>
+
+/**
+ * the image request of a current Chrome, with the client hints and cookies it sends
+*/
+static const char CHROME_GET[] =
+    "GET /images/profile-picture.jpg HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", \"Not-A.Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like "
+    "Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: https://www.example.com/welcome.html\r\n"
+    "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+    "Accept-Language: en-US,en;q=0.9,de;q=0.8\r\n"
+    "Cookie: _ga=GA1.1.1304182937.1714380022; session=6f1c2a9e4b7d4c1f8e3a5b2d9c0f7e6a; "
+    "theme=dark; _ga_XYZ123=GS1.1.1714380022.3.1.1714381120.0.0.0\r\n"
+    "\r\n";
+
+/**
+ * the shortest request a client sends
+*/
+static const char CURL_GET[] =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:1316\r\n"
+    "User-Agent: curl/8.5.0\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+/**
+ * keep the compiler from dropping the results
+*/
+static volatile size_t sink;
+
+/**
+ * run a function a number of times
+ * @param rounds number of calls
+ * @param func the code under test, storing its result into sink
+ * @return average time of a call in ns
+*/
+template<class F>
+static double measure(int rounds, F &&func) {
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; i++) {
+        func();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / rounds;
+}
+
+#endif
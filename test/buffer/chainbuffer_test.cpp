@@ -0,0 +1,283 @@
+#include "../../code/buffer/chainbuffer.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+static const size_t BLOCK = BlockPool::BLOCK_SIZE_;
+static const size_t MIN_BLOCK = BlockPool::MIN_BLOCK_SIZE_;
+
+static std::string pattern(size_t len) {
+    std::string str(len, '\0');
+    for (size_t i = 0; i < len; i++) {
+        str[i] = 'a' + i % 26;
+    }
+    return str;
+}
+
+// Test fixture for ChainBuffer class, with a pool of its own
+class ChainBufferTest : public ::testing::Test {
+protected:
+    BlockPool pool;
+    ChainBuffer buffer;
+
+    ChainBufferTest() : pool(16), buffer(&pool) {}
+};
+
+// Test for initial state, no block is taken before the first write
+TEST_F(ChainBufferTest, InitialState) {
+    EXPECT_EQ(buffer.ReadableBytes(), 0);
+    EXPECT_EQ(buffer.WritableBytes(), 0);
+    EXPECT_EQ(buffer.Peek(), buffer.BeginWriteConst());
+    EXPECT_EQ(buffer.RetrieveAllToString(), "");
+}
+
+// Test for Append and Retrieve within one block
+TEST_F(ChainBufferTest, AppendAndRetrieve) {
+    std::string data = "Hello, World!";
+    buffer.Append(data);
+
+    EXPECT_EQ(buffer.ReadableBytes(), data.size());
+    EXPECT_EQ(buffer.WritableBytes(), MIN_BLOCK - data.size());
+    EXPECT_EQ(std::string(buffer.Peek(), buffer.ReadableBytes()), data);
+    EXPECT_EQ(buffer.Peek() + buffer.ReadableBytes(), buffer.BeginWriteConst());
+
+    buffer.RetrieveUntil(buffer.Peek() + 7);
+    EXPECT_EQ(buffer.RetrieveAllToString(), "World!");
+    EXPECT_EQ(buffer.ReadableBytes(), 0);
+    EXPECT_EQ(buffer.WritableBytes(), MIN_BLOCK);
+}
+
+// Test for appending across blocks and reading the chain back
+TEST_F(ChainBufferTest, AppendAcrossBlocks) {
+    std::string data = pattern(3 * BLOCK + 100);
+    buffer.Append(data.substr(0, 10));
+    buffer.Append(data.substr(10));
+
+    EXPECT_EQ(buffer.ReadableBytes(), data.size());
+    struct iovec iov[8];
+    int cnt = buffer.ReadableIovec(iov, 8);
+    ASSERT_EQ(cnt, 4);
+    // the chain starts small and grows up to full blocks
+    EXPECT_EQ(iov[0].iov_len, MIN_BLOCK);
+    EXPECT_EQ(iov[1].iov_len, BLOCK);
+    size_t total = 0;
+    for (int i = 0; i < cnt; i++) {
+        total += iov[i].iov_len;
+    }
+    EXPECT_EQ(total, data.size());
+    EXPECT_EQ(buffer.RetrieveAllToString(), data);
+}
+
+// Test for Peek pulling a chain up into one contiguous range
+TEST_F(ChainBufferTest, PeekPullsUp) {
+    std::string data = pattern(BLOCK + 10);
+    buffer.Append(data);
+    buffer.Retrieve(20);
+
+    const char *peek = buffer.Peek();
+    EXPECT_EQ(std::string(peek, buffer.ReadableBytes()), data.substr(20));
+    EXPECT_EQ(peek + buffer.ReadableBytes(), buffer.BeginWriteConst());
+    struct iovec iov[8];
+    EXPECT_EQ(buffer.ReadableIovec(iov, 8), 1);
+
+    // appending after a pull-up keeps everything in order
+    buffer.Append("tail", 4);
+    EXPECT_EQ(buffer.RetrieveAllToString(), data.substr(20) + "tail");
+}
+
+// Test for Retrieve releasing the blocks that were fully read
+TEST_F(ChainBufferTest, RetrieveAcrossBlocks) {
+    std::string data = pattern(2 * BLOCK + 5);
+    buffer.Append(data);
+    buffer.Retrieve(BLOCK + 3);
+
+    struct iovec iov[8];
+    ASSERT_EQ(buffer.ReadableIovec(iov, 8), 2);
+    EXPECT_EQ(iov[0].iov_len, BLOCK - 3);
+    EXPECT_EQ(buffer.RetrieveAllToString(), data.substr(BLOCK + 3));
+}
+
+// Test for Erase in one block and across blocks
+TEST_F(ChainBufferTest, Erase) {
+    std::string data = pattern(100);
+    buffer.Append(data);
+    buffer.Erase(10, 20);
+    data.erase(10, 20);
+    EXPECT_EQ(buffer.ReadableBytes(), data.size());
+    EXPECT_EQ(std::string(buffer.Peek(), buffer.ReadableBytes()), data);
+
+    std::string tail = pattern(BLOCK);
+    buffer.Append(tail);
+    data += tail;
+    buffer.Erase(data.size() - 50, 50);
+    data.erase(data.size() - 50);
+    buffer.Append("xy", 2);
+    data += "xy";
+    EXPECT_EQ(buffer.RetrieveAllToString(), data);
+}
+
+// Test for RetrieveAll reusing its block
+TEST_F(ChainBufferTest, RetrieveAllReuses) {
+    buffer.Append(pattern(100));
+    const char *begin = buffer.Peek();
+    buffer.RetrieveAll();
+    EXPECT_EQ(buffer.ReadableBytes(), 0);
+    EXPECT_EQ(buffer.BeginWriteConst(), begin);
+
+    // the oversize block of a pull-up is not kept
+    buffer.Append(pattern(3 * BLOCK));
+    buffer.Peek();
+    buffer.RetrieveAll();
+    EXPECT_EQ(buffer.WritableBytes(), 0);
+}
+
+// Test for Shrink giving every block back once the buffer is idle
+TEST_F(ChainBufferTest, ShrinkWhenIdle) {
+    buffer.Append(pattern(BLOCK + 10));
+    EXPECT_EQ(pool.stats().in_use_bytes, 2 * BLOCK);
+
+    buffer.Shrink();
+    EXPECT_EQ(buffer.ReadableBytes(), BLOCK + 10);
+    buffer.Retrieve(BLOCK + 10);
+    buffer.Shrink();
+    EXPECT_EQ(buffer.WritableBytes(), 0);
+    EXPECT_EQ(buffer.Peek(), buffer.BeginWriteConst());
+
+    BlockPool::Stats stats = pool.stats();
+    EXPECT_EQ(stats.in_use_bytes, 0);
+    EXPECT_EQ(stats.cached_bytes, 2 * BLOCK);
+    EXPECT_EQ(stats.peak_bytes, 2 * BLOCK);
+
+    // the cached blocks are reused
+    buffer.Append(pattern(10));
+    EXPECT_EQ(pool.stats().allocated_bytes, 2 * BLOCK + MIN_BLOCK);
+}
+
+// Test for the size classes of the pool
+TEST_F(ChainBufferTest, SizeClasses) {
+    BlockPool::Block *small = pool.get(100);
+    BlockPool::Block *middle = pool.get(5000);
+    BlockPool::Block *large = pool.get(BLOCK + 1);
+    EXPECT_EQ(small->cap, MIN_BLOCK);
+    EXPECT_EQ(middle->cap, 4 * MIN_BLOCK);
+    EXPECT_EQ(large->cap, BLOCK + 1);
+    EXPECT_EQ(pool.stats().in_use_bytes, MIN_BLOCK + 4 * MIN_BLOCK + BLOCK + 1);
+
+    pool.put(small);
+    pool.put(middle);
+    pool.put(large);
+    BlockPool::Stats stats = pool.stats();
+    EXPECT_EQ(stats.in_use_bytes, 0);
+    EXPECT_EQ(stats.allocated_bytes, MIN_BLOCK + 4 * MIN_BLOCK);
+    BlockPool::Block *block = pool.get(MIN_BLOCK + 1);
+    EXPECT_EQ(block->cap, 2 * MIN_BLOCK);
+    pool.put(block);
+}
+
+// Test for the thread caches of the shared pool, with blocks released on other threads
+TEST(BlockPoolTest, ThreadCaches) {
+    BlockPool *pool = BlockPool::instance();
+    size_t in_use = pool->stats().in_use_bytes;
+
+    const int thread_num = 4;
+    const int rounds = 20000;
+    MpmcRing<BlockPool::Block *> handoff(1024);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < thread_num; i++) {
+        threads.emplace_back([&, i] {
+            ChainBuffer buffer;
+            BlockPool::Block *block = nullptr;
+            for (int j = 0; j < rounds; j++) {
+                buffer.Append(pattern((i * 7919 + j * 104729) % (3 * BLOCK)));
+                buffer.RetrieveAll();
+                buffer.Shrink();
+                if (!handoff.push(pool->get(j % BLOCK))) {
+                    break;
+                }
+                if (handoff.pop(block)) {
+                    pool->put(block);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    BlockPool::Block *block = nullptr;
+    while (handoff.pop(block)) {
+        pool->put(block);
+    }
+    EXPECT_EQ(pool->stats().in_use_bytes, in_use);
+}
+
+// Test for EnsureWritable and writing at BeginWrite
+TEST_F(ChainBufferTest, EnsureWritable) {
+    buffer.Append(pattern(BLOCK - 4));
+    buffer.EnsureWritable(16);
+    ASSERT_GE(buffer.WritableBytes(), 16);
+    memcpy(buffer.BeginWrite(), "0123456789abcdef", 16);
+    buffer.HasWritten(16);
+    EXPECT_EQ(buffer.RetrieveAllToString(), pattern(BLOCK - 4) + "0123456789abcdef");
+}
+
+// Test for filling the ranges of WritableIovec
+TEST_F(ChainBufferTest, WritableIovec) {
+    buffer.Append("head", 4);
+    struct iovec iov[8];
+    int cnt = buffer.WritableIovec(iov, 8, 2 * BLOCK);
+    ASSERT_EQ(cnt, 3);
+    EXPECT_EQ(iov[0].iov_len, MIN_BLOCK - 4);
+
+    std::string data = pattern(BLOCK + 10);
+    size_t copied = 0;
+    for (int i = 0; i < cnt && copied < data.size(); i++) {
+        size_t n = std::min(iov[i].iov_len, data.size() - copied);
+        memcpy(iov[i].iov_base, data.data() + copied, n);
+        copied += n;
+    }
+    buffer.HasWritten(data.size());
+    EXPECT_EQ(buffer.RetrieveAllToString(), "head" + data);
+}
+
+// Test for ReadFd and WriteFd through a socket pair
+TEST_F(ChainBufferTest, ReadFdAndWriteFd) {
+    int fds[2];
+    ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+    std::string data = pattern(3 * BLOCK + 7);
+
+    ChainBuffer out(&pool);
+    out.Append(data);
+    int err = 0;
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t len = out.WriteFd(fds[0], &err);
+        ASSERT_GT(len, 0);
+        sent += len;
+        while (buffer.ReadableBytes() < sent) {
+            ASSERT_GT(buffer.ReadFd(fds[1], &err), 0);
+        }
+    }
+    EXPECT_EQ(out.ReadableBytes(), 0);
+    EXPECT_EQ(buffer.RetrieveAllToString(), data);
+
+    close(fds[0]);
+    EXPECT_EQ(buffer.ReadFd(fds[1], &err), 0);
+    EXPECT_EQ(buffer.ReadableBytes(), 0);
+    close(fds[1]);
+}
+
+// Test for appending one buffer to another
+TEST_F(ChainBufferTest, AppendBuffer) {
+    ChainBuffer other(&pool);
+    std::string data = pattern(BLOCK + 1);
+    other.Append(data);
+    buffer.Append("x", 1);
+    buffer.Append(other);
+    EXPECT_EQ(other.ReadableBytes(), data.size());
+    EXPECT_EQ(buffer.RetrieveAllToString(), "x" + data);
+}
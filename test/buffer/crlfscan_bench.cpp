@@ -0,0 +1,91 @@
+/**
+ * microbenchmark of the CRLF scan kernels against the std::search that HttpRequest::parse
+ * used before, on the request headers browsers send to the server.
+ *
+ * every round splits a request into its lines the way the parser does (find "\r\n", skip it,
+ * repeat) and, separately, finds the end of its header section.
+ *
+ * build and run:
+ *     g++ -std=c++14 -O2 crlfscan_bench.cpp ../../code/buffer/crlfscan.cpp -o crlfscan_bench
+ *     ./crlfscan_bench
+*/
+
+#include "../../code/buffer/crlfscan.h"
+#include "../bench_util.h"
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+static const int ROUNDS = 200000;
+
+static const char FIREFOX_POST[] =
+    "POST /login HTTP/1.1\r\n"
+    "Host: localhost:1316\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 29\r\n"
+    "Origin: http://localhost:1316\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://localhost:1316/login.html\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "\r\n"
+    "username=alice&password=s3cr3t";
+
+static const char *std_find_crlf(const char *begin, const char *end) {
+    const char CRLF[] = "\r\n";
+    return std::search(begin, end, CRLF, CRLF + 2);
+}
+
+static const char *std_find_header_end(const char *begin, const char *end) {
+    const char PATTERN[] = "\r\n\r\n";
+    return std::search(begin, end, PATTERN, PATTERN + 4);
+}
+
+static void bench(const char *name, const std::string &request, ScanKernel::FindFunc find_crlf,
+                  ScanKernel::FindFunc find_header_end) {
+    const char *begin = request.data();
+    const char *end = begin + request.size();
+    double lines_ns = measure(ROUNDS, [&] {
+        size_t lines = 0;
+        const char *p = begin;
+        while (p < end) {
+            const char *line_end = find_crlf(p, end);
+            lines++;
+            p = line_end == end ? end : line_end + 2;
+        }
+        sink = lines;
+    });
+    double header_ns = measure(ROUNDS, [&] {
+        sink = find_header_end(begin, end) - begin;
+    });
+    printf("  %-8s lines %7.1f ns (%5.2f GB/s)   header end %7.1f ns (%5.2f GB/s)\n", name,
+           lines_ns, request.size() / lines_ns, header_ns, request.size() / header_ns);
+}
+
+int main() {
+    const std::vector<std::pair<const char *, std::string>> requests = {
+        {"chrome GET", CHROME_GET}, {"firefox POST", FIREFOX_POST}, {"curl GET", CURL_GET},
+    };
+    size_t num = 0;
+    const ScanKernel *kernels = ScanKernels(&num);
+    printf("active kernel: %s\n", ActiveScanKernel().name);
+    for (const auto &request : requests) {
+        printf("%s, %zu bytes\n", request.first, request.second.size());
+        bench("std", request.second, std_find_crlf, std_find_header_end);
+        for (size_t i = 0; i < num; i++) {
+            if (kernels[i].supported()) {
+                bench(kernels[i].name, request.second, kernels[i].find_crlf,
+                      kernels[i].find_header_end);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include "../../code/buffer/crlfscan.h"
+#include "../../code/buffer/chainbuffer.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+static const char *naive_find(const char *begin, const char *end, const char *pattern) {
+    return std::search(begin, end, pattern, pattern + strlen(pattern));
+}
+
+// Test fixture running every kernel the CPU supports
+class CrlfScanTest : public ::testing::Test {
+protected:
+    std::vector<const ScanKernel *> kernels;
+
+    void SetUp() override {
+        size_t num = 0;
+        const ScanKernel *all = ScanKernels(&num);
+        for (size_t i = 0; i < num; i++) {
+            if (all[i].supported()) {
+                kernels.push_back(&all[i]);
+            }
+        }
+        ASSERT_FALSE(kernels.empty());
+    }
+
+    void check(const std::string &data) {
+        // every suffix and prefix, so the delimiters land on every vector lane and in the tail
+        for (size_t from = 0; from <= data.size(); from++) {
+            for (size_t to = from; to <= data.size(); to += (to - from < 80 ? 1 : 7)) {
+                const char *begin = data.data() + from;
+                const char *end = data.data() + to;
+                const char *crlf = naive_find(begin, end, "\r\n");
+                const char *header_end = naive_find(begin, end, "\r\n\r\n");
+                for (const ScanKernel *kernel : kernels) {
+                    ASSERT_EQ(kernel->find_crlf(begin, end), crlf)
+                        << kernel->name << " from " << from << " to " << to;
+                    ASSERT_EQ(kernel->find_header_end(begin, end), header_end)
+                        << kernel->name << " from " << from << " to " << to;
+                }
+            }
+        }
+    }
+};
+
+// Test for inputs without any delimiter
+TEST_F(CrlfScanTest, NoDelimiter) {
+    check(std::string(100, 'a'));
+    check(std::string(100, '\r'));
+    check(std::string(100, '\n'));
+    check(std::string(""));
+}
+
+// Test for a real request header
+TEST_F(CrlfScanTest, RequestHeader) {
+    check("GET /index.html HTTP/1.1\r\nHost: localhost\r\nAccept: */*\r\n"
+          "Connection: keep-alive\r\n\r\nbody\r\n");
+}
+
+// Test for delimiters crossing every vector boundary
+TEST_F(CrlfScanTest, BoundaryPositions) {
+    for (size_t pos = 0; pos < 70; pos++) {
+        std::string data(72, 'x');
+        data.replace(pos, 2, "\r\n");
+        check(data);
+        data = std::string(74, 'x');
+        data.replace(pos, 4, "\r\n\r\n");
+        check(data);
+    }
+}
+
+// Test for random bytes dense with '\r' and '\n'
+TEST_F(CrlfScanTest, RandomDense) {
+    std::mt19937 rng(42);
+    const char alphabet[] = "\r\n\r\nab";
+    for (int round = 0; round < 20; round++) {
+        std::string data(120, '\0');
+        for (char &c : data) {
+            c = alphabet[rng() % 6];
+        }
+        check(data);
+    }
+}
+
+// Test for the buffer wrappers on a chain that has to be pulled up
+TEST_F(CrlfScanTest, ChainBuffer) {
+    BlockPool pool(16);
+    ChainBuffer buffer(&pool);
+    EXPECT_EQ(buffer.FindCRLF(), buffer.BeginWriteConst());
+    std::string head(BlockPool::BLOCK_SIZE_ - 1, 'h');
+    buffer.Append(head);
+    buffer.Append("\r\n\r\nrest", 8);
+    EXPECT_EQ(buffer.FindCRLF(), buffer.Peek() + head.size());
+    EXPECT_EQ(buffer.FindHeaderEnd(), buffer.Peek() + head.size());
+    buffer.Retrieve(head.size() + 4);
+    EXPECT_EQ(buffer.FindHeaderEnd(), buffer.BeginWriteConst());
+}
@@ -0,0 +1,102 @@
+#include "../../code/http/filecache.h"
+#include "tempdir.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Test fixture for FileCache class, with files in a temporary directory
+class FileCacheTest : public ::testing::Test {
+protected:
+    TempDir tmp{"filecache"};
+    std::string dir;
+
+    void SetUp() override {
+        ASSERT_FALSE(tmp.path().empty());
+        dir = tmp.path();
+    }
+
+    /**
+     * write a file and add it to the cache
+    */
+    bool add(FileCache &cache, const std::string &name, const std::string &data) {
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (!tmp.write(name, data) || stat(path.c_str(), &st) < 0) {
+            ADD_FAILURE() << "cannot write " << path;
+            return false;
+        }
+        return cache.put(path, st, data, "close:" + name, "keep-alive:" + name);
+    }
+};
+
+// Test for a hit returning the bytes and the headers of both connection types
+TEST_F(FileCacheTest, Hit) {
+    FileCache cache(1024, 256, 1);
+    EXPECT_EQ(cache.get(dir + "/a"), nullptr);
+    ASSERT_TRUE(add(cache, "a", "aaaa"));
+    auto entry = cache.get(dir + "/a");
+    ASSERT_NE(entry, nullptr);
+    EXPECT_EQ(entry->body, "aaaa");
+    EXPECT_EQ(entry->header(false), "close:a");
+    EXPECT_EQ(entry->header(true), "keep-alive:a");
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(cache.bytes(), 4);
+}
+
+// Test for the least recently used entry being evicted, and an evicted entry staying valid
+TEST_F(FileCacheTest, Evict) {
+    FileCache cache(300, 256, 1);
+    ASSERT_TRUE(add(cache, "a", std::string(100, 'a')));
+    ASSERT_TRUE(add(cache, "b", std::string(100, 'b')));
+    ASSERT_TRUE(add(cache, "c", std::string(100, 'c')));
+    auto a = cache.get(dir + "/a");
+    ASSERT_NE(a, nullptr);
+
+    ASSERT_TRUE(add(cache, "d", std::string(100, 'd')));
+    EXPECT_EQ(cache.get(dir + "/b"), nullptr);
+    EXPECT_NE(cache.get(dir + "/a"), nullptr);
+    EXPECT_EQ(cache.bytes(), 300);
+
+    ASSERT_TRUE(add(cache, "e", std::string(250, 'e')));
+    EXPECT_EQ(cache.size(), 1);
+    EXPECT_EQ(a->body, std::string(100, 'a'));
+
+    EXPECT_FALSE(add(cache, "f", std::string(257, 'f')));
+    EXPECT_FALSE(FileCache(0, 256).accepts(1));
+}
+
+// Test for a changed file being dropped on the next hit
+TEST_F(FileCacheTest, Revalidate) {
+    FileCache cache(1024, 256, 4, 0);
+    ASSERT_TRUE(add(cache, "a", "aaaa"));
+    EXPECT_NE(cache.get(dir + "/a"), nullptr);
+
+    ASSERT_TRUE(tmp.write("a", "more", true));
+    EXPECT_EQ(cache.get(dir + "/a"), nullptr);
+    EXPECT_EQ(cache.size(), 0);
+
+    ASSERT_TRUE(add(cache, "b", "bbbb"));
+    unlink((dir + "/b").c_str());
+    EXPECT_EQ(cache.get(dir + "/b"), nullptr);
+}
+
+// Test for a watched entry skipping the stat(), and an erase refusing a put read before it
+TEST_F(FileCacheTest, Generation) {
+    FileCache cache(1024, 256, 4, 0);
+    ASSERT_TRUE(add(cache, "a", "aaaa"));
+    unlink((dir + "/a").c_str());
+    EXPECT_NE(cache.get(dir + "/a", true), nullptr);
+    EXPECT_EQ(cache.get(dir + "/a"), nullptr);
+
+    std::string path = dir + "/b";
+    uint64_t generation = cache.generation(path);
+    ASSERT_TRUE(add(cache, "b", "bbbb"));
+    struct stat st;
+    ASSERT_EQ(stat(path.c_str(), &st), 0);
+    cache.erase(path);
+    EXPECT_FALSE(cache.put(path, st, "bbbb", "close:b", "keep-alive:b", generation));
+    EXPECT_EQ(cache.get(path, true), nullptr);
+    EXPECT_TRUE(cache.put(path, st, "bbbb", "close:b", "keep-alive:b", cache.generation(path)));
+    EXPECT_NE(cache.get(path, true), nullptr);
+}
@@ -0,0 +1,118 @@
+#include "../../code/http/fileindex.h"
+#include "../../code/http/filecache.h"
+#include "tempdir.h"
+#include <chrono>
+#include <cstdio>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+// Test fixture for FileIndex class, indexing a temporary directory
+class FileIndexTest : public ::testing::Test {
+protected:
+    TempDir tmp{"fileindex"};
+    std::string root;
+    FileIndex index;
+
+    void SetUp() override {
+        ASSERT_FALSE(tmp.path().empty());
+        root = tmp.path() + "/";
+        write("index.html", "<html></html>");
+        ASSERT_EQ(mkdir((root + "css").c_str(), 0755), 0);
+        write("css/a.css", "body {}");
+        ASSERT_TRUE(index.init(root));
+    }
+
+    void TearDown() override {
+        index.stop();
+    }
+
+    void write(const std::string &name, const std::string &data) {
+        ASSERT_TRUE(tmp.write(name, data)) << name;
+    }
+
+    /**
+     * wait for the index thread to catch up with a change
+    */
+    FileIndex::LOOKUP_ wait_for(const std::string &path, FileIndex::LOOKUP_ expected) {
+        FileIndex::Meta meta;
+        FileIndex::LOOKUP_ ret = index.lookup(root, path, &meta);
+        for (int i = 0; i < 200 && ret != expected; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            ret = index.lookup(root, path, &meta);
+        }
+        return ret;
+    }
+};
+
+// Test for the tree walked by init()
+TEST_F(FileIndexTest, Walk) {
+    FileIndex::Meta meta;
+    ASSERT_EQ(index.lookup(root, "/index.html", &meta), FileIndex::FOUND);
+    EXPECT_EQ(meta.size, 13);
+    EXPECT_TRUE(S_ISREG(meta.mode));
+    EXPECT_EQ(meta.type, "text/html");
+    ASSERT_EQ(index.lookup(root, "/css", &meta), FileIndex::FOUND);
+    EXPECT_TRUE(S_ISDIR(meta.mode));
+    EXPECT_EQ(index.lookup(root, "/css/a.css", &meta), FileIndex::FOUND);
+    EXPECT_EQ(index.size(), 3);
+
+    EXPECT_EQ(index.lookup(root, "/wp-login.php", &meta), FileIndex::MISSING);
+    EXPECT_EQ(index.lookup(root, "/css/b.css", &meta), FileIndex::MISSING);
+    EXPECT_EQ(index.lookup(root, "/../index.html", &meta), FileIndex::UNKNOWN);
+    EXPECT_EQ(index.lookup(root, "//index.html", &meta), FileIndex::UNKNOWN);
+    EXPECT_EQ(index.lookup("/other/", "/index.html", &meta), FileIndex::UNKNOWN);
+}
+
+// Test for created, changed, moved and deleted files and directories
+TEST_F(FileIndexTest, Changes) {
+    write("new.txt", "1");
+    EXPECT_EQ(wait_for("/new.txt", FileIndex::FOUND), FileIndex::FOUND);
+
+    write("index.html", "<html>changed</html>");
+    FileIndex::Meta meta;
+    for (int i = 0; i < 200; i++) {
+        index.lookup(root, "/index.html", &meta);
+        if (meta.size == 20) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_EQ(meta.size, 20);
+
+    ASSERT_EQ(unlink((root + "new.txt").c_str()), 0);
+    EXPECT_EQ(wait_for("/new.txt", FileIndex::MISSING), FileIndex::MISSING);
+
+    ASSERT_EQ(mkdir((root + "img").c_str(), 0755), 0);
+    write("img/a.png", "png");
+    EXPECT_EQ(wait_for("/img/a.png", FileIndex::FOUND), FileIndex::FOUND);
+
+    ASSERT_EQ(rename((root + "css").c_str(), (root + "style").c_str()), 0);
+    EXPECT_EQ(wait_for("/css/a.css", FileIndex::MISSING), FileIndex::MISSING);
+    EXPECT_EQ(wait_for("/style/a.css", FileIndex::FOUND), FileIndex::FOUND);
+    write("style/b.css", "b");
+    EXPECT_EQ(wait_for("/style/b.css", FileIndex::FOUND), FileIndex::FOUND);
+}
+
+// Test for a changed file being dropped from the FileCache
+TEST_F(FileIndexTest, DropsCached) {
+    // the cache is set up while nothing else uses it
+    index.stop();
+    FileCache *cache = FileCache::instance();
+    cache->init(1024, 256, 1, -1);
+    ASSERT_TRUE(index.init(root));
+    struct stat st;
+    ASSERT_EQ(stat((root + "index.html").c_str(), &st), 0);
+    ASSERT_TRUE(cache->put(root + "/index.html", st, "<html></html>", "", ""));
+    ASSERT_NE(cache->get(root + "/index.html"), nullptr);
+
+    write("index.html", "<html>changed</html>");
+    for (int i = 0; i < 200 && cache->get(root + "/index.html") != nullptr; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_EQ(cache->get(root + "/index.html"), nullptr);
+    index.stop();
+    cache->init(0, 0);
+}
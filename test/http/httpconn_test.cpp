@@ -0,0 +1,214 @@
+#include "../../code/http/httpconn.h"
+#include "tempdir.h"
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+// Test fixture for HttpConn class, serving a temporary directory over a socketpair
+class HttpConnTest : public ::testing::Test {
+protected:
+    HttpConn conn;
+    TempDir tmp{"httpconn"};
+    std::string dir;
+    int client = -1;
+    int prefetches = 0;
+
+    void SetUp() override {
+        ASSERT_FALSE(tmp.path().empty());
+        dir = tmp.path();
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        // a small send buffer, so most writes of a response are partial
+        int size = 4096;
+        ASSERT_EQ(setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)), 0);
+        fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+        client = fds[1];
+        HttpConn::is_ET = false;
+        HttpConn::src_dir = dir.c_str();
+        HttpConn::prefetch_window = 0;
+        HttpResponse::sendfile_threshold = 64 * 1024;
+        conn.init(fds[0], sockaddr_in{});
+    }
+
+    void TearDown() override {
+        conn.close();
+        close(client);
+        HttpResponse::sendfile_threshold = SIZE_MAX;
+        HttpConn::prefetch_window = 0;
+    }
+
+    /**
+     * write a file with bytes that differ from offset to offset
+    */
+    std::string write(const std::string &name, size_t size) {
+        std::string data;
+        for (size_t i = 0; i < size; i++) {
+            data += static_cast<char>('a' + (i * 7 + i / 4096) % 26);
+        }
+        EXPECT_TRUE(tmp.write(name, data)) << name;
+        return data;
+    }
+
+    /**
+     * drop the pages of a file from the page cache, so it has to be read in again
+    */
+    void evict(const std::string &name) {
+        int fd = open((dir + "/" + name).c_str(), O_RDONLY);
+        ASSERT_GE(fd, 0);
+        fsync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+
+    /**
+     * send requests and answer them the way the reactors do: write until the socket is full,
+     * run the prefetch job where write() asks for one, every other time skipping it like a
+     * full IO lane does, and process the next requests once the responses are out
+     * @param by_msg send with send_msg() where the connection allows it, like the ring does
+     * @return the bytes the client received
+    */
+    std::string exchange(const std::string &requests, bool by_msg = false) {
+        EXPECT_EQ(::write(client, requests.data(), requests.size()),
+                  static_cast<ssize_t>(requests.size()));
+        int save_error = 0;
+        EXPECT_GT(conn.read(&save_error), 0);
+        std::string received;
+        while (conn.process()) {
+            while (conn.to_write_bytes() > 0) {
+                save_error = 0;
+                int flags = 0;
+                const struct msghdr *msg = by_msg ? conn.send_msg(&flags) : nullptr;
+                if (msg != nullptr) {
+                    // what an event backend sending for the connection does
+                    EXPECT_TRUE(conn.is_sending());
+                    ssize_t len = sendmsg(conn.get_fd(), msg, flags);
+                    conn.finish_send(len < 0 ? -errno : len);
+                    EXPECT_FALSE(conn.is_sending());
+                    drain(&received);
+                    continue;
+                }
+                ssize_t len = conn.write(&save_error);
+                if (conn.needs_prefetch()) {
+                    if (prefetches++ % 2 == 0) {
+                        conn.prefetch_job()();
+                    }
+                    conn.finish_prefetch();
+                } else if (len < 0 && save_error != EAGAIN) {
+                    ADD_FAILURE() << "write error " << save_error;
+                    return received;
+                }
+                drain(&received);
+            }
+        }
+        drain(&received);
+        return received;
+    }
+
+    void drain(std::string *received) {
+        char buf[64 * 1024];
+        ssize_t len;
+        while ((len = read(client, buf, sizeof(buf))) > 0) {
+            received->append(buf, len);
+        }
+    }
+
+    /**
+     * split the bytes of pipelined responses into their bodies, by their Content-length
+    */
+    static std::vector<std::string> bodies(const std::string &received) {
+        std::vector<std::string> ret;
+        size_t pos = 0;
+        while (pos < received.size()) {
+            size_t end = received.find("\r\n\r\n", pos);
+            size_t field = received.find("Content-length: ", pos);
+            if (end == std::string::npos || field == std::string::npos || field > end) {
+                ADD_FAILURE() << "malformed response at " << pos;
+                break;
+            }
+            size_t len = std::stoul(received.substr(field + 16));
+            ret.push_back(received.substr(end + 4, len));
+            pos = end + 4 + len;
+        }
+        return ret;
+    }
+};
+
+// Test for pipelined responses from mapped files, written in many partial writes
+TEST_F(HttpConnTest, PipelinedPartialWrites) {
+    std::string a = write("a.txt", 30000);
+    std::string b = write("b.txt", 1000);
+    std::string request = "GET /a.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n";
+    std::string received = exchange(request + request +
+                                     "GET /b.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n" +
+                                     request);
+    std::vector<std::string> got = bodies(received);
+    ASSERT_EQ(got.size(), 4);
+    EXPECT_EQ(got[0], a);
+    EXPECT_EQ(got[1], a);
+    EXPECT_EQ(got[2], b);
+    EXPECT_EQ(got[3], a);
+    EXPECT_TRUE(conn.is_keep_alive());
+    EXPECT_EQ(conn.to_write_bytes(), 0);
+}
+
+// Test for a response sent with sendfile() followed by one from a mapped file
+TEST_F(HttpConnTest, SendfileThenMapped) {
+    std::string big = write("big.bin", 300000);
+    std::string small = write("small.txt", 5000);
+    std::string received = exchange("GET /big.bin HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+                                     "GET /small.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+                                     "GET /big.bin HTTP/1.1\r\n\r\n");
+    std::vector<std::string> got = bodies(received);
+    ASSERT_EQ(got.size(), 3);
+    EXPECT_EQ(got[0], big);
+    EXPECT_EQ(got[1], small);
+    EXPECT_EQ(got[2], big);
+    EXPECT_FALSE(conn.is_keep_alive());
+}
+
+// Test for files cut at the prefetch window and sent on after finish_prefetch()
+TEST_F(HttpConnTest, Prefetch) {
+    HttpConn::prefetch_window = 16 * 1024;
+    std::string big = write("big.bin", 200000);
+    std::string small = write("small.txt", 50000);
+    evict("big.bin");
+    evict("small.txt");
+    std::string received = exchange("GET /small.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+                                     "GET /big.bin HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+                                     "GET /small.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n");
+    std::vector<std::string> got = bodies(received);
+    ASSERT_EQ(got.size(), 3);
+    EXPECT_EQ(got[0], small);
+    EXPECT_EQ(got[1], big);
+    EXPECT_EQ(got[2], small);
+    /**
+     * whether write() finds a window cold depends on how soon the disk has read it in, the
+     * bytes and their order have to be the same either way
+    */
+    EXPECT_FALSE(conn.needs_prefetch());
+}
+
+// Test for responses sent as messages from send_msg(), handing files over to write()
+TEST_F(HttpConnTest, SendMsg) {
+    std::string big = write("big.bin", 300000);
+    std::string small = write("small.txt", 30000);
+    std::string received = exchange("GET /small.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+                                     "GET /big.bin HTTP/1.1\r\nConnection: keep-alive\r\n\r\n"
+                                     "GET /small.txt HTTP/1.1\r\nConnection: keep-alive\r\n\r\n",
+                                     true);
+    std::vector<std::string> got = bodies(received);
+    ASSERT_EQ(got.size(), 3);
+    EXPECT_EQ(got[0], small);
+    EXPECT_EQ(got[1], big);
+    EXPECT_EQ(got[2], small);
+    EXPECT_EQ(conn.to_write_bytes(), 0);
+    int flags = 0;
+    EXPECT_EQ(conn.send_msg(&flags), nullptr);
+}
@@ -0,0 +1,41 @@
+#include "../../code/http/httpdate.h"
+#include <ctime>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Test for formatting and parsing a date
+TEST(HttpDateTest, FormatParse) {
+    char date[HttpDate::LEN];
+    HttpDate::format(784111777, date);
+    EXPECT_EQ(std::string(date, sizeof(date)), "Sun, 06 Nov 1994 08:49:37 GMT");
+    HttpDate::format(0, date);
+    EXPECT_EQ(std::string(date, sizeof(date)), "Thu, 01 Jan 1970 00:00:00 GMT");
+
+    time_t t = 0;
+    ASSERT_TRUE(HttpDate::parse("Sun, 06 Nov 1994 08:49:37 GMT", &t));
+    EXPECT_EQ(t, 784111777);
+    EXPECT_FALSE(HttpDate::parse("Sunday, 06-Nov-94 08:49:37 GMT", &t));
+    EXPECT_FALSE(HttpDate::parse("Sun, 06 Nov 1994 08:49:37 GMT trailing", &t));
+}
+
+// Test for the current date shared by several threads
+TEST(HttpDateTest, Now) {
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        threads.emplace_back([]() {
+            for (int j = 0; j < 10000; j++) {
+                time_t before = time(nullptr);
+                std::string now(HttpDate::now());
+                time_t t = 0;
+                ASSERT_TRUE(HttpDate::parse(now, &t)) << now;
+                EXPECT_GE(t, before);
+                EXPECT_LE(t, time(nullptr));
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+}
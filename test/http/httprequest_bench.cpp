@@ -0,0 +1,149 @@
+/**
+ * microbenchmark of HttpRequest::parse against the std::regex parser it replaced, on the
+ * request headers browsers send to the server.
+ *
+ * every round appends a request to an empty buffer, parses it, drops it from the buffer and
+ * resets the parser, the way HttpConn::process() handles a keep-alive connection. the regex
+ * parser is a copy of the old one without its logging and POST handling, which both parsers
+ * share.
+ *
+ * build and run (links the MySQL client library through HttpRequest::user_verify):
+ *     g++ -std=c++17 -O2 httprequest_bench.cpp ../../code/http/httprequest.cpp \
+ *         ../../code/http/bodysink.cpp ../../code/http/router.cpp ../../code/http/httpdate.cpp \
+ *         ../../code/buffer/*.cpp ../../code/log/*.cpp ../../code/pool/*.cpp \
+ *         ../../code/server/epoller.cpp ../../code/server/iouring.cpp \
+ *         -lmysqlclient -lpthread -o httprequest_bench
+ *     ./httprequest_bench
+*/
+
+#include "../../code/http/httprequest.h"
+#include "../bench_util.h"
+#include <cstdio>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+static const int ROUNDS = 20000;
+
+static const char FIREFOX_GET[] =
+    "GET /welcome.html HTTP/1.1\r\n"
+    "Host: localhost:1316\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:125.0) Gecko/20100101 Firefox/125.0\r\n"
+    "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;q=0.8\r\n"
+    "Accept-Language: en-US,en;q=0.5\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Connection: keep-alive\r\n"
+    "Referer: http://localhost:1316/login.html\r\n"
+    "Upgrade-Insecure-Requests: 1\r\n"
+    "Sec-Fetch-Dest: document\r\n"
+    "Sec-Fetch-Mode: navigate\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-User: ?1\r\n"
+    "\r\n";
+
+/**
+ * the parser before the state machine: one std::string per line, matched with std::regex
+*/
+class RegexRequest {
+public:
+    void init() {
+        state_ = REQUEST_LINE;
+        method_ = path_ = version_ = "";
+        header_.clear();
+    }
+
+    bool parse(ChainBuffer &buffer) {
+        while (buffer.ReadableBytes() != 0 && state_ != FINISH) {
+            const char *begin = buffer.Peek();
+            const char *end = begin + buffer.ReadableBytes();
+            const char *line_end = buffer.FindCRLF();
+            std::string line(begin, line_end);
+            switch (state_) {
+                case REQUEST_LINE:
+                    if (!parse_request_line(line)) {
+                        return false;
+                    }
+                    break;
+                case HEADERS:
+                    parse_header(line);
+                    if (buffer.ReadableBytes() <= 2) {
+                        state_ = FINISH;
+                    }
+                    break;
+                default:
+                    break;
+            }
+            if (line_end == end) {
+                break;
+            }
+            buffer.RetrieveUntil(line_end + 2);
+        }
+        return true;
+    }
+
+    size_t header_num() const {
+        return header_.size();
+    }
+
+private:
+    bool parse_request_line(const std::string &line) {
+        std::regex patten("^([^ ]*) ([^ ]*) HTTP/([^ ]*)$");
+        std::smatch sub_match;
+        if (std::regex_match(line, sub_match, patten)) {
+            method_ = sub_match[1];
+            path_ = sub_match[2];
+            version_ = sub_match[3];
+            state_ = HEADERS;
+            return true;
+        }
+        return false;
+    }
+
+    void parse_header(const std::string &line) {
+        std::regex patten("^([^:]*): ?(.*)$");
+        std::smatch sub_match;
+        if (std::regex_match(line, sub_match, patten)) {
+            header_[sub_match[1]] = sub_match[2];
+        } else {
+            state_ = FINISH;
+        }
+    }
+
+    enum { REQUEST_LINE, HEADERS, FINISH } state_;
+    std::string method_, path_, version_;
+    std::unordered_map<std::string, std::string> header_;
+};
+
+int main() {
+    const std::vector<std::pair<const char *, std::string>> requests = {
+        {"chrome GET", CHROME_GET}, {"firefox GET", FIREFOX_GET}, {"curl GET", CURL_GET},
+    };
+    BlockPool pool(16);
+    ChainBuffer buffer(&pool);
+    for (const auto &request : requests) {
+        const std::string &data = request.second;
+
+        RegexRequest old_request;
+        double regex_ns = measure(ROUNDS, [&] {
+            old_request.init();
+            buffer.Append(data);
+            old_request.parse(buffer);
+            buffer.RetrieveAll();
+            sink = old_request.header_num();
+        });
+
+        HttpRequest new_request;
+        double state_ns = measure(ROUNDS, [&] {
+            new_request.init();
+            buffer.Append(data);
+            new_request.parse(buffer);
+            buffer.Retrieve(new_request.size());
+            sink = new_request.header("Host").size();
+        });
+
+        printf("%-12s %4zu bytes   regex %8.1f ns   state machine %6.1f ns   %5.1fx\n",
+               request.first, data.size(), regex_ns, state_ns, regex_ns / state_ns);
+    }
+    return 0;
+}
@@ -0,0 +1,400 @@
+#include "../../code/http/httprequest.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <unistd.h>
+
+static const std::string GET =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Connection: keep-alive\r\n"
+    "Accept:text/html\r\n"
+    "User-Agent: Mozilla/5.0 (X11; Linux x86_64)\r\n"
+    "\r\n";
+
+static const std::string POST =
+    "POST /picture HTTP/1.1\r\n"
+    "Host: www.example.com\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 32\r\n"
+    "\r\n"
+    "username=John+Doe&password=1%3A2";
+
+// Test fixture for HttpRequest class
+class HttpRequestTest : public ::testing::Test {
+protected:
+    BlockPool pool;
+    ChainBuffer buffer;
+    HttpRequest request;
+
+    HttpRequestTest() : pool(16), buffer(&pool) {}
+
+    /**
+     * answer the finished request like HttpConn::process() does
+    */
+    void drop() {
+        ASSERT_TRUE(request.is_finished());
+        buffer.Retrieve(request.size());
+        request.init();
+    }
+};
+
+// Test for a request line and headers received at once
+TEST_F(HttpRequestTest, CompleteGet) {
+    buffer.Append(GET);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.method(), "GET");
+    EXPECT_EQ(request.path(), "/index.html");
+    EXPECT_EQ(request.version(), "1.1");
+    EXPECT_EQ(request.header("Host"), "www.example.com");
+    EXPECT_EQ(request.header("Accept"), "text/html");
+    EXPECT_EQ(request.header("User-Agent"), "Mozilla/5.0 (X11; Linux x86_64)");
+    EXPECT_EQ(request.header("Cookie"), "");
+    EXPECT_TRUE(request.is_keep_alive());
+    EXPECT_EQ(request.size(), GET.size());
+}
+
+// Test for the default pages and the form body
+TEST_F(HttpRequestTest, PostForm) {
+    buffer.Append(POST);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.path(), "/picture.html");
+    EXPECT_EQ(request.get_post("username"), "John Doe");
+    EXPECT_FALSE(request.is_keep_alive());
+    EXPECT_FALSE(request.needs_verify());
+    EXPECT_EQ(request.size(), POST.size());
+}
+
+// Test for a request arriving one byte at a time
+TEST_F(HttpRequestTest, ByteByByte) {
+    for (size_t i = 0; i < POST.size(); i++) {
+        ASSERT_EQ(request.parse(buffer), HttpRequest::NO_REQUEST) << "after " << i << " bytes";
+        buffer.Append(POST.data() + i, 1);
+    }
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.method(), "POST");
+    EXPECT_EQ(request.header("Content-Length"), "32");
+    EXPECT_EQ(request.get_post("username"), "John Doe");
+}
+
+// Test for a request split across blocks of the buffer
+TEST_F(HttpRequestTest, SplitAcrossBlocks) {
+    std::string cookie(BlockPool::BLOCK_SIZE_, 'c');
+    std::string head = "GET / HTTP/1.1\r\nCookie: " + cookie + "\r\n";
+    buffer.Append(head);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::NO_REQUEST);
+    buffer.Append("Connection: keep-alive\r\n\r\n", 26);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.path(), "/index.html");
+    EXPECT_EQ(request.header("Cookie"), cookie);
+    EXPECT_TRUE(request.is_keep_alive());
+}
+
+// Test for pipelined requests in one buffer
+TEST_F(HttpRequestTest, Pipelined) {
+    buffer.Append(GET + POST + GET);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.method(), "GET");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.method(), "POST");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.header("Host"), "www.example.com");
+    drop();
+    EXPECT_EQ(buffer.ReadableBytes(), 0);
+}
+
+// Test for malformed requests
+TEST_F(HttpRequestTest, BadRequests) {
+    const char *bad[] = {
+        "GET /index.html\r\n\r\n",
+        "GET /index.html FTP/1.1\r\n\r\n",
+        "GET /index.html HTTP/1.1 extra\r\n\r\n",
+        "GET / HTTP/1.1\r\nno colon here\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 12x\r\n\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 99999999999999999999\r\n\r\n",
+    };
+    for (const char *item : bad) {
+        buffer.Append(std::string(item));
+        EXPECT_EQ(request.parse(buffer), HttpRequest::BAD_REQUEST) << item;
+        EXPECT_FALSE(request.is_keep_alive());
+        drop();
+        EXPECT_EQ(buffer.ReadableBytes(), 0);
+    }
+}
+
+// Test for a header section that never ends
+TEST_F(HttpRequestTest, HeaderTooLarge) {
+    buffer.Append(std::string("GET / HTTP/1.1\r\nX-Long: "));
+    HttpRequest::HTTP_CODE_ ret = HttpRequest::NO_REQUEST;
+    for (int i = 0; i < 100 && ret == HttpRequest::NO_REQUEST; i++) {
+        buffer.Append(std::string(1024, 'x'));
+        ret = request.parse(buffer);
+    }
+    EXPECT_EQ(ret, HttpRequest::BAD_REQUEST);
+}
+
+// Test for the perfect hash over the known header names
+TEST(HttpRequestHeaderTest, HeaderId) {
+    EXPECT_EQ(HttpRequest::header_id("Host"), HttpRequest::HOST);
+    EXPECT_EQ(HttpRequest::header_id("content-length"), HttpRequest::CONTENT_LENGTH);
+    EXPECT_EQ(HttpRequest::header_id("CONTENT-TYPE"), HttpRequest::CONTENT_TYPE);
+    EXPECT_EQ(HttpRequest::header_id("If-None-Match"), HttpRequest::IF_NONE_MATCH);
+    EXPECT_EQ(HttpRequest::header_id("Authorization"), HttpRequest::AUTHORIZATION);
+    EXPECT_EQ(HttpRequest::header_id(""), HttpRequest::UNKNOWN_HEADER);
+    EXPECT_EQ(HttpRequest::header_id("Hast"), HttpRequest::UNKNOWN_HEADER);
+    EXPECT_EQ(HttpRequest::header_id("X-Forwarded-For"), HttpRequest::UNKNOWN_HEADER);
+    EXPECT_EQ(HttpRequest::header_id("Content-Lengths"), HttpRequest::UNKNOWN_HEADER);
+}
+
+// Test for known and unknown headers looked up in any case
+TEST_F(HttpRequestTest, HeaderSlots) {
+    buffer.Append(std::string("GET / HTTP/1.1\r\n"
+                              "host: a\r\n"
+                              "CONNECTION: Keep-Alive\r\n"
+                              "X-Request-Id: 42\r\n"
+                              "Host: b\r\n"
+                              "Accept-Language:\r\n"
+                              "\r\n"));
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.header(HttpRequest::HOST), "b");
+    EXPECT_EQ(request.header("HOST"), "b");
+    EXPECT_EQ(request.header("x-request-id"), "42");
+    EXPECT_EQ(request.header(HttpRequest::ACCEPT_LANGUAGE), "");
+    EXPECT_EQ(request.header(HttpRequest::COOKIE), "");
+    EXPECT_TRUE(request.is_keep_alive());
+    drop();
+    EXPECT_EQ(request.header(HttpRequest::HOST), "");
+}
+
+static const std::string CHUNKED =
+    "POST /upload HTTP/1.1\r\n"
+    "Transfer-Encoding: chunked\r\n"
+    "Connection: keep-alive\r\n"
+    "\r\n"
+    "4\r\nWiki\r\n"
+    "5;name=value\r\npedia\r\n"
+    "E\r\n in\r\n\r\nchunks.\r\n"
+    "0\r\n"
+    "Expires: never\r\n"
+    "\r\n";
+
+/**
+ * read the whole body file of a request
+*/
+static std::string read_body_file(const HttpRequest &request) {
+    std::string data(request.body_size(), '\0');
+    ssize_t len = pread(request.body_fd(), &data[0], data.size(), 0);
+    EXPECT_EQ(len, static_cast<ssize_t>(data.size()));
+    return data;
+}
+
+// Test for a chunked body decoded in place, followed by a pipelined request
+TEST_F(HttpRequestTest, ChunkedInPlace) {
+    buffer.Append(CHUNKED + GET);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.body(), "Wikipedia in\r\n\r\nchunks.");
+    EXPECT_EQ(request.body_size(), 23);
+    EXPECT_EQ(request.body_fd(), -1);
+    EXPECT_EQ(request.header("Expires"), "");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.path(), "/index.html");
+    drop();
+    EXPECT_EQ(buffer.ReadableBytes(), 0);
+}
+
+// Test for a chunked body arriving one byte at a time
+TEST_F(HttpRequestTest, ChunkedByteByByte) {
+    for (size_t i = 0; i < CHUNKED.size(); i++) {
+        ASSERT_EQ(request.parse(buffer), HttpRequest::NO_REQUEST) << "after " << i << " bytes";
+        buffer.Append(CHUNKED.data() + i, 1);
+    }
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.body(), "Wikipedia in\r\n\r\nchunks.");
+    EXPECT_TRUE(request.is_keep_alive());
+}
+
+// Test for a chunked form
+TEST_F(HttpRequestTest, ChunkedForm) {
+    buffer.Append(std::string("POST /picture HTTP/1.1\r\n"
+                              "Content-Type: application/x-www-form-urlencoded\r\n"
+                              "Transfer-Encoding: chunked\r\n\r\n"
+                              "9\r\nusername=\r\n8\r\nJohn+Doe\r\n0\r\n\r\n"));
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.get_post("username"), "John Doe");
+}
+
+// Test for a Content-Length body that is too large to stay in the buffer
+TEST_F(HttpRequestTest, LargeBodySpilled) {
+    std::string head = "POST /upload HTTP/1.1\r\nContent-Length: 1048576\r\n\r\n";
+    buffer.Append(head);
+    std::string body;
+    for (int i = 0; body.size() < 1048576; i++) {
+        std::string piece(16384, static_cast<char>('a' + i % 26));
+        body += piece;
+        buffer.Append(piece);
+        HttpRequest::HTTP_CODE_ ret = request.parse(buffer);
+        ASSERT_EQ(ret, body.size() < 1048576 ? HttpRequest::NO_REQUEST : HttpRequest::GET_REQUEST);
+        // only the headers stay buffered, the body goes to the file as it arrives
+        EXPECT_EQ(buffer.ReadableBytes(), head.size());
+    }
+    EXPECT_EQ(request.body(), "");
+    ASSERT_GE(request.body_fd(), 0);
+    EXPECT_EQ(request.body_size(), body.size());
+    EXPECT_TRUE(read_body_file(request) == body);
+    drop();
+    EXPECT_EQ(request.body_fd(), -1);
+}
+
+// Test for a chunked body that outgrows the buffer halfway
+TEST_F(HttpRequestTest, LargeChunkedSpilled) {
+    std::string head = "POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    buffer.Append(head);
+    std::string body;
+    for (int i = 0; i < 100; i++) {
+        std::string piece(2000 + i, static_cast<char>('a' + i % 26));
+        body += piece;
+        char size[16];
+        snprintf(size, sizeof(size), "%x\r\n", static_cast<unsigned>(piece.size()));
+        buffer.Append(std::string(size) + piece + "\r\n");
+        ASSERT_EQ(request.parse(buffer), HttpRequest::NO_REQUEST);
+        EXPECT_LE(buffer.ReadableBytes(), head.size() + 65536);
+    }
+    buffer.Append(std::string("0\r\n\r\n"));
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    ASSERT_GE(request.body_fd(), 0);
+    EXPECT_TRUE(read_body_file(request) == body);
+    EXPECT_EQ(request.size(), head.size());
+}
+
+// Test for malformed body framing
+TEST_F(HttpRequestTest, BadFraming) {
+    const char *bad[] = {
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 4\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n;x\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n2\r\nabc\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nffffffffffffffffff\r\n",
+        "POST / HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: 50\r\n\r\n",
+        "POST / HTTP/1.1\r\nTransfer-Encoding: gzip\r\nTransfer-Encoding: chunked\r\n\r\n",
+    };
+    for (const char *item : bad) {
+        buffer.Append(std::string(item));
+        EXPECT_EQ(request.parse(buffer), HttpRequest::BAD_REQUEST) << item;
+        drop();
+        EXPECT_EQ(buffer.ReadableBytes(), 0);
+    }
+}
+
+// Test for the built-in routes and a route added from outside
+TEST_F(HttpRequestTest, Routes) {
+    int id = HttpRequest::add_route(Router::PREFIX, "/api/", [](HttpRequest &request) {
+        request.path() = "/api.json";
+    });
+    ASSERT_GE(id, HttpRequest::USER_ROUTE);
+    int png = HttpRequest::add_route(Router::SUFFIX, ".png", [](HttpRequest &request) {
+        request.path() = "/image.png";
+    });
+    ASSERT_GE(png, HttpRequest::USER_ROUTE);
+
+    buffer.Append(std::string("GET /welcome HTTP/1.1\r\n\r\n"
+                              "GET /welcome?x=1 HTTP/1.1\r\n\r\n"
+                              "GET /login.html HTTP/1.1\r\n\r\n"
+                              "GET /api/users?id=1 HTTP/1.1\r\n\r\n"
+                              "GET /a.png?v=3 HTTP/1.1\r\n\r\n"
+                              "GET /other HTTP/1.1\r\n\r\n"));
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.route(), HttpRequest::PAGE_ROUTE);
+    EXPECT_EQ(request.path(), "/welcome.html");
+    EXPECT_EQ(request.query(), "");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.route(), HttpRequest::PAGE_ROUTE);
+    EXPECT_EQ(request.path(), "/welcome.html");
+    EXPECT_EQ(request.query(), "x=1");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.route(), HttpRequest::LOGIN_ROUTE);
+    EXPECT_EQ(request.path(), "/login.html");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.route(), id);
+    EXPECT_EQ(request.path(), "/api.json");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.route(), png);
+    EXPECT_EQ(request.path(), "/image.png");
+    EXPECT_EQ(request.query(), "v=3");
+    drop();
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.route(), Router::NO_ROUTE);
+    EXPECT_EQ(request.path(), "/other");
+}
+
+// Test for evaluating If-None-Match and If-Modified-Since
+TEST_F(HttpRequestTest, Conditional) {
+    buffer.Append(GET);
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_FALSE(request.is_conditional());
+    EXPECT_FALSE(request.is_not_modified("\"1-2-3\"", 0));
+    drop();
+
+    buffer.Append("GET /a.css HTTP/1.1\r\n"
+                  "If-None-Match: \"0-0-0\", W/\"1-2-3\"\r\n"
+                  "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+                  "\r\n");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_TRUE(request.is_conditional());
+    EXPECT_TRUE(request.is_not_modified("\"1-2-3\"", 0));
+    EXPECT_TRUE(request.is_not_modified("W/\"0-0-0\"", 0));
+    // If-None-Match decides alone, however old the file is
+    EXPECT_FALSE(request.is_not_modified("\"1-2-4\"", 0));
+    drop();
+
+    buffer.Append("GET /a.css HTTP/1.1\r\nIf-None-Match: *\r\n\r\n");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_TRUE(request.is_not_modified("\"1-2-3\"", 0));
+    drop();
+
+    buffer.Append("GET /a.css HTTP/1.1\r\n"
+                  "If-Modified-Since: Sun, 06 Nov 1994 08:49:37 GMT\r\n"
+                  "\r\n");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_TRUE(request.is_not_modified("\"1-2-3\"", 784111777));
+    EXPECT_FALSE(request.is_not_modified("\"1-2-3\"", 784111778));
+    drop();
+
+    buffer.Append("GET /a.css HTTP/1.1\r\nIf-Modified-Since: yesterday\r\n\r\n");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_FALSE(request.is_not_modified("\"1-2-3\"", 0));
+}
+
+// Test for the Range of a GET and its If-Range
+TEST_F(HttpRequestTest, Range) {
+    buffer.Append("GET /a.mpg HTTP/1.1\r\nRange: bytes=0-99\r\n\r\n");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.range(), "bytes=0-99");
+    EXPECT_TRUE(request.is_range_current("\"1-2-3\"", 0));
+    drop();
+
+    buffer.Append("GET /a.mpg HTTP/1.1\r\nRange: bytes=0-99\r\nIf-Range: \"1-2-3\"\r\n\r\n");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_TRUE(request.is_range_current("\"1-2-3\"", 0));
+    EXPECT_FALSE(request.is_range_current("\"1-2-4\"", 0));
+    EXPECT_FALSE(request.is_range_current("W/\"1-2-3\"", 0));
+    drop();
+
+    buffer.Append("GET /a.mpg HTTP/1.1\r\nRange: bytes=0-99\r\n"
+                  "If-Range: Sun, 06 Nov 1994 08:49:37 GMT\r\n\r\n");
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_TRUE(request.is_range_current("\"1-2-3\"", 784111777));
+    EXPECT_FALSE(request.is_range_current("\"1-2-3\"", 784111776));
+    drop();
+
+    buffer.Append(POST.substr(0, POST.find("\r\n\r\n")) + "\r\nRange: bytes=0-1\r\n\r\n" +
+                  POST.substr(POST.find("\r\n\r\n") + 4));
+    ASSERT_EQ(request.parse(buffer), HttpRequest::GET_REQUEST);
+    EXPECT_EQ(request.range(), "");
+}
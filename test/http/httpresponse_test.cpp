@@ -0,0 +1,310 @@
+#include "../../code/http/httpresponse.h"
+#include "../../code/http/compressor.h"
+#include "tempdir.h"
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// Test fixture for HttpResponse class, serving a temporary directory
+class HttpResponseTest : public ::testing::Test {
+protected:
+    BlockPool pool;
+    ChainBuffer buffer;
+    HttpResponse response;
+    TempDir tmp{"httpresponse"};
+    std::string dir;
+
+    HttpResponseTest() : pool(16), buffer(&pool) {}
+
+    void SetUp() override {
+        ASSERT_FALSE(tmp.path().empty());
+        dir = tmp.path() + "/";
+        write("app.js", std::string(100, 'j'));
+        write("app.js.gz", std::string(40, 'g'));
+        write("app.js.br", std::string(30, 'b'));
+        write("style.css", std::string(50, 'c'));
+        write("style.css.gz", std::string(20, 'g'));
+        write("logo.png", std::string(10, 'p'));
+        write("logo.png.gz", std::string(10, 'g'));
+        write("404.html", "not found");
+    }
+
+    void write(const std::string &name, const std::string &data) {
+        ASSERT_TRUE(tmp.write(name, data)) << name;
+    }
+
+    /**
+     * answer a request for path with the given Accept-Encoding, returning the headers
+    */
+    std::string respond(std::string path, const char *accept_encoding) {
+        response.init(dir, path, true, 200, HttpResponse::accepted_encodings(accept_encoding));
+        buffer.RetrieveAll();
+        response.make_response(buffer);
+        return buffer.RetrieveAllToString();
+    }
+
+    /**
+     * answer a conditional request for path, the validators compared like HttpRequest does
+     * for "If-None-Match: <etag>"
+    */
+    std::string revalidate(std::string path, const char *accept_encoding, std::string etag) {
+        response.init(dir, path, true, 200, HttpResponse::accepted_encodings(accept_encoding),
+                      [etag](std::string_view tag, time_t) { return tag == etag; });
+        buffer.RetrieveAll();
+        response.make_response(buffer);
+        return buffer.RetrieveAllToString();
+    }
+
+    /**
+     * answer a request for a Range of path, with an If-Range that is current or not
+    */
+    std::string ranged(std::string path, std::string range, bool is_current = true) {
+        response.init(dir, path, true, 200, HttpResponse::IDENTITY, nullptr, range,
+                      [is_current](std::string_view, time_t) { return is_current; });
+        buffer.RetrieveAll();
+        response.make_response(buffer);
+        return buffer.RetrieveAllToString();
+    }
+
+    /**
+     * get the value of a header field of a response
+    */
+    static std::string field(const std::string &head, const std::string &name) {
+        size_t pos = head.find("\r\n" + name + ": ");
+        if (pos == std::string::npos) {
+            return "";
+        }
+        pos += name.size() + 4;
+        return head.substr(pos, head.find("\r\n", pos) - pos);
+    }
+};
+
+// Test for parsing Accept-Encoding
+TEST_F(HttpResponseTest, AcceptedEncodings) {
+    EXPECT_EQ(HttpResponse::accepted_encodings(""), HttpResponse::IDENTITY);
+    EXPECT_EQ(HttpResponse::accepted_encodings("gzip, deflate, br, zstd"),
+              HttpResponse::GZIP | HttpResponse::BROTLI);
+    EXPECT_EQ(HttpResponse::accepted_encodings("deflate,GZIP"), HttpResponse::GZIP);
+    EXPECT_EQ(HttpResponse::accepted_encodings("br;q=0.9, gzip; q=0"), HttpResponse::BROTLI);
+    EXPECT_EQ(HttpResponse::accepted_encodings("br;q=0.000,x-gzip;q=1"), HttpResponse::GZIP);
+    EXPECT_EQ(HttpResponse::accepted_encodings("*"), HttpResponse::GZIP | HttpResponse::BROTLI);
+    EXPECT_EQ(HttpResponse::accepted_encodings("identity, brotli"), HttpResponse::IDENTITY);
+}
+
+// Test for serving the precompressed sibling the client prefers
+TEST_F(HttpResponseTest, Precompressed) {
+    std::string head = respond("/app.js", "gzip, deflate, br");
+    EXPECT_NE(head.find("Content-Encoding: br\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Vary: Accept-Encoding\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Content-type: text/javascript"), std::string::npos);
+    EXPECT_NE(head.find("Content-length: 30\r\n"), std::string::npos);
+    EXPECT_EQ(response.file_len(), 30);
+
+    head = respond("/app.js", "gzip");
+    EXPECT_NE(head.find("Content-Encoding: gzip\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Content-length: 40\r\n"), std::string::npos);
+
+    // the plain file still varies with the header, a cache must not hand it to everyone
+    head = respond("/app.js", "");
+    EXPECT_EQ(head.find("Content-Encoding"), std::string::npos);
+    EXPECT_NE(head.find("Vary: Accept-Encoding\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Content-length: 100\r\n"), std::string::npos);
+
+    head = respond("/style.css", "br");
+    EXPECT_EQ(head.find("Content-Encoding"), std::string::npos);
+    EXPECT_NE(head.find("Vary: Accept-Encoding\r\n"), std::string::npos);
+}
+
+// Test for a sibling requested as it is and as negotiated, cached apart from each other
+TEST_F(HttpResponseTest, CachedSibling) {
+    FileCache::instance()->init(1 << 20, 1 << 16);
+    for (int i = 0; i < 2; i++) {
+        std::string head = respond("/app.js.gz", "");
+        EXPECT_EQ(response.cached() != nullptr, i == 1);
+        EXPECT_EQ(field(head, "Content-type"), "application/x-gzip");
+        EXPECT_EQ(field(head, "Content-Encoding"), "");
+
+        head = respond("/app.js", "gzip");
+        EXPECT_EQ(response.cached() != nullptr, i == 1);
+        EXPECT_EQ(field(head, "Content-type").compare(0, 15, "text/javascript"), 0);
+        EXPECT_EQ(field(head, "Content-Encoding"), "gzip");
+        EXPECT_EQ(field(head, "Vary"), "Accept-Encoding");
+        EXPECT_EQ(field(head, "Content-length"), "40");
+    }
+    FileCache::instance()->init(0, 0);
+}
+
+// Test for files that are never negotiated
+TEST_F(HttpResponseTest, NotNegotiated) {
+    std::string head = respond("/logo.png", "gzip");
+    EXPECT_EQ(head.find("Content-Encoding"), std::string::npos);
+    EXPECT_EQ(head.find("Vary"), std::string::npos);
+    EXPECT_NE(head.find("Content-length: 10\r\n"), std::string::npos);
+
+    // a sibling without the file it was compressed from is not served
+    write("gone.js.gz", "g");
+    head = respond("/gone.js", "gzip");
+    EXPECT_EQ(response.code(), 404);
+    EXPECT_EQ(head.find("Content-Encoding"), std::string::npos);
+}
+
+// Test for gzipping a file without a sibling behind the first request
+TEST_F(HttpResponseTest, Gzip) {
+    std::string text;
+    for (int i = 0; i < 200; i++) {
+        text += "line " + std::to_string(i) + " of a very compressible file\n";
+    }
+    write("page.html", text);
+    int jobs = 0;
+    Compressor::instance()->init(6, 1024, 1 << 20, [&jobs](std::function<void()> job) {
+        jobs++;
+        job();
+        return true;
+    });
+
+    std::string head = respond("/page.html", "gzip");
+    EXPECT_EQ(head.find("Content-Encoding"), std::string::npos);
+    EXPECT_NE(head.find("Vary: Accept-Encoding\r\n"), std::string::npos);
+    EXPECT_EQ(jobs, 1);
+
+    head = respond("/page.html", "deflate, gzip");
+    EXPECT_NE(head.find("Content-Encoding: gzip\r\n"), std::string::npos);
+    EXPECT_NE(head.find("Content-type: text/html"), std::string::npos);
+    ASSERT_NE(response.cached(), nullptr);
+    const std::string &body = response.cached()->body;
+    EXPECT_NE(head.find("Content-length: " + std::to_string(body.size()) + "\r\n"),
+              std::string::npos);
+    EXPECT_LT(body.size(), text.size() / 4);
+
+    z_stream stream = {};
+    ASSERT_EQ(inflateInit2(&stream, 15 + 16), Z_OK);
+    std::string plain(text.size(), '\0');
+    stream.next_in = (Bytef *) body.data();
+    stream.avail_in = body.size();
+    stream.next_out = (Bytef *) &plain[0];
+    stream.avail_out = plain.size();
+    EXPECT_EQ(inflate(&stream, Z_FINISH), Z_STREAM_END);
+    inflateEnd(&stream);
+    EXPECT_EQ(plain, text);
+
+    // a changed file is compressed again, small and binary files never
+    write("page.html", text + "more\n");
+    head = respond("/page.html", "gzip");
+    EXPECT_EQ(head.find("Content-Encoding"), std::string::npos);
+    EXPECT_EQ(jobs, 2);
+    respond("/404.html", "gzip");
+    respond("/logo.png", "gzip");
+    EXPECT_EQ(jobs, 2);
+    Compressor::instance()->init(0, 0, 0, nullptr);
+}
+
+// Test for the validators of a file and a header-only 304 for a current copy
+TEST_F(HttpResponseTest, NotModified) {
+    std::string head = respond("/style.css", "");
+    std::string etag = field(head, "ETag");
+    ASSERT_FALSE(etag.empty());
+    EXPECT_EQ(etag.front(), '"');
+    EXPECT_NE(field(head, "Last-Modified").find(" GMT"), std::string::npos);
+    EXPECT_EQ(field(head, "Cache-Control"), "max-age=3600");
+
+    head = revalidate("/style.css", "", etag);
+    EXPECT_EQ(response.code(), 304);
+    EXPECT_EQ(head.compare(0, 26, "HTTP/1.1 304 Not Modified\r"), 0);
+    EXPECT_EQ(field(head, "ETag"), etag);
+    EXPECT_EQ(field(head, "Cache-Control"), "max-age=3600");
+    EXPECT_EQ(field(head, "Vary"), "Accept-Encoding");
+    EXPECT_EQ(head.find("Content-length"), std::string::npos);
+    EXPECT_EQ(head.substr(head.size() - 4), "\r\n\r\n");
+    EXPECT_EQ(response.file(), nullptr);
+    EXPECT_EQ(response.file_fd(), -1);
+
+    // the gzip sibling is another file with another tag
+    head = revalidate("/style.css", "gzip", etag);
+    EXPECT_EQ(response.code(), 200);
+    EXPECT_NE(field(head, "ETag"), etag);
+
+    write("style.css", std::string(51, 'c'));
+    head = revalidate("/style.css", "", etag);
+    EXPECT_EQ(response.code(), 200);
+    EXPECT_NE(field(head, "ETag"), etag);
+
+    HttpResponse::set_max_age(".css", -1);
+    head = respond("/style.css", "");
+    EXPECT_EQ(field(head, "Cache-Control"), "");
+    HttpResponse::set_max_age(".css", 3600);
+    EXPECT_EQ(field(respond("/404.html", ""), "Cache-Control"), "no-cache");
+    EXPECT_EQ(field(respond("/missing.css", ""), "ETag"), "");
+}
+
+// Test for single and multipart ranges, and the ranges that are not served
+TEST_F(HttpResponseTest, Ranges) {
+    std::string data;
+    for (int i = 0; i < 1000; i++) {
+        data += static_cast<char>('a' + i % 26);
+    }
+    write("movie.mpg", data);
+
+    std::string head = ranged("/movie.mpg", "bytes=100-199");
+    EXPECT_EQ(response.code(), 206);
+    EXPECT_EQ(field(head, "Content-Range"), "bytes 100-199/1000");
+    EXPECT_EQ(field(head, "Content-length"), "100");
+    EXPECT_EQ(field(head, "Content-type"), "video/mpeg");
+    ASSERT_EQ(response.parts().size(), 1);
+    EXPECT_EQ(response.parts()[0].offset, 100);
+    EXPECT_EQ(response.parts()[0].len, 100);
+    ASSERT_NE(response.file(), nullptr);
+
+    head = ranged("/movie.mpg", "bytes=-100");
+    EXPECT_EQ(field(head, "Content-Range"), "bytes 900-999/1000");
+    head = ranged("/movie.mpg", "bytes=990-99999999999999999999999");
+    EXPECT_EQ(field(head, "Content-Range"), "bytes 990-999/1000");
+
+    head = ranged("/movie.mpg", "bytes=0-9, 2000-, -5");
+    EXPECT_EQ(response.code(), 206);
+    EXPECT_EQ(field(head, "Content-Range"), "");
+    std::string type = field(head, "Content-type");
+    ASSERT_EQ(type.compare(0, 30, "multipart/byteranges; boundary"), 0);
+    std::string boundary = type.substr(31);
+    const std::vector<HttpResponse::Part> &parts = response.parts();
+    ASSERT_EQ(parts.size(), 3);
+    std::string body;
+    for (const HttpResponse::Part &part : parts) {
+        body += part.head + data.substr(part.offset, part.len);
+    }
+    EXPECT_EQ(body, "--" + boundary + "\r\nContent-type: video/mpeg\r\n"
+                    "Content-Range: bytes 0-9/1000\r\n\r\nabcdefghij\r\n"
+                    "--" + boundary + "\r\nContent-type: video/mpeg\r\n"
+                    "Content-Range: bytes 995-999/1000\r\n\r\nhijkl\r\n"
+                    "--" + boundary + "--\r\n");
+    EXPECT_EQ(field(head, "Content-length"), std::to_string(body.size()));
+
+    // overlapping and adjacent ranges are sent once, in the order of the file
+    head = ranged("/movie.mpg", "bytes=0-,0-,0-,0-,0-,0-,0-,0-,0-,0-,0-,0-,0-,0-,0-,0-");
+    EXPECT_EQ(response.code(), 206);
+    EXPECT_EQ(field(head, "Content-Range"), "bytes 0-999/1000");
+    EXPECT_EQ(field(head, "Content-length"), "1000");
+    head = ranged("/movie.mpg", "bytes=500-599, 0-9, 10-19, 550-699");
+    // two ranges and the closing boundary
+    ASSERT_EQ(response.parts().size(), 3);
+    EXPECT_EQ(response.parts()[0].offset, 0);
+    EXPECT_EQ(response.parts()[0].len, 20);
+    EXPECT_EQ(response.parts()[1].offset, 500);
+    EXPECT_EQ(response.parts()[1].len, 200);
+
+    head = ranged("/movie.mpg", "bytes=1000-");
+    EXPECT_EQ(response.code(), 416);
+    EXPECT_EQ(field(head, "Content-Range"), "bytes */1000");
+    EXPECT_EQ(field(head, "Content-length"), "0");
+    EXPECT_EQ(response.file(), nullptr);
+
+    // a malformed or outdated Range gets the whole file
+    for (const char *range : {"bytes=5-1", "lines=1-2", "bytes=a-", "bytes=1-2,3"}) {
+        ranged("/movie.mpg", range);
+        EXPECT_EQ(response.code(), 200) << range;
+        EXPECT_TRUE(response.parts().empty());
+    }
+    head = ranged("/movie.mpg", "bytes=0-9", false);
+    EXPECT_EQ(response.code(), 200);
+    EXPECT_EQ(field(head, "Content-length"), "1000");
+}
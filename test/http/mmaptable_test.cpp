@@ -0,0 +1,92 @@
+#include "../../code/http/mmaptable.h"
+#include "tempdir.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Test fixture for MmapTable class, with files in a temporary directory
+class MmapTableTest : public ::testing::Test {
+protected:
+    TempDir tmp{"mmaptable"};
+    std::string dir;
+
+    void SetUp() override {
+        ASSERT_FALSE(tmp.path().empty());
+        dir = tmp.path();
+    }
+
+    /**
+     * write a file, replacing it like an editor does, and map it through the table
+    */
+    std::shared_ptr<const MmapTable::Mapping> map(MmapTable &table, const std::string &name,
+                                                  const std::string &data,
+                                                  struct stat *st) {
+        std::string path = dir + "/" + name;
+        if (!tmp.write(name + ".tmp", data) || rename((path + ".tmp").c_str(), path.c_str()) < 0) {
+            ADD_FAILURE() << "cannot write " << path;
+            return nullptr;
+        }
+        int fd = open(path.c_str(), O_RDONLY);
+        fstat(fd, st);
+        auto mapping = table.map(path, fd, *st);
+        close(fd);
+        return mapping;
+    }
+};
+
+// Test for a mapping being lent out again while the file is unchanged
+TEST_F(MmapTableTest, Hit) {
+    MmapTable table(1 << 20, 1);
+    struct stat st;
+    auto mapping = map(table, "a", "aaaa", &st);
+    ASSERT_NE(mapping, nullptr);
+    EXPECT_EQ(std::string(mapping->data, mapping->len), "aaaa");
+    EXPECT_EQ(table.get(dir + "/a", st), mapping);
+    EXPECT_EQ(table.size(), 1);
+    EXPECT_EQ(table.bytes(), 4);
+
+    // another version of the file misses, and its mapping replaces the old one
+    struct stat changed = st;
+    changed.st_mtim.tv_nsec++;
+    EXPECT_EQ(table.get(dir + "/a", changed), nullptr);
+    auto remapped = map(table, "a", "bbbbbb", &st);
+    EXPECT_EQ(table.get(dir + "/a", st), remapped);
+    EXPECT_EQ(table.size(), 1);
+    EXPECT_EQ(table.bytes(), 6);
+    EXPECT_EQ(std::string(mapping->data, mapping->len), "aaaa");
+
+    table.erase(dir + "/a");
+    EXPECT_EQ(table.get(dir + "/a", st), nullptr);
+    EXPECT_EQ(table.bytes(), 0);
+}
+
+// Test for the least recently used mapping being evicted, and a borrowed one staying valid
+TEST_F(MmapTableTest, Evict) {
+    MmapTable table(300, 1);
+    struct stat a_st, st;
+    auto a = map(table, "a", std::string(100, 'a'), &a_st);
+    map(table, "b", std::string(100, 'b'), &st);
+    map(table, "c", std::string(100, 'c'), &st);
+    EXPECT_EQ(table.get(dir + "/a", a_st), a);
+    map(table, "d", std::string(100, 'd'), &st);
+    EXPECT_EQ(table.size(), 3);
+    EXPECT_EQ(table.get(dir + "/b", st), nullptr);
+
+    // too large to be kept, still mapped for the caller
+    auto e = map(table, "e", std::string(400, 'e'), &st);
+    ASSERT_NE(e, nullptr);
+    EXPECT_EQ(e->data[399], 'e');
+    EXPECT_EQ(table.get(dir + "/e", st), nullptr);
+    EXPECT_EQ(table.size(), 3);
+
+    // a disabled table maps without keeping anything
+    table.init(0, 1);
+    EXPECT_EQ(a->data[99], 'a');
+    auto f = map(table, "f", "ffff", &st);
+    ASSERT_NE(f, nullptr);
+    EXPECT_EQ(table.get(dir + "/f", st), nullptr);
+    EXPECT_EQ(table.size(), 0);
+}
@@ -0,0 +1,51 @@
+#include "../../code/http/router.h"
+#include <gtest/gtest.h>
+#include <string>
+
+// Test fixture for Router class, with the routes of the example in router.h
+class RouterTest : public ::testing::Test {
+protected:
+    Router router;
+
+    void SetUp() override {
+        ASSERT_TRUE(router.add(Router::EXACT, "/login", 1));
+        ASSERT_TRUE(router.add(Router::PREFIX, "/static/", 2));
+        ASSERT_TRUE(router.add(Router::PREFIX, "/", 3));
+        ASSERT_TRUE(router.add(Router::SUFFIX, ".png", 4));
+    }
+};
+
+// Test for the precedence of exact, prefix and suffix routes
+TEST_F(RouterTest, Precedence) {
+    EXPECT_EQ(router.match("/login"), 1);
+    EXPECT_EQ(router.match("/static/a.png"), 2);
+    EXPECT_EQ(router.match("/a.png"), 3);
+    EXPECT_EQ(router.match("/login/"), 3);
+    EXPECT_EQ(router.match("/logi"), 3);
+    EXPECT_EQ(router.match("a.png"), 4);
+    EXPECT_EQ(router.match("static"), Router::NO_ROUTE);
+    EXPECT_EQ(router.match(""), Router::NO_ROUTE);
+}
+
+// Test for the longest prefix and suffix winning
+TEST_F(RouterTest, Longest) {
+    router.add(Router::PREFIX, "/static/img/", 5);
+    router.add(Router::SUFFIX, "icon.png", 6);
+    EXPECT_EQ(router.match("/static/img/a.png"), 5);
+    EXPECT_EQ(router.match("/static/im"), 2);
+    EXPECT_EQ(router.match("xicon.png"), 6);
+    EXPECT_EQ(router.match("xcon.png"), 4);
+}
+
+// Test for replacing a route and for routes sharing a pattern with another match type
+TEST_F(RouterTest, Replace) {
+    EXPECT_EQ(router.size(), 4);
+    router.add(Router::EXACT, "/login", 7);
+    router.add(Router::PREFIX, "/login", 8);
+    EXPECT_EQ(router.size(), 5);
+    EXPECT_EQ(router.match("/login"), 7);
+    EXPECT_EQ(router.match("/login.html"), 8);
+    EXPECT_FALSE(router.add(Router::EXACT, "", 9));
+    EXPECT_FALSE(router.add(Router::EXACT, "/x", -1));
+    EXPECT_EQ(router.size(), 5);
+}
@@ -0,0 +1,73 @@
+/**
+ * TempDir is a directory under /tmp for the files a test serves, removed with everything in it
+ * when the TempDir is destroyed.
+*/
+
+#ifndef TEMP_DIR_H_
+#define TEMP_DIR_H_
+
+#include <cstdio>
+#include <cstdlib>
+#include <ftw.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class TempDir {
+public:
+    /**
+     * create /tmp/<name>_testXXXXXX
+     * @param name prefix of the directory, e.g. the module under test
+    */
+    explicit TempDir(const std::string &name) {
+        std::string tmpl = "/tmp/" + name + "_testXXXXXX";
+        if (mkdtemp(&tmpl[0]) != nullptr) {
+            path_ = tmpl;
+        }
+    }
+
+    ~TempDir() {
+        if (!path_.empty()) {
+            // depth first, without following symlinks out of the directory
+            nftw(path_.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+        }
+    }
+
+    TempDir(const TempDir &) = delete;
+    TempDir &operator=(const TempDir &) = delete;
+
+    /**
+     * get the directory
+     * @return full path without a trailing '/', empty if mkdtemp() failed
+    */
+    const std::string &path() const {
+        return path_;
+    }
+
+    /**
+     * write a file readable by everyone, like the files the server is given
+     * @param name path of the file relative to the directory
+     * @param data content of the file
+     * @param append whether data is appended to the file instead of replacing it
+     * @return false if the file could not be written completely
+    */
+    bool write(const std::string &name, const std::string &data, bool append = false) const {
+        std::string path = path_ + "/" + name;
+        FILE *fp = fopen(path.c_str(), append ? "a" : "w");
+        if (fp == nullptr) {
+            return false;
+        }
+        bool ok = fwrite(data.data(), 1, data.size(), fp) == data.size();
+        ok = fclose(fp) == 0 && ok;
+        return ok && chmod(path.c_str(), 0644) == 0;
+    }
+
+private:
+    static int remove_entry(const char *path, const struct stat *, int type, struct FTW *) {
+        return type == FTW_DP ? rmdir(path) : unlink(path);
+    }
+
+    std::string path_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "../../code/pool/asyncuserstore.h"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+
+/**
+ * these tests need a local mysqld with the `user` table of the server. the connection is read
+ * from MYSQL_HOST, MYSQL_PORT, MYSQL_USER, MYSQL_PWD and MYSQL_DB (defaults: localhost, 3306,
+ * root, root, webserver). every test is skipped if no connection can be opened
+*/
+static const char *env(const char *name, const char *value) {
+    const char *ret = getenv(name);
+    return ret != nullptr ? ret : value;
+}
+
+// Waits for a number of callbacks of the store
+class Results {
+public:
+    AsyncUserStore::Callback callback() {
+        return [this](bool result) {
+            std::lock_guard<std::mutex> locker(mutex_);
+            done_++;
+            success_ += result ? 1 : 0;
+            cond_.notify_all();
+        };
+    }
+
+    bool wait(int count) {
+        std::unique_lock<std::mutex> locker(mutex_);
+        return cond_.wait_for(locker, std::chrono::seconds(30), [&] { return done_ >= count; });
+    }
+
+    int success() {
+        std::lock_guard<std::mutex> locker(mutex_);
+        return success_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    int done_ = 0;
+    int success_ = 0;
+};
+
+// Test fixture for AsyncUserStore class
+class AsyncUserStoreTest : public ::testing::Test {
+protected:
+    AsyncUserStore store;
+
+    void SetUp() override {
+        if (!store.init(env("MYSQL_HOST", "localhost"), atoi(env("MYSQL_PORT", "3306")),
+                        env("MYSQL_USER", "root"), env("MYSQL_PWD", "root"),
+                        env("MYSQL_DB", "webserver"), 4)) {
+            GTEST_SKIP() << "no mysqld available";
+        }
+    }
+
+    bool verify(const std::string &name, const std::string &pwd, bool is_login) {
+        Results results;
+        EXPECT_TRUE(store.verify(name, pwd, is_login, results.callback()));
+        EXPECT_TRUE(results.wait(1));
+        return results.success() == 1;
+    }
+
+    static std::string unique_name(const char *prefix) {
+        return prefix + std::to_string(
+            std::chrono::steady_clock::now().time_since_epoch().count());
+    }
+};
+
+// Test for a user that does not exist
+TEST_F(AsyncUserStoreTest, UnknownUserLoginFails) {
+    EXPECT_FALSE(verify(unique_name("nobody"), "pwd", true));
+}
+
+// Test for empty form fields, answered without a query
+TEST_F(AsyncUserStoreTest, EmptyFieldsFail) {
+    EXPECT_FALSE(verify("", "pwd", true));
+    EXPECT_FALSE(verify("name", "", false));
+}
+
+// Test for register, login and register again
+TEST_F(AsyncUserStoreTest, RegisterThenLogin) {
+    std::string name = unique_name("async");
+    EXPECT_TRUE(verify(name, "secret", false));
+    EXPECT_TRUE(verify(name, "secret", true));
+    EXPECT_FALSE(verify(name, "wrong", true));
+    EXPECT_FALSE(verify(name, "secret", false));
+}
+
+// Test for names that need escaping
+TEST_F(AsyncUserStoreTest, QuotesAreEscaped) {
+    std::string name = unique_name("o'brien\\");
+    EXPECT_TRUE(verify(name, "it's", false));
+    EXPECT_TRUE(verify(name, "it's", true));
+}
+
+// Test for many concurrent logins on a few connections
+TEST_F(AsyncUserStoreTest, ManyConcurrentLogins) {
+    std::string name = unique_name("many");
+    ASSERT_TRUE(verify(name, "secret", false));
+
+    const int count = 2000;
+    Results results;
+    for (int i = 0; i < count; i++) {
+        ASSERT_TRUE(store.verify(name, i % 2 == 0 ? "secret" : "wrong", true,
+                                 results.callback()));
+    }
+    ASSERT_TRUE(results.wait(count));
+    EXPECT_EQ(results.success(), count / 2);
+}
+
+// Test for jobs still queued when the store stops
+TEST_F(AsyncUserStoreTest, StopCompletesQueuedJobs) {
+    const int count = 100;
+    Results results;
+    for (int i = 0; i < count; i++) {
+        store.verify(unique_name("stop"), "pwd", true, results.callback());
+    }
+    store.stop();
+    EXPECT_TRUE(results.wait(count));
+    EXPECT_FALSE(store.verify("name", "pwd", true, results.callback()));
+}
@@ -0,0 +1,123 @@
+#include "../../code/pool/fdslab.h"
+#include "../../code/server/epoller.h"
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <vector>
+
+// the per-connection state the event loop keeps in the slab, reduced to its generation
+struct Conn {
+    uint32_t generation = 0;
+
+    static int alive;
+
+    Conn() {
+        alive++;
+    }
+
+    ~Conn() {
+        alive--;
+    }
+};
+
+int Conn::alive = 0;
+
+// Test for the fd and the generation sharing epoll_event.data.u64
+TEST(FdSlabTest, Pack) {
+    epoll_event ev{};
+    ev.data.u64 = Epoller::pack(42, 7);
+    EXPECT_EQ(ev.data.fd, 42);
+    EXPECT_EQ(ev.data.u64 >> 32, 7u);
+    ev.data.u64 = Epoller::pack(65535, UINT32_MAX);
+    EXPECT_EQ(ev.data.fd, 65535);
+    EXPECT_EQ(ev.data.u64 >> 32, UINT32_MAX);
+
+    // io_uring reports its completions in the same layout
+    for (Epoller::Backend backend : {Epoller::EPOLL, Epoller::IO_URING}) {
+        SCOPED_TRACE(backend);
+        int fds[2];
+        ASSERT_EQ(pipe(fds), 0);
+        Epoller epoller(16, backend);
+        ASSERT_TRUE(epoller.add_fd(fds[0], EPOLLIN, 3));
+        ASSERT_EQ(write(fds[1], "x", 1), 1);
+        ASSERT_EQ(epoller.wait(1000), 1);
+        EXPECT_EQ(epoller.get_event_fd(0), fds[0]);
+        EXPECT_EQ(epoller.get_event_generation(0), 3u);
+        ASSERT_TRUE(epoller.mod_fd(fds[0], EPOLLIN, 4));
+        ASSERT_EQ(epoller.wait(1000), 1);
+        EXPECT_EQ(epoller.get_event_generation(0), 4u);
+        epoller.del_fd(fds[0]);
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+
+// Test for an event of a closed connection being told apart from the one reusing its fd
+TEST(FdSlabTest, StaleGeneration) {
+    FdSlab<Conn> slab(1024);
+    Epoller epoller;
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    int fd = fds[0];
+    Conn &conn = slab[fd];
+    conn.generation++;
+    ASSERT_TRUE(epoller.add_fd(fd, EPOLLIN, conn.generation));
+    ASSERT_EQ(write(fds[1], "x", 1), 1);
+    ASSERT_EQ(epoller.wait(1000), 1);
+    uint32_t tag = epoller.get_event_generation(0);
+    EXPECT_EQ(slab.get(epoller.get_event_fd(0))->generation, tag);
+
+    // the connection is closed before the event is handled, and a new one gets the same fd
+    epoller.del_fd(fd);
+    close(fds[0]);
+    close(fds[1]);
+    // bumped by HttpConn::close() and again by the init() of the next connection
+    conn.generation++;
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(fds[0], fd);
+    conn.generation++;
+    EXPECT_EQ(&slab[fd], &conn);
+    EXPECT_NE(slab.get(fd)->generation, tag);
+
+    ASSERT_TRUE(epoller.add_fd(fd, EPOLLIN, conn.generation));
+    ASSERT_EQ(write(fds[1], "y", 1), 1);
+    ASSERT_EQ(epoller.wait(1000), 1);
+    EXPECT_EQ(slab.get(epoller.get_event_fd(0))->generation, epoller.get_event_generation(0));
+    close(fds[0]);
+    close(fds[1]);
+}
+
+// Test for chunks being allocated on first use without moving the slots handed out before
+TEST(FdSlabTest, Grow) {
+    {
+        FdSlab<Conn> slab(300);
+        EXPECT_EQ(slab.capacity(), 512u);
+        EXPECT_EQ(slab.get(-1), nullptr);
+        EXPECT_EQ(slab.get(0), nullptr);
+        EXPECT_EQ(Conn::alive, 0);
+
+        Conn *first = &slab[0];
+        first->generation = 1;
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(first) % 64, 0u);
+        EXPECT_EQ(Conn::alive, 256);
+        // the first chunk covers fds 0-255, the next one is not allocated yet
+        EXPECT_NE(slab.get(255), nullptr);
+        EXPECT_EQ(slab.get(256), nullptr);
+
+        std::vector<Conn *> slots;
+        for (int fd = 0; fd < static_cast<int>(slab.capacity()); fd++) {
+            slots.push_back(&slab[fd]);
+        }
+        EXPECT_EQ(Conn::alive, 512);
+        EXPECT_EQ(slots[0], first);
+        EXPECT_EQ(slab.get(0)->generation, 1u);
+        for (int fd = 0; fd < static_cast<int>(slab.capacity()); fd++) {
+            ASSERT_EQ(slab.get(fd), slots[fd]);
+        }
+        // neighbouring fds never share a cache line
+        EXPECT_GE(reinterpret_cast<char *>(slots[1]) - reinterpret_cast<char *>(slots[0]), 64);
+        EXPECT_EQ(slab.get(512), nullptr);
+    }
+    EXPECT_EQ(Conn::alive, 0);
+}
@@ -0,0 +1,67 @@
+#include "../../code/pool/mpmcring.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+TEST(MpmcRingTest, FullAndEmpty) {
+    MpmcRing<int> ring(3);
+    int item = 0;
+    EXPECT_EQ(ring.capacity(), 4u);
+    EXPECT_TRUE(ring.empty());
+    EXPECT_FALSE(ring.pop(item));
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(ring.push(i));
+    }
+    EXPECT_FALSE(ring.push(4));
+    EXPECT_EQ(ring.size(), 4u);
+    ASSERT_TRUE(ring.pop(item));
+    EXPECT_EQ(item, 0);
+    // the freed cell is reused once the ring wraps around
+    EXPECT_TRUE(ring.push(4));
+    EXPECT_FALSE(ring.push(5));
+    for (int i = 1; i <= 4; i++) {
+        ASSERT_TRUE(ring.pop(item));
+        EXPECT_EQ(item, i);
+    }
+    EXPECT_TRUE(ring.empty());
+    EXPECT_FALSE(ring.pop(item));
+}
+
+TEST(MpmcRingTest, ProducersAndConsumers) {
+    const int PRODUCERS = 4;
+    const int CONSUMERS = 3;
+    const int PER_PRODUCER = 20000;
+    const int ITEMS = PRODUCERS * PER_PRODUCER;
+    MpmcRing<int> ring(128);
+    std::vector<std::atomic<int>> seen(ITEMS);
+    std::atomic<int> consumed(0);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < PRODUCERS; p++) {
+        threads.emplace_back([&, p] {
+            for (int i = p * PER_PRODUCER; i < (p + 1) * PER_PRODUCER; i++) {
+                while (!ring.push(i)) {
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    for (int c = 0; c < CONSUMERS; c++) {
+        threads.emplace_back([&] {
+            int item = 0;
+            while (consumed.load() < ITEMS) {
+                if (ring.pop(item)) {
+                    seen[item].fetch_add(1);
+                    consumed.fetch_add(1);
+                }
+            }
+        });
+    }
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    for (int i = 0; i < ITEMS; i++) {
+        ASSERT_EQ(seen[i].load(), 1) << "item " << i;
+    }
+    EXPECT_TRUE(ring.empty());
+}
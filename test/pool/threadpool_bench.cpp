@@ -0,0 +1,162 @@
+/**
+ * microbenchmark of task submission: the current ThreadPool against the previous design
+ * (one mutex + std::queue<std::function<void()>>), with the task the reactor submits for every
+ * event, std::bind(&Server::on_read, this, client, generation).
+ *
+ * like a reactor bounded by its number of connections, the producer keeps at most WINDOW tasks
+ * in flight, so the numbers measure the hand-off to the workers rather than the caller-runs
+ * fallback of a full ThreadPool.
+ *
+ * build and run:
+ *     g++ -std=c++14 -O2 -pthread threadpool_bench.cpp -o threadpool_bench && ./threadpool_bench
+*/
+
+#include "../../code/pool/threadpool.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <queue>
+#include <thread>
+
+static const size_t WINDOW = 1024;
+
+static std::atomic<size_t> alloc_cnt(0);
+
+void *operator new(size_t size) {
+    alloc_cnt.fetch_add(1, std::memory_order_relaxed);
+    void *ptr = malloc(size == 0 ? 1 : size);
+    if (ptr == nullptr) {
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+/**
+ * the thread pool before the work-stealing rewrite
+*/
+class MutexThreadPool {
+public:
+    explicit MutexThreadPool(size_t thread_num) : pool_(std::make_shared<Pool>()) {
+        for (size_t i = 0; i < thread_num; i++) {
+            std::thread([pool = pool_] {
+                std::unique_lock<std::mutex> locker(pool->mutex_);
+                while (true) {
+                    if (!pool->tasks_.empty()) {
+                        auto task = std::move(pool->tasks_.front());
+                        pool->tasks_.pop();
+                        locker.unlock();
+                        task();
+                        locker.lock();
+                    } else if (pool->is_closed_) {
+                        break;
+                    } else {
+                        pool->cond_.wait(locker);
+                    }
+                }
+            }).detach();
+        }
+    }
+
+    ~MutexThreadPool() {
+        {
+            std::lock_guard<std::mutex> locker(pool_->mutex_);
+            pool_->is_closed_ = true;
+        }
+        pool_->cond_.notify_all();
+    }
+
+    template<class F>
+    void AddTask(F &&task) {
+        {
+            std::lock_guard<std::mutex> locker(pool_->mutex_);
+            pool_->tasks_.emplace(std::forward<F>(task));
+        }
+        pool_->cond_.notify_one();
+    }
+
+private:
+    struct Pool {
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        bool is_closed_ = false;
+        std::queue<std::function<void()>> tasks_;
+    };
+    std::shared_ptr<Pool> pool_;
+};
+
+struct Conn {
+    int fd;
+};
+
+struct Server {
+    std::atomic<size_t> done{0};
+    std::atomic<size_t> on_caller{0};
+    std::thread::id caller;
+
+    void on_read(Conn *client, uint32_t generation) {
+        (void) client;
+        (void) generation;
+        if (std::this_thread::get_id() == caller) {
+            on_caller.fetch_add(1, std::memory_order_relaxed);
+        }
+        done.fetch_add(1, std::memory_order_relaxed);
+    }
+};
+
+template<class Pool>
+void run(const char *name, size_t thread_num, size_t task_num) {
+    Server server;
+    server.caller = std::this_thread::get_id();
+    Conn conn = {42};
+    {
+        Pool pool(thread_num);
+        // let the workers start and park
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+        size_t alloc_before = alloc_cnt.load();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < task_num; i++) {
+            while (i - server.done.load(std::memory_order_relaxed) >= WINDOW) {
+                std::this_thread::yield();
+            }
+            pool.AddTask(std::bind(&Server::on_read, &server, &conn, static_cast<uint32_t>(i)));
+        }
+        auto submitted = std::chrono::steady_clock::now();
+        while (server.done.load(std::memory_order_relaxed) != task_num) {
+            std::this_thread::yield();
+        }
+        auto end = std::chrono::steady_clock::now();
+        size_t allocs = alloc_cnt.load() - alloc_before;
+
+        double submit_sec = std::chrono::duration<double>(submitted - start).count();
+        double total_sec = std::chrono::duration<double>(end - start).count();
+        printf("%-12s threads=%-2zu submit %6.2f Mtasks/s  end-to-end %6.2f Mtasks/s  "
+               "allocs/task %.3f  run by caller %zu\n",
+               name, thread_num, task_num / submit_sec / 1e6, task_num / total_sec / 1e6,
+               static_cast<double>(allocs) / task_num, server.on_caller.load());
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+int main(int argc, char **argv) {
+    size_t task_num = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+    for (size_t thread_num : {1, 2, 4, 8}) {
+        run<MutexThreadPool>("mutex+queue", thread_num, task_num);
+        run<ThreadPool>("ThreadPool", thread_num, task_num);
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "../../code/pool/threadpool.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Holds the tasks of the pool until it is opened
+class Gate {
+public:
+    void wait() {
+        std::unique_lock<std::mutex> locker(mutex_);
+        waiting_++;
+        cond_.notify_all();
+        cond_.wait(locker, [this] { return is_open_; });
+    }
+
+    bool wait_for_waiters(int count) {
+        std::unique_lock<std::mutex> locker(mutex_);
+        return cond_.wait_for(locker, std::chrono::seconds(10),
+                              [&] { return waiting_ >= count; });
+    }
+
+    void open() {
+        std::lock_guard<std::mutex> locker(mutex_);
+        is_open_ = true;
+        cond_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    int waiting_ = 0;
+    bool is_open_ = false;
+};
+
+static bool wait_for(const std::atomic<int> &counter, int count) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (counter.load() < count) {
+        if (std::chrono::steady_clock::now() > deadline) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+TEST(ThreadPoolTest, FullPool) {
+    Gate gate;
+    std::atomic<int> done(0);
+    ThreadPool pool(2, 2);
+    // both slots are taken by tasks blocked on the gate
+    for (int i = 0; i < 2; i++) {
+        pool.AddTask([&] {
+            gate.wait();
+            done++;
+        });
+    }
+    ASSERT_TRUE(gate.wait_for_waiters(2));
+
+    EXPECT_FALSE(pool.TryAddTask([&] { done++; }));
+    std::thread::id runner;
+    pool.AddTask([&] { runner = std::this_thread::get_id(); });
+    EXPECT_EQ(runner, std::this_thread::get_id());
+
+    gate.open();
+    ASSERT_TRUE(wait_for(done, 2));
+    // slots are back in the free ring once the tasks are done
+    std::atomic<int> queued(0);
+    bool accepted = false;
+    for (int i = 0; i < 1000 && !accepted; i++) {
+        accepted = pool.TryAddTask([&] { queued++; });
+        if (!accepted) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    EXPECT_TRUE(accepted);
+    EXPECT_TRUE(wait_for(queued, 1));
+}
+
+TEST(ThreadPoolTest, RunsEveryTask) {
+    const int TASKS = 100000;
+    auto done = std::make_shared<std::atomic<int>>(0);
+    std::atomic<int> outer(0);
+    {
+        ThreadPool pool(4, 256);
+        std::thread outside([&] {
+            for (int i = 0; i < TASKS / 2; i++) {
+                pool.AddTask([done] { (*done)++; });
+            }
+        });
+        for (int i = 0; i < TASKS / 2; i++) {
+            // tasks that queue a follow-up go to the worker's own deque
+            pool.AddTask([&pool, &outer, done] {
+                pool.AddTask([done] { (*done)++; });
+                outer++;
+            });
+        }
+        outside.join();
+        // the pool must outlive the tasks that submit to it, not the follow-ups
+        ASSERT_TRUE(wait_for(outer, TASKS / 2));
+    }
+    // the workers drain every queued task before they exit
+    EXPECT_TRUE(wait_for(*done, TASKS));
+}
@@ -0,0 +1,79 @@
+#include "../../code/pool/workstealingdeque.h"
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+TEST(WorkStealingDequeTest, FullAndEmpty) {
+    WorkStealingDeque<int> deque(5);
+    int item = 0;
+    EXPECT_TRUE(deque.empty());
+    EXPECT_FALSE(deque.pop(item));
+    EXPECT_FALSE(deque.steal(item));
+    // the capacity is rounded up to 8
+    for (int i = 0; i < 8; i++) {
+        EXPECT_TRUE(deque.push(i));
+    }
+    EXPECT_FALSE(deque.push(8));
+    // the owner takes the newest, a thief the oldest
+    ASSERT_TRUE(deque.pop(item));
+    EXPECT_EQ(item, 7);
+    ASSERT_TRUE(deque.steal(item));
+    EXPECT_EQ(item, 0);
+    EXPECT_TRUE(deque.push(8));
+    EXPECT_TRUE(deque.push(9));
+    EXPECT_FALSE(deque.push(10));
+    std::vector<int> rest;
+    while (deque.pop(item)) {
+        rest.push_back(item);
+    }
+    EXPECT_EQ(rest, std::vector<int>({9, 8, 6, 5, 4, 3, 2, 1}));
+    EXPECT_TRUE(deque.empty());
+    EXPECT_FALSE(deque.pop(item));
+    EXPECT_FALSE(deque.steal(item));
+}
+
+TEST(WorkStealingDequeTest, OwnerAgainstThieves) {
+    const int ITEMS = 200000;
+    const int THIEVES = 4;
+    WorkStealingDeque<int> deque(64);
+    std::unique_ptr<std::atomic<int>[]> seen(new std::atomic<int>[ITEMS]);
+    for (int i = 0; i < ITEMS; i++) {
+        seen[i].store(0);
+    }
+    std::atomic<bool> done(false);
+    std::vector<std::thread> thieves;
+    for (int i = 0; i < THIEVES; i++) {
+        thieves.emplace_back([&] {
+            int item = 0;
+            while (!done.load(std::memory_order_acquire) || !deque.empty()) {
+                if (deque.steal(item)) {
+                    seen[item].fetch_add(1);
+                }
+            }
+        });
+    }
+    // the owner pops every third item itself, and whenever the deque is full
+    int item = 0;
+    for (int i = 0; i < ITEMS; i++) {
+        while (!deque.push(i)) {
+            if (deque.pop(item)) {
+                seen[item].fetch_add(1);
+            }
+        }
+        if (i % 3 == 0 && deque.pop(item)) {
+            seen[item].fetch_add(1);
+        }
+    }
+    while (deque.pop(item)) {
+        seen[item].fetch_add(1);
+    }
+    done.store(true, std::memory_order_release);
+    for (auto &thief : thieves) {
+        thief.join();
+    }
+    for (int i = 0; i < ITEMS; i++) {
+        ASSERT_EQ(seen[i].load(), 1) << "item " << i;
+    }
+}